@@ -0,0 +1,748 @@
+#include "audioengine.h"
+#include "tagreader.h"
+#include "trace.h"
+#include <QIODevice>
+#include <QMediaDevices>
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Pull-mode source for the sink. Reads decoded PCM for the current track,
+// applies its loudness gain, runs the equalizer and converts to the sink's
+// sample format. When the current track runs out and a next buffer is
+// queued, the stream switches to it (and its gain) within the same read,
+// so consecutive tracks are joined at the sample boundary. With a
+// crossfade set, the switch instead happens the fade length before the
+// current track's last frame (once its decode is finished, so the end is
+// known exactly); the outgoing track then keeps playing from a second
+// cursor and is mixed under the incoming one until it ends. It always
+// returns a full buffer (silence past the end or while the decoder catches
+// up), so the sink never underruns. Scratch buffers only grow.
+class AudioStream : public QIODevice
+{
+public:
+    // Positions are counted in frames handed to the sink since the stream was created
+    struct Cursor
+    {
+        qint64 deliveredFrames;
+        qint64 trackStart;  // Delivered-frame count at which the current track's frame 0 plays
+        qint64 endOfAudio;  // Delivered-frame count at which audio ran out, or -1
+        int switches;       // Number of gapless track switches so far
+    };
+
+    AudioStream(const QAudioFormat &format, Equalizer *equalizer, QObject *parent)
+        : QIODevice(parent),
+          format(format),
+          equalizer(equalizer),
+          trackFrame(0),
+          deliveredFrames(0),
+          trackStart(0),
+          endOfAudio(-1),
+          switches(0),
+          firstFramesPending(false),
+          gain(1.0f),
+          nextGain(1.0f),
+          crossfadeFrames(0),
+          curve(Crossfade::EqualPower),
+          fadeFrame(0),
+          fadeGain(1.0f),
+          fadePosition(0),
+          fadeLength(0),
+          fadeOffset(0)
+    {
+    }
+
+    void setCrossfade(qint64 frames, Crossfade::Curve fadeCurve)
+    {
+        QMutexLocker locker(&mutex);
+        crossfadeFrames = std::max<qint64>(0, frames);
+        curve = fadeCurve;
+    }
+
+    void setBuffer(const QSharedPointer<PcmBuffer> &pcm, float trackGain)
+    {
+        QMutexLocker locker(&mutex);
+        buffer = pcm;
+        gain = trackGain;
+        nextBuffer.reset();
+        fadeBuffer.reset();
+        trackFrame = 0;
+        trackStart = deliveredFrames;
+        endOfAudio = -1;
+        firstFramesPending = true;
+    }
+
+    // Like setBuffer(), but fades the current track out under the new one
+    // from the next read; returns the new track start
+    qint64 crossfadeTo(const QSharedPointer<PcmBuffer> &pcm, float trackGain)
+    {
+        QMutexLocker locker(&mutex);
+        if (buffer && crossfadeFrames > 0) {
+            // A skipped track's decode may be cut short; missing frames fade out as silence
+            const qint64 remaining = buffer->isFinished() ? buffer->frameCount() - trackFrame : crossfadeFrames;
+            beginFade(0, std::clamp<qint64>(remaining, 0, crossfadeFrames));
+        } else {
+            fadeBuffer.reset();
+        }
+        buffer = pcm;
+        gain = trackGain;
+        nextBuffer.reset();
+        trackFrame = 0;
+        trackStart = deliveredFrames;
+        endOfAudio = -1;
+        firstFramesPending = true;
+        return trackStart;
+    }
+
+    // Swaps in a fresh decode of the current track, keeping its gain and whatever is queued after it
+    void restartBuffer(const QSharedPointer<PcmBuffer> &pcm)
+    {
+        QMutexLocker locker(&mutex);
+        buffer = pcm;
+    }
+
+    void setNextBuffer(const QSharedPointer<PcmBuffer> &pcm, float trackGain)
+    {
+        QMutexLocker locker(&mutex);
+        nextBuffer = pcm;
+        nextGain = trackGain;
+        if (pcm) {
+            endOfAudio = -1;
+        }
+    }
+
+    void setGain(float trackGain)
+    {
+        QMutexLocker locker(&mutex);
+        gain = trackGain;
+    }
+
+    void setNextGain(float trackGain)
+    {
+        QMutexLocker locker(&mutex);
+        nextGain = trackGain;
+    }
+
+    // Moves the read position within the current track; returns the new track start
+    qint64 setFrame(qint64 frame)
+    {
+        QMutexLocker locker(&mutex);
+        trackFrame = std::max<qint64>(0, frame);
+        if (buffer) {
+            buffer->setReadFrame(trackFrame);
+        }
+        trackStart = deliveredFrames - trackFrame;
+        endOfAudio = -1;
+        fadeBuffer.reset();
+        return trackStart;
+    }
+
+    Cursor cursor() const
+    {
+        QMutexLocker locker(&mutex);
+        return {deliveredFrames, trackStart, endOfAudio, switches};
+    }
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override { return 1 << 20; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        const int channels = format.channelCount();
+        const qint64 frames = maxSize / format.bytesPerFrame();
+        if (frames <= 0) {
+            return 0;
+        }
+
+        const size_t samples = size_t(frames * channels);
+        if (pcm16.size() < samples) {
+            pcm16.resize(samples);
+            pcmFloat.resize(samples);
+            fadeFloat.resize(samples);
+            outgoingGains.resize(size_t(frames));
+            incomingGains.resize(size_t(frames));
+        }
+
+        qint64 filled = 0;
+        {
+            QMutexLocker locker(&mutex);
+            while (buffer && filled < frames) {
+                qint64 wanted = frames - filled;
+
+                // Stop the read exactly where the fade into the next track begins
+                const qint64 fadeStart = scheduledFade();
+                if (fadeStart >= 0) {
+                    if (trackFrame >= fadeStart) {
+                        beginFade(filled, buffer->frameCount() - trackFrame);
+                        switchToNext(filled);
+                        continue;
+                    }
+                    wanted = std::min(wanted, fadeStart - trackFrame);
+                }
+
+                const qint64 got = buffer->read(trackFrame, pcm16.data() + filled * channels, wanted);
+
+                // Converted per read, since a switch within this block may change the gain
+                const float scale = gain * (1.0f / 32768.0f);
+                const qint16 *in = pcm16.data() + filled * channels;
+                float *out = pcmFloat.data() + filled * channels;
+                for (qint64 i = 0; i < got * channels; ++i) {
+                    out[i] = in[i] * scale;
+                }
+
+                trackFrame += got;
+                filled += got;
+                if (filled == frames) {
+                    break;
+                }
+                if (got == wanted) {
+                    continue; // Reached the fade start
+                }
+
+                // Short read: either the decoder is behind, or this track is done
+                if (!buffer->isFinished() || trackFrame < buffer->frameCount()) {
+                    break;
+                }
+                if (!nextBuffer) {
+                    if (endOfAudio < 0) {
+                        // A fade still in progress plays out first
+                        const qint64 fadeEnd = fadeBuffer ? fadeOffset + fadeLength - fadePosition : 0;
+                        endOfAudio = deliveredFrames + std::max(filled, fadeEnd);
+                    }
+                    break;
+                }
+
+                switchToNext(filled);
+            }
+
+            const size_t valid = size_t(filled * channels);
+            std::fill(pcmFloat.begin() + valid, pcmFloat.begin() + samples, 0.0f);
+
+            if (fadeBuffer) {
+                mixFade(frames);
+            }
+            deliveredFrames += frames;
+
+            if (firstFramesPending && trackFrame > 0) {
+                firstFramesPending = false;
+                TRACE_INSTANT("audio", "first buffer");
+            }
+        }
+
+        equalizer->process(pcmFloat.data(), frames);
+
+        switch (format.sampleFormat()) {
+        case QAudioFormat::Float:
+            std::memcpy(data, pcmFloat.data(), samples * sizeof(float));
+            break;
+        case QAudioFormat::Int32: {
+            qint32 *out = reinterpret_cast<qint32 *>(data);
+            for (size_t i = 0; i < samples; ++i) {
+                out[i] = qint32(std::lrint(std::clamp(pcmFloat[i], -1.0f, 1.0f) * 2147483520.0f));
+            }
+            break;
+        }
+        case QAudioFormat::UInt8: {
+            quint8 *out = reinterpret_cast<quint8 *>(data);
+            for (size_t i = 0; i < samples; ++i) {
+                out[i] = quint8(std::lrint(std::clamp(pcmFloat[i], -1.0f, 1.0f) * 127.0f) + 128);
+            }
+            break;
+        }
+        default: {
+            qint16 *out = reinterpret_cast<qint16 *>(data);
+            for (size_t i = 0; i < samples; ++i) {
+                out[i] = qint16(std::lrint(std::clamp(pcmFloat[i], -1.0f, 1.0f) * 32767.0f));
+            }
+            break;
+        }
+        }
+
+        return frames * format.bytesPerFrame();
+    }
+
+    qint64 writeData(const char *data, qint64 size) override
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(size);
+        return -1;
+    }
+
+private:
+    // Frame of the current track at which the fade into the next one starts, or -1
+    qint64 scheduledFade() const
+    {
+        if (!nextBuffer || crossfadeFrames <= 0 || fadeBuffer || !buffer->isFinished()) {
+            return -1;
+        }
+        // Never longer than half the outgoing track
+        const qint64 length = buffer->frameCount();
+        return length - std::min(crossfadeFrames, length / 2);
+    }
+
+    // The current track becomes the outgoing side of a fade starting at frame offset of this block
+    void beginFade(qint64 offset, qint64 length)
+    {
+        fadeBuffer = buffer;
+        fadeFrame = trackFrame;
+        fadeGain = gain;
+        fadePosition = 0;
+        fadeLength = length;
+        fadeOffset = offset;
+    }
+
+    void switchToNext(qint64 offset)
+    {
+        buffer = nextBuffer;
+        gain = nextGain;
+        nextBuffer.reset();
+        trackFrame = 0;
+        trackStart = deliveredFrames + offset;
+        ++switches;
+        firstFramesPending = true;
+    }
+
+    // Mixes the outgoing track into pcmFloat from fadeOffset to the end of the block or the fade
+    void mixFade(qint64 frames)
+    {
+        const int channels = format.channelCount();
+        const qint64 offset = fadeOffset;
+        const qint64 count = std::min(frames - offset, fadeLength - fadePosition);
+        fadeOffset = 0;
+
+        if (count > 0) {
+            const qint64 got = fadeBuffer->read(fadeFrame, pcm16.data(), count);
+            const float scale = fadeGain * (1.0f / 32768.0f);
+            for (qint64 i = 0; i < got * channels; ++i) {
+                fadeFloat[i] = pcm16[i] * scale;
+            }
+            std::fill(fadeFloat.begin() + got * channels, fadeFloat.begin() + count * channels, 0.0f);
+
+            Crossfade::gains(curve, fadePosition, fadeLength, outgoingGains.data(), incomingGains.data(), count);
+            Crossfade::mix(pcmFloat.data() + offset * channels, fadeFloat.data(), outgoingGains.data(),
+                           incomingGains.data(), count, channels);
+            fadeFrame += count;
+            fadePosition += count;
+        }
+
+        if (fadePosition >= fadeLength) {
+            fadeBuffer.reset();
+        }
+    }
+
+    const QAudioFormat format;
+    Equalizer *equalizer;
+
+    mutable QMutex mutex;
+    QSharedPointer<PcmBuffer> buffer;
+    QSharedPointer<PcmBuffer> nextBuffer;
+    qint64 trackFrame;
+    qint64 deliveredFrames;
+    qint64 trackStart;
+    qint64 endOfAudio;
+    int switches;
+    bool firstFramesPending; // Current track hasn't reached the sink yet
+    float gain;              // Loudness normalization, linear
+    float nextGain;
+
+    qint64 crossfadeFrames;  // 0 joins tracks gaplessly instead
+    Crossfade::Curve curve;
+    QSharedPointer<PcmBuffer> fadeBuffer; // Outgoing track while a fade runs
+    qint64 fadeFrame;        // Its read position
+    float fadeGain;
+    qint64 fadePosition;     // Frames of the fade played so far
+    qint64 fadeLength;
+    qint64 fadeOffset;       // Where in the current block the fade starts
+
+    std::vector<qint16> pcm16;
+    std::vector<float> pcmFloat;
+    std::vector<float> fadeFloat;
+    std::vector<float> outgoingGains;
+    std::vector<float> incomingGains;
+};
+
+AudioEngine::AudioEngine(QObject *parent)
+    : QObject(parent),
+      sink(nullptr),
+      positionTimer(nullptr),
+      wakePending(false),
+      durationMs(0),
+      nextDuration(0),
+      expectedDuration(0),
+      trackStart(0),
+      handledSwitches(0),
+      volume(1.0f),
+      muted(false),
+      crossfadeDuration(0),
+      crossfadeCurve(Crossfade::EqualPower),
+      state(QMediaPlayer::StoppedState)
+{
+    // Prefer float output so the equalizer's headroom isn't lost to integer clipping
+    device = QMediaDevices::defaultAudioOutput();
+    format = device.preferredFormat();
+    QAudioFormat floatFormat = format;
+    floatFormat.setSampleFormat(QAudioFormat::Float);
+    if (device.isFormatSupported(floatFormat)) {
+        format = floatFormat;
+    }
+
+    eq.setFormat(format.sampleRate(), format.channelCount());
+
+    stream = new AudioStream(format, &eq, this);
+    stream->open(QIODevice::ReadOnly);
+}
+
+AudioEngine::~AudioEngine()
+{
+    if (sink) {
+        sink->stop();
+    }
+}
+
+void AudioEngine::initialize()
+{
+    // Created here rather than in the constructor so the sink belongs to the engine thread
+    sink = new QAudioSink(device, format, this);
+    sink->setVolume(muted ? 0.0 : volume);
+
+    // Also how often the snapshot is refreshed; the UI samples it at its own rate
+    positionTimer = new QTimer(this);
+    positionTimer->setTimerType(Qt::PreciseTimer);
+    positionTimer->setInterval(20);
+    connect(positionTimer, &QTimer::timeout, this, &AudioEngine::updatePosition);
+
+    publish();
+}
+
+bool AudioEngine::post(const EngineCommand &command)
+{
+    if (!commands.push(command)) {
+        return false;
+    }
+
+    // One wake-up per batch; processCommands() clears the flag before draining
+    if (!wakePending.exchange(true, std::memory_order_acq_rel)) {
+        QMetaObject::invokeMethod(this, &AudioEngine::processCommands, Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void AudioEngine::processCommands()
+{
+    TRACE_SCOPE("engine", "AudioEngine::processCommands");
+    wakePending.store(false, std::memory_order_release);
+
+    EngineCommand command;
+    while (commands.pop(command)) {
+        switch (command.type) {
+        case EngineCommand::SetSource:
+            setSource(command.path, command.level);
+            break;
+        case EngineCommand::SetNextSource:
+            setNextSource(command.path, command.level);
+            break;
+        case EngineCommand::SetGain:
+            stream->setGain(command.level);
+            break;
+        case EngineCommand::Play:
+            play();
+            break;
+        case EngineCommand::Pause:
+            pause();
+            break;
+        case EngineCommand::Stop:
+            stop();
+            break;
+        case EngineCommand::SetPosition:
+            setPosition(command.value);
+            break;
+        case EngineCommand::SetVolume:
+            setVolume(command.level);
+            break;
+        case EngineCommand::SetMuted:
+            setMuted(command.value != 0);
+            break;
+        case EngineCommand::SetCrossfade:
+            setCrossfade(command.value, crossfadeCurve);
+            break;
+        case EngineCommand::SetCrossfadeCurve:
+            setCrossfade(crossfadeDuration, Crossfade::Curve(command.value));
+            break;
+        }
+    }
+
+    publish();
+}
+
+void AudioEngine::publish()
+{
+    PlaybackSnapshot snapshot;
+    snapshot.position = position();
+    snapshot.duration = durationMs;
+    snapshot.state = state;
+    published.store(snapshot);
+}
+
+void AudioEngine::setSource(const QString &filePath, float gain)
+{
+    TRACE_SCOPE_ARG("engine", "AudioEngine::setSource", filePath);
+
+    // Skipping while playing fades from wherever the current track is
+    const bool fade = crossfadeDuration > 0 && state == QMediaPlayer::PlayingState && decoder;
+
+    // Not stop(): a pending gapless switch is being discarded, not reported
+    if (!fade) {
+        sink->stop();
+        positionTimer->stop();
+        state = QMediaPlayer::StoppedState;
+    }
+
+    if (decoder && decoder != nextDecoder) {
+        decoder->deleteLater();
+    }
+    if (nextDecoder) {
+        nextDecoder->deleteLater();
+    }
+    nextDecoder = nullptr;
+    nextPath.clear();
+
+    sourcePath = filePath;
+    decoder = createDecoder(filePath);
+    durationMs = expectedDuration;
+
+    if (fade) {
+        trackStart = stream->crossfadeTo(decoder->buffer(), gain);
+    } else {
+        stream->setBuffer(decoder->buffer(), gain);
+        trackStart = stream->setFrame(0);
+    }
+    handledSwitches = stream->cursor().switches;
+    decoder->start();
+
+    emit mediaStatusChanged(QMediaPlayer::LoadingMedia);
+}
+
+void AudioEngine::setNextSource(const QString &filePath, float gain)
+{
+    // The stream may already be reading the queued track while the sink still
+    // plays out the last one; that decoder is the current one now, not to be replaced
+    promotePendingTrack();
+
+    if (filePath == nextPath && (nextDecoder || filePath.isEmpty())) {
+        stream->setNextGain(gain);
+        return;
+    }
+
+    if (nextDecoder && nextDecoder != decoder) {
+        nextDecoder->deleteLater();
+    }
+    nextDecoder = nullptr;
+    nextPath = filePath;
+
+    if (filePath.isEmpty() || !decoder) {
+        stream->setNextBuffer(QSharedPointer<PcmBuffer>(), gain);
+        return;
+    }
+
+    // Repeat One decodes the track again too: the current buffer only holds a window of it
+    nextDecoder = createDecoder(filePath);
+    nextDuration = expectedDuration;
+    stream->setNextBuffer(nextDecoder->buffer(), gain);
+
+    // Don't compete with the current track's decode; start as soon as it is done
+    if (decoder->buffer()->isFinished()) {
+        nextDecoder->start();
+    }
+}
+
+void AudioEngine::play()
+{
+    if (sourcePath.isEmpty() || state == QMediaPlayer::PlayingState) {
+        return;
+    }
+
+    TRACE_INSTANT("engine", "sink start");
+    if (sink->state() == QAudio::SuspendedState) {
+        sink->resume();
+    } else {
+        sink->start(stream);
+    }
+
+    positionTimer->start();
+    state = QMediaPlayer::PlayingState;
+}
+
+void AudioEngine::pause()
+{
+    if (state != QMediaPlayer::PlayingState) {
+        return;
+    }
+
+    sink->suspend();
+    positionTimer->stop();
+    state = QMediaPlayer::PausedState;
+}
+
+void AudioEngine::stop()
+{
+    sink->stop();
+    promotePendingTrack();
+    seekFrame(0);
+    positionTimer->stop();
+    state = QMediaPlayer::StoppedState;
+}
+
+void AudioEngine::setPosition(qint64 position)
+{
+    promotePendingTrack();
+    seekFrame(position * format.sampleRate() / 1000);
+}
+
+void AudioEngine::seekFrame(qint64 frame)
+{
+    // The buffer only keeps a window around the read position, and
+    // QAudioDecoder can't seek, so reaching further back decodes the track
+    // again from the start; the stream plays silence until it gets there
+    if (decoder && !decoder->buffer()->isRetained(frame)) {
+        TRACE_INSTANT_ARG("engine", "decode again", sourcePath);
+        TrackDecoder *fresh = createDecoder(sourcePath);
+        decoder->deleteLater();
+        decoder = fresh;
+        stream->restartBuffer(decoder->buffer());
+        decoder->start();
+    }
+    trackStart = stream->setFrame(frame);
+}
+
+qint64 AudioEngine::position() const
+{
+    // What the listener hears lags the delivered frames by whatever the sink has buffered
+    const AudioStream::Cursor cursor = stream->cursor();
+    qint64 played = cursor.deliveredFrames - bufferedFrames();
+    if (cursor.endOfAudio >= 0) {
+        played = std::min(played, cursor.endOfAudio);
+    }
+    return std::max<qint64>(0, played - trackStart) * 1000 / format.sampleRate();
+}
+
+void AudioEngine::setVolume(float newVolume)
+{
+    volume = newVolume;
+    sink->setVolume(muted ? 0.0 : volume);
+}
+
+void AudioEngine::setMuted(bool newMuted)
+{
+    muted = newMuted;
+    sink->setVolume(muted ? 0.0 : volume);
+}
+
+void AudioEngine::setCrossfade(qint64 duration, Crossfade::Curve curve)
+{
+    crossfadeDuration = qBound<qint64>(0, duration, Crossfade::MaxSeconds * 1000);
+    crossfadeCurve = curve;
+    stream->setCrossfade(crossfadeDuration * format.sampleRate() / 1000, curve);
+}
+
+void AudioEngine::updatePosition()
+{
+    const AudioStream::Cursor cursor = stream->cursor();
+    const qint64 played = cursor.deliveredFrames - bufferedFrames();
+
+    // Report the switch once the first frame of the next track is audible
+    if (cursor.switches != handledSwitches && played >= cursor.trackStart) {
+        promotePendingTrack();
+    }
+
+    // Stop once the last real sample has left the sink, not when it was read
+    if (cursor.endOfAudio >= 0 && played >= cursor.endOfAudio) {
+        sink->stop();
+        positionTimer->stop();
+        state = QMediaPlayer::StoppedState;
+        emit mediaStatusChanged(QMediaPlayer::EndOfMedia);
+    }
+
+    publish();
+}
+
+void AudioEngine::promotePendingTrack()
+{
+    const AudioStream::Cursor cursor = stream->cursor();
+    if (cursor.switches == handledSwitches) {
+        return;
+    }
+    handledSwitches = cursor.switches;
+    trackStart = cursor.trackStart;
+
+    if (!nextDecoder) {
+        // Nothing was queued to switch to; there is no current track any more
+        if (decoder) {
+            decoder->deleteLater();
+        }
+        decoder = nullptr;
+        durationMs = 0;
+    } else if (nextDecoder != decoder) {
+        if (decoder) {
+            decoder->deleteLater();
+        }
+        decoder = nextDecoder;
+        durationMs = nextDuration;
+        if (decoder->buffer()->isFinished()) {
+            const QSharedPointer<PcmBuffer> pcm = decoder->buffer();
+            durationMs = pcm->frameCount() * 1000 / pcm->sampleRate();
+        }
+    }
+    nextDecoder = nullptr;
+    sourcePath = nextPath;
+    nextPath.clear();
+
+    emit currentSourceChanged(sourcePath);
+}
+
+TrackDecoder *AudioEngine::createDecoder(const QString &filePath)
+{
+    TRACE_SCOPE_ARG("engine", "AudioEngine::createDecoder", filePath);
+
+    // Tag duration is known before decoding and sizes the PCM buffer
+    expectedDuration = TagReader::readTrack(filePath).duration;
+
+    TrackDecoder *created = new TrackDecoder(filePath, format.sampleRate(), format.channelCount(), this);
+    connect(created, &TrackDecoder::finished, this, [this, created]() {
+        if (created == decoder) {
+            // The decoded length is exact; the tag duration may not be
+            const QSharedPointer<PcmBuffer> pcm = created->buffer();
+            durationMs = pcm->frameCount() * 1000 / pcm->sampleRate();
+            publish();
+            emit mediaStatusChanged(QMediaPlayer::LoadedMedia);
+
+            if (nextDecoder && !nextDecoder->isStarted()) {
+                nextDecoder->start();
+            }
+        }
+    });
+    connect(created, &TrackDecoder::errorOccurred, this, [this, created](const QString &message) {
+        if (created == decoder) {
+            emit mediaStatusChanged(QMediaPlayer::InvalidMedia);
+            emit errorOccurred(message);
+
+            // The buffer ends where the error struck; the queued track follows as after a clean finish
+            if (nextDecoder && !nextDecoder->isStarted()) {
+                nextDecoder->start();
+            }
+        }
+    });
+    return created;
+}
+
+
+qint64 AudioEngine::bufferedFrames() const
+{
+    if (!sink || sink->state() == QAudio::StoppedState) {
+        return 0;
+    }
+    return std::max<qint64>(0, sink->bufferSize() - sink->bytesFree()) / format.bytesPerFrame();
+}
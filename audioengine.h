@@ -0,0 +1,142 @@
+#ifndef AUDIOENGINE_H
+#define AUDIOENGINE_H
+
+#include <QObject>
+#include <QAudioDevice>
+#include <QAudioFormat>
+#include <QAudioSink>
+#include <QMediaPlayer>
+#include <QPointer>
+#include <QTimer>
+#include <atomic>
+#include "crossfade.h"
+#include "equalizer.h"
+#include "seqlock.h"
+#include "spscqueue.h"
+#include "trackdecoder.h"
+
+class AudioStream;
+
+// One transport request for the engine thread
+struct EngineCommand
+{
+    enum Type {
+        SetSource,
+        SetNextSource,
+        Play,
+        Pause,
+        Stop,
+        SetPosition,
+        SetVolume,
+        SetMuted,
+        SetGain,
+        SetCrossfade,
+        SetCrossfadeCurve
+    };
+
+    Type type = Stop;
+    QString path;     // SetSource, SetNextSource
+    qint64 value = 0; // SetPosition (ms), SetMuted (0/1), SetCrossfade (ms), SetCrossfadeCurve (Crossfade::Curve)
+    float level = 0;  // SetVolume; loudness gain (linear) for SetSource, SetNextSource, SetGain
+};
+
+// What the UI shows; published by the engine, sampled by the UI
+struct PlaybackSnapshot
+{
+    qint64 position = 0; // ms into the current track
+    qint64 duration = 0; // ms
+    QMediaPlayer::PlaybackState state = QMediaPlayer::StoppedState;
+
+    bool operator==(const PlaybackSnapshot &other) const
+    {
+        return position == other.position && duration == other.duration && state == other.state;
+    }
+    bool operator!=(const PlaybackSnapshot &other) const { return !(*this == other); }
+};
+
+// Playback through our own PCM path: QAudioDecoder -> PcmBuffer ->
+// loudness gain -> Equalizer -> QAudioSink. The engine lives on its own thread (see
+// PlaybackController) and is driven only through post(): commands go
+// through a lock-free queue and position/state come back as snapshots,
+// so a busy GUI thread never delays a transport request, and vice versa.
+// Track changes and status are still reported with (queued) signals.
+// A queued next source is decoded ahead of time and joined to the current
+// one without a gap, or crossfaded into it when a crossfade is set, after
+// which currentSourceChanged() reports the switch. With a crossfade set,
+// changing the source while playing fades too.
+class AudioEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AudioEngine(QObject *parent = nullptr);
+    ~AudioEngine();
+
+    // From the one controlling thread; false if the queue is full
+    bool post(const EngineCommand &command);
+
+    // From any thread
+    PlaybackSnapshot snapshot() const { return published.load(); }
+
+    // The equalizer's parameters are atomics; setGain() may be called from any thread
+    Equalizer *equalizer() { return &eq; }
+
+public slots:
+    // Creates the sink; must run on the engine thread before any command
+    void initialize();
+
+signals:
+    void currentSourceChanged(const QString &filePath);
+    void mediaStatusChanged(QMediaPlayer::MediaStatus status);
+    void errorOccurred(const QString &message);
+
+private slots:
+    void processCommands();
+    void updatePosition();
+
+private:
+    void setSource(const QString &filePath, float gain);
+    void setNextSource(const QString &filePath, float gain);
+    void play();
+    void pause();
+    void stop();
+    void setPosition(qint64 position);
+    void seekFrame(qint64 frame);
+    void setVolume(float volume);
+    void setMuted(bool muted);
+    void setCrossfade(qint64 duration, Crossfade::Curve curve);
+
+    qint64 position() const;
+    void publish();
+    void promotePendingTrack();
+    TrackDecoder *createDecoder(const QString &filePath);
+    qint64 bufferedFrames() const;
+
+    QAudioFormat format;
+    QAudioDevice device;
+    QAudioSink *sink;
+    AudioStream *stream;
+    Equalizer eq;
+    QPointer<TrackDecoder> decoder;
+    QPointer<TrackDecoder> nextDecoder;
+    QTimer *positionTimer;
+
+    SpscQueue<EngineCommand, 256> commands;
+    std::atomic<bool> wakePending;
+    SeqLock<PlaybackSnapshot> published;
+
+    QString sourcePath;
+    QString nextPath;
+    qint64 durationMs;
+    qint64 nextDuration;
+    qint64 expectedDuration;
+    qint64 trackStart;      // Stream frame at which the displayed track's frame 0 plays
+    int handledSwitches;
+    float volume;
+    bool muted;
+    qint64 crossfadeDuration; // ms, 0 for gapless
+    Crossfade::Curve crossfadeCurve;
+    QMediaPlayer::PlaybackState state;
+};
+
+#endif // AUDIOENGINE_H
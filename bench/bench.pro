@@ -0,0 +1,17 @@
+QT += core gui multimedia concurrent
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = bench
+
+include(../core.pri)
+
+SOURCES += \
+    benchrunner.cpp \
+    corpus.cpp \
+    main.cpp
+
+HEADERS += \
+    benchrunner.h \
+    corpus.h
@@ -0,0 +1,100 @@
+#include "benchrunner.h"
+#include <QDateTime>
+#include <QSysInfo>
+#include <QThread>
+#include <QTextStream>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+const int MinIterations = 3;
+const int MaxIterations = 1000;
+const qint64 MinTotalNs = 300 * 1000 * 1000;
+
+} // namespace
+
+BenchRunner::BenchRunner(const QString &filter)
+    : filter(filter)
+{
+}
+
+bool BenchRunner::isSelected(const QString &name) const
+{
+    return name.startsWith(filter);
+}
+
+bool BenchRunner::isGroupSelected(const QString &prefix) const
+{
+    return prefix.startsWith(filter) || filter.startsWith(prefix);
+}
+
+void BenchRunner::run(const QString &name, qint64 items, const std::function<void()> &body)
+{
+    run(name, items, std::function<void()>(), body);
+}
+
+void BenchRunner::run(const QString &name, qint64 items, const std::function<void()> &setup,
+                      const std::function<void()> &body)
+{
+    if (!isSelected(name)) {
+        return;
+    }
+
+    QTextStream(stderr) << name << " (" << items << ")..." << Qt::flush;
+
+    std::vector<qint64> samples;
+    qint64 total = 0;
+    QElapsedTimer timer;
+
+    // The first run is a warm-up and is not recorded
+    for (int i = 0; i <= MaxIterations; ++i) {
+        if (setup) {
+            setup();
+        }
+        timer.start();
+        body();
+        const qint64 elapsed = timer.nsecsElapsed();
+
+        if (i > 0) {
+            samples.push_back(elapsed);
+            total += elapsed;
+            if (int(samples.size()) >= MinIterations && total >= MinTotalNs) {
+                break;
+            }
+        }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    const double minMs = samples.front() / 1e6;
+    const double medianMs = samples[samples.size() / 2] / 1e6;
+
+    QJsonObject result;
+    result["name"] = name;
+    result["items"] = items;
+    result["iterations"] = int(samples.size());
+    result["min_ms"] = minMs;
+    result["median_ms"] = medianMs;
+    result["ns_per_item"] = items > 0 ? samples[samples.size() / 2] / double(items) : 0.0;
+    results.append(result);
+
+    QTextStream(stderr) << " " << QString::number(medianMs, 'f', 3) << " ms\n";
+}
+
+QJsonObject BenchRunner::report() const
+{
+    QJsonObject report;
+    report["suite"] = "music-player-bench";
+    report["format_version"] = 1;
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["qt_version"] = QString::fromLatin1(qVersion());
+    report["cpu"] = QSysInfo::currentCpuArchitecture();
+    report["threads"] = QThread::idealThreadCount();
+#ifdef QT_DEBUG
+    report["build"] = "debug";
+#else
+    report["build"] = "release";
+#endif
+    report["results"] = results;
+    return report;
+}
@@ -0,0 +1,38 @@
+#ifndef BENCHRUNNER_H
+#define BENCHRUNNER_H
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+#include <functional>
+
+// Times benchmark bodies and collects the results as JSON. Each body is
+// run once to warm up, then repeatedly until both a minimum iteration
+// count and a minimum total time are reached; min and median are kept so
+// noisy machines can still be compared between releases.
+class BenchRunner
+{
+public:
+    explicit BenchRunner(const QString &filter = QString());
+
+    // The filter is a name prefix, e.g. "search/" or "playlist/parse-m3u"
+    bool isSelected(const QString &name) const;
+    // Whether any benchmark under prefix may run; used to skip building corpora
+    bool isGroupSelected(const QString &prefix) const;
+
+    // items is the number of work units one run processes (files, rows, frames)
+    void run(const QString &name, qint64 items, const std::function<void()> &body);
+
+    // For bodies that need fresh state per iteration; setup is not timed
+    void run(const QString &name, qint64 items, const std::function<void()> &setup,
+             const std::function<void()> &body);
+
+    QJsonObject report() const;
+
+private:
+    QString filter;
+    QJsonArray results;
+};
+
+#endif // BENCHRUNNER_H
@@ -0,0 +1,275 @@
+#include "corpus.h"
+#include <QDir>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QtEndian>
+
+namespace {
+
+const char *const Words[] = {
+    "love", "night", "blue", "heart", "fire", "road", "dream", "light", "rain", "summer",
+    "city", "river", "gold", "shadow", "echo", "midnight", "wild", "ocean", "stone", "paper",
+    "ghost", "silver", "morning", "home", "storm", "glass", "dance", "winter", "moon", "electric"
+};
+const int WordCount = int(sizeof(Words) / sizeof(Words[0]));
+
+QString phrase(QRandomGenerator &rng, int words)
+{
+    QStringList parts;
+    for (int i = 0; i < words; ++i) {
+        QString word = QString::fromLatin1(Words[rng.bounded(WordCount)]);
+        word[0] = word[0].toUpper();
+        parts.append(word);
+    }
+    return parts.join(QLatin1Char(' '));
+}
+
+QByteArray be32(quint32 value)
+{
+    QByteArray bytes(4, Qt::Uninitialized);
+    qToBigEndian(value, bytes.data());
+    return bytes;
+}
+
+QByteArray le32(quint32 value)
+{
+    QByteArray bytes(4, Qt::Uninitialized);
+    qToLittleEndian(value, bytes.data());
+    return bytes;
+}
+
+QByteArray le16(quint16 value)
+{
+    QByteArray bytes(2, Qt::Uninitialized);
+    qToLittleEndian(value, bytes.data());
+    return bytes;
+}
+
+QByteArray syncsafe(quint32 value)
+{
+    QByteArray bytes(4, Qt::Uninitialized);
+    for (int i = 3; i >= 0; --i) {
+        bytes[i] = char(value & 0x7f);
+        value >>= 7;
+    }
+    return bytes;
+}
+
+QByteArray mp3File(const TrackInfo &track)
+{
+    // ID3v2.3 with Latin-1 text frames
+    QByteArray frames;
+    auto textFrame = [&frames](const char *id, const QString &text) {
+        const QByteArray payload = '\0' + text.toLatin1();
+        frames += QByteArray(id) + be32(quint32(payload.size())) + QByteArray(2, '\0') + payload;
+    };
+    textFrame("TIT2", track.title);
+    textFrame("TPE1", track.artist);
+    textFrame("TALB", track.album);
+    textFrame("TCON", track.genre);
+    frames += QByteArray(256, '\0'); // Padding
+
+    QByteArray file = "ID3" + QByteArray("\x03\x00\x00", 3) + syncsafe(quint32(frames.size())) + frames;
+
+    // MPEG-1 Layer III, 128 kbit/s, 44.1 kHz, stereo; the first frame carries a Xing header
+    const qint64 frameCount = track.duration * 44100 / 1152 / 1000;
+    QByteArray frame(417, '\0');
+    frame[0] = char(0xff);
+    frame[1] = char(0xfb);
+    frame[2] = char(0x90);
+    frame[3] = char(0x00);
+    QByteArray xing = "Xing" + be32(1) + be32(quint32(frameCount));
+    frame.replace(4 + 32, xing.size(), xing);
+    file += frame;
+
+    frame.replace(4 + 32, xing.size(), QByteArray(xing.size(), '\0'));
+    for (int i = 0; i < 3; ++i) {
+        file += frame;
+    }
+    return file;
+}
+
+QByteArray flacFile(const TrackInfo &track)
+{
+    const quint64 sampleRate = 44100;
+    const quint64 totalSamples = quint64(track.duration) * sampleRate / 1000;
+
+    QByteArray streamInfo(34, '\0');
+    qToBigEndian<quint16>(4096, streamInfo.data());
+    qToBigEndian<quint16>(4096, streamInfo.data() + 2);
+    const quint64 packed = (sampleRate << 44) | (quint64(2 - 1) << 41) | (quint64(16 - 1) << 36) | totalSamples;
+    qToBigEndian(packed, streamInfo.data() + 10);
+
+    QByteArray comment = le32(5) + "bench";
+    const QList<QByteArray> fields = {
+        "TITLE=" + track.title.toUtf8(),
+        "ARTIST=" + track.artist.toUtf8(),
+        "ALBUM=" + track.album.toUtf8(),
+        "GENRE=" + track.genre.toUtf8(),
+    };
+    comment += le32(quint32(fields.size()));
+    for (const QByteArray &field : fields) {
+        comment += le32(quint32(field.size())) + field;
+    }
+
+    auto blockHeader = [](int type, bool last, int length) {
+        QByteArray header(4, '\0');
+        header[0] = char((last ? 0x80 : 0) | type);
+        header[1] = char((length >> 16) & 0xff);
+        header[2] = char((length >> 8) & 0xff);
+        header[3] = char(length & 0xff);
+        return header;
+    };
+
+    return "fLaC" + blockHeader(0, false, streamInfo.size()) + streamInfo
+         + blockHeader(4, true, comment.size()) + comment
+         + QByteArray(512, '\0'); // Stand-in for audio frames
+}
+
+QByteArray wavFile(const TrackInfo &track)
+{
+    auto infoField = [](const char *id, const QString &text) {
+        QByteArray value = text.toUtf8() + '\0';
+        if (value.size() & 1) {
+            value += '\0';
+        }
+        return QByteArray(id) + le32(quint32(value.size())) + value;
+    };
+    const QByteArray info = "INFO" + infoField("INAM", track.title) + infoField("IART", track.artist)
+                          + infoField("IPRD", track.album) + infoField("IGNR", track.genre);
+
+    const quint32 byteRate = 44100 * 4;
+    const QByteArray fmt = le16(1) + le16(2) + le32(44100) + le32(byteRate) + le16(4) + le16(16);
+    const QByteArray data(4410, '\0'); // 25 ms of silence
+
+    const QByteArray body = "WAVE"
+                          + QByteArray("fmt ") + le32(quint32(fmt.size())) + fmt
+                          + QByteArray("LIST") + le32(quint32(info.size())) + info
+                          + QByteArray("data") + le32(quint32(data.size())) + data;
+    return "RIFF" + le32(quint32(body.size())) + body;
+}
+
+QString safeName(QString name)
+{
+    return name.replace(QLatin1Char('/'), QLatin1Char('_'));
+}
+
+} // namespace
+
+namespace Corpus {
+
+QList<TrackInfo> tracks(int count, quint32 seed)
+{
+    QRandomGenerator rng(seed);
+
+    const int artistCount = qMax(1, count / 40);
+    QStringList artists;
+    for (int i = 0; i < artistCount; ++i) {
+        artists.append(phrase(rng, 2) + QStringLiteral(" %1").arg(i));
+    }
+
+    QList<TrackInfo> result;
+    result.reserve(count);
+
+    int index = 0;
+    while (index < count) {
+        // One album of 8-12 tracks at a time, by one artist
+        const int artistIndex = int(rng.bounded(artistCount));
+        const QString artist = artists.at(artistIndex);
+        const QString genre = TagReader::detail::id3v1Genre(artistIndex % 80);
+        const QString album = phrase(rng, 2);
+        const int albumTracks = qMin(count - index, 8 + int(rng.bounded(5)));
+
+        for (int t = 0; t < albumTracks; ++t, ++index) {
+            TrackInfo track;
+            track.title = phrase(rng, 1 + int(rng.bounded(3)));
+            track.artist = artist;
+            track.album = album;
+            track.genre = genre;
+            track.duration = 120000 + rng.bounded(240000);
+            track.size = track.duration * 16;
+            track.modified = 1600000000000LL + index;
+            track.path = QStringLiteral("/music/%1/%2/%3 - %4.mp3")
+                             .arg(safeName(artist), safeName(album))
+                             .arg(t + 1, 2, 10, QLatin1Char('0'))
+                             .arg(safeName(track.title));
+            result.append(track);
+        }
+    }
+
+    return result;
+}
+
+QStringList writeAudioFiles(const QString &dir, int count, quint32 seed)
+{
+    return writeAudioFiles(dir, count, QString(), seed);
+}
+
+QStringList writeAudioFiles(const QString &dir, int count, const QString &format, quint32 seed)
+{
+    static const char *const Formats[] = {"mp3", "flac", "wav"};
+
+    QStringList paths;
+    paths.reserve(count);
+
+    const QList<TrackInfo> infos = tracks(count, seed);
+    for (int i = 0; i < infos.size(); ++i) {
+        const TrackInfo &track = infos.at(i);
+        const QString extension = format.isEmpty() ? QString::fromLatin1(Formats[i % 3]) : format;
+
+        const QString albumDir = dir + "/" + safeName(track.artist) + "/" + safeName(track.album);
+        QDir().mkpath(albumDir);
+        const QString path = albumDir + QStringLiteral("/%1 %2.").arg(i).arg(safeName(track.title)) + extension;
+
+        QByteArray contents;
+        if (extension == QLatin1String("flac")) {
+            contents = flacFile(track);
+        } else if (extension == QLatin1String("wav")) {
+            contents = wavFile(track);
+        } else {
+            contents = mp3File(track);
+        }
+
+        QFile file(path);
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(contents);
+            paths.append(path);
+        }
+    }
+
+    return paths;
+}
+
+QList<PlaylistEntry> playlist(int count, quint32 seed)
+{
+    const QList<TrackInfo> infos = tracks(count, seed);
+
+    QList<PlaylistEntry> entries;
+    entries.reserve(infos.size());
+    for (const TrackInfo &track : infos) {
+        entries.append({track.path, track.artist + " - " + track.title, track.duration});
+    }
+    return entries;
+}
+
+std::vector<float> noise(qint64 frames, int channels, quint32 seed)
+{
+    QRandomGenerator rng(seed);
+    std::vector<float> samples(size_t(frames * channels));
+    for (float &sample : samples) {
+        sample = float(rng.generateDouble() * 0.5 - 0.25);
+    }
+    return samples;
+}
+
+std::vector<qint16> noise16(qint64 frames, int channels, quint32 seed)
+{
+    const std::vector<float> samples = noise(frames, channels, seed);
+    std::vector<qint16> result(samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        result[i] = qint16(samples[i] * 32767.0f);
+    }
+    return result;
+}
+
+} // namespace Corpus
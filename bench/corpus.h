@@ -0,0 +1,38 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <vector>
+#include "playlistparser.h"
+#include "tagreader.h"
+
+// Deterministic synthetic inputs for the benchmarks. The same seed always
+// produces the same corpus, so numbers are comparable between runs and
+// releases without shipping media files.
+namespace Corpus {
+
+// Library rows with realistic repetition: about one artist per 40 tracks
+// and one album per 10, one genre per artist, titles drawn from a small
+// vocabulary
+QList<TrackInfo> tracks(int count, quint32 seed = 1);
+
+// Writes count small but well-formed audio files (MP3 with ID3v2 and a
+// Xing header, FLAC with STREAMINFO and Vorbis comments, WAV with LIST
+// INFO), cycling through the formats, under dir/<artist>/<album>/.
+// Returns the file paths.
+QStringList writeAudioFiles(const QString &dir, int count, quint32 seed = 1);
+
+// Writes only one format: "mp3", "flac" or "wav"
+QStringList writeAudioFiles(const QString &dir, int count, const QString &format, quint32 seed = 1);
+
+QList<PlaylistEntry> playlist(int count, quint32 seed = 1);
+
+// Interleaved stereo noise at -12 dBFS
+std::vector<float> noise(qint64 frames, int channels, quint32 seed = 1);
+std::vector<qint16> noise16(qint64 frames, int channels, quint32 seed = 1);
+
+} // namespace Corpus
+
+#endif // CORPUS_H
@@ -0,0 +1,515 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QtConcurrent>
+#include "benchrunner.h"
+#include "corpus.h"
+#include "crossfade.h"
+#include "equalizer.h"
+#include "fingerprint.h"
+#include "libraryindex.h"
+#include "loudness.h"
+#include "playbackqueue.h"
+#include "playlistmodel.h"
+#include "playlistparser.h"
+#include "searchindex.h"
+#include "smartplaylist.h"
+#include "tagreader.h"
+#include "trace.h"
+#include "trackdecoder.h"
+#include "trackstore.h"
+#include "waveform.h"
+
+namespace {
+
+QList<int> sizesUpTo(int maxSize)
+{
+    QList<int> sizes;
+    for (int size = 10000; size <= maxSize; size *= 10) {
+        sizes.append(size);
+    }
+    return sizes;
+}
+
+void benchTagReader(BenchRunner &runner, const QString &dir, int files)
+{
+    for (const QString format : {"mp3", "flac", "wav"}) {
+        const QString name = "tagreader/" + format;
+        if (!runner.isGroupSelected(name)) {
+            continue;
+        }
+
+        const QStringList paths = Corpus::writeAudioFiles(dir + "/tags-" + format, files, format);
+        runner.run(name, paths.size(), [&]() {
+            qint64 total = 0;
+            for (const QString &path : paths) {
+                total += TagReader::readTrack(path).duration;
+            }
+            Q_UNUSED(total);
+        });
+    }
+}
+
+void benchLibrary(BenchRunner &runner, const QString &dir, int files)
+{
+    if (!runner.isGroupSelected("library/")) {
+        return;
+    }
+
+    const QString root = dir + "/library";
+    Corpus::writeAudioFiles(root, files);
+    const QString indexFile = dir + "/library.idx";
+
+    // Full scan as the Library tab does it: stat, then parse new files on the pool
+    runner.run("library/scan-full", files, [&]() {
+        LibraryIndex index(indexFile);
+        const QStringList changed = index.refresh({root});
+        index.update(QtConcurrent::blockingMapped(changed, &TagReader::readTrack));
+    });
+
+    LibraryIndex index(indexFile);
+    index.update(QtConcurrent::blockingMapped(index.refresh({root}), &TagReader::readTrack));
+
+    runner.run("library/rescan-unchanged", files, [&]() {
+        index.refresh({root});
+    });
+    runner.run("library/index-save", files, [&]() {
+        index.save();
+    });
+    runner.run("library/index-load", files, [&]() {
+        LibraryIndex loaded(indexFile);
+        loaded.load();
+    });
+}
+
+void benchStore(BenchRunner &runner, int maxSize)
+{
+    for (int size : sizesUpTo(maxSize)) {
+        if (!runner.isGroupSelected("store/")) {
+            return;
+        }
+
+        const QList<TrackInfo> tracks = Corpus::tracks(size);
+        const QString suffix = "/" + QString::number(size);
+
+        runner.run("store/append" + suffix, size, [&]() {
+            TrackStore store;
+            store.reserve(size);
+            for (const TrackInfo &track : tracks) {
+                store.append(track);
+            }
+        });
+
+        TrackStore store;
+        for (const TrackInfo &track : tracks) {
+            store.append(track);
+        }
+
+        runner.run("store/find" + suffix, size, [&]() {
+            int found = 0;
+            for (const TrackInfo &track : tracks) {
+                found += store.find(track.path) >= 0;
+            }
+            Q_UNUSED(found);
+        });
+
+        // A whole-column pass, as album grouping and smart queries do it
+        runner.run("store/scan-artist" + suffix, size, [&]() {
+            const qint64 id = store.artistDictionary().find(tracks.at(size / 2).artist);
+            int matches = 0;
+            for (quint32 artist : store.artistColumn()) {
+                matches += artist == id;
+            }
+            Q_UNUSED(matches);
+        });
+    }
+}
+
+void benchSearch(BenchRunner &runner, int maxSize)
+{
+    for (int size : sizesUpTo(maxSize)) {
+        if (!runner.isGroupSelected("search/")) {
+            return;
+        }
+
+        TrackStore tracks;
+        for (const TrackInfo &track : Corpus::tracks(size)) {
+            tracks.append(track);
+        }
+        const QString suffix = "/" + QString::number(size);
+
+        runner.run("search/build" + suffix, size, [&]() {
+            SearchIndex index;
+            index.build(tracks);
+        });
+
+        SearchIndex index;
+        index.build(tracks);
+
+        // Short queries scan distinct strings; longer ones use the trigram postings
+        const QStringList queries = {"l", "lo", "love", "midnight rain", "zzqx"};
+        for (const QString &query : queries) {
+            runner.run("search/match-" + QString(query).replace(' ', '_') + suffix, size, [&]() {
+                index.match(query);
+            });
+        }
+    }
+}
+
+void benchSmartQuery(BenchRunner &runner, int maxSize)
+{
+    for (int size : sizesUpTo(maxSize)) {
+        if (!runner.isGroupSelected("smartquery/")) {
+            return;
+        }
+
+        TrackStore tracks;
+        for (const TrackInfo &track : Corpus::tracks(size)) {
+            tracks.append(track);
+        }
+        const QString suffix = "/" + QString::number(size);
+
+        // The corpus's files all date from September 2020 on
+        const QList<QPair<QString, QString>> rules = {
+            {"artist", QString("artist = \"%1\" and duration > 5:00 and added > 2020-09-01 order by album")
+                           .arg(tracks.artist(size / 2))},
+            {"genre", "genre = Rock or genre ~ jazz"},
+            {"title", "title ~ love"},
+            {"numbers", "duration >= 3:00 and duration < 4:00 and size > 3MB order by duration desc limit 100"},
+        };
+        for (const auto &rule : rules) {
+            const SmartQuery query(rule.second);
+            runner.run("smartquery/parse-" + rule.first + suffix, 1, [&]() {
+                const SmartQuery parsed(rule.second);
+                Q_UNUSED(parsed);
+            });
+            runner.run("smartquery/evaluate-" + rule.first + suffix, size, [&]() {
+                SmartPlaylist playlist(rule.first, query);
+                playlist.evaluate(tracks);
+                playlist.rows(tracks);
+            });
+        }
+
+        // A tag edit touching a hundred rows
+        SmartPlaylist playlist("artist", SmartQuery(rules.first().second));
+        playlist.evaluate(tracks);
+        QList<int> changed;
+        for (int i = 0; i < 100; ++i) {
+            changed.append(int(qint64(i) * size / 100));
+        }
+        runner.run("smartquery/update-100" + suffix, 100, [&]() {
+            playlist.update(tracks, changed);
+        });
+    }
+}
+
+void benchDuplicates(BenchRunner &runner, int maxSize)
+{
+    for (int size : sizesUpTo(maxSize)) {
+        if (!runner.isGroupSelected("duplicates/")) {
+            return;
+        }
+
+        // Random fingerprints, plus a copy with a few flipped bits after every hundredth track
+        QList<TrackInfo> tracks = Corpus::tracks(size);
+        QRandomGenerator random(19);
+        for (int i = 0; i < tracks.size(); ++i) {
+            QList<quint32> words(FingerprintBuilder::MaxWords);
+            if (i % 100 == 1) {
+                words = tracks.at(i - 1).fingerprint;
+                for (quint32 &word : words) {
+                    word ^= random.bounded(8) == 0 ? 1u << random.bounded(32) : 0u;
+                }
+                tracks[i].duration = tracks.at(i - 1).duration;
+            } else {
+                for (quint32 &word : words) {
+                    word = random.generate();
+                }
+            }
+            tracks[i].fingerprint = words;
+        }
+
+        TrackStore store;
+        for (const TrackInfo &track : std::as_const(tracks)) {
+            store.append(track);
+        }
+
+        runner.run("duplicates/find/" + QString::number(size), size, [&]() {
+            Fingerprint::findDuplicates(store);
+        });
+    }
+}
+
+void benchPlaylist(BenchRunner &runner, const QString &dir, int maxSize)
+{
+    for (int size : sizesUpTo(maxSize)) {
+        if (!runner.isGroupSelected("playlist/")) {
+            return;
+        }
+
+        const QList<PlaylistEntry> entries = Corpus::playlist(size);
+        const QString suffix = "/" + QString::number(size);
+
+        for (const QString format : {"m3u", "pls", "xspf"}) {
+            const QString fileName = dir + "/playlist-" + QString::number(size) + "." + format;
+
+            runner.run("playlist/write-" + format + suffix, size, [&]() {
+                PlaylistParser::write(fileName, entries);
+            });
+            PlaylistParser::write(fileName, entries);
+
+            runner.run("playlist/parse-" + format + suffix, size, [&]() {
+                QFuture<QList<PlaylistEntry>> future = PlaylistParser::parseAsync(fileName);
+                future.waitForFinished();
+            });
+
+            // Time until the first chunk is available, i.e. until the playlist is playable
+            runner.run("playlist/first-chunk-" + format + suffix, size, [&]() {
+                QFuture<QList<PlaylistEntry>> future = PlaylistParser::parseAsync(fileName);
+                future.resultAt(0);
+                future.cancel();
+                future.waitForFinished();
+            });
+        }
+
+        PlaylistModel model;
+        runner.run("playlist/model-append" + suffix, size, [&]() { model.clear(); }, [&]() {
+            model.append(entries);
+        });
+
+        // Shuffle orders are permutations over the model's rows
+        PlaybackQueue queue;
+        queue.setRepeatMode(PlaybackQueue::RepeatAll);
+        runner.run("playlist/queue-shuffle" + suffix, size, [&]() {
+            queue.reset(size);
+            queue.setShuffleMode(PlaybackQueue::NoShuffle, -1);
+        }, [&]() {
+            queue.setShuffleMode(PlaybackQueue::Shuffle, 0);
+        });
+
+        queue.setGroupFunction([&](int row) {
+            // Corpus display names are "artist - title"
+            return entries.at(row).title.section(" - ", 0, 0);
+        });
+        runner.run("playlist/queue-artist-spread" + suffix, size, [&]() {
+            queue.setShuffleMode(PlaybackQueue::NoShuffle, -1);
+        }, [&]() {
+            queue.setShuffleMode(PlaybackQueue::ArtistSpread, 0);
+        });
+
+        runner.run("playlist/queue-next" + suffix, size, [&]() {
+            int row = 0;
+            for (int i = 0; i < size; ++i) {
+                row = queue.next(row);
+            }
+        });
+
+        runner.run("playlist/queue-unshuffle" + suffix, 1, [&]() {
+            queue.setShuffleMode(PlaybackQueue::Shuffle, 0);
+        }, [&]() {
+            queue.setShuffleMode(PlaybackQueue::NoShuffle, 0);
+        });
+
+        // 1000 scattered rows, as from a multi-selection
+        QList<int> rows;
+        runner.run("playlist/model-remove-1000" + suffix, 1000, [&]() {
+            model.clear();
+            model.append(entries);
+            QRandomGenerator rng(size);
+            rows.clear();
+            for (int i = 0; i < 1000; ++i) {
+                rows.append(rng.bounded(size));
+            }
+        }, [&]() {
+            model.removeRowList(rows);
+        });
+    }
+}
+
+void benchAudio(BenchRunner &runner)
+{
+    const int rate = 48000;
+    const int channels = 2;
+    const qint64 frames = rate * 10; // Ten seconds per run
+    const std::vector<float> input = Corpus::noise(frames, channels);
+    std::vector<float> buffer(input.size());
+
+    // Blocks of the size the sink typically pulls
+    const qint64 block = 1024;
+    auto runEqualizer = [&](Equalizer &eq) {
+        buffer = input;
+        for (qint64 pos = 0; pos < frames; pos += block) {
+            eq.process(buffer.data() + pos * channels, qMin(block, frames - pos));
+        }
+    };
+
+    Equalizer flat;
+    flat.setFormat(rate, channels);
+    runner.run("audio/equalizer-flat", frames, [&]() { runEqualizer(flat); });
+
+    Equalizer active;
+    active.setFormat(rate, channels);
+    for (int band = 0; band < Equalizer::BandCount; ++band) {
+        active.setGain(band, band % 2 ? -4.0f : 6.0f);
+    }
+    runner.run("audio/equalizer-10-band", frames, [&]() { runEqualizer(active); });
+
+    const std::vector<qint16> pcm = Corpus::noise16(frames, channels);
+    runner.run("audio/pcm-append", frames, [&]() {
+        PcmBuffer buffer(rate, channels);
+        for (qint64 pos = 0; pos < frames; pos += 4096) {
+            buffer.append(pcm.data() + pos * channels, qMin<qint64>(4096, frames - pos));
+        }
+    });
+
+    PcmBuffer filled(rate, channels);
+    filled.append(pcm.data(), frames);
+    std::vector<qint16> out(size_t(block * channels));
+    runner.run("audio/pcm-read", frames, [&]() {
+        for (qint64 pos = 0; pos < frames; pos += block) {
+            filled.read(pos, out.data(), block);
+        }
+    });
+
+    // Loudness analysis cost per frame, decode excluded
+    runner.run("audio/loudness-meter", frames, [&]() {
+        LoudnessMeter meter(rate, channels);
+        for (qint64 pos = 0; pos < frames; pos += block) {
+            meter.addFrames(input.data() + pos * channels, qMin(block, frames - pos));
+        }
+        meter.integratedLoudness();
+    });
+
+    // Waveform overview cost per frame, decode excluded; must stay far above 50x real time
+    runner.run("audio/waveform-build", frames, [&]() {
+        WaveformBuilder builder(rate, channels, frames);
+        for (qint64 pos = 0; pos < frames; pos += block) {
+            builder.addFrames(input.data() + pos * channels, qMin(block, frames - pos));
+        }
+        builder.finish();
+    });
+
+    // Fingerprint cost per frame, decode excluded; stops early once full, as analyzeFile does
+    runner.run("audio/fingerprint-build", frames, [&]() {
+        FingerprintBuilder builder;
+        for (qint64 pos = 0; pos < frames && !builder.isFull(); pos += block) {
+            builder.addFrames(input.data() + pos * channels, qMin(block, frames - pos), rate, channels);
+        }
+        builder.fingerprint();
+    });
+
+    // One block of a crossfade: both gain curves plus the mix, per frame
+    std::vector<float> mixed(input.size());
+    std::vector<float> outgoingGains(size_t(block));
+    std::vector<float> incomingGains(size_t(block));
+    runner.run("audio/crossfade-mix", frames, [&]() {
+        std::copy(input.begin(), input.end(), mixed.begin());
+        for (qint64 pos = 0; pos < frames; pos += block) {
+            const qint64 count = qMin(block, frames - pos);
+            Crossfade::gains(Crossfade::EqualPower, pos, frames, outgoingGains.data(), incomingGains.data(), count);
+            Crossfade::mix(mixed.data() + pos * channels, input.data() + pos * channels, outgoingGains.data(),
+                           incomingGains.data(), count, channels);
+        }
+    });
+
+    // The sink-side conversion done per block in AudioStream
+    std::vector<float> converted(pcm.size());
+    runner.run("audio/int16-to-float", frames, [&]() {
+        for (size_t i = 0; i < pcm.size(); ++i) {
+            converted[i] = pcm[i] * (1.0f / 32768.0f);
+        }
+    });
+}
+
+void benchTrace(BenchRunner &runner)
+{
+    if (!runner.isGroupSelected("trace/")) {
+        return;
+    }
+
+    // Cost of a trace point; "disabled" is what every build pays by default
+    const int count = 100000;
+    const QString arg = QStringLiteral("/music/Artist/Album/01 Track.flac");
+    volatile int sink = 0;
+
+    Trace::setEnabled(false);
+    runner.run("trace/scope-disabled", count, [&]() {
+        for (int i = 0; i < count; ++i) {
+            TRACE_SCOPE_ARG("bench", "scope", arg);
+            sink = sink + 1;
+        }
+    });
+
+    Trace::setEnabled(true);
+    runner.run("trace/scope-enabled", count, [&]() {
+        for (int i = 0; i < count; ++i) {
+            TRACE_SCOPE("bench", "scope");
+            sink = sink + 1;
+        }
+    });
+    runner.run("trace/scope-enabled-arg", count, [&]() {
+        for (int i = 0; i < count; ++i) {
+            TRACE_SCOPE_ARG("bench", "scope", arg);
+            sink = sink + 1;
+        }
+    });
+    Trace::setEnabled(false);
+    Trace::clear();
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless performance benchmarks for the music player");
+    parser.addHelpOption();
+    QCommandLineOption outputOption({"o", "output"}, "Write the JSON report to <file> instead of stdout.", "file");
+    QCommandLineOption filterOption({"f", "filter"}, "Only run benchmarks whose name starts with <prefix>.", "prefix");
+    QCommandLineOption maxSizeOption("max-size", "Largest playlist/library row count (default 1000000).", "rows", "1000000");
+    QCommandLineOption filesOption("files", "Number of synthetic audio files to scan (default 3000).", "count", "3000");
+    QCommandLineOption quickOption("quick", "Small sizes for a fast smoke run.");
+    parser.addOptions({outputOption, filterOption, maxSizeOption, filesOption, quickOption});
+    parser.process(app);
+
+    const bool quick = parser.isSet(quickOption);
+    const int maxSize = quick ? 10000 : parser.value(maxSizeOption).toInt();
+    const int files = quick ? 300 : parser.value(filesOption).toInt();
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        QTextStream(stderr) << "Cannot create a temporary directory\n";
+        return 1;
+    }
+
+    BenchRunner runner(parser.value(filterOption));
+    benchTagReader(runner, dir.path(), files);
+    benchLibrary(runner, dir.path(), files);
+    benchStore(runner, maxSize);
+    benchSearch(runner, maxSize);
+    benchSmartQuery(runner, maxSize);
+    benchDuplicates(runner, maxSize);
+    benchPlaylist(runner, dir.path(), maxSize);
+    benchAudio(runner);
+    benchTrace(runner);
+
+    const QByteArray json = QJsonDocument(runner.report()).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+            QTextStream(stderr) << "Cannot write " << file.fileName() << "\n";
+            return 1;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+
+    return 0;
+}
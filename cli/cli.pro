@@ -0,0 +1,13 @@
+QT += core gui multimedia concurrent
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Headless front end: scans, exports and plays with the same core as the
+# GUI, but links no QtWidgets and runs under a QCoreApplication
+TARGET = player-cli
+
+include(../core.pri)
+
+SOURCES += \
+    main.cpp
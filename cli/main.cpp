@@ -0,0 +1,573 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QScopedPointer>
+#include <QTextStream>
+#include "controlprotocol.h"
+#include "controlserver.h"
+#include "libraryindex.h"
+#include "libraryscanner.h"
+#include "librarywatcher.h"
+#include "playersession.h"
+#include "playlistparser.h"
+#include "sessionstore.h"
+#include "smartplaylist.h"
+#include "tagwriter.h"
+#include "trace.h"
+#include <numeric>
+
+namespace {
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+QTextStream &err()
+{
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+int scan(QCoreApplication &app, LibraryIndex &index, QStringList roots)
+{
+    if (roots.isEmpty()) {
+        roots = index.roots();
+    }
+    if (roots.isEmpty()) {
+        err() << "No roots given and none stored in the index\n";
+        return 2;
+    }
+    for (QString &root : roots) {
+        root = QFileInfo(root).absoluteFilePath();
+    }
+
+    int status = 0;
+    LibraryScanner scanner(&index);
+    QObject::connect(&scanner, &LibraryScanner::finished, &app, [&](int updated, bool saved) {
+        out() << index.tracks().size() << " files, " << updated << " updated" << Qt::endl;
+        if (!saved) {
+            err() << "Could not save the library index\n";
+            status = 1;
+        }
+        app.quit();
+    });
+    scanner.scan(roots);
+    app.exec();
+    return status;
+}
+
+// Scans, then keeps the index in step with the roots until killed
+int watch(QCoreApplication &app, LibraryIndex &index, const QStringList &roots)
+{
+    LibraryScanner scanner(&index);
+    LibraryWatcher watcher;
+    QObject::connect(&scanner, &LibraryScanner::finished, &app, [&](int updated, bool saved) {
+        out() << index.tracks().size() << " files, " << updated << " updated" << Qt::endl;
+        if (!saved) {
+            err() << "Could not save the library index\n";
+        }
+    });
+    QObject::connect(&watcher, &LibraryWatcher::changesReady, &scanner, &LibraryScanner::update);
+    QObject::connect(&watcher, &LibraryWatcher::overflowed, &app, [&]() {
+        scanner.scan(index.roots());
+    });
+
+    const int status = scan(app, index, roots);
+    if (index.roots().isEmpty()) {
+        return status;
+    }
+    watcher.setRoots(index.roots());
+    return app.exec();
+}
+
+QString field(QString text)
+{
+    return text.replace(QLatin1Char('\t'), QLatin1Char(' ')).replace(QLatin1Char('\n'), QLatin1Char(' '));
+}
+
+// One track per line: TSV with a header row, or a JSON array of objects
+int exportTracks(const TrackStore &tracks, const QList<int> &rows, const QString &format, const QString &fileName)
+{
+    QFile file(fileName);
+    const bool opened = fileName.isEmpty() ? file.open(stdout, QIODevice::WriteOnly) : file.open(QIODevice::WriteOnly);
+    if (!opened) {
+        err() << "Cannot write " << fileName << "\n";
+        return 1;
+    }
+
+    const bool json = format == QLatin1String("json");
+    file.write(json ? "[\n" : "path\ttitle\tartist\talbum\tgenre\tduration_ms\tloudness_lufs\n");
+    for (int i = 0; i < rows.size(); ++i) {
+        const int row = rows.at(i);
+        const bool analyzed = tracks.gatedBlocks(row) > 0;
+        QByteArray line;
+        if (json) {
+            QJsonObject track{
+                {"path", tracks.path(row)},
+                {"title", tracks.title(row).toString()},
+                {"artist", tracks.artist(row)},
+                {"album", tracks.album(row)},
+                {"genre", tracks.genre(row)},
+                {"duration", tracks.duration(row)},
+            };
+            if (analyzed) {
+                track.insert("loudness", tracks.trackLoudness(row));
+            }
+            line = "  " + QJsonDocument(track).toJson(QJsonDocument::Compact)
+                 + (i + 1 < rows.size() ? ",\n" : "\n");
+        } else {
+            line = (field(tracks.path(row)) + '\t' + field(tracks.title(row).toString()) + '\t'
+                    + field(tracks.artist(row)) + '\t' + field(tracks.album(row)) + '\t'
+                    + field(tracks.genre(row)) + '\t' + QString::number(tracks.duration(row)) + '\t'
+                    + (analyzed ? QString::number(tracks.trackLoudness(row), 'f', 2) : QString()) + '\n')
+                       .toUtf8();
+        }
+        if (file.write(line) != line.size()) {
+            err() << "Cannot write " << fileName << "\n";
+            return 1;
+        }
+    }
+    if (json) {
+        file.write("]\n");
+    }
+    return file.flush() ? 0 : 1;
+}
+
+int exportIndex(const LibraryIndex &index, const QString &format, const QString &fileName)
+{
+    QList<int> rows(index.tracks().size());
+    std::iota(rows.begin(), rows.end(), 0);
+    return exportTracks(index.tracks(), rows, format, fileName);
+}
+
+// The tracks a smart playlist rule selects, in its order, written as export writes them
+int query(const LibraryIndex &index, const QCommandLineParser &parser, const QStringList &arguments)
+{
+    const SmartQuery rule(arguments.join(QLatin1Char(' ')));
+    if (!rule.isValid()) {
+        err() << rule.errorString() << "\n";
+        return 2;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    SmartPlaylist playlist(QString(), rule);
+    playlist.evaluate(index.tracks());
+    const QList<int> rows = playlist.rows(index.tracks());
+    err() << rows.size() << " of " << index.tracks().size() << " tracks in " << timer.elapsed() << " ms\n";
+    err().flush();
+
+    return exportTracks(index.tracks(), rows, parser.value("format"), parser.value("output"));
+}
+
+// Audio files as they are, playlists by their entries, folders by the audio files under them
+void addToPlaylist(PlaylistModel *playlist, const QStringList &arguments)
+{
+    for (const QString &argument : arguments) {
+        const QFileInfo info(argument);
+        if (info.isDir()) {
+            QStringList files;
+            QDirIterator it(info.absoluteFilePath(), LibraryIndex::nameFilters(), QDir::Files,
+                            QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                files.append(it.next());
+            }
+            files.sort();
+            playlist->append(files);
+            continue;
+        }
+
+        const QString suffix = info.suffix().toLower();
+        if (suffix == "m3u" || suffix == "m3u8" || suffix == "pls" || suffix == "xspf") {
+            for (const QList<PlaylistEntry> &chunk : PlaylistParser::parseAsync(info.absoluteFilePath()).results()) {
+                playlist->append(chunk);
+            }
+        } else {
+            playlist->append(QStringList{info.absoluteFilePath()});
+        }
+    }
+}
+
+int play(QCoreApplication &app, const LibraryIndex &index, const QCommandLineParser &parser, const QStringList &items)
+{
+    PlayerSession session(&index);
+    addToPlaylist(session.playlist(), items);
+    if (session.playlist()->isEmpty()) {
+        err() << "Nothing to play\n";
+        return 2;
+    }
+
+    const QString repeat = parser.value("repeat");
+    session.queue().setRepeatMode(repeat == "one" ? PlaybackQueue::RepeatOne
+                                  : repeat == "all" ? PlaybackQueue::RepeatAll
+                                                    : PlaybackQueue::NoRepeat);
+    if (parser.isSet("shuffle")) {
+        session.queue().setShuffleMode(parser.isSet("spread-artists") ? PlaybackQueue::ArtistSpread
+                                                                      : PlaybackQueue::Shuffle, -1);
+    }
+    const QString loudness = parser.value("loudness");
+    session.setLoudnessMode(loudness == "off" ? Loudness::Off
+                            : loudness == "album" ? Loudness::Album
+                                                  : Loudness::Track);
+    session.playback()->setVolume(qBound(0, parser.value("volume").toInt(), 100) / 100.0f);
+    session.playback()->setCrossfade(qBound(0, parser.value("crossfade").toInt(), Crossfade::MaxSeconds) * 1000,
+                                     Crossfade::EqualPower);
+
+    QObject::connect(&session, &PlayerSession::currentTrackChanged, &app, [](const QString &filePath) {
+        out() << "Playing " << filePath << Qt::endl;
+    });
+    QObject::connect(&session, &PlayerSession::playingChanged, &app, [&](bool playing) {
+        if (!playing) {
+            app.quit();
+        }
+    });
+    QObject::connect(session.playback(), &PlaybackController::errorOccurred, &app, [](const QString &message) {
+        err() << message << "\n";
+    });
+
+    // The first entry of the play order: a random one when shuffled
+    session.playRow(qMax(0, session.queue().next(-1)));
+    return app.exec();
+}
+
+// A play session other processes drive through the control socket; runs until killed
+int serve(QCoreApplication &app, const LibraryIndex &index, const QCommandLineParser &parser, const QStringList &items)
+{
+    PlayerSession session(&index);
+    session.playback()->setVolume(qBound(0, parser.value("volume").toInt(), 100) / 100.0f);
+    QObject::connect(&session, &PlayerSession::currentTrackChanged, &app, [](const QString &filePath) {
+        out() << "Playing " << filePath << Qt::endl;
+    });
+    QObject::connect(session.playback(), &PlaybackController::errorOccurred, &app, [](const QString &message) {
+        err() << message << "\n";
+    });
+
+    ControlServer server(&session, &index);
+    const QString name = parser.isSet("socket") ? parser.value("socket") : ControlServer::defaultName();
+    if (!server.listen(name)) {
+        err() << "Cannot listen on " << name << ": " << server.errorString() << "\n";
+        return 1;
+    }
+    out() << "Listening on " << name << Qt::endl;
+
+    // With --session, the queue and position survive restarts and crashes
+    QScopedPointer<SessionStore> store;
+    bool resumed = false;
+    if (parser.isSet("session")) {
+        store.reset(new SessionStore(&session, parser.value("session")));
+        resumed = store->restore();
+        store->start();
+    }
+
+    addToPlaylist(session.playlist(), items);
+    if (resumed) {
+        if (store->wasPlaying()) {
+            session.play();
+        }
+    } else if (!session.playlist()->isEmpty()) {
+        session.playRow(0);
+    }
+    return app.exec();
+}
+
+// The next frame's payload; false on timeout, a closed socket or a bad length
+bool readFrame(QLocalSocket &socket, QByteArray *payload, int timeout = 5000)
+{
+    while (socket.bytesAvailable() < 4) {
+        if (!socket.waitForReadyRead(timeout)) {
+            return false;
+        }
+    }
+    char header[4];
+    socket.read(header, 4);
+    const quint32 length = qFromLittleEndian<quint32>(header);
+    if (length < quint32(ControlProtocol::HeaderSize) || length > ControlProtocol::MaxFrameSize) {
+        return false;
+    }
+    while (socket.bytesAvailable() < qint64(length)) {
+        if (!socket.waitForReadyRead(timeout)) {
+            return false;
+        }
+    }
+    *payload = socket.read(length);
+    return true;
+}
+
+QString formatTime(qint64 ms)
+{
+    return QString("%1:%2").arg(ms / 60000).arg(ms / 1000 % 60, 2, 10, QLatin1Char('0'));
+}
+
+// Prints a reply or event; false for Error
+bool printMessage(const QByteArray &payload)
+{
+    using namespace ControlProtocol;
+    Reader message(payload);
+    switch (message.type()) {
+    case Ok:
+        return true;
+    case Error:
+        err() << message.readString() << "\n";
+        return false;
+    case Status: {
+        const bool playing = message.read<quint8>();
+        const qint64 position = message.read<qint64>();
+        const qint64 duration = message.read<qint64>();
+        const qint32 row = message.read<qint32>();
+        const quint8 shuffle = message.read<quint8>();
+        const quint8 repeat = message.read<quint8>();
+        const QString path = message.readString();
+        out() << (playing ? "playing" : "paused") << ' ' << formatTime(position) << '/' << formatTime(duration)
+              << " row " << row << " shuffle " << shuffle << " repeat " << repeat << '\n' << path << Qt::endl;
+        return true;
+    }
+    case Queue: {
+        const qint32 current = message.read<qint32>();
+        const QStringList paths = message.readStrings();
+        for (int row = 0; row < paths.size(); ++row) {
+            out() << (row == current ? "* " : "  ") << row << '\t' << paths.at(row) << '\n';
+        }
+        out().flush();
+        return true;
+    }
+    case Tracks: {
+        const quint32 count = message.read<quint32>();
+        for (quint32 i = 0; i < count && message.isValid(); ++i) {
+            const QString path = message.readString();
+            const QString title = message.readString();
+            const QString artist = message.readString();
+            const QString album = message.readString();
+            const qint64 duration = message.read<qint64>();
+            out() << field(artist) << '\t' << field(album) << '\t' << field(title) << '\t'
+                  << formatTime(duration) << '\t' << path << '\n';
+        }
+        out().flush();
+        return true;
+    }
+    case PositionEvent: {
+        const qint64 position = message.read<qint64>();
+        const qint64 duration = message.read<qint64>();
+        out() << "position " << formatTime(position) << '/' << formatTime(duration) << Qt::endl;
+        return true;
+    }
+    case StateEvent:
+        out() << (message.read<quint8>() ? "playing" : "paused") << Qt::endl;
+        return true;
+    case TrackEvent:
+        out() << "track " << message.readString() << Qt::endl;
+        return true;
+    case QueueEvent:
+        out() << "queue " << message.read<quint32>() << " entries" << Qt::endl;
+        return true;
+    default:
+        err() << "Unexpected message type " << message.type() << "\n";
+        return false;
+    }
+}
+
+QStringList absolutePaths(const QStringList &files)
+{
+    QStringList paths;
+    for (const QString &file : files) {
+        paths.append(QFileInfo(file).absoluteFilePath());
+    }
+    return paths;
+}
+
+// One request to a running player (the GUI or serve), then its reply
+int control(const QCommandLineParser &parser, const QStringList &arguments)
+{
+    using namespace ControlProtocol;
+    if (arguments.isEmpty()) {
+        err() << "ctl needs a command\n";
+        return 2;
+    }
+    const QString command = arguments.first();
+    const QStringList rest = arguments.mid(1);
+    const quint32 id = 1;
+
+    QByteArray frame;
+    if (command == "ping") {
+        frame = Writer(Ping, id).frame();
+    } else if (command == "play") {
+        frame = Writer(Play, id).frame();
+    } else if (command == "pause") {
+        frame = Writer(Pause, id).frame();
+    } else if (command == "toggle") {
+        frame = Writer(TogglePlay, id).frame();
+    } else if (command == "stop") {
+        frame = Writer(Stop, id).frame();
+    } else if (command == "next") {
+        frame = Writer(Next, id).frame();
+    } else if (command == "previous") {
+        frame = Writer(Previous, id).frame();
+    } else if (command == "seek" && rest.size() == 1) {
+        frame = Writer(Seek, id).add<qint64>(qint64(rest.first().toDouble() * 1000)).frame();
+    } else if (command == "volume" && rest.size() == 1) {
+        frame = Writer(SetVolume, id).add<quint8>(quint8(qBound(0, rest.first().toInt(), 100))).frame();
+    } else if (command == "row" && rest.size() == 1) {
+        frame = Writer(PlayRow, id).add<qint32>(rest.first().toInt()).frame();
+    } else if (command == "shuffle" && rest.size() == 1) {
+        const QString mode = rest.first();
+        frame = Writer(SetShuffle, id).add<quint8>(mode == "spread" ? PlaybackQueue::ArtistSpread
+                                                   : mode == "on" ? PlaybackQueue::Shuffle
+                                                                  : PlaybackQueue::NoShuffle).frame();
+    } else if (command == "repeat" && rest.size() == 1) {
+        const QString mode = rest.first();
+        frame = Writer(SetRepeat, id).add<quint8>(mode == "one" ? PlaybackQueue::RepeatOne
+                                                  : mode == "all" ? PlaybackQueue::RepeatAll
+                                                                  : PlaybackQueue::NoRepeat).frame();
+    } else if (command == "status") {
+        frame = Writer(GetStatus, id).frame();
+    } else if (command == "add" && !rest.isEmpty()) {
+        frame = Writer(QueueAppend, id).add(absolutePaths(rest)).frame();
+    } else if (command == "insert" && rest.size() >= 2) {
+        frame = Writer(QueueInsert, id).add<qint32>(rest.first().toInt()).add(absolutePaths(rest.mid(1))).frame();
+    } else if (command == "remove" && !rest.isEmpty()) {
+        Writer writer(QueueRemove, id);
+        writer.add<quint32>(quint32(rest.size()));
+        for (const QString &row : rest) {
+            writer.add<qint32>(row.toInt());
+        }
+        frame = writer.frame();
+    } else if (command == "clear") {
+        frame = Writer(QueueClear, id).frame();
+    } else if (command == "queue") {
+        frame = Writer(QueueList, id).frame();
+    } else if (command == "search" && !rest.isEmpty()) {
+        frame = Writer(LibrarySearch, id).add(rest.join(QLatin1Char(' ')))
+                    .add<quint32>(quint32(qMax(1, parser.value("limit").toInt()))).frame();
+    } else if (command == "events") {
+        frame = Writer(Subscribe, id).add<quint8>(PositionEvents | StateEvents | TrackEvents | QueueEvents).frame();
+    } else {
+        err() << "Unknown or incomplete ctl command " << command << "\n";
+        return 2;
+    }
+
+    QLocalSocket socket;
+    const QString name = parser.isSet("socket") ? parser.value("socket") : ControlServer::defaultName();
+    socket.connectToServer(name);
+    if (!socket.waitForConnected(1000)) {
+        err() << "No player listening on " << name << "\n";
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    socket.write(frame);
+    QByteArray payload;
+    if (!readFrame(socket, &payload)) {
+        err() << "No reply from the player\n";
+        return 1;
+    }
+    if (command == "ping") {
+        out() << "pong in " << timer.nsecsElapsed() / 1000 << " us" << Qt::endl;
+        return 0;
+    }
+    if (!printMessage(payload)) {
+        return 1;
+    }
+
+    // Events until the player goes away
+    if (command == "events") {
+        while (readFrame(socket, &payload, -1)) {
+            printMessage(payload);
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    // Same names as the GUI, so both use the same library index
+    app.setOrganizationName("MusicPlayer");
+    app.setApplicationName("LocalMusicPlayer");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless music player: library scans and exports, playback without a display, "
+                                     "and remote control of a running player");
+    parser.addHelpOption();
+    parser.addPositionalArgument("command",
+                                 "scan [root...]: update the index (default: the stored roots)\n"
+                                 "watch [root...]: scan, then keep the index up to date\n"
+                                 "export: write the index as TSV or JSON\n"
+                                 "query <rule>: write the tracks a smart playlist rule selects, as export does,\n"
+                                 "  e.g. 'artist = \"X\" and duration > 5:00 and added < 30d order by album'\n"
+                                 "play <file|folder|playlist>...: play, then exit\n"
+                                 "serve [file|folder|playlist...]: play under control of the socket until killed\n"
+                                 "ctl <command> [args]: send one command to a running player: ping, play, pause,\n"
+                                 "  toggle, stop, next, previous, seek <s>, volume <0-100>, row <n>,\n"
+                                 "  shuffle off|on|spread, repeat none|all|one, status, add <file>...,\n"
+                                 "  insert <row> <file>..., remove <row>..., clear, queue, search <text>, events");
+    parser.addOptions({
+        {"index", "Library index file (default: the GUI's).", "file", LibraryIndex::defaultFileName()},
+        {{"o", "output"}, "export, query: write to <file> instead of stdout.", "file"},
+        {"format", "export, query: tsv or json (default tsv).", "format", "tsv"},
+        {"shuffle", "play: shuffle the queue."},
+        {"spread-artists", "play: keep tracks by the same artist apart when shuffling."},
+        {"repeat", "play: none, all or one (default none).", "mode", "none"},
+        {"loudness", "play: off, track or album normalization (default track).", "mode", "track"},
+        {"volume", "play: 0-100 (default 70).", "percent", "70"},
+        {"crossfade", "play: seconds of crossfade (default 0, gapless).", "seconds", "0"},
+        {"socket", "serve, ctl: control socket name or path (default: the GUI's).", "name"},
+        {"session", "serve: keep the queue and playback position in <file> across restarts.", "file"},
+        {"limit", "ctl search: at most <n> tracks (default 50).", "n", "50"},
+        {"trace", "Record a Chrome trace of the run to <file>.", "file"},
+    });
+    parser.process(app);
+
+    const QStringList arguments = parser.positionalArguments();
+    if (arguments.isEmpty()) {
+        parser.showHelp(2);
+    }
+    const QString command = arguments.first();
+    const QStringList rest = arguments.mid(1);
+
+    // Kept quick: the player on the other end has the library loaded already
+    if (command == "ctl") {
+        return control(parser, rest);
+    }
+
+    Trace::setEnabled(parser.isSet("trace") || qEnvironmentVariableIntValue("PLAYER_TRACE") != 0);
+
+    // Finish tag edits a crash interrupted before anything reads those files
+    TagWriter::recoverJournal();
+
+    // A missing index is an empty library; scan creates it
+    LibraryIndex index(parser.value("index"));
+    index.load();
+
+    int status = 2;
+    if (command == "scan") {
+        status = scan(app, index, rest);
+    } else if (command == "watch") {
+        status = watch(app, index, rest);
+    } else if (command == "export") {
+        status = exportIndex(index, parser.value("format"), parser.value("output"));
+    } else if (command == "query") {
+        status = query(index, parser, rest);
+    } else if (command == "play") {
+        status = play(app, index, parser, rest);
+    } else if (command == "serve") {
+        status = serve(app, index, parser, rest);
+    } else {
+        err() << "Unknown command " << command << "\n";
+    }
+
+    if (parser.isSet("trace") && !Trace::writeChromeJson(parser.value("trace"))) {
+        err() << "Cannot write " << parser.value("trace") << "\n";
+    }
+    return status;
+}
@@ -0,0 +1,172 @@
+#ifndef CONTROLPROTOCOL_H
+#define CONTROLPROTOCOL_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QtEndian>
+
+// Wire format of the control socket (see ControlServer). Every message is
+// a frame: a u32 payload length, then the payload, which starts with a u8
+// message type and a u32 request id (echoed in the reply; 0 for events)
+// followed by the body listed next to each type. Integers are
+// little-endian; strings are a u32 byte length plus UTF-8. Replies come
+// back in request order, except Tracks, which may overtake later replies.
+namespace ControlProtocol {
+
+const quint32 MaxFrameSize = 1 << 20;
+const int HeaderSize = 5; // Type and request id
+
+enum Type : quint8 {
+    // Requests
+    Ping = 0x01,
+    Play = 0x02,
+    Pause = 0x03,
+    TogglePlay = 0x04,
+    Stop = 0x05,
+    Next = 0x06,
+    Previous = 0x07,
+    Seek = 0x08,          // i64 position (ms)
+    SetVolume = 0x09,     // u8 percent
+    PlayRow = 0x0a,       // i32 row
+    SetShuffle = 0x0b,    // u8 PlaybackQueue::ShuffleMode
+    SetRepeat = 0x0c,     // u8 PlaybackQueue::RepeatMode
+    GetStatus = 0x0d,
+    QueueAppend = 0x20,   // string list
+    QueueInsert = 0x21,   // i32 row, string list
+    QueueRemove = 0x22,   // u32 count, count x i32 row
+    QueueClear = 0x23,
+    QueueList = 0x24,
+    LibrarySearch = 0x30, // string query, u32 limit
+    Subscribe = 0x40,     // u8 Events mask; 0 unsubscribes
+
+    // Replies
+    Ok = 0x80,
+    Error = 0x81,         // string message
+    Status = 0x82,        // u8 playing, i64 position, i64 duration, i32 current row,
+                          // u8 shuffle, u8 repeat, string path
+    Queue = 0x83,         // i32 current row, string list
+    Tracks = 0x84,        // u32 count, count x {string path, title, artist, album; i64 duration}
+
+    // Events, to subscribers only
+    PositionEvent = 0xc0, // i64 position, i64 duration; at most PlaybackController::FrameRate a second
+    StateEvent = 0xc1,    // u8 playing
+    TrackEvent = 0xc2,    // string path
+    QueueEvent = 0xc3     // u32 entry count
+};
+
+enum Events : quint8 {
+    PositionEvents = 0x01,
+    StateEvents = 0x02,
+    TrackEvents = 0x04,
+    QueueEvents = 0x08
+};
+
+// Builds one frame
+class Writer
+{
+public:
+    explicit Writer(quint8 type, quint32 id = 0)
+        : data(4, '\0')
+    {
+        add<quint8>(type);
+        add<quint32>(id);
+    }
+
+    template <typename T>
+    Writer &add(T value)
+    {
+        char buffer[sizeof(T)];
+        qToLittleEndian(value, buffer);
+        data.append(buffer, sizeof(T));
+        return *this;
+    }
+
+    Writer &add(const QString &text)
+    {
+        const QByteArray utf8 = text.toUtf8();
+        add<quint32>(quint32(utf8.size()));
+        data.append(utf8);
+        return *this;
+    }
+
+    Writer &add(const QStringList &list)
+    {
+        add<quint32>(quint32(list.size()));
+        for (const QString &text : list) {
+            add(text);
+        }
+        return *this;
+    }
+
+    // The finished frame, length included
+    QByteArray frame()
+    {
+        qToLittleEndian<quint32>(quint32(data.size() - 4), data.data());
+        return data;
+    }
+
+private:
+    QByteArray data;
+};
+
+// Reads one payload (a frame without its length); reading past the end
+// yields zeros and clears isValid()
+class Reader
+{
+public:
+    explicit Reader(const QByteArray &payload)
+        : data(payload),
+          pos(HeaderSize),
+          valid(payload.size() >= HeaderSize)
+    {
+    }
+
+    quint8 type() const { return valid ? quint8(data.at(0)) : 0; }
+    quint32 id() const { return valid ? qFromLittleEndian<quint32>(data.constData() + 1) : 0; }
+    bool isValid() const { return valid; }
+    bool atEnd() const { return pos >= data.size(); }
+
+    template <typename T>
+    T read()
+    {
+        if (!valid || pos + qsizetype(sizeof(T)) > data.size()) {
+            valid = false;
+            return T();
+        }
+        const T value = qFromLittleEndian<T>(data.constData() + pos);
+        pos += sizeof(T);
+        return value;
+    }
+
+    QString readString()
+    {
+        const quint32 length = read<quint32>();
+        if (!valid || pos + qsizetype(length) > data.size()) {
+            valid = false;
+            return QString();
+        }
+        const QString text = QString::fromUtf8(data.constData() + pos, length);
+        pos += length;
+        return text;
+    }
+
+    QStringList readStrings()
+    {
+        const quint32 count = read<quint32>();
+        QStringList list;
+        for (quint32 i = 0; i < count && valid; ++i) {
+            list.append(readString());
+        }
+        return list;
+    }
+
+private:
+    QByteArray data;
+    qsizetype pos;
+    bool valid;
+};
+
+} // namespace ControlProtocol
+
+#endif // CONTROLPROTOCOL_H
@@ -0,0 +1,400 @@
+#include "controlserver.h"
+#include "controlprotocol.h"
+#include "trace.h"
+#include <QCoreApplication>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QStandardPaths>
+#include <QtConcurrent>
+
+using namespace ControlProtocol;
+
+namespace {
+
+// Unsent bytes past which a client that isn't reading misses events, and
+// past which it is cut off; the second leaves room for a few full replies
+const qint64 MaxPendingEvents = 256 * 1024;
+const qint64 MaxPendingBytes = 8 * qint64(MaxFrameSize);
+
+} // namespace
+
+bool ControlConnections::listen(const QString &name, QString *error)
+{
+    server = new QLocalServer(this);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(server, &QLocalServer::newConnection, this, &ControlConnections::accept);
+
+    bool ok = server->listen(name);
+    if (!ok && server->serverError() == QAbstractSocket::AddressInUseError) {
+        // A live instance answers; a socket file left by a crashed one doesn't
+        QLocalSocket probe;
+        probe.connectToServer(name);
+        if (!probe.waitForConnected(100)) {
+            QLocalServer::removeServer(name);
+            ok = server->listen(name);
+        }
+    }
+    if (!ok) {
+        *error = server->errorString();
+    }
+    return ok;
+}
+
+void ControlConnections::accept()
+{
+    while (QLocalSocket *socket = server->nextPendingConnection()) {
+        const quint32 client = nextClient++;
+        clients.insert(client, {socket, QByteArray(), 0});
+        connect(socket, &QLocalSocket::readyRead, this, [this, client]() {
+            readFrames(client);
+        });
+        connect(socket, &QLocalSocket::disconnected, this, [this, client, socket]() {
+            clients.remove(client);
+            socket->deleteLater();
+        });
+    }
+}
+
+void ControlConnections::readFrames(quint32 client)
+{
+    auto it = clients.find(client);
+    if (it == clients.end()) {
+        return;
+    }
+    it->buffer.append(it->socket->readAll());
+
+    // Every complete frame in the buffer; a partial one waits for more data
+    qsizetype pos = 0;
+    while (it->buffer.size() - pos >= 4) {
+        const quint32 length = qFromLittleEndian<quint32>(it->buffer.constData() + pos);
+        if (length < quint32(HeaderSize) || length > MaxFrameSize) {
+            it->socket->abort(); // Not speaking the protocol
+            return;
+        }
+        if (it->buffer.size() - pos - 4 < qsizetype(length)) {
+            break;
+        }
+        const QByteArray payload = it->buffer.mid(pos + 4, length);
+        pos += 4 + length;
+
+        // Even Ping goes through the session's thread, so replies keep request order
+        emit requestReceived(client, payload);
+    }
+    it->buffer.remove(0, pos);
+}
+
+void ControlConnections::setEvents(quint32 client, quint8 events)
+{
+    auto it = clients.find(client);
+    if (it != clients.end()) {
+        it->events = events;
+    }
+}
+
+void ControlConnections::send(quint32 client, const QByteArray &frame)
+{
+    // The client may have gone while its request was handled
+    auto it = clients.constFind(client);
+    if (it == clients.constEnd()) {
+        return;
+    }
+    if (it->socket->bytesToWrite() > MaxPendingBytes) {
+        // Replies can't be dropped without breaking request order
+        it->socket->abort();
+        return;
+    }
+    it->socket->write(frame);
+}
+
+void ControlConnections::broadcast(quint8 events, const QByteArray &frame)
+{
+    for (const Client &client : std::as_const(clients)) {
+        // A subscriber that stopped reading skips events rather than
+        // buffering them without bound; the next one it takes is current
+        if ((client.events & events) && client.socket->bytesToWrite() <= MaxPendingEvents) {
+            client.socket->write(frame);
+        }
+    }
+}
+
+ControlServer::ControlServer(PlayerSession *session, const LibraryIndex *library, QObject *parent)
+    : QObject(parent),
+      session(session),
+      library(library)
+{
+    thread.setObjectName("Control");
+    connections = new ControlConnections();
+    connections->moveToThread(&thread);
+    connect(&thread, &QThread::finished, connections, &QObject::deleteLater);
+    connect(connections, &ControlConnections::requestReceived, this, &ControlServer::handle);
+    thread.start();
+
+    // Library queries shouldn't queue behind a scan on the global pool
+    queryPool.setMaxThreadCount(2);
+
+    PlaylistModel *playlist = session->playlist();
+    connect(session, &PlayerSession::currentTrackChanged, this, [this](const QString &filePath) {
+        broadcast(TrackEvents, Writer(TrackEvent).add(filePath).frame());
+    });
+    connect(session, &PlayerSession::playingChanged, this, [this](bool playing) {
+        broadcast(StateEvents, Writer(StateEvent).add<quint8>(playing).frame());
+    });
+    connect(session->playback(), &PlaybackController::snapshotChanged, this, [this](const PlaybackSnapshot &snapshot) {
+        broadcast(PositionEvents, Writer(PositionEvent).add<qint64>(snapshot.position).add<qint64>(snapshot.duration).frame());
+    });
+    auto queueChanged = [this, playlist]() {
+        broadcast(QueueEvents, Writer(QueueEvent).add<quint32>(quint32(playlist->count())).frame());
+    };
+    connect(playlist, &QAbstractItemModel::rowsInserted, this, queueChanged);
+    connect(playlist, &QAbstractItemModel::rowsRemoved, this, queueChanged);
+    connect(playlist, &QAbstractItemModel::rowsMoved, this, queueChanged);
+    connect(playlist, &QAbstractItemModel::modelReset, this, queueChanged);
+}
+
+ControlServer::~ControlServer()
+{
+    queryPool.waitForDone();
+    thread.quit();
+    thread.wait();
+}
+
+QString ControlServer::defaultName()
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (dir.isEmpty()) {
+        dir = QStandardPaths::writableLocation(QStandardPaths::TempLocation);
+    }
+    return dir + "/" + QCoreApplication::applicationName() + ".control";
+}
+
+bool ControlServer::listen(const QString &name)
+{
+    // The server object is created on, and belongs to, the socket thread
+    bool ok = false;
+    QMetaObject::invokeMethod(connections, [&]() {
+        ok = connections->listen(name, &lastError);
+    }, Qt::BlockingQueuedConnection);
+    return ok;
+}
+
+void ControlServer::handle(quint32 client, const QByteArray &payload)
+{
+    TRACE_SCOPE("control", "ControlServer::handle");
+    Reader request(payload);
+    const quint32 id = request.id();
+    PlaylistModel *playlist = session->playlist();
+    PlaybackQueue &queue = session->queue();
+    QString error;
+
+    switch (request.type()) {
+    case Ping:
+        break;
+    case Subscribe: {
+        // Queued ahead of the reply, so events follow from the moment it arrives
+        const quint8 events = request.read<quint8>();
+        if (request.isValid()) {
+            ControlConnections *target = connections;
+            QMetaObject::invokeMethod(target, [target, client, events]() {
+                target->setEvents(client, events);
+            }, Qt::QueuedConnection);
+        }
+        break;
+    }
+    case Play:
+        if (!session->play()) {
+            error = "The queue is empty";
+        }
+        break;
+    case Pause:
+        session->pause();
+        break;
+    case TogglePlay:
+        if (session->isPlaying()) {
+            session->pause();
+        } else if (!session->play()) {
+            error = "The queue is empty";
+        }
+        break;
+    case Stop:
+        session->stop();
+        break;
+    case Next:
+        session->next();
+        break;
+    case Previous:
+        session->previous();
+        break;
+    case Seek:
+        session->playback()->setPosition(qMax<qint64>(0, request.read<qint64>()));
+        break;
+    case SetVolume: {
+        const int percent = qMin<int>(request.read<quint8>(), 100);
+        session->playback()->setVolume(percent / 100.0f);
+        emit volumeChanged(percent);
+        break;
+    }
+    case PlayRow: {
+        const int row = request.read<qint32>();
+        if (row < 0 || row >= playlist->count()) {
+            error = "No such row";
+        } else {
+            session->playRow(row);
+        }
+        break;
+    }
+    case SetShuffle: {
+        const quint8 mode = request.read<quint8>();
+        if (mode > PlaybackQueue::ArtistSpread) {
+            error = "Unknown shuffle mode";
+            break;
+        }
+        queue.setShuffleMode(PlaybackQueue::ShuffleMode(mode), playlist->currentRow());
+        session->queueNextTrack();
+        emit playOrderChanged();
+        break;
+    }
+    case SetRepeat: {
+        const quint8 mode = request.read<quint8>();
+        if (mode > PlaybackQueue::RepeatOne) {
+            error = "Unknown repeat mode";
+            break;
+        }
+        queue.setRepeatMode(PlaybackQueue::RepeatMode(mode));
+        session->queueNextTrack();
+        emit playOrderChanged();
+        break;
+    }
+    case GetStatus:
+        reply(client, status(id));
+        return;
+    case QueueAppend: {
+        const QStringList paths = request.readStrings();
+        if (request.isValid()) {
+            playlist->append(paths);
+            session->queueNextTrack();
+        }
+        break;
+    }
+    case QueueInsert: {
+        const int row = request.read<qint32>();
+        const QStringList paths = request.readStrings();
+        if (row < 0 || row > playlist->count()) {
+            error = "No such row";
+        } else if (request.isValid()) {
+            playlist->insert(row, paths);
+            session->queueNextTrack();
+        }
+        break;
+    }
+    case QueueRemove: {
+        const quint32 count = request.read<quint32>();
+        QList<int> rows;
+        for (quint32 i = 0; i < count && request.isValid(); ++i) {
+            const int row = request.read<qint32>();
+            if (row >= 0 && row < playlist->count()) {
+                rows.append(row);
+            }
+        }
+        if (request.isValid()) {
+            playlist->removeRowList(rows);
+            session->queueNextTrack();
+        }
+        break;
+    }
+    case QueueClear:
+        playlist->clear();
+        session->queueNextTrack();
+        break;
+    case QueueList:
+        reply(client, Writer(Queue, id).add<qint32>(playlist->currentRow()).add(playlist->paths()).frame());
+        return;
+    case LibrarySearch: {
+        const QString query = request.readString();
+        const quint32 limit = request.read<quint32>();
+        if (request.isValid()) {
+            search(client, id, query, int(qMin<quint32>(limit, 10000)));
+            return;
+        }
+        break;
+    }
+    default:
+        error = "Unknown request";
+        break;
+    }
+
+    if (!request.isValid()) {
+        error = "Truncated request";
+    }
+    reply(client, error.isEmpty() ? Writer(Ok, id).frame() : Writer(Error, id).add(error).frame());
+}
+
+void ControlServer::search(quint32 client, quint32 id, const QString &query, int limit)
+{
+    // The copy shares the columns; it stays as it is if the library changes meanwhile
+    const TrackStore tracks = library ? library->tracks() : TrackStore();
+    ControlConnections *target = connections;
+    QtConcurrent::run(&queryPool, [tracks, client, id, query, limit, target]() {
+        TRACE_SCOPE_ARG("control", "library search", query);
+
+        // Like the Library tab: any of title, artist or album contains the query.
+        // Artists and albums are tested once per distinct value.
+        auto matchesOf = [&query](const StringDictionary &dictionary) {
+            QList<bool> matches(dictionary.size());
+            for (int value = 0; value < dictionary.size(); ++value) {
+                matches[value] = dictionary.value(quint32(value)).contains(query, Qt::CaseInsensitive);
+            }
+            return matches;
+        };
+        const QList<bool> artists = matchesOf(tracks.artistDictionary());
+        const QList<bool> albums = matchesOf(tracks.albumDictionary());
+
+        QList<int> rows;
+        for (int row = 0; row < tracks.size() && rows.size() < limit; ++row) {
+            if (artists.at(tracks.artistColumn().at(row)) || albums.at(tracks.albumColumn().at(row))
+                || tracks.title(row).contains(query, Qt::CaseInsensitive)) {
+                rows.append(row);
+            }
+        }
+
+        Writer writer(Tracks, id);
+        writer.add<quint32>(quint32(rows.size()));
+        for (int row : rows) {
+            writer.add(tracks.path(row)).add(tracks.title(row).toString()).add(tracks.artist(row))
+                  .add(tracks.album(row)).add<qint64>(tracks.duration(row));
+        }
+        const QByteArray frame = writer.frame();
+        QMetaObject::invokeMethod(target, [target, client, frame]() {
+            target->send(client, frame);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ControlServer::reply(quint32 client, const QByteArray &frame)
+{
+    ControlConnections *target = connections;
+    QMetaObject::invokeMethod(target, [target, client, frame]() {
+        target->send(client, frame);
+    }, Qt::QueuedConnection);
+}
+
+void ControlServer::broadcast(quint8 events, const QByteArray &frame)
+{
+    ControlConnections *target = connections;
+    QMetaObject::invokeMethod(target, [target, events, frame]() {
+        target->broadcast(events, frame);
+    }, Qt::QueuedConnection);
+}
+
+QByteArray ControlServer::status(quint32 id) const
+{
+    const PlaybackSnapshot snapshot = session->playback()->snapshot();
+    return Writer(Status, id)
+        .add<quint8>(session->isPlaying())
+        .add<qint64>(snapshot.position)
+        .add<qint64>(snapshot.duration)
+        .add<qint32>(session->playlist()->currentRow())
+        .add<quint8>(session->queue().shuffleMode())
+        .add<quint8>(session->queue().repeatMode())
+        .add(session->playback()->source())
+        .frame();
+}
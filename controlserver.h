@@ -0,0 +1,95 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QThread>
+#include <QThreadPool>
+#include "libraryindex.h"
+#include "playersession.h"
+
+class QLocalServer;
+class QLocalSocket;
+
+// The socket side of ControlServer; lives on the server's own thread.
+// Reads frames and passes every request on; writes replies and fans
+// events out to subscribers. A client that stops reading misses events
+// once its unsent backlog passes a limit, and is dropped past a larger one.
+class ControlConnections : public QObject
+{
+    Q_OBJECT
+
+public:
+    bool listen(const QString &name, QString *error);
+    void send(quint32 client, const QByteArray &frame);
+    void broadcast(quint8 events, const QByteArray &frame);
+    void setEvents(quint32 client, quint8 events);
+
+signals:
+    // One complete payload (type, id and body, without the length)
+    void requestReceived(quint32 client, const QByteArray &payload);
+
+private:
+    struct Client
+    {
+        QLocalSocket *socket;
+        QByteArray buffer;
+        quint8 events;
+    };
+
+    void accept();
+    void readFrames(quint32 client);
+
+    QLocalServer *server = nullptr;
+    QHash<quint32, Client> clients;
+    quint32 nextClient = 1;
+};
+
+// Local control interface for scripts and automation: transport, queue
+// edits, library queries and position/state subscriptions over the framed
+// protocol in controlprotocol.h, on a Unix-domain socket only the user
+// can open. Clients are read and written on a thread of the server's own,
+// so a busy UI never delays a reply's I/O and a slow client never stalls
+// the UI; each decoded request is one queued call into this object on the
+// session's thread. That keeps every engine command coming from the
+// PlaybackController, the single producer on the engine's command queue.
+// Library queries run on a small pool over a snapshot of the TrackStore.
+class ControlServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Both must outlive the server
+    ControlServer(PlayerSession *session, const LibraryIndex *library, QObject *parent = nullptr);
+    ~ControlServer();
+
+    // Under the runtime directory, named after the application, so the GUI
+    // and the CLI find each other
+    static QString defaultName();
+
+    // Replaces a stale socket left by a crashed instance, but not a live one
+    bool listen(const QString &name = defaultName());
+    QString errorString() const { return lastError; }
+
+signals:
+    // Transport state changed by a client, for views to follow
+    void volumeChanged(int percent);
+    void playOrderChanged();
+
+private:
+    void handle(quint32 client, const QByteArray &payload);
+    void reply(quint32 client, const QByteArray &frame);
+    void broadcast(quint8 events, const QByteArray &frame);
+    void search(quint32 client, quint32 id, const QString &query, int limit);
+    QByteArray status(quint32 id) const;
+
+    PlayerSession *session;
+    const LibraryIndex *library;
+    QThread thread;
+    ControlConnections *connections;
+    QThreadPool queryPool;
+    QString lastError;
+};
+
+#endif // CONTROLSERVER_H
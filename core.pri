@@ -0,0 +1,71 @@
+# Player sources shared by the GUI app, the headless CLI and the benchmarks;
+# everything here is free of QtWidgets
+
+QT += core gui multimedia concurrent network
+
+CONFIG += c++17
+
+# Trace points are compiled in (and off until enabled at run time) unless CONFIG += notrace
+!CONFIG(notrace): DEFINES += PLAYER_TRACING
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/audioengine.cpp \
+    $$PWD/controlserver.cpp \
+    $$PWD/coverartcache.cpp \
+    $$PWD/crossfade.cpp \
+    $$PWD/diskcache.cpp \
+    $$PWD/equalizer.cpp \
+    $$PWD/fingerprint.cpp \
+    $$PWD/libraryindex.cpp \
+    $$PWD/librarymodel.cpp \
+    $$PWD/libraryscanner.cpp \
+    $$PWD/librarywatcher.cpp \
+    $$PWD/loudness.cpp \
+    $$PWD/playbackcontroller.cpp \
+    $$PWD/playbackqueue.cpp \
+    $$PWD/playersession.cpp \
+    $$PWD/playlistmodel.cpp \
+    $$PWD/playlistparser.cpp \
+    $$PWD/searchindex.cpp \
+    $$PWD/sessionstore.cpp \
+    $$PWD/smartplaylist.cpp \
+    $$PWD/tagwriter.cpp \
+    $$PWD/trace.cpp \
+    $$PWD/trackdecoder.cpp \
+    $$PWD/trackstore.cpp \
+    $$PWD/waveform.cpp \
+    $$PWD/waveformcache.cpp
+
+HEADERS += \
+    $$PWD/audioengine.h \
+    $$PWD/controlprotocol.h \
+    $$PWD/controlserver.h \
+    $$PWD/coverartcache.h \
+    $$PWD/crossfade.h \
+    $$PWD/diskcache.h \
+    $$PWD/equalizer.h \
+    $$PWD/fingerprint.h \
+    $$PWD/libraryindex.h \
+    $$PWD/librarymodel.h \
+    $$PWD/libraryscanner.h \
+    $$PWD/librarywatcher.h \
+    $$PWD/loudness.h \
+    $$PWD/playbackcontroller.h \
+    $$PWD/playbackqueue.h \
+    $$PWD/playersession.h \
+    $$PWD/playlistmodel.h \
+    $$PWD/playlistparser.h \
+    $$PWD/searchindex.h \
+    $$PWD/seqlock.h \
+    $$PWD/sessionstore.h \
+    $$PWD/smartplaylist.h \
+    $$PWD/spscqueue.h \
+    $$PWD/tagreader.h \
+    $$PWD/tagwriter.h \
+    $$PWD/trace.h \
+    $$PWD/trackdecoder.h \
+    $$PWD/trackstore.h \
+    $$PWD/waveform.h \
+    $$PWD/waveformcache.h
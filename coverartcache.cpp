@@ -0,0 +1,160 @@
+#include "coverartcache.h"
+#include "diskcache.h"
+#include "tagreader.h"
+#include "trace.h"
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+
+namespace {
+
+// About 40 thumbnails at 200x200, 32-bit
+const int MemoryBudget = 6 * 1024 * 1024;
+
+// Thousands of albums' thumbnails; the least recently shown go first
+const qint64 DiskBudget = 32 * 1024 * 1024;
+
+// Tried in the track's directory when it has no embedded picture
+const char *const FolderImages[] = {"cover.jpg", "folder.jpg", "cover.png", "front.jpg", "album.jpg"};
+
+} // namespace
+
+CoverArtCache::CoverArtCache(const QSize &thumbnailSize, QObject *parent)
+    : QObject(parent),
+      thumbnailSize(thumbnailSize),
+      directory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/covers"),
+      pixmaps(MemoryBudget)
+{
+    QDir().mkpath(directory);
+    connect(&watcher, &QFutureWatcher<Result>::finished, this, &CoverArtCache::finished);
+}
+
+void CoverArtCache::request(const QString &filePath)
+{
+    // A track we've seen whose art is still in memory needs no worker at all
+    const auto known = keyByPath.constFind(filePath);
+    if (known != keyByPath.constEnd()) {
+        if (known->isEmpty()) {
+            emit coverReady(filePath, QPixmap());
+            return;
+        }
+        if (const QPixmap *pixmap = pixmaps.object(*known)) {
+            emit coverReady(filePath, *pixmap);
+            return;
+        }
+    }
+
+    // One job at a time; while it runs only the latest request is kept
+    if (watcher.isRunning()) {
+        pendingPath = filePath;
+        return;
+    }
+    start(filePath);
+}
+
+void CoverArtCache::start(const QString &filePath)
+{
+    pendingPath.clear();
+
+    const QList<QByteArray> keys = pixmaps.keys();
+    const QSet<QByteArray> inMemory(keys.begin(), keys.end());
+    watcher.setFuture(QtConcurrent::run(&CoverArtCache::load, filePath, thumbnailSize, directory, inMemory));
+}
+
+void CoverArtCache::finished()
+{
+    const Result result = watcher.result();
+    keyByPath.insert(result.filePath, result.key);
+
+    QPixmap pixmap;
+    if (!result.key.isEmpty()) {
+        if (!result.image.isNull()) {
+            pixmaps.insert(result.key, new QPixmap(QPixmap::fromImage(result.image)),
+                           int(result.image.sizeInBytes()));
+        }
+        if (const QPixmap *cached = pixmaps.object(result.key)) {
+            pixmap = *cached;
+        }
+    }
+
+    // A superseded request is still worth caching, but only the latest is shown
+    if (pendingPath.isEmpty()) {
+        emit coverReady(result.filePath, pixmap);
+    } else {
+        const QString next = pendingPath;
+        start(next);
+    }
+}
+
+CoverArtCache::Result CoverArtCache::load(const QString &filePath, const QSize &size, const QString &directory,
+                                          const QSet<QByteArray> &inMemory)
+{
+    TRACE_SCOPE_ARG("cover", "CoverArtCache::load", filePath);
+    Result result;
+    result.filePath = filePath;
+
+    QByteArray data = TagReader::readCoverArt(filePath);
+    if (data.isEmpty()) {
+        const QDir dir = QFileInfo(filePath).dir();
+        for (const char *name : FolderImages) {
+            QFile file(dir.filePath(QString::fromLatin1(name)));
+            if (file.open(QIODevice::ReadOnly)) {
+                data = file.readAll();
+                break;
+            }
+        }
+    }
+    if (data.isEmpty()) {
+        return result;
+    }
+
+    // Hashing is cheap next to decoding and lets identical album art share one entry
+    const QByteArray key = QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+    if (inMemory.contains(key)) {
+        result.key = key;
+        return result;
+    }
+
+    const QString thumbnailPath = directory + "/" + QString::fromLatin1(key) + ".jpg";
+    QImage image;
+    QFile thumbnail(thumbnailPath);
+    if (thumbnail.open(QIODevice::ReadOnly) && image.load(&thumbnail, "JPG")) {
+        DiskCache::touch(thumbnail);
+    }
+
+    if (image.isNull()) {
+        QBuffer buffer(&data);
+        QImageReader reader(&buffer);
+        reader.setAutoTransform(true);
+
+        // Let the decoder scale (JPEG decodes at 1/2, 1/4, 1/8 directly), then finish smoothly
+        const QSize original = reader.size();
+        if (original.isValid()) {
+            QSize scaled = original.scaled(size * 2, Qt::KeepAspectRatio);
+            if (scaled.width() < original.width()) {
+                reader.setScaledSize(scaled);
+            }
+        }
+
+        image = reader.read();
+        if (image.isNull()) {
+            return result;
+        }
+        image = image.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation)
+                     .convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+        QSaveFile file(thumbnailPath);
+        if (file.open(QIODevice::WriteOnly) && image.save(&file, "JPG", 90) && file.commit()) {
+            DiskCache::prune(directory, DiskBudget);
+        }
+    }
+
+    result.key = key;
+    result.image = image;
+    return result;
+}
@@ -0,0 +1,55 @@
+#ifndef COVERARTCACHE_H
+#define COVERARTCACHE_H
+
+#include <QObject>
+#include <QCache>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QImage>
+#include <QPixmap>
+#include <QSet>
+#include <QSize>
+
+// Cover art for the Now Playing view. Pictures are extracted, hashed,
+// decoded and downscaled on a worker; the GUI thread only turns the
+// finished thumbnail into a pixmap. Thumbnails are keyed by a hash of the
+// picture bytes, so every track of an album shares one entry, and are
+// kept in an LRU of pixmaps plus a directory of JPEGs under the cache
+// location that survives restarts, held to a size budget by DiskCache.
+class CoverArtCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CoverArtCache(const QSize &thumbnailSize, QObject *parent = nullptr);
+
+    // Answers through coverReady(), synchronously if the art is already in memory.
+    // Only the most recent request is guaranteed an answer.
+    void request(const QString &filePath);
+
+signals:
+    // pixmap is null when the track has no cover art
+    void coverReady(const QString &filePath, const QPixmap &pixmap);
+
+private:
+    struct Result
+    {
+        QString filePath;
+        QByteArray key;  // Hex digest of the picture bytes, empty if there is none
+        QImage image;    // Null if the key was already in memory
+    };
+
+    static Result load(const QString &filePath, const QSize &size, const QString &directory,
+                       const QSet<QByteArray> &inMemory);
+    void start(const QString &filePath);
+    void finished();
+
+    const QSize thumbnailSize;
+    const QString directory;
+    QCache<QByteArray, QPixmap> pixmaps;
+    QHash<QString, QByteArray> keyByPath;
+    QFutureWatcher<Result> watcher;
+    QString pendingPath;
+};
+
+#endif // COVERARTCACHE_H
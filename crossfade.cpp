@@ -0,0 +1,89 @@
+#include "crossfade.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const double HalfPi = 1.57079632679489661923;
+
+template <int Channels>
+void mixFrames(float *incoming, const float *outgoing, const float *outgoingGain, const float *incomingGain,
+               qint64 frames)
+{
+    for (qint64 i = 0; i < frames; ++i) {
+        const float in = incomingGain[i];
+        const float out = outgoingGain[i];
+        for (int ch = 0; ch < Channels; ++ch) {
+            incoming[i * Channels + ch] = incoming[i * Channels + ch] * in + outgoing[i * Channels + ch] * out;
+        }
+    }
+}
+
+} // namespace
+
+namespace Crossfade {
+
+void gains(Curve curve, qint64 position, qint64 length, float *outgoingGain, float *incomingGain, qint64 frames)
+{
+    if (length <= 0) {
+        for (qint64 i = 0; i < frames; ++i) {
+            outgoingGain[i] = 0.0f;
+            incomingGain[i] = 1.0f;
+        }
+        return;
+    }
+
+    const double step = 1.0 / double(length);
+    if (curve == Linear) {
+        for (qint64 i = 0; i < frames; ++i) {
+            const float t = float(std::min(1.0, double(position + i) * step));
+            outgoingGain[i] = 1.0f - t;
+            incomingGain[i] = t;
+        }
+        return;
+    }
+
+    // Rotate (cos, sin) by a fixed angle per frame rather than calling both per
+    // frame; seeded exactly once per block, so rounding can't build up
+    const double angle = HalfPi * step;
+    const double rotateCos = std::cos(angle);
+    const double rotateSin = std::sin(angle);
+    double c = std::cos(HalfPi * std::min(1.0, double(position) * step));
+    double s = std::sin(HalfPi * std::min(1.0, double(position) * step));
+
+    for (qint64 i = 0; i < frames; ++i) {
+        if (position + i >= length) {
+            c = 0.0;
+            s = 1.0;
+        }
+        outgoingGain[i] = float(c);
+        incomingGain[i] = float(s);
+
+        const double nextC = c * rotateCos - s * rotateSin;
+        s = s * rotateCos + c * rotateSin;
+        c = nextC;
+    }
+}
+
+void mix(float *incoming, const float *outgoing, const float *outgoingGain, const float *incomingGain,
+         qint64 frames, int channels)
+{
+    switch (channels) {
+    case 1:
+        mixFrames<1>(incoming, outgoing, outgoingGain, incomingGain, frames);
+        break;
+    case 2:
+        mixFrames<2>(incoming, outgoing, outgoingGain, incomingGain, frames);
+        break;
+    default:
+        for (qint64 i = 0; i < frames; ++i) {
+            for (int ch = 0; ch < channels; ++ch) {
+                const qint64 sample = i * channels + ch;
+                incoming[sample] = incoming[sample] * incomingGain[i] + outgoing[sample] * outgoingGain[i];
+            }
+        }
+        break;
+    }
+}
+
+} // namespace Crossfade
@@ -0,0 +1,28 @@
+#ifndef CROSSFADE_H
+#define CROSSFADE_H
+
+#include <QtGlobal>
+
+// Gain curves and the mix kernel for crossfades between consecutive
+// tracks. The audio thread fills one gain per frame for each side of the
+// fade, then mixes the outgoing block into the incoming one; keeping the
+// curve out of the mix loop lets the compiler vectorize it.
+namespace Crossfade {
+
+const int MaxSeconds = 12;
+
+enum Curve {
+    EqualPower, // cos/sin: constant power, no dip for uncorrelated material
+    Linear      // 1-t/t: constant amplitude, for similar material
+};
+
+// Gains for frames [position, position + frames) of a fade length frames long
+void gains(Curve curve, qint64 position, qint64 length, float *outgoingGain, float *incomingGain, qint64 frames);
+
+// incoming[i] = incoming[i] * incomingGain[f] + outgoing[i] * outgoingGain[f], for frame f of sample i
+void mix(float *incoming, const float *outgoing, const float *outgoingGain, const float *incomingGain,
+         qint64 frames, int channels);
+
+} // namespace Crossfade
+
+#endif // CROSSFADE_H
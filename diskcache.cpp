@@ -0,0 +1,43 @@
+#include "diskcache.h"
+#include "trace.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+
+namespace DiskCache {
+
+void touch(QFileDevice &file)
+{
+    file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+}
+
+void prune(const QString &directory, qint64 maxBytes)
+{
+    TRACE_SCOPE_ARG("cache", "DiskCache::prune", directory);
+    QFileInfoList entries = QDir(directory).entryInfoList(QDir::Files | QDir::NoDotAndDotDot);
+
+    qint64 total = 0;
+    for (const QFileInfo &entry : std::as_const(entries)) {
+        total += entry.size();
+    }
+    if (total <= maxBytes) {
+        return;
+    }
+
+    // Oldest first; stop as soon as what is left fits
+    std::sort(entries.begin(), entries.end(), [](const QFileInfo &a, const QFileInfo &b) {
+        return a.lastModified() < b.lastModified();
+    });
+    for (const QFileInfo &entry : std::as_const(entries)) {
+        if (total <= maxBytes) {
+            break;
+        }
+        if (QFile::remove(entry.filePath())) {
+            total -= entry.size();
+        }
+    }
+}
+
+} // namespace DiskCache
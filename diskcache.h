@@ -0,0 +1,21 @@
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <QFileDevice>
+#include <QString>
+
+// Housekeeping for the cover and waveform directories under the cache
+// location. Each entry is one file whose modification time doubles as its
+// last use, so when a directory outgrows its budget the least recently
+// used entries are deleted first.
+namespace DiskCache {
+
+// Marks an open entry as just used
+void touch(QFileDevice &file);
+
+// Deletes the least recently used files until the directory fits in maxBytes
+void prune(const QString &directory, qint64 maxBytes);
+
+} // namespace DiskCache
+
+#endif // DISKCACHE_H
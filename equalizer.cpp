@@ -0,0 +1,270 @@
+#include "equalizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const double Pi = 3.14159265358979323846;
+const float Q = 1.41f;                 // About one octave wide
+const qint64 RampFrames = 512;         // ~11 ms at 48 kHz
+const float DenormalThreshold = 1e-15f;
+
+} // namespace
+
+const float Equalizer::BandFrequencies[Equalizer::BandCount] = {
+    60.0f, 170.0f, 310.0f, 600.0f, 1000.0f, 3000.0f, 6000.0f, 12000.0f, 14000.0f, 16000.0f
+};
+
+Equalizer::Equalizer()
+    : generation(0),
+      appliedGeneration(0),
+      sampleRate(48000),
+      channels(2),
+      rampRemaining(0),
+      preamp(1.0f),
+      preampTarget(1.0f)
+{
+    for (int band = 0; band < BandCount; ++band) {
+        gains[band].store(0.0f, std::memory_order_relaxed);
+        flat[band] = true;
+    }
+    reset();
+}
+
+void Equalizer::setFormat(int rate, int channelCount)
+{
+    sampleRate = rate > 0 ? rate : 48000;
+    channels = qBound(1, channelCount, int(MaxChannels));
+
+    // Recompute immediately; there is nothing to ramp from after a format change
+    updateTargets();
+    for (int band = 0; band < BandCount; ++band) {
+        current[band] = target[band];
+        flat[band] = gains[band].load(std::memory_order_relaxed) == 0.0f;
+    }
+    preamp = preampTarget;
+    rampRemaining = 0;
+    appliedGeneration = generation.load(std::memory_order_acquire);
+    reset();
+}
+
+void Equalizer::reset()
+{
+    std::memset(s1, 0, sizeof(s1));
+    std::memset(s2, 0, sizeof(s2));
+}
+
+void Equalizer::setGain(int band, float decibels)
+{
+    if (band < 0 || band >= BandCount) {
+        return;
+    }
+    gains[band].store(decibels, std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_release);
+}
+
+float Equalizer::gain(int band) const
+{
+    if (band < 0 || band >= BandCount) {
+        return 0.0f;
+    }
+    return gains[band].load(std::memory_order_relaxed);
+}
+
+void Equalizer::updateTargets()
+{
+    float maxBoost = 0.0f;
+
+    for (int band = 0; band < BandCount; ++band) {
+        const float decibels = gains[band].load(std::memory_order_relaxed);
+        maxBoost = std::max(maxBoost, decibels);
+
+        Coefficients &c = target[band];
+        if (decibels == 0.0f) {
+            c = Coefficients();
+            continue;
+        }
+
+        // RBJ audio EQ cookbook peaking filter
+        const double frequency = std::min<double>(BandFrequencies[band], 0.45 * sampleRate);
+        const double a = std::pow(10.0, decibels / 40.0);
+        const double w0 = 2.0 * Pi * frequency / sampleRate;
+        const double alpha = std::sin(w0) / (2.0 * Q);
+        const double cosw0 = std::cos(w0);
+        const double a0 = 1.0 + alpha / a;
+
+        c.b0 = float((1.0 + alpha * a) / a0);
+        c.b1 = float((-2.0 * cosw0) / a0);
+        c.b2 = float((1.0 - alpha * a) / a0);
+        c.a1 = float((-2.0 * cosw0) / a0);
+        c.a2 = float((1.0 - alpha / a) / a0);
+    }
+
+    // Leave headroom for the largest boost so the cascade cannot clip
+    preampTarget = std::pow(10.0f, -maxBoost / 20.0f);
+}
+
+void Equalizer::process(float *samples, qint64 frames)
+{
+    const int latest = generation.load(std::memory_order_acquire);
+    if (latest != appliedGeneration) {
+        appliedGeneration = latest;
+        updateTargets();
+
+        for (int band = 0; band < BandCount; ++band) {
+            const Coefficients &from = current[band];
+            const Coefficients &to = target[band];
+            step[band].b0 = (to.b0 - from.b0) / RampFrames;
+            step[band].b1 = (to.b1 - from.b1) / RampFrames;
+            step[band].b2 = (to.b2 - from.b2) / RampFrames;
+            step[band].a1 = (to.a1 - from.a1) / RampFrames;
+            step[band].a2 = (to.a2 - from.a2) / RampFrames;
+        }
+        rampRemaining = RampFrames;
+    }
+
+    while (frames > 0) {
+        qint64 count = frames;
+
+        if (rampRemaining > 0) {
+            count = std::min(frames, rampRemaining);
+
+            for (int band = 0; band < BandCount; ++band) {
+                processRamp(band, samples, count);
+            }
+
+            const float preampStep = (preampTarget - preamp) / rampRemaining;
+            for (qint64 i = 0; i < count; ++i) {
+                preamp += preampStep;
+                for (int ch = 0; ch < channels; ++ch) {
+                    samples[i * channels + ch] *= preamp;
+                }
+            }
+
+            rampRemaining -= count;
+            if (rampRemaining == 0) {
+                for (int band = 0; band < BandCount; ++band) {
+                    current[band] = target[band];
+                    flat[band] = target[band].b0 == 1.0f && target[band].b1 == target[band].a1
+                              && target[band].b2 == target[band].a2;
+                }
+                preamp = preampTarget;
+            }
+        } else {
+            for (int band = 0; band < BandCount; ++band) {
+                if (flat[band]) {
+                    continue;
+                }
+                switch (channels) {
+                case 1:
+                    processBand<1>(band, samples, count);
+                    break;
+                case 2:
+                    processBand<2>(band, samples, count);
+                    break;
+                default:
+                    processBandGeneric(band, samples, count);
+                    break;
+                }
+            }
+
+            if (preamp != 1.0f) {
+                const qint64 total = count * channels;
+                for (qint64 i = 0; i < total; ++i) {
+                    samples[i] *= preamp;
+                }
+            }
+        }
+
+        samples += count * channels;
+        frames -= count;
+    }
+
+    // Flush decaying state to zero so silence doesn't run into denormals
+    for (int band = 0; band < BandCount; ++band) {
+        for (int ch = 0; ch < channels; ++ch) {
+            if (std::fabs(s1[band][ch]) < DenormalThreshold) {
+                s1[band][ch] = 0.0f;
+            }
+            if (std::fabs(s2[band][ch]) < DenormalThreshold) {
+                s2[band][ch] = 0.0f;
+            }
+        }
+    }
+}
+
+void Equalizer::processRamp(int band, float *samples, qint64 frames)
+{
+    Coefficients c = current[band];
+    const Coefficients d = step[band];
+    float *z1 = s1[band];
+    float *z2 = s2[band];
+
+    for (qint64 i = 0; i < frames; ++i) {
+        c.b0 += d.b0;
+        c.b1 += d.b1;
+        c.b2 += d.b2;
+        c.a1 += d.a1;
+        c.a2 += d.a2;
+
+        float *frame = samples + i * channels;
+        for (int ch = 0; ch < channels; ++ch) {
+            const float x = frame[ch];
+            const float y = c.b0 * x + z1[ch];
+            z1[ch] = c.b1 * x - c.a1 * y + z2[ch];
+            z2[ch] = c.b2 * x - c.a2 * y;
+            frame[ch] = y;
+        }
+    }
+
+    current[band] = c;
+}
+
+template <int Channels>
+void Equalizer::processBand(int band, float *samples, qint64 frames)
+{
+    const Coefficients c = current[band];
+
+    // Keep the state in locals so it stays in registers across the loop
+    float z1[Channels];
+    float z2[Channels];
+    for (int ch = 0; ch < Channels; ++ch) {
+        z1[ch] = s1[band][ch];
+        z2[ch] = s2[band][ch];
+    }
+
+    for (qint64 i = 0; i < frames; ++i) {
+        float *frame = samples + i * Channels;
+        for (int ch = 0; ch < Channels; ++ch) {
+            const float x = frame[ch];
+            const float y = c.b0 * x + z1[ch];
+            z1[ch] = c.b1 * x - c.a1 * y + z2[ch];
+            z2[ch] = c.b2 * x - c.a2 * y;
+            frame[ch] = y;
+        }
+    }
+
+    for (int ch = 0; ch < Channels; ++ch) {
+        s1[band][ch] = z1[ch];
+        s2[band][ch] = z2[ch];
+    }
+}
+
+void Equalizer::processBandGeneric(int band, float *samples, qint64 frames)
+{
+    const Coefficients c = current[band];
+    float *z1 = s1[band];
+    float *z2 = s2[band];
+
+    for (qint64 i = 0; i < frames; ++i) {
+        float *frame = samples + i * channels;
+        for (int ch = 0; ch < channels; ++ch) {
+            const float x = frame[ch];
+            const float y = c.b0 * x + z1[ch];
+            z1[ch] = c.b1 * x - c.a1 * y + z2[ch];
+            z2[ch] = c.b2 * x - c.a2 * y;
+            frame[ch] = y;
+        }
+    }
+}
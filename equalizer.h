@@ -0,0 +1,66 @@
+#ifndef EQUALIZER_H
+#define EQUALIZER_H
+
+#include <QtGlobal>
+#include <atomic>
+
+// Ten-band graphic equalizer: a cascade of RBJ peaking biquads centred on
+// the bands shown in the Equalizer tab. Gains may be changed from any
+// thread; the audio thread picks them up at the next block and ramps the
+// coefficients over a few milliseconds so slider moves don't click.
+// Each stage runs over the whole block with the channels of one frame in
+// the inner loop, which the compiler unrolls and vectorizes for stereo.
+// Flat bands are skipped entirely.
+class Equalizer
+{
+public:
+    static const int BandCount = 10;
+    static const int MaxChannels = 8;
+    static const float BandFrequencies[BandCount];
+
+    Equalizer();
+
+    // Must not be called concurrently with process()
+    void setFormat(int sampleRate, int channelCount);
+    void reset();
+
+    void setGain(int band, float decibels);
+    float gain(int band) const;
+
+    // Filters interleaved float samples in place
+    void process(float *samples, qint64 frames);
+
+private:
+    struct Coefficients
+    {
+        float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+    };
+
+    void updateTargets();
+    void processRamp(int band, float *samples, qint64 frames);
+    template <int Channels>
+    void processBand(int band, float *samples, qint64 frames);
+    void processBandGeneric(int band, float *samples, qint64 frames);
+
+    std::atomic<float> gains[BandCount];
+    std::atomic<int> generation;
+    int appliedGeneration;
+
+    int sampleRate;
+    int channels;
+
+    Coefficients current[BandCount];
+    Coefficients target[BandCount];
+    Coefficients step[BandCount];
+    bool flat[BandCount];
+    qint64 rampRemaining;
+
+    float preamp;
+    float preampTarget;
+
+    // Transposed direct form II state, per band and channel
+    float s1[BandCount][MaxChannels];
+    float s2[BandCount][MaxChannels];
+};
+
+#endif // EQUALIZER_H
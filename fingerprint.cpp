@@ -0,0 +1,471 @@
+#include "fingerprint.h"
+#include "trace.h"
+#include "trackdecoder.h"
+#include <QHash>
+#include <QtAlgorithms>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+const double Pi = 3.14159265358979323846;
+const int TargetRate = 11025;
+const int FrameSize = 4096;        // 372 ms
+const int FrameStep = 2048;        // Half-overlapping frames
+const double MinFrequency = 28.0;  // Chroma range, A0 to A7
+const double MaxFrequency = 3520.0;
+const float OnsetLevel = 1e-3f;    // -60 dBFS; quieter leading samples are dropped
+
+// Matching
+const int MaxOffset = 10;            // Words either way, about 1.9 s
+const double MaxBitErrorRate = 0.2;
+const int MinSharedKeys = 2;
+const int MaxPostings = 32;          // Keys shared by more tracks than this say nothing
+
+// FFT tables and the bin-to-pitch-class map, shared by all builders
+struct Tables
+{
+    std::vector<float> window;
+    std::vector<int> reversed;
+    std::vector<std::complex<float>> twiddles;
+    std::vector<int> pitchClass; // Per bin, -1 outside the chroma range
+    int firstBin;
+    int lastBin;
+
+    Tables()
+        : window(FrameSize),
+          reversed(FrameSize),
+          twiddles(FrameSize / 2),
+          pitchClass(FrameSize / 2 + 1, -1)
+    {
+        int bits = 0;
+        while ((1 << bits) < FrameSize) {
+            ++bits;
+        }
+        for (int i = 0; i < FrameSize; ++i) {
+            window[i] = float(0.5 - 0.5 * std::cos(2.0 * Pi * i / FrameSize));
+            int r = 0;
+            for (int b = 0; b < bits; ++b) {
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            }
+            reversed[i] = r;
+        }
+        for (int i = 0; i < FrameSize / 2; ++i) {
+            twiddles[i] = std::polar(1.0f, float(-2.0 * Pi * i / FrameSize));
+        }
+
+        firstBin = int(std::ceil(MinFrequency * FrameSize / TargetRate));
+        lastBin = int(std::floor(MaxFrequency * FrameSize / TargetRate));
+        for (int k = firstBin; k <= lastBin; ++k) {
+            const double frequency = double(k) * TargetRate / FrameSize;
+            const long note = std::lround(12.0 * std::log2(frequency / 440.0)) + 69; // MIDI note number
+            pitchClass[k] = int(note % 12);
+        }
+    }
+
+    // In-place radix-2 FFT
+    void transform(std::complex<float> *data) const
+    {
+        for (int i = 0; i < FrameSize; ++i) {
+            if (i < reversed[i]) {
+                std::swap(data[i], data[reversed[i]]);
+            }
+        }
+        for (int length = 2; length <= FrameSize; length *= 2) {
+            const int half = length / 2;
+            const int stride = FrameSize / length;
+            for (int start = 0; start < FrameSize; start += length) {
+                for (int k = 0; k < half; ++k) {
+                    const std::complex<float> odd = data[start + half + k] * twiddles[k * stride];
+                    data[start + half + k] = data[start + k] - odd;
+                    data[start + k] += odd;
+                }
+            }
+        }
+    }
+};
+
+const Tables &tables()
+{
+    static const Tables instance;
+    return instance;
+}
+
+// The within-frame chroma bits of a word and of part of the next; the
+// temporal bits are left out because they are the first to flip when
+// frames shift a little. Anything shorter than 32 bits collides too often
+// across a million tracks.
+quint32 lookupKey(quint32 word, quint32 next)
+{
+    return (word & 0xfff) | ((word >> 24) << 12) | ((next & 0xfff) << 20);
+}
+
+// Keeps about a quarter of the keys, chosen by content rather than
+// position, so two aligned copies keep the same ones
+bool isSampled(quint32 key)
+{
+    return ((key * 0x9e3779b1u) >> 30) == 0;
+}
+
+class DisjointSets
+{
+public:
+    explicit DisjointSets(int count) : parent(size_t(count))
+    {
+        std::iota(parent.begin(), parent.end(), 0);
+    }
+
+    int find(int i)
+    {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    void join(int a, int b)
+    {
+        a = find(a);
+        b = find(b);
+        if (a != b) {
+            parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+private:
+    std::vector<int> parent;
+};
+
+} // namespace
+
+FingerprintBuilder::FingerprintBuilder()
+    : inputRate(0),
+      resamplePosition(0.0),
+      previousSample(0.0f),
+      ring(FrameSize, 0.0f),
+      ringPos(0),
+      sinceFrame(FrameStep - FrameSize), // The first frame needs a full ring
+      spectrum(FrameSize),
+      sounding(false),
+      started(false)
+{
+    std::fill(std::begin(chroma), std::end(chroma), 0.0f);
+    std::fill(std::begin(previousChroma), std::end(previousChroma), 0.0f);
+    words.reserve(MaxWords);
+}
+
+void FingerprintBuilder::addFrames(const float *samples, qint64 frames, int sampleRate, int channelCount)
+{
+    if (sampleRate <= 0 || channelCount <= 0) {
+        return;
+    }
+
+    if (inputRate == 0) {
+        // Fourth-order Butterworth low-pass below the new Nyquist frequency
+        inputRate = sampleRate;
+        const double cutoff = std::min(0.45 * TargetRate, 0.45 * inputRate);
+        const double w0 = 2.0 * Pi * cutoff / inputRate;
+        const double qs[2] = {0.54119610, 1.30656296};
+        for (int i = 0; i < 2; ++i) {
+            const double alpha = std::sin(w0) / (2.0 * qs[i]);
+            const double a0 = 1.0 + alpha;
+            Biquad &f = lowpass[i];
+            f.b0 = (1.0 - std::cos(w0)) / 2.0 / a0;
+            f.b1 = (1.0 - std::cos(w0)) / a0;
+            f.b2 = f.b0;
+            f.a1 = -2.0 * std::cos(w0) / a0;
+            f.a2 = (1.0 - alpha) / a0;
+        }
+    }
+
+    const double step = double(inputRate) / TargetRate;
+    const float scale = 1.0f / channelCount;
+    for (qint64 i = 0; i < frames && !isFull(); ++i) {
+        const float *frame = samples + i * channelCount;
+        float mono = 0.0f;
+        for (int ch = 0; ch < channelCount; ++ch) {
+            mono += frame[ch];
+        }
+
+        double x = mono * scale;
+        for (Biquad &f : lowpass) {
+            const double y = f.b0 * x + f.z1;
+            f.z1 = f.b1 * x - f.a1 * y + f.z2;
+            f.z2 = f.b2 * x - f.a2 * y;
+            x = y;
+        }
+
+        // Linear interpolation between the previous and this input sample
+        const float sample = float(x);
+        while (resamplePosition < 1.0) {
+            addSample(previousSample + (sample - previousSample) * float(resamplePosition));
+            resamplePosition += step;
+        }
+        resamplePosition -= 1.0;
+        previousSample = sample;
+    }
+}
+
+void FingerprintBuilder::addSample(float sample)
+{
+    // Start the frame grid at the first audible sample, so copies with
+    // different leading silence are cut into the same frames
+    if (!sounding) {
+        if (std::fabs(sample) < OnsetLevel) {
+            return;
+        }
+        sounding = true;
+    }
+
+    ring[size_t(ringPos)] = sample;
+    ringPos = (ringPos + 1) % FrameSize;
+    if (++sinceFrame == FrameStep) {
+        sinceFrame = 0;
+        processFrame();
+    }
+}
+
+void FingerprintBuilder::processFrame()
+{
+    if (isFull()) {
+        return;
+    }
+
+    const Tables &t = tables();
+    for (int i = 0; i < FrameSize; ++i) {
+        spectrum[size_t(i)] = ring[size_t((ringPos + i) % FrameSize)] * t.window[size_t(i)];
+    }
+    t.transform(spectrum.data());
+
+    std::fill(std::begin(chroma), std::end(chroma), 0.0f);
+    for (int k = t.firstBin; k <= t.lastBin; ++k) {
+        chroma[t.pitchClass[size_t(k)]] += std::norm(spectrum[size_t(k)]);
+    }
+
+    // Unit length, so the frame-to-frame bits ignore level changes
+    float length = 0.0f;
+    for (float c : chroma) {
+        length += c * c;
+    }
+    length = std::sqrt(length);
+    if (length > 0.0f) {
+        for (float &c : chroma) {
+            c /= length;
+        }
+    }
+
+    // The first sounding frame only seeds the frame-to-frame comparison
+    if (started) {
+        quint32 word = 0;
+        for (int i = 0; i < 12; ++i) {
+            word |= quint32(chroma[i] > chroma[(i + 1) % 12]) << i;
+            word |= quint32(chroma[i] > previousChroma[i]) << (12 + i);
+        }
+        for (int i = 0; i < 8; ++i) {
+            word |= quint32(chroma[i] > chroma[(i + 5) % 12]) << (24 + i);
+        }
+        words.push_back(word);
+    }
+    started = true;
+    std::copy(std::begin(chroma), std::end(chroma), std::begin(previousChroma));
+}
+
+QList<quint32> FingerprintBuilder::fingerprint() const
+{
+    return QList<quint32>(words.cbegin(), words.cend());
+}
+
+namespace Fingerprint {
+
+FingerprintResult analyzeFile(const TrackInfo &track)
+{
+    TRACE_SCOPE_ARG("fingerprint", "Fingerprint::analyzeFile", track.path);
+
+    FingerprintResult result;
+    result.path = track.path;
+    result.modified = track.modified;
+    result.size = track.size;
+
+    FingerprintBuilder builder;
+    const bool ok = TrackDecoder::decodeFile(track.path, [&](const float *samples, qint64 frames, int rate, int channels) {
+        builder.addFrames(samples, frames, rate, channels);
+        return !builder.isFull();
+    });
+
+    result.fingerprint = builder.fingerprint();
+    if (!ok || result.fingerprint.isEmpty()) {
+        result.fingerprint = {0};
+    }
+    return result;
+}
+
+double bitErrorRate(const quint32 *a, int aSize, const quint32 *b, int bSize)
+{
+    if (aSize < MinWords || bSize < MinWords) {
+        return 1.0;
+    }
+
+    double best = 1.0;
+    for (int offset = -MaxOffset; offset <= MaxOffset; ++offset) {
+        const int first = std::max(0, -offset);
+        const int last = std::min(aSize, bSize - offset);
+        if (last - first < MinWords) {
+            continue;
+        }
+        int errors = 0;
+        for (int i = first; i < last; ++i) {
+            errors += qPopulationCount(a[i] ^ b[i + offset]);
+        }
+        best = std::min(best, double(errors) / (32.0 * (last - first)));
+    }
+    return best;
+}
+
+double bitErrorRate(const QList<quint32> &a, const QList<quint32> &b)
+{
+    return bitErrorRate(a.constData(), int(a.size()), b.constData(), int(b.size()));
+}
+
+QList<QStringList> findDuplicates(const TrackStore &tracks)
+{
+    TRACE_SCOPE("fingerprint", "Fingerprint::findDuplicates");
+
+    // Each track's sampled keys, computed in parallel; tracks are
+    // independent, so each task writes only its own slot
+    std::vector<std::vector<quint32>> keysOf(size_t(tracks.size()));
+    QList<int> rows(tracks.size());
+    std::iota(rows.begin(), rows.end(), 0);
+    QtConcurrent::blockingMap(rows, [&](const int &t) {
+        const quint32 *words = tracks.fingerprintData(t);
+        const int count = tracks.fingerprintSize(t);
+        if (count < MinWords) {
+            return;
+        }
+        std::vector<quint32> &keys = keysOf[size_t(t)];
+        for (int i = 0; i + 1 < count; ++i) {
+            const quint32 key = lookupKey(words[i], words[i + 1]);
+            if (isSampled(key)) {
+                keys.push_back(key);
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    });
+
+    // Inverted index with a few postings per hash bucket, built with a
+    // counting pass so nothing needs sorting; bucket b holds postings
+    // [offsets[b], offsets[b + 1]), in track order
+    struct Posting
+    {
+        quint32 key;
+        int track;
+    };
+    qint64 total = 0;
+    for (const std::vector<quint32> &keys : keysOf) {
+        total += qint64(keys.size());
+    }
+    int bits = 1;
+    while ((qint64(1) << bits) < total / 4 && bits < 24) {
+        ++bits;
+    }
+    auto bucketOf = [bits](quint32 key) {
+        return size_t((key * 0x85ebca6bu) >> (32 - bits));
+    };
+
+    std::vector<quint32> offsets((size_t(1) << bits) + 1, 0);
+    for (const std::vector<quint32> &keys : keysOf) {
+        for (quint32 key : keys) {
+            ++offsets[bucketOf(key) + 1];
+        }
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<Posting> postings(static_cast<size_t>(total));
+    std::vector<quint32> fill(offsets.begin(), offsets.end() - 1);
+    for (int t = 0; t < tracks.size(); ++t) {
+        for (quint32 key : keysOf[size_t(t)]) {
+            postings[fill[bucketOf(key)]++] = {key, t};
+        }
+    }
+    std::vector<quint32>().swap(fill);
+
+    // Each track looks up its own keys and compares only the later tracks
+    // that share several of them, again in parallel
+    std::vector<std::vector<int>> matchesOf(size_t(tracks.size()));
+    QtConcurrent::blockingMap(rows, [&](const int &t) {
+        std::vector<int> sharing;
+        std::vector<int> others;
+        for (quint32 key : keysOf[size_t(t)]) {
+            others.clear();
+            const size_t b = bucketOf(key);
+            for (quint32 p = offsets[b]; p < offsets[b + 1]; ++p) {
+                if (postings[p].key == key && postings[p].track != t) {
+                    others.push_back(postings[p].track);
+                }
+            }
+            if (int(others.size()) < MaxPostings) {
+                for (int other : others) {
+                    if (other > t) {
+                        sharing.push_back(other);
+                    }
+                }
+            }
+        }
+
+        const qint64 duration = tracks.duration(t);
+        std::sort(sharing.begin(), sharing.end());
+        for (size_t begin = 0; begin < sharing.size();) {
+            size_t end = begin + 1;
+            while (end < sharing.size() && sharing[end] == sharing[begin]) {
+                ++end;
+            }
+            const int other = sharing[begin];
+            const int shared = int(end - begin);
+            begin = end;
+            if (shared < MinSharedKeys) {
+                continue;
+            }
+            const qint64 otherDuration = tracks.duration(other);
+            if (duration > 0 && otherDuration > 0) {
+                const qint64 tolerance = std::max<qint64>(10000, std::max(duration, otherDuration) / 10);
+                if (std::abs(duration - otherDuration) > tolerance) {
+                    continue; // A radio edit or a live take, not another copy
+                }
+            }
+            if (bitErrorRate(tracks.fingerprintData(t), tracks.fingerprintSize(t),
+                             tracks.fingerprintData(other), tracks.fingerprintSize(other)) <= MaxBitErrorRate) {
+                matchesOf[size_t(t)].push_back(other);
+            }
+        }
+    });
+
+    DisjointSets sets(int(tracks.size()));
+    std::vector<bool> matched(size_t(tracks.size()), false);
+    for (int t = 0; t < tracks.size(); ++t) {
+        for (int other : matchesOf[size_t(t)]) {
+            sets.join(t, other);
+            matched[size_t(t)] = true;
+            matched[size_t(other)] = true;
+        }
+    }
+
+    QHash<int, QStringList> groupByRoot;
+    for (int t = 0; t < tracks.size(); ++t) {
+        if (matched[size_t(t)]) {
+            groupByRoot[sets.find(t)].append(tracks.path(t));
+        }
+    }
+
+    QList<QStringList> groups = groupByRoot.values();
+    for (QStringList &group : groups) {
+        group.sort();
+    }
+    std::sort(groups.begin(), groups.end(), [](const QStringList &a, const QStringList &b) {
+        return a.size() != b.size() ? a.size() > b.size() : a.first() < b.first();
+    });
+    return groups;
+}
+
+} // namespace Fingerprint
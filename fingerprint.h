@@ -0,0 +1,95 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <complex>
+#include <vector>
+#include "tagreader.h"
+#include "trackstore.h"
+
+// Acoustic fingerprint of the start of a track, for finding the same
+// recording under another name or format. The audio is downmixed,
+// resampled to 11025 Hz and cut into 372 ms frames every 186 ms; each
+// frame's spectrum is folded into a 12-bin chroma vector, and each
+// fingerprint word holds 32 sign bits comparing chroma bins within the
+// frame and against the previous frame. Comparing signs rather than levels
+// makes the words survive lossy encoding, resampling and gain changes.
+// Leading silence is skipped, so rips with different padding line up.
+class FingerprintBuilder
+{
+public:
+    FingerprintBuilder();
+
+    // Interleaved float samples; the rate and channel count must not change between calls
+    void addFrames(const float *samples, qint64 frames, int sampleRate, int channelCount);
+
+    // Enough frames have been seen; the decoder can stop
+    bool isFull() const { return int(words.size()) >= MaxWords; }
+
+    QList<quint32> fingerprint() const;
+
+    static const int MaxWords = 96; // About 18 s of audio, 384 bytes per track
+
+private:
+    void addSample(float sample);
+    void processFrame();
+
+    // Two cascaded biquads low-pass the input before it is decimated
+    struct Biquad
+    {
+        double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+        double z1 = 0, z2 = 0;
+    };
+
+    int inputRate;
+    Biquad lowpass[2];
+    double resamplePosition;
+    float previousSample;
+
+    std::vector<float> ring;  // The last frame of 11025 Hz samples
+    int ringPos;
+    int sinceFrame;
+    std::vector<std::complex<float>> spectrum;
+    float chroma[12];
+    float previousChroma[12];
+    bool sounding; // Past the leading silence
+    bool started;  // Seen the first frame
+    std::vector<quint32> words;
+};
+
+struct FingerprintResult
+{
+    QString path;
+    qint64 modified = 0; // What the file looked like when analyzed, so stale results are dropped
+    qint64 size = 0;
+    QList<quint32> fingerprint;
+};
+
+namespace Fingerprint {
+
+// Fingerprints shorter than this (mostly silence, or undecodable) never match
+const int MinWords = 16;
+
+// Decodes the start of the file on the calling thread. Safe to run on many
+// pool threads at once. A file that can't be decoded gets a single zero
+// word, so it counts as analyzed and isn't retried every run.
+FingerprintResult analyzeFile(const TrackInfo &track);
+
+// Fraction of differing bits at the best alignment (within a couple of
+// seconds); 0 for identical audio, around 0.5 for unrelated tracks, and
+// 1 when either fingerprint is too short to compare
+double bitErrorRate(const QList<quint32> &a, const QList<quint32> &b);
+double bitErrorRate(const quint32 *a, int aSize, const quint32 *b, int bSize);
+
+// Groups tracks that are the same recording. Instead of comparing every
+// pair, keys made from the bits of neighbouring words go into an inverted
+// index (a locality-sensitive hash: similar fingerprints share many keys);
+// only tracks sharing several keys are compared in full, in parallel.
+// Returns the paths of each group, largest groups first.
+QList<QStringList> findDuplicates(const TrackStore &tracks);
+
+} // namespace Fingerprint
+
+#endif // FINGERPRINT_H
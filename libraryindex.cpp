@@ -0,0 +1,475 @@
+#include "libraryindex.h"
+#include "trace.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+
+// Layout (all little-endian):
+//   header   magic "MPLI", version, track count, root count, pool offset (u64), pool size (u64)
+//   roots    root count x u32 pool offset
+//   records  track count x {path, title, artist, album: u32 pool offsets; modified, size, duration: i64;
+//            gated blocks: i32; loudness, true peak, album loudness: f32; fingerprint, genre: u32 pool offsets}
+//   pool     u32 byte length + UTF-8 bytes per string, or + u32 words per fingerprint;
+//            titles, artists, albums and genres are deduplicated
+// Version 1 records stop after duration, version 2 records after album
+// loudness and version 3 records after the fingerprint; they load as not
+// yet analyzed, or with no genre.
+const char Magic[4] = {'M', 'P', 'L', 'I'};
+const quint32 Version = 4;
+const int HeaderSize = 32;
+const int RecordSizes[] = {40, 56, 60, 64}; // Per version
+
+template <typename T>
+void append(QByteArray &out, T value)
+{
+    char buffer[sizeof(T)];
+    qToLittleEndian(value, buffer);
+    out.append(buffer, sizeof(T));
+}
+
+class StringPool
+{
+public:
+    quint32 add(const QString &value)
+    {
+        const quint32 offset = quint32(data.size());
+        const QByteArray utf8 = value.toUtf8();
+        append<quint32>(data, quint32(utf8.size()));
+        data.append(utf8);
+        return offset;
+    }
+
+    quint32 add(const QList<quint32> &words)
+    {
+        const quint32 offset = quint32(data.size());
+        append<quint32>(data, quint32(words.size() * 4));
+        for (quint32 word : words) {
+            append<quint32>(data, word);
+        }
+        return offset;
+    }
+
+    quint32 intern(const QString &value)
+    {
+        auto it = offsets.constFind(value);
+        if (it != offsets.constEnd()) {
+            return it.value();
+        }
+        const quint32 offset = add(value);
+        offsets.insert(value, offset);
+        return offset;
+    }
+
+    QByteArray data;
+
+private:
+    QHash<QString, quint32> offsets;
+};
+
+// One unit of the parallel stat walk in refresh()
+struct StatJob
+{
+    QString dir;
+    bool recursive;
+};
+
+struct StatResult
+{
+    QStringList changed; // New or modified files
+    QList<int> seen;     // Rows whose files still exist
+};
+
+class PoolReader
+{
+public:
+    PoolReader(const uchar *pool, quint64 size) : pool(pool), size(size) {}
+
+    bool read(quint32 offset, QString &out) const
+    {
+        if (quint64(offset) + 4 > size) {
+            return false;
+        }
+        const quint32 length = qFromLittleEndian<quint32>(pool + offset);
+        if (quint64(offset) + 4 + length > size) {
+            return false;
+        }
+        out = QString::fromUtf8(reinterpret_cast<const char *>(pool + offset + 4), length);
+        return true;
+    }
+
+    bool read(quint32 offset, QList<quint32> &out) const
+    {
+        if (quint64(offset) + 4 > size) {
+            return false;
+        }
+        const quint32 length = qFromLittleEndian<quint32>(pool + offset);
+        if (quint64(offset) + 4 + length > size || length % 4 != 0) {
+            return false;
+        }
+        out.resize(length / 4);
+        qFromLittleEndian<quint32>(pool + offset + 4, length / 4, out.data());
+        return true;
+    }
+
+    // Shares one QString per pool entry, so repeated artists/albums cost nothing after the first
+    bool readShared(quint32 offset, QString &out)
+    {
+        auto it = cache.constFind(offset);
+        if (it != cache.constEnd()) {
+            out = it.value();
+            return true;
+        }
+        if (!read(offset, out)) {
+            return false;
+        }
+        cache.insert(offset, out);
+        return true;
+    }
+
+private:
+    const uchar *pool;
+    quint64 size;
+    QHash<quint32, QString> cache;
+};
+
+} // namespace
+
+LibraryIndex::LibraryIndex(const QString &fileName)
+    : fileName(fileName)
+{
+}
+
+QString LibraryIndex::defaultFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/library.idx";
+}
+
+QStringList LibraryIndex::nameFilters()
+{
+    return {"*.mp3", "*.wav", "*.flac", "*.ogg", "*.m4a"};
+}
+
+bool LibraryIndex::load()
+{
+    TRACE_SCOPE("library", "LibraryIndex::load");
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < HeaderSize) {
+        return false;
+    }
+
+    const quint64 fileSize = quint64(file.size());
+    const uchar *data = file.map(0, file.size());
+    if (!data) {
+        return false;
+    }
+
+    const quint32 version = qFromLittleEndian<quint32>(data + 4);
+    if (memcmp(data, Magic, 4) != 0 || version < 1 || version > Version) {
+        return false;
+    }
+    const int recordSize = RecordSizes[version - 1];
+
+    const quint32 trackCount = qFromLittleEndian<quint32>(data + 8);
+    const quint32 rootCount = qFromLittleEndian<quint32>(data + 12);
+    const quint64 poolOffset = qFromLittleEndian<quint64>(data + 16);
+    const quint64 poolSize = qFromLittleEndian<quint64>(data + 24);
+    const quint64 recordsOffset = HeaderSize + quint64(rootCount) * 4;
+
+    if (recordsOffset + quint64(trackCount) * recordSize > poolOffset || poolOffset + poolSize > fileSize) {
+        return false;
+    }
+
+    PoolReader pool(data + poolOffset, poolSize);
+
+    QStringList roots;
+    for (quint32 i = 0; i < rootCount; ++i) {
+        QString root;
+        if (!pool.read(qFromLittleEndian<quint32>(data + HeaderSize + i * 4), root)) {
+            return false;
+        }
+        roots.append(root);
+    }
+
+    TrackStore tracks;
+    tracks.reserve(int(trackCount));
+
+    const uchar *record = data + recordsOffset;
+    for (quint32 i = 0; i < trackCount; ++i, record += recordSize) {
+        TrackInfo track;
+        if (!pool.read(qFromLittleEndian<quint32>(record), track.path)
+            || !pool.readShared(qFromLittleEndian<quint32>(record + 4), track.title)
+            || !pool.readShared(qFromLittleEndian<quint32>(record + 8), track.artist)
+            || !pool.readShared(qFromLittleEndian<quint32>(record + 12), track.album)) {
+            return false;
+        }
+        track.modified = qFromLittleEndian<qint64>(record + 16);
+        track.size = qFromLittleEndian<qint64>(record + 24);
+        track.duration = qFromLittleEndian<qint64>(record + 32);
+        if (version >= 2) {
+            track.gatedBlocks = qFromLittleEndian<qint32>(record + 40);
+            track.loudness = qFromLittleEndian<float>(record + 44);
+            track.peak = qFromLittleEndian<float>(record + 48);
+            track.albumLoudness = qFromLittleEndian<float>(record + 52);
+        }
+        if (version >= 3 && !pool.read(qFromLittleEndian<quint32>(record + 56), track.fingerprint)) {
+            return false;
+        }
+        if (version >= 4 && !pool.readShared(qFromLittleEndian<quint32>(record + 60), track.genre)) {
+            return false;
+        }
+        tracks.append(track);
+    }
+
+    rootPaths = roots;
+    store = tracks;
+    return true;
+}
+
+bool LibraryIndex::save() const
+{
+    TRACE_SCOPE("library", "LibraryIndex::save");
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    StringPool pool;
+    QByteArray roots;
+    for (const QString &root : rootPaths) {
+        append<quint32>(roots, pool.add(root));
+    }
+
+    QByteArray records;
+    records.reserve(store.size() * RecordSizes[Version - 1]);
+    for (int row = 0; row < store.size(); ++row) {
+        append<quint32>(records, pool.add(store.path(row)));
+        append<quint32>(records, pool.intern(store.title(row).toString()));
+        append<quint32>(records, pool.intern(store.artist(row)));
+        append<quint32>(records, pool.intern(store.album(row)));
+        append<qint64>(records, store.modified(row));
+        append<qint64>(records, store.fileSize(row));
+        append<qint64>(records, store.duration(row));
+        append<qint32>(records, store.gatedBlocks(row));
+        append<float>(records, store.trackLoudness(row));
+        append<float>(records, store.peak(row));
+        append<float>(records, store.albumLoudness(row));
+        append<quint32>(records, pool.add(store.fingerprint(row)));
+        append<quint32>(records, pool.intern(store.genre(row)));
+    }
+
+    QByteArray header(Magic, 4);
+    append<quint32>(header, Version);
+    append<quint32>(header, quint32(store.size()));
+    append<quint32>(header, quint32(rootPaths.size()));
+    append<quint64>(header, quint64(HeaderSize + roots.size() + records.size()));
+    append<quint64>(header, quint64(pool.data.size()));
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(header);
+    file.write(roots);
+    file.write(records);
+    file.write(pool.data);
+    return file.commit();
+}
+
+QStringList LibraryIndex::refresh(const QStringList &roots)
+{
+    TRACE_SCOPE("scan", "LibraryIndex::refresh");
+
+    // The files directly in each root are one job and every top-level
+    // folder (usually an artist) another, so even a single root is walked
+    // on several pool threads. Hidden and symlinked folders are skipped, as
+    // the recursive walk skips them.
+    QList<StatJob> jobs;
+    for (const QString &root : roots) {
+        jobs.append({root, false});
+        QDirIterator dirs(root, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+        while (dirs.hasNext()) {
+            jobs.append({dirs.next(), true});
+        }
+    }
+
+    // Workers only read the store, which isn't touched until they are done
+    const TrackStore &tracks = store;
+    auto statJob = [&tracks](const StatJob &job) {
+        TRACE_SCOPE_ARG("scan", "stat dir", job.dir);
+        StatResult result;
+        QDirIterator it(job.dir, nameFilters(), QDir::Files,
+                        job.recursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags);
+        while (it.hasNext()) {
+            const QString path = it.next();
+            const int row = tracks.find(path);
+            if (row >= 0) {
+                result.seen.append(row);
+
+                // The iterator already has the stat result cached
+                const QFileInfo info = it.fileInfo();
+                if (tracks.fileSize(row) == info.size()
+                    && tracks.modified(row) == info.lastModified().toMSecsSinceEpoch()) {
+                    continue;
+                }
+            }
+            result.changed.append(path);
+        }
+        return result;
+    };
+    const QList<StatResult> results = QtConcurrent::blockingMapped<QList<StatResult>>(jobs, statJob);
+
+    QList<bool> seen(store.size(), false);
+    QStringList changed;
+    for (const StatResult &result : results) {
+        for (int row : result.seen) {
+            seen[row] = true;
+        }
+        changed.append(result.changed);
+    }
+    if (roots.size() > 1) {
+        changed.removeDuplicates(); // Overlapping roots
+    }
+
+    // Drop entries that were not found under any root
+    if (seen.contains(false)) {
+        store.retain(seen);
+    }
+
+    rootPaths = roots;
+    return changed;
+}
+
+void LibraryIndex::update(const QList<TrackInfo> &tracks, bool tagsOnly)
+{
+    TRACE_SCOPE("library", "LibraryIndex::update");
+    for (const TrackInfo &track : tracks) {
+        const int row = store.find(track.path);
+        if (row >= 0) {
+            const bool sameAudio = tagsOnly
+                                   || (store.modified(row) == track.modified && store.fileSize(row) == track.size);
+            TrackInfo entry = track;
+            if (sameAudio && track.gatedBlocks < 0) {
+                entry.gatedBlocks = store.gatedBlocks(row);
+                entry.loudness = store.trackLoudness(row);
+                entry.peak = store.peak(row);
+                entry.albumLoudness = store.albumLoudness(row);
+            }
+            if (sameAudio && track.fingerprint.isEmpty()) {
+                entry.fingerprint = store.fingerprint(row);
+            }
+            store.set(row, entry);
+        } else {
+            store.append(track);
+        }
+    }
+
+    // An edited album tag can move tracks between albums
+    if (tagsOnly) {
+        Loudness::updateAlbumLoudness(store);
+    }
+}
+
+int LibraryIndex::setLoudness(const QList<LoudnessResult> &results)
+{
+    int applied = 0;
+    for (const LoudnessResult &result : results) {
+        const int row = store.find(result.path);
+        if (row < 0) {
+            continue;
+        }
+
+        // Drop results for files that changed while they were being analyzed
+        if (store.modified(row) != result.modified || store.fileSize(row) != result.size) {
+            continue;
+        }
+
+        // A file that can't be decoded is marked analyzed (at unity gain) so it isn't retried every run
+        store.setLoudness(row, result.valid ? result.gatedBlocks : 0, result.loudness, result.peak);
+        ++applied;
+    }
+
+    if (applied > 0) {
+        Loudness::updateAlbumLoudness(store);
+    }
+    return applied;
+}
+
+int LibraryIndex::setFingerprints(const QList<FingerprintResult> &results)
+{
+    int applied = 0;
+    for (const FingerprintResult &result : results) {
+        const int row = store.find(result.path);
+        if (row < 0) {
+            continue;
+        }
+
+        if (store.modified(row) != result.modified || store.fileSize(row) != result.size) {
+            continue;
+        }
+        store.setFingerprint(row, result.fingerprint);
+        ++applied;
+    }
+    return applied;
+}
+
+QList<int> LibraryIndex::remove(const QStringList &paths)
+{
+    if (paths.isEmpty()) {
+        return QList<int>();
+    }
+
+    QList<bool> keep(store.size(), true);
+    QStringList prefixes;
+    for (const QString &path : paths) {
+        const int row = store.find(path);
+        if (row >= 0) {
+            keep[row] = false;
+        } else {
+            // Not a track, so it may be a directory
+            prefixes.append(path + QLatin1Char('/'));
+        }
+    }
+
+    if (!prefixes.isEmpty()) {
+        // Stored directories end in a slash, so matching each distinct one
+        // against the prefixes covers the removed directory and everything
+        // below it without building a path per row
+        const StringDictionary &directories = store.directoryDictionary();
+        QList<bool> removedDirectory(directories.size(), false);
+        bool anyDirectory = false;
+        for (int id = 0; id < directories.size(); ++id) {
+            for (const QString &prefix : prefixes) {
+                if (directories.value(quint32(id)).startsWith(prefix)) {
+                    removedDirectory[id] = true;
+                    anyDirectory = true;
+                    break;
+                }
+            }
+        }
+        if (anyDirectory) {
+            const QList<quint32> &directoryIds = store.directoryColumn();
+            for (int row = 0; row < store.size(); ++row) {
+                if (removedDirectory.at(directoryIds.at(row))) {
+                    keep[row] = false;
+                }
+            }
+        }
+    }
+
+    QList<int> removed;
+    for (int row = 0; row < store.size(); ++row) {
+        if (!keep.at(row)) {
+            removed.append(row);
+        }
+    }
+
+    if (!removed.isEmpty()) {
+        store.retain(keep);
+    }
+    return removed;
+}
@@ -0,0 +1,62 @@
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include "fingerprint.h"
+#include "loudness.h"
+#include "tagreader.h"
+#include "trackstore.h"
+
+// Persistent library store, keyed by path with the mtime and size seen at
+// the last scan. In memory the entries are a columnar TrackStore; the
+// on-disk file is a fixed-size record table followed by a deduplicated
+// UTF-8 string pool, so loading is a single mmap and a walk over the
+// records.
+class LibraryIndex
+{
+public:
+    explicit LibraryIndex(const QString &fileName = defaultFileName());
+
+    static QString defaultFileName();
+    static QStringList nameFilters();
+
+    bool load();
+    bool save() const;
+
+    const TrackStore &tracks() const { return store; }
+    QStringList roots() const { return rootPaths; }
+
+    // Walks the given roots, drops entries whose files are gone (or lie
+    // outside the roots) and returns the files that are new or have a
+    // different mtime/size than the stored entry. Only stats files, with
+    // the roots' top-level folders walked in parallel on the thread pool.
+    QStringList refresh(const QStringList &roots);
+
+    // Inserts or replaces entries with freshly parsed tags. Loudness results
+    // and fingerprints are kept for files that haven't changed, and for all
+    // of them when tagsOnly says only the tags were rewritten (see TagWriter).
+    void update(const QList<TrackInfo> &tracks, bool tagsOnly = false);
+
+    // Stores loudness analysis results and refreshes album loudness;
+    // returns the number applied
+    int setLoudness(const QList<LoudnessResult> &results);
+
+    // Stores fingerprints; returns the number applied
+    int setFingerprints(const QList<FingerprintResult> &results);
+
+    // Drops the given files, and everything under any of them that is a
+    // directory; returns the rows removed, ascending and numbered as they
+    // were before the removal
+    QList<int> remove(const QStringList &paths);
+
+    int row(const QString &path) const { return store.find(path); }
+
+private:
+    QString fileName;
+    QStringList rootPaths;
+    TrackStore store;
+};
+
+#endif // LIBRARYINDEX_H
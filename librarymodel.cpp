@@ -0,0 +1,213 @@
+#include "librarymodel.h"
+
+namespace {
+
+const int ChunkSize = 50000;
+
+} // namespace
+
+LibraryModel::LibraryModel(QObject *parent)
+    : QAbstractTableModel(parent),
+      insertedRows(0)
+{
+    chunkTimer.setInterval(0);
+    connect(&chunkTimer, &QTimer::timeout, this, &LibraryModel::insertChunk);
+}
+
+int LibraryModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : insertedRows;
+}
+
+int LibraryModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant LibraryModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= insertedRows) {
+        return QVariant();
+    }
+
+    const int row = index.row();
+
+    if (role == Qt::DisplayRole || role == Qt::ToolTipRole) {
+        switch (index.column()) {
+        case Title:
+            return tracks.title(row).toString();
+        case Artist:
+            return tracks.artist(row);
+        case Album:
+            return tracks.album(row);
+        case Duration:
+            return formatDuration(tracks.duration(row));
+        case Path:
+            return tracks.path(row);
+        }
+    } else if (role == Qt::TextAlignmentRole && index.column() == Duration) {
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    }
+
+    return QVariant();
+}
+
+QVariant LibraryModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QAbstractTableModel::headerData(section, orientation, role);
+    }
+
+    switch (section) {
+    case Title:
+        return QStringLiteral("Title");
+    case Artist:
+        return QStringLiteral("Artist");
+    case Album:
+        return QStringLiteral("Album");
+    case Duration:
+        return QStringLiteral("Duration");
+    case Path:
+        return QStringLiteral("Path");
+    }
+
+    return QVariant();
+}
+
+void LibraryModel::setTracks(const TrackStore &newTracks)
+{
+    beginResetModel();
+    tracks = newTracks;
+    insertedRows = 0;
+    endResetModel();
+
+    if (tracks.isEmpty()) {
+        chunkTimer.stop();
+        emit populated();
+        return;
+    }
+
+    // First chunk goes in right away so the table is never blank
+    insertChunk();
+}
+
+void LibraryModel::clear()
+{
+    setTracks(TrackStore());
+}
+
+void LibraryModel::appendTracks(const QList<TrackInfo> &added)
+{
+    if (added.isEmpty()) {
+        return;
+    }
+
+    for (const TrackInfo &track : added) {
+        tracks.append(track);
+    }
+
+    // While the initial chunks are still going in, they pick the new rows up too
+    if (!chunkTimer.isActive()) {
+        beginInsertRows(QModelIndex(), insertedRows, int(tracks.size()) - 1);
+        insertedRows = int(tracks.size());
+        endInsertRows();
+    }
+}
+
+void LibraryModel::setTrack(int row, const TrackInfo &track)
+{
+    if (row < 0 || row >= tracks.size()) {
+        return;
+    }
+
+    tracks.set(row, track);
+    if (row < insertedRows) {
+        emit dataChanged(index(row, 0), index(row, ColumnCount - 1));
+    }
+}
+
+void LibraryModel::removeTracks(const QList<int> &rows, const TrackStore &remaining)
+{
+    // From the last run back, so the rows of each run are numbered as in
+    // the old store, which answers data() until the new one takes over
+    int end = int(rows.size());
+    while (end > 0) {
+        int begin = end - 1;
+        while (begin > 0 && rows.at(begin - 1) == rows.at(begin) - 1) {
+            --begin;
+        }
+
+        // Rows the initial chunks haven't reached were never shown
+        const int first = rows.at(begin);
+        const int last = qMin(rows.at(end - 1), insertedRows - 1);
+        if (first <= last) {
+            beginRemoveRows(QModelIndex(), first, last);
+            insertedRows -= last - first + 1;
+            endRemoveRows();
+        }
+        end = begin;
+    }
+
+    tracks = remaining;
+}
+
+void LibraryModel::insertChunk()
+{
+    const int last = qMin(insertedRows + ChunkSize, int(tracks.size())) - 1;
+
+    if (last >= insertedRows) {
+        beginInsertRows(QModelIndex(), insertedRows, last);
+        insertedRows = last + 1;
+        endInsertRows();
+    }
+
+    if (insertedRows < tracks.size()) {
+        chunkTimer.start();
+    } else {
+        chunkTimer.stop();
+        emit populated();
+    }
+}
+
+QString LibraryModel::formatDuration(qint64 ms)
+{
+    int seconds = ms / 1000;
+    int minutes = seconds / 60;
+    seconds %= 60;
+
+    return QString("%1:%2").arg(minutes).arg(seconds, 2, 10, QChar('0'));
+}
+
+LibraryFilterModel::LibraryFilterModel(QObject *parent)
+    : QSortFilterProxyModel(parent),
+      filtering(false)
+{
+}
+
+void LibraryFilterModel::setMatches(const QBitArray &rows)
+{
+    matches = rows;
+    filtering = true;
+    invalidateFilter();
+}
+
+void LibraryFilterModel::clearMatches()
+{
+    if (!filtering) {
+        return;
+    }
+
+    matches.clear();
+    filtering = false;
+    invalidateFilter();
+}
+
+bool LibraryFilterModel::filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const
+{
+    Q_UNUSED(sourceParent);
+
+    if (!filtering) {
+        return true;
+    }
+    return sourceRow < matches.size() && matches.testBit(sourceRow);
+}
@@ -0,0 +1,78 @@
+#ifndef LIBRARYMODEL_H
+#define LIBRARYMODEL_H
+
+#include <QAbstractTableModel>
+#include <QBitArray>
+#include <QList>
+#include <QSortFilterProxyModel>
+#include <QTimer>
+#include "tagreader.h"
+#include "trackstore.h"
+
+// Table model for the Library tab. Tracks are kept in a columnar TrackStore
+// (shared copy-on-write with the library index) and cell text is produced
+// on demand in data(), so no per-cell objects are allocated. Large
+// libraries are exposed to the view in chunks, one beginInsertRows() per
+// chunk, so the GUI stays responsive while a million rows come in.
+class LibraryModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column { Title, Artist, Album, Duration, Path, ColumnCount };
+
+    explicit LibraryModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    void setTracks(const TrackStore &tracks);
+    void clear();
+
+    // Incremental edits, for changes picked up by the library watcher
+    void appendTracks(const QList<TrackInfo> &added);
+    void setTrack(int row, const TrackInfo &track);
+    // Takes out rows (ascending, as LibraryIndex::remove() returns them)
+    // run by run, so views keep their selection and scroll position;
+    // remaining is the store without them
+    void removeTracks(const QList<int> &rows, const TrackStore &remaining);
+
+    TrackInfo track(int row) const { return tracks.at(row); }
+
+signals:
+    void populated();
+
+private slots:
+    void insertChunk();
+
+private:
+    static QString formatDuration(qint64 ms);
+
+    TrackStore tracks;
+    int insertedRows;
+    QTimer chunkTimer;
+};
+
+// Applies a precomputed row mask (one bit per source row) in a single
+// filter pass, instead of hiding rows in the view one by one
+class LibraryFilterModel : public QSortFilterProxyModel
+{
+    Q_OBJECT
+
+public:
+    explicit LibraryFilterModel(QObject *parent = nullptr);
+
+    void setMatches(const QBitArray &rows);
+    void clearMatches();
+
+protected:
+    bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const override;
+
+private:
+    QBitArray matches;
+    bool filtering;
+};
+
+#endif // LIBRARYMODEL_H
@@ -0,0 +1,99 @@
+#include "libraryscanner.h"
+#include "trace.h"
+#include <QtConcurrent>
+
+LibraryScanner::LibraryScanner(LibraryIndex *index, QObject *parent)
+    : QObject(parent),
+      index(index),
+      running(false),
+      indexChanged(false)
+{
+    connect(&watcher, &QFutureWatcher<TrackInfo>::progressRangeChanged, this, &LibraryScanner::progressRangeChanged);
+    connect(&watcher, &QFutureWatcher<TrackInfo>::progressValueChanged, this, &LibraryScanner::progressValueChanged);
+    connect(&watcher, &QFutureWatcher<TrackInfo>::finished, this, &LibraryScanner::tagsRead);
+    connect(&refreshWatcher, &QFutureWatcher<Refresh>::finished, this, &LibraryScanner::refreshed);
+}
+
+LibraryScanner::~LibraryScanner()
+{
+    refreshWatcher.waitForFinished();
+    watcher.cancel();
+    watcher.waitForFinished();
+}
+
+void LibraryScanner::scan(const QStringList &roots)
+{
+    if (running) {
+        return;
+    }
+    running = true;
+
+    // Only stats files; just the new and changed ones need their tags read.
+    // The walk takes a while on a large library, so it runs on a copy off the
+    // caller's thread (the copy shares the store's columns until refresh() edits them).
+    emit progressRangeChanged(0, 0);
+    const LibraryIndex snapshot = *index;
+    refreshWatcher.setFuture(QtConcurrent::run([snapshot, roots]() {
+        TRACE_SCOPE("scan", "LibraryScanner::scan");
+        Refresh result{snapshot, QStringList()};
+        result.files = result.index.refresh(roots);
+        return result;
+    }));
+}
+
+void LibraryScanner::refreshed()
+{
+    // Entries for files that are gone were dropped, so this pass always saves
+    *index = refreshWatcher.result().index;
+    indexChanged = true;
+    readTags(refreshWatcher.result().files);
+}
+
+void LibraryScanner::update(const QStringList &changed, const QStringList &removed)
+{
+    for (const QString &path : changed) {
+        pendingChanged.insert(path);
+    }
+    pendingRemoved.append(removed);
+    if (running) {
+        return;
+    }
+    running = true;
+
+    // Removals need no I/O
+    indexChanged = !index->remove(pendingRemoved).isEmpty();
+    pendingRemoved.clear();
+
+    const QStringList files(pendingChanged.cbegin(), pendingChanged.cend());
+    pendingChanged.clear();
+    readTags(files);
+}
+
+void LibraryScanner::cancel()
+{
+    watcher.cancel();
+}
+
+void LibraryScanner::readTags(const QStringList &files)
+{
+    // The reader only touches file headers; finished() arrives through the
+    // watcher even when there is nothing to read
+    emit progressRangeChanged(0, int(files.size()));
+    watcher.setFuture(QtConcurrent::mapped(files, &TagReader::readTrack));
+}
+
+void LibraryScanner::tagsRead()
+{
+    const QList<TrackInfo> tracks = watcher.future().results();
+    if (!tracks.isEmpty()) {
+        index->update(tracks);
+    }
+    const bool saved = (tracks.isEmpty() && !indexChanged) || index->save();
+    indexChanged = false;
+    running = false;
+    emit finished(int(tracks.size()), saved);
+
+    if (!running && (!pendingChanged.isEmpty() || !pendingRemoved.isEmpty())) {
+        update({}, {});
+    }
+}
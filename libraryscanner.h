@@ -0,0 +1,65 @@
+#ifndef LIBRARYSCANNER_H
+#define LIBRARYSCANNER_H
+
+#include <QFutureWatcher>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include "libraryindex.h"
+
+// Brings a LibraryIndex up to date without blocking the caller's event
+// loop: a scan stats the roots on a worker (in parallel, see
+// LibraryIndex::refresh) against a copy of the index, which replaces the
+// caller's once the walk is done, reads the tags of new and changed files
+// on the thread pool, then updates and saves the index. The main window shows its progress in a
+// dialog; the daemon scans and follows the library watcher with it.
+class LibraryScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LibraryScanner(LibraryIndex *index, QObject *parent = nullptr);
+    ~LibraryScanner();
+
+    bool isRunning() const { return running; }
+
+    // Ignored while a pass is running
+    void scan(const QStringList &roots);
+
+    // Applies a batch from LibraryWatcher; batches arriving during a pass
+    // are merged and applied when it ends
+    void update(const QStringList &changed, const QStringList &removed);
+
+    // Stops reading tags; what was read so far is still stored
+    void cancel();
+
+signals:
+    void progressRangeChanged(int minimum, int maximum);
+    void progressValueChanged(int value);
+    // updated is the number of files whose tags were read; saved is false
+    // if the index could not be written
+    void finished(int updated, bool saved);
+
+private slots:
+    void refreshed();
+    void tagsRead();
+
+private:
+    struct Refresh
+    {
+        LibraryIndex index;  // Without the entries whose files are gone
+        QStringList files;   // New or changed, to read tags from
+    };
+
+    void readTags(const QStringList &files);
+
+    LibraryIndex *index;
+    QFutureWatcher<Refresh> refreshWatcher;
+    QFutureWatcher<TrackInfo> watcher;
+    bool running;
+    bool indexChanged; // Beyond the tags read, so the pass must save
+    QSet<QString> pendingChanged;
+    QStringList pendingRemoved;
+};
+
+#endif // LIBRARYSCANNER_H
@@ -0,0 +1,331 @@
+#include "librarywatcher.h"
+#include "libraryindex.h"
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSocketNotifier>
+#include <QtConcurrent>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const int QuietMs = 500;     // Report once no event arrived for this long
+const int MaxDelayMs = 3000; // ...but never hold changes back longer than this
+const int RescanMs = 10 * 60 * 1000; // Between rescans once watches ran out
+
+#ifdef Q_OS_LINUX
+const uint32_t WatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                         | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+#endif
+
+} // namespace
+
+LibraryWatcher::LibraryWatcher(QObject *parent)
+    : QObject(parent),
+      fd(-1),
+      notifier(nullptr),
+      stopping(false),
+      generation(0)
+{
+    quietTimer.setSingleShot(true);
+    quietTimer.setInterval(QuietMs);
+    connect(&quietTimer, &QTimer::timeout, this, &LibraryWatcher::flush);
+    rescanTimer.setSingleShot(true);
+    rescanTimer.setInterval(RescanMs);
+    connect(&rescanTimer, &QTimer::timeout, this, &LibraryWatcher::overflowed);
+    connect(&walker, &QFutureWatcher<WalkResult>::finished, this, &LibraryWatcher::walkFinished);
+
+#ifdef Q_OS_LINUX
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0) {
+        notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        connect(notifier, &QSocketNotifier::activated, this, &LibraryWatcher::readEvents);
+    }
+#endif
+}
+
+LibraryWatcher::~LibraryWatcher()
+{
+    stopping = true;
+    walker.waitForFinished();
+#ifdef Q_OS_LINUX
+    if (fd >= 0) {
+        delete notifier;
+        ::close(fd);
+    }
+#endif
+}
+
+void LibraryWatcher::setRoots(const QStringList &roots)
+{
+    clear();
+    for (const QString &root : roots) {
+        watchTree(QDir::cleanPath(root), false);
+    }
+}
+
+void LibraryWatcher::clear()
+{
+    // A walk stops at its next directory; whatever it found is dropped
+    stopping = true;
+    walker.waitForFinished();
+    stopping = false;
+    pendingWalks.clear();
+    ++generation;
+    rescanTimer.stop();
+
+#ifdef Q_OS_LINUX
+    for (auto it = dirByWatch.constBegin(); it != dirByWatch.constEnd(); ++it) {
+        inotify_rm_watch(fd, it.key());
+    }
+#endif
+    dirByWatch.clear();
+    watchByDir.clear();
+    changedPaths.clear();
+    removedPaths.clear();
+    quietTimer.stop();
+    firstPending.invalidate();
+}
+
+void LibraryWatcher::watchTree(const QString &dir, bool reportFiles)
+{
+#ifdef Q_OS_LINUX
+    if (fd < 0) {
+        return;
+    }
+    pendingWalks.append(qMakePair(dir, reportFiles));
+    startWalk();
+#else
+    Q_UNUSED(dir);
+    Q_UNUSED(reportFiles);
+#endif
+}
+
+void LibraryWatcher::startWalk()
+{
+    if (walker.isRunning() || pendingWalks.isEmpty()) {
+        return;
+    }
+    const QPair<QString, bool> next = pendingWalks.takeFirst();
+    const int walkGeneration = generation;
+    walker.setFuture(QtConcurrent::run([this, next, walkGeneration]() {
+        return walk(next.first, next.second, walkGeneration);
+    }));
+}
+
+LibraryWatcher::WalkResult LibraryWatcher::walk(const QString &root, bool reportFiles, int walkGeneration)
+{
+    WalkResult result;
+    result.generation = walkGeneration;
+#ifdef Q_OS_LINUX
+    QStringList dirs = {root};
+    while (!dirs.isEmpty() && !stopping) {
+        const QString dir = dirs.takeLast();
+
+        // Watch first, then list: a file created in between is seen twice, never missed.
+        // Adding and recording the watch happen under the lock, so readEvents()
+        // knows the descriptor by the time it can see an event for it.
+        {
+            QMutexLocker locker(&watchLock);
+            if (!watchByDir.contains(dir)) {
+                const int wd = inotify_add_watch(fd, QFile::encodeName(dir).constData(), WatchMask);
+                if (wd < 0) {
+                    if (errno == ENOSPC) {
+                        result.limitReached = true;
+                        return result;
+                    }
+                    continue; // Gone again, or unreadable
+                }
+                // The kernel reuses a descriptor when a directory is watched twice under two names
+                const QString previous = dirByWatch.value(wd);
+                if (!previous.isEmpty()) {
+                    watchByDir.remove(previous);
+                }
+                dirByWatch.insert(wd, dir);
+                watchByDir.insert(dir, wd);
+            }
+        }
+
+        QDirIterator it(dir, QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot);
+        while (it.hasNext()) {
+            const QString path = it.next();
+            const QFileInfo info = it.fileInfo();
+            if (info.isDir()) {
+                if (!info.isSymLink()) {
+                    dirs.append(path);
+                }
+            } else if (reportFiles && isAudioFile(path)) {
+                // Landed in a new directory before its watch existed
+                result.files.append(path);
+            }
+        }
+    }
+#else
+    Q_UNUSED(root);
+    Q_UNUSED(reportFiles);
+#endif
+    return result;
+}
+
+void LibraryWatcher::walkFinished()
+{
+    const WalkResult result = walker.result();
+    if (result.generation == generation) {
+        for (const QString &path : result.files) {
+            fileChanged(path);
+        }
+        if (result.limitReached && !rescanTimer.isActive()) {
+            qWarning("Library watcher: out of inotify watches (raise fs.inotify.max_user_watches); "
+                     "rescanning every %d minutes instead", RescanMs / 60000);
+            rescanTimer.start();
+        }
+    }
+    startWalk();
+}
+
+void LibraryWatcher::readEvents()
+{
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buffer[64 * 1024];
+
+    for (;;) {
+        const ssize_t length = ::read(fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break; // EAGAIN: drained
+        }
+
+        for (ssize_t pos = 0; pos < length;) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(buffer + pos);
+            pos += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                changedPaths.clear();
+                removedPaths.clear();
+                quietTimer.stop();
+                firstPending.invalidate();
+                emit overflowed();
+                continue;
+            }
+
+            QMutexLocker locker(&watchLock);
+            const QString dir = dirByWatch.value(event->wd);
+            if (dir.isEmpty()) {
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED) {
+                // Watch is gone (directory deleted or unmounted)
+                dirByWatch.remove(event->wd);
+                watchByDir.remove(dir);
+                continue;
+            }
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                continue; // The parent's IN_DELETE/IN_MOVED_FROM already reported it
+            }
+
+            const QString path = dir + QLatin1Char('/') + QFile::decodeName(event->name);
+            const bool isDir = event->mask & IN_ISDIR;
+
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                if (isDir) {
+                    // Forget watches below it; a moved directory gets new ones where it lands
+                    const QString prefix = path + QLatin1Char('/');
+                    for (auto it = watchByDir.begin(); it != watchByDir.end();) {
+                        if (it.key() == path || it.key().startsWith(prefix)) {
+                            inotify_rm_watch(fd, it.value());
+                            dirByWatch.remove(it.value());
+                            it = watchByDir.erase(it);
+                        } else {
+                            ++it;
+                        }
+                    }
+                    pathRemoved(path);
+                } else if (isAudioFile(path)) {
+                    pathRemoved(path);
+                }
+            } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if (isDir) {
+                    watchTree(path, true);
+                } else if ((event->mask & IN_MOVED_TO) && isAudioFile(path)) {
+                    // A created file is reported on IN_CLOSE_WRITE, once its tags are complete
+                    fileChanged(path);
+                }
+            } else if ((event->mask & IN_CLOSE_WRITE) && isAudioFile(path)) {
+                fileChanged(path);
+            }
+        }
+    }
+#endif
+}
+
+void LibraryWatcher::fileChanged(const QString &path)
+{
+    removedPaths.remove(path);
+    changedPaths.insert(path);
+    schedule();
+}
+
+void LibraryWatcher::pathRemoved(const QString &path)
+{
+    // A file written and deleted within one burst never needs its tags read
+    changedPaths.remove(path);
+    removedPaths.insert(path);
+    schedule();
+}
+
+void LibraryWatcher::schedule()
+{
+    if (!quietTimer.isActive() && !firstPending.isValid()) {
+        firstPending.start();
+    }
+
+    const qint64 waited = firstPending.elapsed();
+    quietTimer.start(int(qBound<qint64>(0, MaxDelayMs - waited, QuietMs)));
+}
+
+void LibraryWatcher::flush()
+{
+    firstPending.invalidate();
+
+    if (changedPaths.isEmpty() && removedPaths.isEmpty()) {
+        return;
+    }
+
+    // Removals are applied before changes, so a directory that was deleted and
+    // recreated within one burst comes back. Files that were created and then
+    // moved or deleted again are simply gone.
+    const QStringList removed(removedPaths.cbegin(), removedPaths.cend());
+    QStringList changed;
+    changed.reserve(changedPaths.size());
+    for (const QString &path : std::as_const(changedPaths)) {
+        if (QFileInfo::exists(path)) {
+            changed.append(path);
+        }
+    }
+
+    changedPaths.clear();
+    removedPaths.clear();
+    emit changesReady(changed, removed);
+}
+
+bool LibraryWatcher::isAudioFile(const QString &path)
+{
+    static const QStringList suffixes = [] {
+        QStringList result;
+        for (const QString &filter : LibraryIndex::nameFilters()) {
+            result.append(filter.mid(1)); // "*.mp3" -> ".mp3"
+        }
+        return result;
+    }();
+
+    for (const QString &suffix : suffixes) {
+        if (path.endsWith(suffix, Qt::CaseInsensitive)) {
+            return true;
+        }
+    }
+    return false;
+}
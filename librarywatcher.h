@@ -0,0 +1,89 @@
+#ifndef LIBRARYWATCHER_H
+#define LIBRARYWATCHER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <atomic>
+
+class QSocketNotifier;
+
+// Follows the library roots for changes so the index can be updated
+// without a rescan. On Linux every directory under the roots gets an
+// inotify watch; events are collected into sets of changed and removed
+// paths and reported once things have been quiet for a moment (or after
+// a maximum delay during a long copy), so a burst of thousands of events
+// becomes one update. Trees are walked on the thread pool, one at a time,
+// each directory watched before it is listed. If the kernel runs out of
+// watches (fs.inotify.max_user_watches) the rest of the tree can't be
+// followed, so overflowed() then fires periodically to ask for rescans.
+// Elsewhere the watcher is inert and rescans remain the way to pick up
+// changes.
+class LibraryWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LibraryWatcher(QObject *parent = nullptr);
+    ~LibraryWatcher();
+
+    void setRoots(const QStringList &roots);
+
+signals:
+    // removed: deleted audio files, or directories that went away with
+    // everything under them. changed: audio files that are new or were
+    // rewritten. Apply removed first.
+    void changesReady(const QStringList &changed, const QStringList &removed);
+
+    // The kernel dropped events, or not every directory has a watch; only
+    // a full rescan can be trusted now
+    void overflowed();
+
+private slots:
+    void readEvents();
+    void walkFinished();
+    void flush();
+
+private:
+    struct WalkResult
+    {
+        int generation = 0;
+        QStringList files;         // Audio files found, when asked for
+        bool limitReached = false; // Out of inotify watches
+    };
+
+    void clear();
+    void watchTree(const QString &dir, bool reportFiles);
+    void startWalk();
+    WalkResult walk(const QString &root, bool reportFiles, int generation);
+    void fileChanged(const QString &path);
+    void pathRemoved(const QString &path);
+    void schedule();
+    static bool isAudioFile(const QString &path);
+
+    int fd;
+    QSocketNotifier *notifier;
+    QMutex watchLock; // The walk adds watches while events are read
+    QHash<int, QString> dirByWatch;
+    QHash<QString, int> watchByDir;
+
+    QFutureWatcher<WalkResult> walker;
+    QList<QPair<QString, bool>> pendingWalks;
+    std::atomic<bool> stopping;
+    int generation;
+    QTimer rescanTimer;
+
+    QSet<QString> changedPaths;
+    QSet<QString> removedPaths;
+    QTimer quietTimer;
+    QElapsedTimer firstPending;
+};
+
+#endif // LIBRARYWATCHER_H
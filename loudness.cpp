@@ -0,0 +1,303 @@
+#include "loudness.h"
+#include "trace.h"
+#include "trackdecoder.h"
+#include <QHash>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+namespace {
+
+const double Pi = 3.14159265358979323846;
+const double AbsoluteGate = -70.0; // LUFS
+const double RelativeGate = -10.0; // LU below the absolutely gated loudness
+const int BlockSubBlocks = 4;      // 400 ms blocks from 100 ms steps
+const int Phases = 4;              // True peak oversampling
+const int TapsPerPhase = 12;
+
+double energyToLoudness(double energy)
+{
+    return -0.691 + 10.0 * std::log10(energy);
+}
+
+double loudnessToEnergy(double loudness)
+{
+    return std::pow(10.0, (loudness + 0.691) / 10.0);
+}
+
+// Windowed-sinc interpolator for 4x oversampling; each phase sums to one
+struct Interpolator
+{
+    float taps[Phases][TapsPerPhase];
+
+    Interpolator()
+    {
+        const int length = Phases * TapsPerPhase;
+        const double centre = (length - 1) / 2.0;
+        for (int phase = 0; phase < Phases; ++phase) {
+            double sum = 0.0;
+            for (int k = 0; k < TapsPerPhase; ++k) {
+                const int n = k * Phases + phase;
+                const double x = (n - centre) / Phases;
+                const double sinc = x == 0.0 ? 1.0 : std::sin(Pi * x) / (Pi * x);
+                const double window = 0.5 - 0.5 * std::cos(2.0 * Pi * (n + 0.5) / length);
+                taps[phase][k] = float(sinc * window);
+                sum += taps[phase][k];
+            }
+            for (int k = 0; k < TapsPerPhase; ++k) {
+                taps[phase][k] = float(taps[phase][k] / sum);
+            }
+        }
+    }
+};
+
+const Interpolator &interpolator()
+{
+    static const Interpolator instance;
+    return instance;
+}
+
+} // namespace
+
+LoudnessMeter::LoudnessMeter(int sampleRate, int channelCount)
+    : rate(sampleRate > 0 ? sampleRate : 48000),
+      channels(qBound(1, channelCount, int(MaxChannels))),
+      subBlockFrames(std::max(1, rate / 10)),
+      subBlockFilled(0),
+      subBlockSum(0.0),
+      historyPos(0),
+      peak(0.0f)
+{
+    // BS.1770 K-weighting for any sample rate (the shelf and RLB high-pass
+    // re-derived from their analog prototypes, as libebur128 does)
+    double f0 = 1681.974450955533;
+    const double gain = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = std::tan(Pi * f0 / rate);
+    const double vh = std::pow(10.0, gain / 20.0);
+    const double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    shelf = {(vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+             2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = std::tan(Pi * f0 / rate);
+    a0 = 1.0 + k / q + k * k;
+    highpass = {1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+
+    // Channel weights for up to 5.1 in the usual L R C LFE Ls Rs order
+    for (int ch = 0; ch < MaxChannels; ++ch) {
+        weights[ch] = ch == 3 && channels >= 6 ? 0.0f : (ch >= 4 && channels >= 6 ? 1.41f : 1.0f);
+        for (double &s : state[ch]) {
+            s = 0.0;
+        }
+        std::fill(std::begin(history[ch]), std::end(history[ch]), 0.0f);
+    }
+}
+
+void LoudnessMeter::addFrames(const float *samples, qint64 frames)
+{
+    const Interpolator &interp = interpolator();
+
+    for (qint64 i = 0; i < frames; ++i) {
+        const float *frame = samples + i * channels;
+        double frameSum = 0.0;
+
+        historyPos = (historyPos + TapsPerPhase - 1) % TapsPerPhase;
+        for (int ch = 0; ch < channels; ++ch) {
+            const double x = frame[ch];
+
+            double *z = state[ch];
+            const double y1 = shelf.b0 * x + z[0];
+            z[0] = shelf.b1 * x - shelf.a1 * y1 + z[1];
+            z[1] = shelf.b2 * x - shelf.a2 * y1;
+            const double y2 = highpass.b0 * y1 + z[2];
+            z[2] = highpass.b1 * y1 - highpass.a1 * y2 + z[3];
+            z[3] = highpass.b2 * y1 - highpass.a2 * y2;
+            frameSum += weights[ch] * y2 * y2;
+
+            // Newest sample at historyPos, older ones after it; stored twice so reads never wrap
+            float *h = history[ch];
+            h[historyPos] = frame[ch];
+            h[historyPos + TapsPerPhase] = frame[ch];
+            const float *recent = h + historyPos;
+            for (int phase = 0; phase < Phases; ++phase) {
+                const float *taps = interp.taps[phase];
+                float value = 0.0f;
+                for (int t = 0; t < TapsPerPhase; ++t) {
+                    value += taps[t] * recent[t];
+                }
+                peak = std::max(peak, std::fabs(value));
+            }
+            peak = std::max(peak, std::fabs(frame[ch]));
+        }
+
+        subBlockSum += frameSum;
+        if (++subBlockFilled == subBlockFrames) {
+            subBlocks.push_back(subBlockSum);
+            subBlockSum = 0.0;
+            subBlockFilled = 0;
+        }
+    }
+
+    // Keep the filter state out of denormals across silence
+    for (int ch = 0; ch < channels; ++ch) {
+        for (double &s : state[ch]) {
+            if (std::fabs(s) < 1e-30) {
+                s = 0.0;
+            }
+        }
+    }
+}
+
+void LoudnessMeter::gate(double &energy, int &count) const
+{
+    energy = 0.0;
+    count = 0;
+
+    const int blocks = int(subBlocks.size()) - BlockSubBlocks + 1;
+    if (blocks <= 0) {
+        return;
+    }
+
+    const double scale = 1.0 / double(subBlockFrames * BlockSubBlocks);
+    std::vector<double> energies(static_cast<size_t>(blocks));
+    double running = 0.0;
+    for (int i = 0; i < int(subBlocks.size()); ++i) {
+        running += subBlocks[i];
+        if (i >= BlockSubBlocks) {
+            running -= subBlocks[i - BlockSubBlocks];
+        }
+        if (i >= BlockSubBlocks - 1) {
+            energies[size_t(i - BlockSubBlocks + 1)] = std::max(0.0, running) * scale;
+        }
+    }
+
+    const double absolute = loudnessToEnergy(AbsoluteGate);
+    double sum = 0.0;
+    int passed = 0;
+    for (double e : energies) {
+        if (e > absolute) {
+            sum += e;
+            ++passed;
+        }
+    }
+    if (passed == 0) {
+        return;
+    }
+
+    const double relative = loudnessToEnergy(energyToLoudness(sum / passed) + RelativeGate);
+    const double threshold = std::max(absolute, relative);
+    for (double e : energies) {
+        if (e > threshold) {
+            energy += e;
+            ++count;
+        }
+    }
+    if (count > 0) {
+        energy /= count;
+    }
+}
+
+double LoudnessMeter::integratedLoudness() const
+{
+    double energy;
+    int count;
+    gate(energy, count);
+    return count > 0 ? energyToLoudness(energy) : -std::numeric_limits<double>::infinity();
+}
+
+int LoudnessMeter::gatedBlocks() const
+{
+    double energy;
+    int count;
+    gate(energy, count);
+    return count;
+}
+
+namespace Loudness {
+
+LoudnessResult analyzeFile(const TrackInfo &track)
+{
+    TRACE_SCOPE_ARG("loudness", "Loudness::analyzeFile", track.path);
+
+    LoudnessResult result;
+    result.path = track.path;
+    result.modified = track.modified;
+    result.size = track.size;
+
+    std::unique_ptr<LoudnessMeter> meter;
+    const bool ok = TrackDecoder::decodeFile(track.path, [&](const float *samples, qint64 frames, int rate, int channels) {
+        if (!meter) {
+            meter = std::make_unique<LoudnessMeter>(rate, channels);
+        }
+        meter->addFrames(samples, frames);
+        return true;
+    });
+    if (!ok || !meter) {
+        return result;
+    }
+
+    result.valid = true;
+    result.gatedBlocks = meter->gatedBlocks();
+    result.loudness = result.gatedBlocks > 0 ? float(meter->integratedLoudness()) : float(AbsoluteGate);
+    result.peak = meter->truePeak();
+    return result;
+}
+
+float playbackGain(const TrackInfo &track, Mode mode)
+{
+    if (mode == Off || track.gatedBlocks <= 0) {
+        return 1.0f;
+    }
+
+    const double loudness = mode == Album ? track.albumLoudness : track.loudness;
+    double gain = std::pow(10.0, (ReferenceLoudness - loudness) / 20.0);
+
+    // Clip protection: never push the track's true peak past full scale
+    if (track.peak > 0.0f) {
+        gain = std::min(gain, 1.0 / track.peak);
+    }
+    return float(gain);
+}
+
+void updateAlbumLoudness(TrackStore &tracks)
+{
+    struct Album
+    {
+        double energy = 0.0;
+        qint64 blocks = 0;
+        bool complete = true;
+    };
+
+    // Folder and album are both interned, so the pair of ids is the key
+    auto albumKey = [&tracks](int row) {
+        return (quint64(tracks.directoryColumn().at(row)) << 32) | tracks.albumColumn().at(row);
+    };
+    const qint64 unknownAlbum = tracks.albumDictionary().find(QStringLiteral("Unknown Album"));
+
+    QHash<quint64, Album> albums;
+    for (int row = 0; row < tracks.size(); ++row) {
+        Album &album = albums[albumKey(row)];
+        const qint32 gatedBlocks = tracks.gatedBlocks(row);
+        if (gatedBlocks < 0) {
+            album.complete = false;
+        } else if (gatedBlocks > 0) {
+            album.energy += loudnessToEnergy(tracks.trackLoudness(row)) * gatedBlocks;
+            album.blocks += gatedBlocks;
+        }
+    }
+
+    for (int row = 0; row < tracks.size(); ++row) {
+        const Album &album = albums[albumKey(row)];
+        if (album.complete && album.blocks > 0 && tracks.albumColumn().at(row) != unknownAlbum) {
+            tracks.setAlbumLoudness(row, float(energyToLoudness(album.energy / album.blocks)));
+        } else {
+            tracks.setAlbumLoudness(row, tracks.trackLoudness(row));
+        }
+    }
+}
+
+} // namespace Loudness
@@ -0,0 +1,94 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <QList>
+#include <QString>
+#include <vector>
+#include "tagreader.h"
+#include "trackstore.h"
+
+// EBU R128 / ITU-R BS.1770-4 loudness meter: K-weighting, 400 ms blocks
+// with 75% overlap, absolute (-70 LUFS) and relative (-10 LU) gates, and a
+// 4x oversampled true peak. Feed it interleaved float samples of one track.
+class LoudnessMeter
+{
+public:
+    static const int MaxChannels = 8;
+
+    LoudnessMeter(int sampleRate, int channelCount);
+
+    int sampleRate() const { return rate; }
+    int channelCount() const { return channels; }
+
+    void addFrames(const float *samples, qint64 frames);
+
+    // Integrated loudness in LUFS, or -infinity if no block passed the gates
+    double integratedLoudness() const;
+    int gatedBlocks() const;
+    // Linear; 1.0 is full scale
+    float truePeak() const { return peak; }
+
+private:
+    struct Biquad
+    {
+        double b0, b1, b2, a1, a2;
+    };
+
+    void gate(double &energy, int &count) const;
+
+    int rate;
+    int channels;
+    Biquad shelf;
+    Biquad highpass;
+    double state[MaxChannels][4]; // Two direct form II transposed filters per channel
+    float weights[MaxChannels];
+
+    qint64 subBlockFrames;          // 100 ms
+    qint64 subBlockFilled;
+    double subBlockSum;
+    std::vector<double> subBlocks;  // Weighted sum of squares per 100 ms
+
+    // True peak: polyphase interpolation over the last taps of each channel
+    float history[MaxChannels][24];
+    int historyPos;
+    float peak;
+};
+
+struct LoudnessResult
+{
+    QString path;
+    qint64 modified = 0; // What the file looked like when analyzed, so stale results are dropped
+    qint64 size = 0;
+    bool valid = false;
+    qint32 gatedBlocks = 0;
+    float loudness = 0;
+    float peak = 0;
+};
+
+namespace Loudness {
+
+// ReplayGain 2.0 reference level
+const double ReferenceLoudness = -18.0;
+
+enum Mode {
+    Off,
+    Track,
+    Album
+};
+
+// Decodes the whole file on the calling thread (with its own event loop)
+// and measures it. Safe to run on many pool threads at once.
+LoudnessResult analyzeFile(const TrackInfo &track);
+
+// Linear gain that brings the track to the reference level, limited so
+// its true peak doesn't exceed full scale; 1.0 for unanalyzed tracks
+float playbackGain(const TrackInfo &track, Mode mode);
+
+// Album loudness is the gated-block-weighted energy mean of the tracks'
+// integrated loudness; tracks are grouped by folder and album tag.
+// Albums with an unanalyzed track get their tracks' own loudness.
+void updateAlbumLoudness(TrackStore &tracks);
+
+} // namespace Loudness
+
+#endif // LOUDNESS_H
@@ -1,10 +1,28 @@
 #include <QApplication>
 #include "mainwindow.h"
+#include "startupprofile.h"
+#include "tagwriter.h"
+#include "trace.h"
 
 int main(int argc, char *argv[])
 {
+    // Time to the first frame is reported by phase; see StartupProfile
+    StartupProfile::start();
     QApplication app(argc, argv);
+    StartupProfile::mark("QApplication");
+    
+    // PLAYER_TRACE=1 records from startup; otherwise Tools > Record Trace
+    Trace::setEnabled(qEnvironmentVariableIntValue("PLAYER_TRACE") != 0);
+    
+    app.setOrganizationName("MusicPlayer");
+    app.setApplicationName("LocalMusicPlayer");
+    
+    // Finish tag edits a crash interrupted before anything reads those files
+    TagWriter::recoverJournal();
+    StartupProfile::mark("tag journal");
+    
     MainWindow window;
     window.show();
+    StartupProfile::mark("show");
     return app.exec();
 }
\ No newline at end of file
@@ -22,32 +22,107 @@
 #include <QProgressDialog>    // Added missing include
 #include <QDirIterator>      // Added missing include
 #include <QEventLoop>
+#include <QSignalBlocker>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include "tagreader.h"
+#include "startupprofile.h"
+#include "tagwriter.h"
+#include "trace.h"
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent),
-      isPlaying(false),
       isMuted(false),
-      isShuffled(false),
-      repeatMode(0),
-      currentIndex(-1),
-      settings("MusicPlayer", "LocalMusicPlayer")
+      crossfadeSeconds(0),
+      crossfadeCurve(Crossfade::EqualPower),
+      settings("MusicPlayer", "LocalMusicPlayer"),
+      firstFrameShown(false),
+      activeSmartPlaylist(-1),
+      indexSavePending(false)
 {
-    // Initialize media player
-    mediaPlayer = new QMediaPlayer(this);
-    audioOutput = new QAudioOutput(this);
-    mediaPlayer->setAudioOutput(audioOutput);
+    // The session owns the audio engine (on its own thread) and the playlist
+    session = new PlayerSession(&libraryIndex, this);
+    playback = session->playback();
+    playlistModel = session->playlist();
+    libraryScanner = new LibraryScanner(&libraryIndex, this);
+    libraryWatcher = new LibraryWatcher(this);
+    controlServer = new ControlServer(session, &libraryIndex, this);
+    StartupProfile::mark("session");
     
     setupUi();
+    StartupProfile::mark("Now Playing tab");
     setupConnections();
     setupMenus();
+    StartupProfile::mark("connections and menus");
     loadSettings();
+    StartupProfile::mark("settings");
+    
+    // Pick up the queue where the last run left it, paused at the same spot;
+    // from here on every change is recorded as it happens
+    sessionStore = new SessionStore(session, SessionStore::defaultFileName(), this);
+    if (sessionStore->restore()) {
+        showPlayOrder();
+    }
+    sessionStore->start();
+    StartupProfile::mark("session restore");
+    
+    // Scripts and the command-line client drive this window through the control socket
+    if (!controlServer->listen()) {
+        statusBar()->showMessage("Control socket unavailable: " + controlServer->errorString(), 5000);
+    }
+    StartupProfile::mark("control socket");
     
     setWindowTitle("Qt Music Player");
     resize(1000, 600);
 }
 
+void MainWindow::paintEvent(QPaintEvent *event)
+{
+    QMainWindow::paintEvent(event);
+    
+    // The frame is flushed to the screen before the event loop comes round again
+    if (!firstFrameShown) {
+        firstFrameShown = true;
+        QTimer::singleShot(0, this, &MainWindow::startupFinished);
+    }
+}
+
+void MainWindow::startupFinished()
+{
+    StartupProfile::finish();
+    
+    // Restore the library from the on-disk index; rescans only touch changed files.
+    // Loading it and watching its folders can take a while, so it waits for the first frame.
+    TRACE_SCOPE("startup", "restoreLibrary");
+    if (libraryIndex.load()) {
+        populateLibrary();
+        libraryWatcher->setRoots(libraryIndex.roots());
+        
+        // The restored track was cued before its loudness was known
+        session->refreshGains();
+    }
+}
+
 MainWindow::~MainWindow()
 {
+    playlistImportWatcher.cancel();
+    
+    // Keep what the loudness analysis has finished so the next run resumes from there
+    if (loudnessWatcher.isRunning()) {
+        loudnessWatcher.cancel();
+        loudnessWatcher.waitForFinished();
+        loudnessResultsReady(0, loudnessTaken.size());
+        applyLoudnessResults();
+    }
+    if (fingerprintWatcher.isRunning()) {
+        fingerprintWatcher.cancel();
+        fingerprintWatcher.waitForFinished();
+        applyFingerprintResults();
+    }
+    if (indexSaveTimer->isActive() || indexSaveWatcher.isRunning()) {
+        saveIndexNow();
+    }
+    sessionStore->compact();
     saveSettings();
 }
 
@@ -71,6 +146,7 @@ void MainWindow::setupUi()
     albumArtLabel->setFixedSize(200, 200);
     albumArtLabel->setAlignment(Qt::AlignCenter);
     albumArtLabel->setStyleSheet("background-color: #f0f0f0; border: 1px solid #ddd;");
+    coverArtCache = new CoverArtCache(albumArtLabel->size(), this);
     
     QVBoxLayout *songInfoLayout = new QVBoxLayout();
     songTitleLabel = new QLabel("No song playing");
@@ -98,6 +174,10 @@ void MainWindow::setupUi()
     seekLayout->addWidget(seekSlider);
     seekLayout->addWidget(totalTimeLabel);
     
+    // Waveform overview under the seek bar, filled in once the cache has it
+    waveformView = new WaveformView();
+    waveformCache = new WaveformCache(this);
+    
     // Playback controls
     QHBoxLayout *controlsLayout = new QHBoxLayout();
     previousButton = new QPushButton("Previous");
@@ -129,11 +209,68 @@ void MainWindow::setupUi()
     // Add all layouts to the Now Playing tab
     nowPlayingLayout->addLayout(infoLayout);
     nowPlayingLayout->addLayout(seekLayout);
+    nowPlayingLayout->addWidget(waveformView);
     nowPlayingLayout->addLayout(controlsLayout);
     nowPlayingLayout->addLayout(volumeLayout);
     
-    // Library Tab
+    // Library model and search, which exist before the Library tab is first shown
+    libraryModel = new LibraryModel(this);
+    libraryFilter = new LibraryFilterModel(this);
+    libraryFilter->setSourceModel(libraryModel);
+    
+    // Search as you type, once typing pauses
+    searchTimer = new QTimer(this);
+    searchTimer->setSingleShot(true);
+    searchTimer->setInterval(150);
+    
+    // Watcher edits reach the index file a couple of seconds later, in one write
+    indexSaveTimer = new QTimer(this);
+    indexSaveTimer->setSingleShot(true);
+    indexSaveTimer->setInterval(2000);
+    
+    // The other tabs are empty pages until first shown; see ensureTab()
     libraryTab = new QWidget();
+    playlistsTab = new QWidget();
+    equalizerTab = new QWidget();
+    fileBrowserTab = new QWidget();
+    
+    // Add all tabs to the tab widget
+    tabWidget->addTab(nowPlayingTab, "Now Playing");
+    tabWidget->addTab(libraryTab, "Library");
+    tabWidget->addTab(playlistsTab, "Playlists");
+    tabWidget->addTab(equalizerTab, "Equalizer");
+    tabWidget->addTab(fileBrowserTab, "File Browser");
+    
+    // Add tab widget to main layout
+    mainLayout->addWidget(tabWidget);
+    
+    // Set central widget
+    setCentralWidget(centralWidget);
+    
+    // Set initial volume
+    playback->setVolume(volumeSlider->value() / 100.0);
+}
+
+void MainWindow::ensureTab(int index)
+{
+    QWidget *tab = tabWidget->widget(index);
+    if (tab == libraryTab) {
+        buildLibraryTab();
+    } else if (tab == playlistsTab) {
+        buildPlaylistsTab();
+    } else if (tab == equalizerTab) {
+        buildEqualizerTab();
+    } else if (tab == fileBrowserTab) {
+        buildFileBrowserTab();
+    }
+}
+
+void MainWindow::buildLibraryTab()
+{
+    if (libraryTableView) {
+        return;
+    }
+    TRACE_SCOPE("ui", "buildLibraryTab");
     QVBoxLayout *libraryLayout = new QVBoxLayout(libraryTab);
     
     QHBoxLayout *searchLayout = new QHBoxLayout();
@@ -141,26 +278,72 @@ void MainWindow::setupUi()
     searchBox->setPlaceholderText("Search library...");
     searchButton = new QPushButton("Search");
     QPushButton *scanButton = new QPushButton("Scan Library");
+    smartPlaylistBox = new QComboBox();
+    refreshSmartPlaylistBox();
     
+    searchLayout->addWidget(smartPlaylistBox);
     searchLayout->addWidget(searchBox);
     searchLayout->addWidget(searchButton);
     searchLayout->addWidget(scanButton);
     
-    libraryModel = new QStandardItemModel(this);
-    libraryModel->setHorizontalHeaderLabels({"Title", "Artist", "Album", "Duration", "Path"});
-    
     libraryTableView = new QTableView();
-    libraryTableView->setModel(libraryModel);
+    libraryTableView->setModel(libraryFilter);
     libraryTableView->setSelectionBehavior(QAbstractItemView::SelectRows);
     libraryTableView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    libraryTableView->setWordWrap(false);
     libraryTableView->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
     libraryTableView->verticalHeader()->setVisible(false);
+    // Fixed row heights let the view map scroll positions to rows without measuring them
+    libraryTableView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    libraryTableView->verticalHeader()->setDefaultSectionSize(libraryTableView->fontMetrics().height() + 6);
+    
+    // Duplicate groups, shown by Tools > Find Duplicates
+    duplicatesPanel = new QWidget();
+    QVBoxLayout *duplicatesLayout = new QVBoxLayout(duplicatesPanel);
+    duplicatesLayout->setContentsMargins(0, 0, 0, 0);
+    
+    QHBoxLayout *duplicatesHeader = new QHBoxLayout();
+    duplicatesLabel = new QLabel();
+    hideDuplicatesButton = new QPushButton("Hide");
+    duplicatesHeader->addWidget(duplicatesLabel, 1);
+    duplicatesHeader->addWidget(hideDuplicatesButton);
+    
+    duplicatesTree = new QTreeWidget();
+    duplicatesTree->setHeaderLabels({"Title", "Artist", "Album", "Duration", "Path"});
+    duplicatesTree->setUniformRowHeights(true);
+    duplicatesTree->header()->setSectionResizeMode(QHeaderView::Stretch);
+    
+    duplicatesLayout->addLayout(duplicatesHeader);
+    duplicatesLayout->addWidget(duplicatesTree);
+    duplicatesPanel->hide();
     
     libraryLayout->addLayout(searchLayout);
     libraryLayout->addWidget(libraryTableView);
+    libraryLayout->addWidget(duplicatesPanel);
     
-    // Playlists Tab
-    playlistsTab = new QWidget();
+    connect(searchButton, &QPushButton::clicked, this, &MainWindow::searchLibrary);
+    connect(searchBox, &QLineEdit::returnPressed, this, &MainWindow::searchLibrary);
+    connect(searchBox, &QLineEdit::textChanged, searchTimer, qOverload<>(&QTimer::start));
+    connect(smartPlaylistBox, qOverload<int>(&QComboBox::currentIndexChanged), this, [this](int index) {
+        showSmartPlaylist(index - 1);
+    });
+    connect(libraryTableView, &QTableView::doubleClicked, [this](const QModelIndex &index) {
+        playFile(libraryModel->track(libraryFilter->mapToSource(index).row()).path);
+    });
+    connect(duplicatesTree, &QTreeWidget::itemDoubleClicked, this, [this](QTreeWidgetItem *item) {
+        if (item->parent()) {
+            playFile(item->text(4));
+        }
+    });
+    connect(hideDuplicatesButton, &QPushButton::clicked, duplicatesPanel, &QWidget::hide);
+}
+
+void MainWindow::buildPlaylistsTab()
+{
+    if (playlistView) {
+        return;
+    }
+    TRACE_SCOPE("ui", "buildPlaylistsTab");
     QVBoxLayout *playlistsLayout = new QVBoxLayout(playlistsTab);
     
     QHBoxLayout *playlistButtonsLayout = new QHBoxLayout();
@@ -172,7 +355,13 @@ void MainWindow::setupUi()
     playlistButtonsLayout->addWidget(loadPlaylistButton);
     playlistButtonsLayout->addWidget(savePlaylistButton);
     
-    playlistListWidget = new QListWidget();
+    playlistView = new QListView();
+    playlistView->setModel(playlistModel);
+    playlistView->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    playlistView->setUniformItemSizes(true);
+    // Dragged rows are moved in place (PlaylistModel::moveRows), keeping their selection
+    playlistView->setDragDropMode(QAbstractItemView::InternalMove);
+    playlistView->setDefaultDropAction(Qt::MoveAction);
     
     QHBoxLayout *playlistItemButtonsLayout = new QHBoxLayout();
     addToPlaylistButton = new QPushButton("Add Files");
@@ -182,11 +371,27 @@ void MainWindow::setupUi()
     playlistItemButtonsLayout->addWidget(removeFromPlaylistButton);
     
     playlistsLayout->addLayout(playlistButtonsLayout);
-    playlistsLayout->addWidget(playlistListWidget);
+    playlistsLayout->addWidget(playlistView);
     playlistsLayout->addLayout(playlistItemButtonsLayout);
     
-    // Equalizer Tab
-    equalizerTab = new QWidget();
+    if (playlistModel->currentRow() >= 0) {
+        playlistView->scrollTo(playlistModel->index(playlistModel->currentRow()));
+    }
+    
+    connect(createPlaylistButton, &QPushButton::clicked, this, &MainWindow::createPlaylist);
+    connect(loadPlaylistButton, &QPushButton::clicked, this, &MainWindow::loadPlaylist);
+    connect(savePlaylistButton, &QPushButton::clicked, this, &MainWindow::savePlaylist);
+    connect(addToPlaylistButton, &QPushButton::clicked, this, &MainWindow::addToPlaylist);
+    connect(removeFromPlaylistButton, &QPushButton::clicked, this, &MainWindow::removeFromPlaylist);
+    connect(playlistView, &QListView::doubleClicked, this, &MainWindow::playlistItemDoubleClicked);
+}
+
+void MainWindow::buildEqualizerTab()
+{
+    if (equalizerPresets) {
+        return;
+    }
+    TRACE_SCOPE("ui", "buildEqualizerTab");
     QVBoxLayout *equalizerLayout = new QVBoxLayout(equalizerTab);
     
     QHBoxLayout *equalizerPresetsLayout = new QHBoxLayout();
@@ -206,7 +411,8 @@ void MainWindow::setupUi()
         QVBoxLayout *bandLayout = new QVBoxLayout();
         QSlider *slider = new QSlider(Qt::Vertical);
         slider->setRange(-12, 12);
-        slider->setValue(0);
+        // The engine holds the gains, restored from the settings at startup
+        slider->setValue(qRound(playback->equalizer()->gain(int(equalizerSliders.size()))));
         slider->setTickPosition(QSlider::TicksBothSides);
         slider->setTickInterval(3);
         equalizerSliders.append(slider);
@@ -222,48 +428,56 @@ void MainWindow::setupUi()
     equalizerLayout->addLayout(equalizerPresetsLayout);
     equalizerLayout->addLayout(slidersLayout);
     
-    // File Browser Tab
-    fileBrowserTab = new QWidget();
+    for (int i = 0; i < equalizerSliders.size(); ++i) {
+        connect(equalizerSliders[i], &QSlider::valueChanged, this, [this, i](int value) {
+            applyEqualizer(i, value);
+        });
+    }
+    connect(equalizerPresets, &QComboBox::textActivated, this, &MainWindow::loadEqualizerPreset);
+    connect(saveEqualizerButton, &QPushButton::clicked, this, &MainWindow::saveEqualizerPreset);
+}
+
+void MainWindow::buildFileBrowserTab()
+{
+    if (fileSystemModel) {
+        return;
+    }
+    TRACE_SCOPE("ui", "buildFileBrowserTab");
     QVBoxLayout *fileBrowserLayout = new QVBoxLayout(fileBrowserTab);
     
+    // The model starts reading and watching its root as soon as it has one,
+    // which on a network home can take seconds; only the shown folder is watched
     fileSystemModel = new QFileSystemModel(this);
-    fileSystemModel->setRootPath(QDir::homePath());
+    fileSystemModel->setRootPath(fileBrowserRoot);
     fileSystemModel->setFilter(QDir::AllDirs | QDir::Files);
     fileSystemModel->setNameFilters({"*.mp3", "*.wav", "*.flac", "*.ogg", "*.m4a"});
     fileSystemModel->setNameFilterDisables(false);
     
     fileSystemView = new QTreeView();
     fileSystemView->setModel(fileSystemModel);
-    fileSystemView->setRootIndex(fileSystemModel->index(QDir::homePath()));
+    fileSystemView->setRootIndex(fileSystemModel->index(fileBrowserRoot));
     fileSystemView->setColumnWidth(0, 250);
     fileSystemView->setAnimated(true);
     fileSystemView->setSortingEnabled(true);
     
     fileBrowserLayout->addWidget(fileSystemView);
     
-    // Add all tabs to the tab widget
-    tabWidget->addTab(nowPlayingTab, "Now Playing");
-    tabWidget->addTab(libraryTab, "Library");
-    tabWidget->addTab(playlistsTab, "Playlists");
-    tabWidget->addTab(equalizerTab, "Equalizer");
-    tabWidget->addTab(fileBrowserTab, "File Browser");
-    
-    // Add tab widget to main layout
-    mainLayout->addWidget(tabWidget);
-    
-    // Set central widget
-    setCentralWidget(centralWidget);
-    
-    // Set initial volume
-    audioOutput->setVolume(volumeSlider->value() / 100.0);
+    connect(fileSystemView, &QTreeView::doubleClicked, [this](const QModelIndex &index) {
+        QString filePath = fileSystemModel->filePath(index);
+        if (!fileSystemModel->isDir(index)) {
+            session->load(filePath);
+        }
+    });
 }
 
 void MainWindow::setupConnections()
 {
     // Media player connections
-    connect(mediaPlayer, &QMediaPlayer::positionChanged, this, &MainWindow::updatePosition);
-    connect(mediaPlayer, &QMediaPlayer::durationChanged, this, &MainWindow::updateDuration);
-    connect(mediaPlayer, &QMediaPlayer::metaDataChanged, this, &MainWindow::updateMetadata);
+    connect(playback, &PlaybackController::snapshotChanged, this, &MainWindow::updatePlaybackInfo);
+    connect(session, &PlayerSession::currentTrackChanged, this, &MainWindow::showCurrentTrack);
+    connect(session, &PlayerSession::playingChanged, this, &MainWindow::playingChanged);
+    connect(coverArtCache, &CoverArtCache::coverReady, this, &MainWindow::showCoverArt);
+    connect(waveformCache, &WaveformCache::waveformReady, this, &MainWindow::showWaveform);
     
     // UI control connections
     connect(playPauseButton, &QPushButton::clicked, this, &MainWindow::playPause);
@@ -275,25 +489,56 @@ void MainWindow::setupConnections()
     connect(muteButton, &QPushButton::clicked, this, &MainWindow::toggleMute);
     
     connect(seekSlider, &QSlider::sliderMoved, this, &MainWindow::seekChanged);
+    connect(waveformView, &WaveformView::seekRequested, playback, &PlaybackController::setPosition);
     connect(volumeSlider, &QSlider::valueChanged, this, &MainWindow::setVolume);
+    connect(controlServer, &ControlServer::volumeChanged, volumeSlider, &QSlider::setValue);
+    connect(controlServer, &ControlServer::playOrderChanged, this, &MainWindow::showPlayOrder);
+    
+    // Tabs other than Now Playing are built when first shown
+    connect(tabWidget, &QTabWidget::currentChanged, this, &MainWindow::ensureTab);
     
     // Library connections
-    connect(searchButton, &QPushButton::clicked, this, &MainWindow::searchLibrary);
+    connect(searchTimer, &QTimer::timeout, this, &MainWindow::searchLibrary);
+    connect(libraryWatcher, &LibraryWatcher::changesReady, this, &MainWindow::libraryChanged);
+    connect(libraryWatcher, &LibraryWatcher::overflowed, this, &MainWindow::rescanLibrary);
+    connect(&libraryTagWatcher, &QFutureWatcher<TrackInfo>::finished, this, &MainWindow::libraryTagsRead);
+    connect(indexSaveTimer, &QTimer::timeout, this, &MainWindow::saveIndexInBackground);
+    connect(&indexSaveWatcher, &QFutureWatcher<bool>::finished, this, [this]() {
+        if (!indexSaveWatcher.result()) {
+            statusBar()->showMessage("Could not save the library index");
+        }
+        if (indexSavePending) {
+            indexSavePending = false;
+            saveIndexInBackground();
+        }
+    });
+    connect(&tagWriteWatcher, &QFutureWatcher<TagWriteResult>::finished, this, &MainWindow::tagsWritten);
+    connect(&tagWriteWatcher, &QFutureWatcher<TagWriteResult>::progressValueChanged, this, [this](int value) {
+        statusBar()->showMessage(QString("Writing tags: %1 of %2").arg(value).arg(tagWriteWatcher.progressMaximum()));
+    });
+    connect(&loudnessWatcher, &QFutureWatcher<LoudnessResult>::resultsReadyAt, this, &MainWindow::loudnessResultsReady);
+    connect(&loudnessWatcher, &QFutureWatcher<LoudnessResult>::finished, this, &MainWindow::loudnessAnalysisFinished);
+    connect(&loudnessWatcher, &QFutureWatcher<LoudnessResult>::progressValueChanged, this, [this](int value) {
+        statusBar()->showMessage(QString("Analyzing loudness: %1 of %2")
+                                 .arg(value).arg(loudnessWatcher.progressMaximum()));
+    });
+    connect(&fingerprintWatcher, &QFutureWatcher<FingerprintResult>::finished, this, &MainWindow::fingerprintsFinished);
+    connect(&fingerprintWatcher, &QFutureWatcher<FingerprintResult>::progressValueChanged, this, [this](int value) {
+        statusBar()->showMessage(QString("Fingerprinting: %1 of %2")
+                                 .arg(value).arg(fingerprintWatcher.progressMaximum()));
+    });
+    connect(&duplicateWatcher, &QFutureWatcher<QList<QStringList>>::finished, this, &MainWindow::showDuplicates);
+    connect(&searchIndexWatcher, &QFutureWatcher<SearchIndex>::finished, this, [this]() {
+        searchIndex = searchIndexWatcher.result();
+        searchLibrary();
+    });
     
     // Playlist connections
-    connect(createPlaylistButton, &QPushButton::clicked, this, &MainWindow::createPlaylist);
-    connect(loadPlaylistButton, &QPushButton::clicked, this, &MainWindow::loadPlaylist);
-    connect(savePlaylistButton, &QPushButton::clicked, this, &MainWindow::savePlaylist);
-    connect(addToPlaylistButton, &QPushButton::clicked, this, &MainWindow::addToPlaylist);
-    connect(removeFromPlaylistButton, &QPushButton::clicked, this, &MainWindow::removeFromPlaylist);
-    connect(playlistListWidget, &QListWidget::itemDoubleClicked, this, &MainWindow::playlistItemDoubleClicked);
-    
-    // File browser connections
-    connect(fileSystemView, &QTreeView::doubleClicked, [this](const QModelIndex &index) {
-        QString filePath = fileSystemModel->filePath(index);
-        if (!fileSystemModel->isDir(index)) {
-            loadSong(filePath);
+    connect(&playlistImportWatcher, &QFutureWatcher<QList<PlaylistEntry>>::resultsReadyAt, this, [this](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            playlistModel->append(playlistImportWatcher.resultAt(i));
         }
+        session->queueNextTrack();
     });
 }
 
@@ -308,6 +553,9 @@ void MainWindow::setupMenus()
     QAction *scanLibraryAction = fileMenu->addAction("Scan Library");
     connect(scanLibraryAction, &QAction::triggered, this, &MainWindow::scanLibrary);
     
+    QAction *rescanLibraryAction = fileMenu->addAction("Rescan Library");
+    connect(rescanLibraryAction, &QAction::triggered, this, &MainWindow::rescanLibrary);
+    
     fileMenu->addSeparator();
     
     QAction *exitAction = fileMenu->addAction("Exit");
@@ -324,15 +572,132 @@ void MainWindow::setupMenus()
     
     playbackMenu->addSeparator();
     
+    spreadArtistsAction = playbackMenu->addAction("Spread Out Artists When Shuffling");
+    spreadArtistsAction->setCheckable(true);
+    connect(spreadArtistsAction, &QAction::toggled, this, [this]() {
+        if (session->queue().shuffleMode() != PlaybackQueue::NoShuffle) {
+            session->queue().setShuffleMode(shuffleMode(), playlistModel->currentRow());
+            session->queueNextTrack();
+        }
+    });
+    
+    QAction *reshuffleAction = playbackMenu->addAction("Reshuffle Each Time the Playlist Repeats");
+    reshuffleAction->setCheckable(true);
+    reshuffleAction->setChecked(settings.value("reshuffleOnRepeat", false).toBool());
+    session->queue().setReshuffleOnWrap(reshuffleAction->isChecked());
+    connect(reshuffleAction, &QAction::toggled, this, [this](bool checked) {
+        session->queue().setReshuffleOnWrap(checked);
+        settings.setValue("reshuffleOnRepeat", checked);
+    });
+    
+    QMenu *loudnessMenu = playbackMenu->addMenu("Loudness Normalization");
+    loudnessModeGroup = new QActionGroup(this);
+    const QList<QPair<QString, Loudness::Mode>> loudnessModes = {
+        {"Off", Loudness::Off}, {"Track Gain", Loudness::Track}, {"Album Gain", Loudness::Album}
+    };
+    for (const auto &mode : loudnessModes) {
+        QAction *action = loudnessMenu->addAction(mode.first);
+        action->setCheckable(true);
+        action->setData(int(mode.second));
+        loudnessModeGroup->addAction(action);
+    }
+    connect(loudnessModeGroup, &QActionGroup::triggered, this, [this](QAction *action) {
+        setLoudnessMode(Loudness::Mode(action->data().toInt()));
+    });
+    
+    QMenu *crossfadeMenu = playbackMenu->addMenu("Crossfade");
+    crossfadeLengthGroup = new QActionGroup(this);
+    for (int seconds : {0, 1, 2, 3, 4, 6, 8, 10, 12}) {
+        QAction *action = crossfadeMenu->addAction(seconds == 0 ? QString("Off") : QString("%1 s").arg(seconds));
+        action->setCheckable(true);
+        action->setData(seconds);
+        crossfadeLengthGroup->addAction(action);
+    }
+    connect(crossfadeLengthGroup, &QActionGroup::triggered, this, [this](QAction *action) {
+        setCrossfade(action->data().toInt(), crossfadeCurve);
+    });
+    
+    crossfadeMenu->addSeparator();
+    crossfadeCurveGroup = new QActionGroup(this);
+    const QList<QPair<QString, Crossfade::Curve>> crossfadeCurves = {
+        {"Equal Power Curve", Crossfade::EqualPower}, {"Linear Curve", Crossfade::Linear}
+    };
+    for (const auto &curve : crossfadeCurves) {
+        QAction *action = crossfadeMenu->addAction(curve.first);
+        action->setCheckable(true);
+        action->setData(int(curve.second));
+        crossfadeCurveGroup->addAction(action);
+    }
+    connect(crossfadeCurveGroup, &QActionGroup::triggered, this, [this](QAction *action) {
+        setCrossfade(crossfadeSeconds, Crossfade::Curve(action->data().toInt()));
+    });
+    
+    playbackMenu->addSeparator();
+    
     QAction *sleepTimerAction = playbackMenu->addAction("Sleep Timer");
     connect(sleepTimerAction, &QAction::triggered, this, &MainWindow::setSleepTimer);
     
+    // Smart playlists menu
+    QMenu *smartMenu = menuBar()->addMenu("Smart Playlists");
+    
+    QAction *newSmartAction = smartMenu->addAction("New Smart Playlist...");
+    connect(newSmartAction, &QAction::triggered, this, &MainWindow::newSmartPlaylist);
+    
+    QAction *editSmartAction = smartMenu->addAction("Edit Smart Playlist...");
+    connect(editSmartAction, &QAction::triggered, this, &MainWindow::editSmartPlaylist);
+    
+    QAction *deleteSmartAction = smartMenu->addAction("Delete Smart Playlist...");
+    connect(deleteSmartAction, &QAction::triggered, this, &MainWindow::deleteSmartPlaylist);
+    
+    smartMenu->addSeparator();
+    
+    QAction *playSmartAction = smartMenu->addAction("Play Smart Playlist...");
+    connect(playSmartAction, &QAction::triggered, this, &MainWindow::playSmartPlaylist);
+    
     // Tools menu
     QMenu *toolsMenu = menuBar()->addMenu("Tools");
     
     QAction *editMetadataAction = toolsMenu->addAction("Edit Metadata");
     connect(editMetadataAction, &QAction::triggered, this, &MainWindow::editMetadata);
     
+    analyzeLoudnessAction = toolsMenu->addAction("Analyze Loudness");
+    connect(analyzeLoudnessAction, &QAction::triggered, this, &MainWindow::analyzeLoudness);
+    
+    findDuplicatesAction = toolsMenu->addAction("Find Duplicates");
+    connect(findDuplicatesAction, &QAction::triggered, this, &MainWindow::findDuplicates);
+    
+#ifdef PLAYER_TRACING
+    toolsMenu->addSeparator();
+    
+    QAction *traceAction = toolsMenu->addAction("Record Trace");
+    traceAction->setCheckable(true);
+    traceAction->setChecked(Trace::isEnabled());
+    connect(traceAction, &QAction::toggled, this, [](bool checked) {
+        if (checked) {
+            Trace::clear();
+        }
+        Trace::setEnabled(checked);
+    });
+    
+    QAction *saveTraceAction = toolsMenu->addAction("Save Trace...");
+    connect(saveTraceAction, &QAction::triggered, this, [this]() {
+        QString filePath = QFileDialog::getSaveFileName(this, "Save Trace", QDir::homePath() + "/player-trace.json",
+                                                        "Chrome Trace (*.json)");
+        if (filePath.isEmpty()) return;
+        
+        if (Trace::writeChromeJson(filePath)) {
+            statusBar()->showMessage("Trace saved; open it in ui.perfetto.dev or chrome://tracing");
+        } else {
+            QMessageBox::warning(this, "Error", "Could not write the trace file");
+        }
+    });
+#endif
+    
+    QAction *startupAction = toolsMenu->addAction("Startup Timing");
+    connect(startupAction, &QAction::triggered, this, [this]() {
+        QMessageBox::information(this, "Startup Timing", StartupProfile::report());
+    });
+    
     // Create status bar
     statusBar()->showMessage("Ready");
 }
@@ -342,17 +707,30 @@ void MainWindow::loadSettings()
     // Load volume
     int volume = settings.value("volume", 70).toInt();
     volumeSlider->setValue(volume);
-    audioOutput->setVolume(volume / 100.0);
+    playback->setVolume(volume / 100.0);
     
-    // Load last directory
-    QString lastDir = settings.value("lastDirectory", QDir::homePath()).toString();
-    fileSystemView->setRootIndex(fileSystemModel->index(lastDir));
+    // Load last directory; the File Browser opens there when first shown
+    fileBrowserRoot = settings.value("lastDirectory", QDir::homePath()).toString();
     
-    // Load equalizer settings
+    spreadArtistsAction->setChecked(settings.value("spreadArtists", false).toBool());
+    setLoudnessMode(Loudness::Mode(settings.value("loudnessNormalization", int(Loudness::Track)).toInt()));
+    setCrossfade(settings.value("crossfadeSeconds", 0).toInt(),
+                 Crossfade::Curve(settings.value("crossfadeCurve", int(Crossfade::EqualPower)).toInt()));
+    
+    // Load equalizer settings straight into the engine; the sliders read them back when built
     int size = settings.beginReadArray("equalizer");
-    for (int i = 0; i < size && i < equalizerSliders.size(); ++i) {
+    for (int i = 0; i < size && i < Equalizer::BandCount; ++i) {
         settings.setArrayIndex(i);
-        equalizerSliders[i]->setValue(settings.value("value", 0).toInt());
+        applyEqualizer(i, settings.value("value", 0).toInt());
+    }
+    settings.endArray();
+    
+    // Smart playlist rules; each is parsed here and evaluated when first shown or played
+    size = settings.beginReadArray("smartPlaylists");
+    for (int i = 0; i < size; ++i) {
+        settings.setArrayIndex(i);
+        smartPlaylists.append(SmartPlaylist(settings.value("name").toString(),
+                                            SmartQuery(settings.value("rule").toString())));
     }
     settings.endArray();
 }
@@ -363,16 +741,21 @@ void MainWindow::saveSettings()
     settings.setValue("volume", volumeSlider->value());
     
     // Save last directory
-    QModelIndex currentIndex = fileSystemView->rootIndex();
-    if (currentIndex.isValid()) {
-        settings.setValue("lastDirectory", fileSystemModel->filePath(currentIndex));
+    if (fileSystemView && fileSystemView->rootIndex().isValid()) {
+        fileBrowserRoot = fileSystemModel->filePath(fileSystemView->rootIndex());
     }
+    settings.setValue("lastDirectory", fileBrowserRoot);
+    
+    settings.setValue("spreadArtists", spreadArtistsAction->isChecked());
+    settings.setValue("loudnessNormalization", int(session->loudnessMode()));
+    settings.setValue("crossfadeSeconds", crossfadeSeconds);
+    settings.setValue("crossfadeCurve", int(crossfadeCurve));
     
     // Save equalizer settings
     settings.beginWriteArray("equalizer");
-    for (int i = 0; i < equalizerSliders.size(); ++i) {
+    for (int i = 0; i < Equalizer::BandCount; ++i) {
         settings.setArrayIndex(i);
-        settings.setValue("value", equalizerSliders[i]->value());
+        settings.setValue("value", qRound(playback->equalizer()->gain(i)));
     }
     settings.endArray();
 }
@@ -388,193 +771,175 @@ void MainWindow::openFile()
     
     if (!filePaths.isEmpty()) {
         // Add to playlist
-        currentPlaylist.append(filePaths);
-        updatePlaylist();
+        playlistModel->append(filePaths);
         
         // Start playing the first file if not already playing
-        if (!isPlaying && currentIndex == -1) {
-            currentIndex = currentPlaylist.size() - filePaths.size();
-            loadSong(currentPlaylist[currentIndex]);
-            playPause();
+        if (!session->isPlaying() && playlistModel->currentRow() == -1) {
+            session->playRow(playlistModel->count() - filePaths.size());
+        } else {
+            session->queueNextTrack();
         }
     }
 }
 
 void MainWindow::playPause()
 {
-    if (mediaPlayer->playbackState() == QMediaPlayer::PlayingState) {
-        mediaPlayer->pause();
-        playPauseButton->setText("Play");
-        isPlaying = false;
-    } else {
-        if (currentIndex >= 0 && currentIndex < currentPlaylist.size()) {
-            mediaPlayer->play();
-            playPauseButton->setText("Pause");
-            isPlaying = true;
-        } else if (!currentPlaylist.isEmpty()) {
-            currentIndex = 0;
-            loadSong(currentPlaylist[currentIndex]);
-            mediaPlayer->play();
-            playPauseButton->setText("Pause");
-            isPlaying = true;
-        } else {
-            openFile();
-        }
+    if (session->isPlaying()) {
+        session->pause();
+    } else if (!session->play()) {
+        openFile();
     }
 }
 
 void MainWindow::stop()
 {
-    mediaPlayer->stop();
-    playPauseButton->setText("Play");
-    isPlaying = false;
+    session->stop();
 }
 
 void MainWindow::next()
 {
-    if (currentPlaylist.isEmpty()) return;
-    
-    if (++currentIndex >= currentPlaylist.size()) {
-        if (repeatMode == 1) { // Repeat all
-            currentIndex = 0;
-        } else {
-            currentIndex = currentPlaylist.size() - 1;
-            stop();
-            return;
-        }
-    }
-    
-    loadSong(currentPlaylist[currentIndex]);
-    if (isPlaying) {
-        mediaPlayer->play();
-    }
+    session->next();
 }
 
 void MainWindow::previous()
 {
-    if (currentPlaylist.isEmpty()) return;
-    
-    // If we're more than 3 seconds into the song, restart it
-    if (mediaPlayer->position() > 3000) {
-        mediaPlayer->setPosition(0);
-        return;
-    }
-    
-    if (--currentIndex < 0) {
-        if (repeatMode == 1) { // Repeat all
-            currentIndex = currentPlaylist.size() - 1;
-        } else {
-            currentIndex = 0;
-            stop();
-            return;
-        }
-    }
-    
-    loadSong(currentPlaylist[currentIndex]);
-    if (isPlaying) {
-        mediaPlayer->play();
-    }
+    session->previous();
 }
 
-void MainWindow::seekChanged(int position)
+void MainWindow::playingChanged(bool playing)
 {
-    mediaPlayer->setPosition(position);
+    playPauseButton->setText(playing ? "Pause" : "Play");
 }
 
-void MainWindow::updatePosition(qint64 position)
+void MainWindow::seekChanged(int position)
 {
-    seekSlider->setValue(position);
-    currentTimeLabel->setText(formatTime(position));
+    playback->setPosition(position);
 }
 
-void MainWindow::updateDuration(qint64 duration)
+void MainWindow::updatePlaybackInfo(const PlaybackSnapshot &snapshot)
 {
-    seekSlider->setRange(0, duration);
-    totalTimeLabel->setText(formatTime(duration));
+    // Called at most PlaybackController::FrameRate times a second; only touch what changed
+    if (snapshot.duration != shownPlayback.duration) {
+        seekSlider->setRange(0, snapshot.duration);
+        totalTimeLabel->setText(formatTime(snapshot.duration));
+        waveformView->setDuration(snapshot.duration);
+    }
+    if (!seekSlider->isSliderDown()) {
+        seekSlider->setValue(snapshot.position);
+    }
+    waveformView->setPosition(snapshot.position);
+    if (snapshot.position / 1000 != shownPlayback.position / 1000) {
+        currentTimeLabel->setText(formatTime(snapshot.position));
+    }
+    shownPlayback = snapshot;
 }
 
-void MainWindow::updateMetadata()
+void MainWindow::updateMetadata(const QString &filePath)
 {
-    // Get metadata from the media player
-    QMediaMetaData metaData = mediaPlayer->metaData();
+    TRACE_SCOPE("ui", "updateMetadata");
     
-    // Update song info
-    QString title = metaData.value(QMediaMetaData::Title).toString();
-    if (title.isEmpty() && currentIndex >= 0 && currentIndex < currentPlaylist.size()) {
-        QFileInfo fileInfo(currentPlaylist[currentIndex]);
-        title = fileInfo.baseName();
-    }
-    songTitleLabel->setText(title.isEmpty() ? "Unknown Title" : title);
+    // Tags come from the native reader (a few small reads); cover art follows from the cache
+    const TrackInfo info = TagReader::readTrack(filePath);
+    songTitleLabel->setText(info.title);
+    artistLabel->setText(info.artist);
+    albumLabel->setText(info.album);
     
-    QString artist = metaData.value(QMediaMetaData::AlbumArtist).toString();
-    if (artist.isEmpty()) {
-        artist = metaData.value(QMediaMetaData::Author).toString();
+    // Store metadata for later use
+    currentMetadata.clear();
+    currentMetadata["title"] = info.title;
+    currentMetadata["artist"] = info.artist;
+    currentMetadata["album"] = info.album;
+}
+
+void MainWindow::showCoverArt(const QString &filePath, const QPixmap &pixmap)
+{
+    // Ignore art for a track that is no longer playing
+    if (filePath != playback->source()) {
+        return;
     }
-    artistLabel->setText(artist.isEmpty() ? "Unknown Artist" : artist);
+    TRACE_INSTANT_ARG("ui", "cover art shown", filePath);
     
-    QString album = metaData.value(QMediaMetaData::AlbumTitle).toString();
-    albumLabel->setText(album.isEmpty() ? "Unknown Album" : album);
-    
-    // Update album art
-    QVariant coverArtVariant = metaData.value(QMediaMetaData::CoverArtImage);
-    if (coverArtVariant.isValid()) {
-        QImage coverArt = coverArtVariant.value<QImage>();
-        if (!coverArt.isNull()) {
-            QPixmap pixmap = QPixmap::fromImage(coverArt);
-            albumArtLabel->setPixmap(pixmap.scaled(albumArtLabel->size(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
-        } else {
-            albumArtLabel->setText("No Cover");
-        }
-    } else {
+    if (pixmap.isNull()) {
         albumArtLabel->setText("No Cover");
+    } else {
+        albumArtLabel->setPixmap(pixmap);
     }
-    
-    // Store metadata for later use
-    currentMetadata.clear();
-    currentMetadata["title"] = title;
-    currentMetadata["artist"] = artist;
-    currentMetadata["album"] = album;
+}
+
+void MainWindow::showWaveform(const QString &filePath, QSharedPointer<const WaveformSummary> summary)
+{
+    // Same rule as cover art: only the playing track is drawn
+    if (filePath != playback->source()) {
+        return;
+    }
+    TRACE_INSTANT_ARG("ui", "waveform shown", filePath);
+    waveformView->setSummary(summary);
 }
 
 void MainWindow::setVolume(int volume)
 {
-    audioOutput->setVolume(volume / 100.0);
+    playback->setVolume(volume / 100.0);
 }
 
 void MainWindow::toggleMute()
 {
     isMuted = !isMuted;
-    audioOutput->setMuted(isMuted);
+    playback->setMuted(isMuted);
     muteButton->setText(isMuted ? "Unmute" : "Mute");
 }
 
 void MainWindow::toggleRepeat()
 {
-    repeatMode = (repeatMode + 1) % 3;
+    PlaybackQueue &queue = session->queue();
+    switch (queue.repeatMode()) {
+    case PlaybackQueue::NoRepeat:
+        queue.setRepeatMode(PlaybackQueue::RepeatAll);
+        break;
+    case PlaybackQueue::RepeatAll:
+        queue.setRepeatMode(PlaybackQueue::RepeatOne);
+        break;
+    case PlaybackQueue::RepeatOne:
+        queue.setRepeatMode(PlaybackQueue::NoRepeat);
+        break;
+    }
+    showPlayOrder();
+    
+    // The track after this one may have changed
+    session->queueNextTrack();
+}
+
+void MainWindow::toggleShuffle()
+{
+    // Shuffling only changes the play order; the playlist itself keeps its order
+    bool shuffled = session->queue().shuffleMode() == PlaybackQueue::NoShuffle;
+    session->queue().setShuffleMode(shuffled ? shuffleMode() : PlaybackQueue::NoShuffle,
+                                    playlistModel->currentRow());
+    showPlayOrder();
     
-    switch (repeatMode) {
-    case 0:
+    session->queueNextTrack();
+}
+
+void MainWindow::showPlayOrder()
+{
+    // Also called when a control client changes the order
+    const PlaybackQueue &queue = session->queue();
+    shuffleButton->setText(queue.shuffleMode() == PlaybackQueue::NoShuffle ? "Shuffle" : "Unshuffle");
+    switch (queue.repeatMode()) {
+    case PlaybackQueue::NoRepeat:
         repeatButton->setText("Repeat");
         break;
-    case 1:
+    case PlaybackQueue::RepeatAll:
         repeatButton->setText("Repeat All");
         break;
-    case 2:
+    case PlaybackQueue::RepeatOne:
         repeatButton->setText("Repeat One");
         break;
     }
 }
 
-void MainWindow::toggleShuffle()
+PlaybackQueue::ShuffleMode MainWindow::shuffleMode() const
 {
-    isShuffled = !isShuffled;
-    shuffleButton->setText(isShuffled ? "Unshuffle" : "Shuffle");
-    
-    if (isShuffled) {
-        shufflePlaylist();
-    } else {
-        // TODO: Restore original order
-    }
+    return spreadArtistsAction->isChecked() ? PlaybackQueue::ArtistSpread : PlaybackQueue::Shuffle;
 }
 
 void MainWindow::createPlaylist()
@@ -584,8 +949,8 @@ void MainWindow::createPlaylist()
     
     if (ok && !name.isEmpty()) {
         // Clear current playlist
-        currentPlaylist.clear();
-        updatePlaylist();
+        playlistModel->clear();
+        session->queueNextTrack();
         
         // Set window title to include playlist name
         setWindowTitle("Qt Music Player - " + name);
@@ -598,35 +963,25 @@ void MainWindow::loadPlaylist()
         this,
         "Open Playlist",
         QStandardPaths::standardLocations(QStandardPaths::MusicLocation).first(),
-        "Playlist Files (*.m3u *.pls);;All Files (*)"
+        "Playlist Files (*.m3u *.m3u8 *.pls *.xspf);;All Files (*)"
     );
     
     if (!filePath.isEmpty()) {
-        QFile file(filePath);
-        if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-            currentPlaylist.clear();
-            
-            QTextStream in(&file);
-            while (!in.atEnd()) {
-                QString line = in.readLine().trimmed();
-                if (!line.isEmpty() && !line.startsWith('#')) {
-                    currentPlaylist.append(line);
-                }
-            }
-            
-            file.close();
-            updatePlaylist();
-            
-            // Set window title to include playlist name
-            QFileInfo fileInfo(filePath);
-            setWindowTitle("Qt Music Player - " + fileInfo.baseName());
-        }
+        // Parsing runs on a worker; entries arrive in chunks through playlistImportWatcher
+        playlistImportWatcher.cancel();
+        playlistImportWatcher.waitForFinished();
+        playlistModel->clear();
+        playlistImportWatcher.setFuture(PlaylistParser::parseAsync(filePath));
+        
+        // Set window title to include playlist name
+        QFileInfo fileInfo(filePath);
+        setWindowTitle("Qt Music Player - " + fileInfo.baseName());
     }
 }
 
 void MainWindow::savePlaylist()
 {
-    if (currentPlaylist.isEmpty()) {
+    if (playlistModel->isEmpty()) {
         QMessageBox::information(this, "Save Playlist", "The playlist is empty.");
         return;
     }
@@ -635,34 +990,14 @@ void MainWindow::savePlaylist()
         this,
         "Save Playlist",
         QStandardPaths::standardLocations(QStandardPaths::MusicLocation).first(),
-        "M3U Playlist (*.m3u);;PLS Playlist (*.pls)"
+        "M3U Playlist (*.m3u);;M3U8 Playlist (*.m3u8);;PLS Playlist (*.pls);;XSPF Playlist (*.xspf)"
     );
     
     if (!filePath.isEmpty()) {
-        QFile file(filePath);
-        if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream out(&file);
-            
-            if (filePath.endsWith(".m3u", Qt::CaseInsensitive)) {
-                out << "#EXTM3U\n";
-                for (const QString &path : currentPlaylist) {
-                    out << path << "\n";
-                }
-            } else if (filePath.endsWith(".pls", Qt::CaseInsensitive)) {
-                out << "[playlist]\n";
-                out << "NumberOfEntries=" << currentPlaylist.size() << "\n";
-                
-                for (int i = 0; i < currentPlaylist.size(); ++i) {
-                    out << "File" << (i+1) << "=" << currentPlaylist[i] << "\n";
-                    out << "Title" << (i+1) << "=" << QFileInfo(currentPlaylist[i]).baseName() << "\n";
-                    out << "Length" << (i+1) << "=-1\n";
-                }
-                
-                out << "Version=2\n";
-            }
-            
-            file.close();
+        if (PlaylistParser::write(filePath, playlistModel->toEntries())) {
             QMessageBox::information(this, "Save Playlist", "Playlist saved successfully.");
+        } else {
+            QMessageBox::warning(this, "Save Playlist", "Could not write the playlist file.");
         }
     }
 }
@@ -677,64 +1012,230 @@ void MainWindow::addToPlaylist()
     );
     
     if (!filePaths.isEmpty()) {
-        currentPlaylist.append(filePaths);
-        updatePlaylist();
+        playlistModel->append(filePaths);
+        session->queueNextTrack();
     }
 }
 
 void MainWindow::removeFromPlaylist()
 {
-    QList<QListWidgetItem*> selectedItems = playlistListWidget->selectedItems();
-    if (selectedItems.isEmpty()) {
+    const QModelIndexList selected = playlistView->selectionModel()->selectedRows();
+    if (selected.isEmpty()) {
         return;
     }
     
-    for (QListWidgetItem *item : selectedItems) {
-        int row = playlistListWidget->row(item);
-        if (row >= 0 && row < currentPlaylist.size()) {
-            currentPlaylist.removeAt(row);
-            delete playlistListWidget->takeItem(row);
+    QList<int> rows;
+    rows.reserve(selected.size());
+    for (const QModelIndex &index : selected) {
+        rows.append(index.row());
+    }
+    
+    // The model removes contiguous ranges at once and keeps the current row in step
+    playlistModel->removeRowList(rows);
+    session->queueNextTrack();
+}
+
+void MainWindow::playlistItemDoubleClicked(const QModelIndex &index)
+{
+    TRACE_SCOPE("ui", "playlistItemDoubleClicked");
+    session->playRow(index.row());
+}
+
+void MainWindow::searchLibrary()
+{
+    searchTimer->stop();
+    if (!searchBox) {
+        return; // Nothing typed before the Library tab is shown
+    }
+    
+    // The active smart playlist narrows the view, and typed text narrows it further
+    bool filtered = false;
+    QBitArray matches;
+    if (activeSmartPlaylist >= 0) {
+        SmartPlaylist &playlist = smartPlaylists[activeSmartPlaylist];
+        if (!playlist.isEvaluated()) {
+            playlist.evaluate(libraryIndex.tracks());
         }
+        matches = playlist.matches();
+        filtered = true;
     }
     
-    // Update current index if necessary
-    if (currentIndex >= currentPlaylist.size()) {
-        currentIndex = currentPlaylist.size() - 1;
+    QString searchText = searchBox->text().trimmed();
+    if (!searchText.isEmpty()) {
+        TRACE_SCOPE("search", "searchLibrary");
+        
+        // The index answers from posting lists; the proxy applies the result in one pass
+        const QBitArray found = searchIndex.match(searchText);
+        matches = filtered ? matches & found : found;
+        filtered = true;
+    }
+    
+    if (filtered) {
+        libraryFilter->setMatches(matches);
+    } else {
+        libraryFilter->clearMatches();
     }
 }
 
-void MainWindow::playlistItemDoubleClicked(QListWidgetItem *item)
+void MainWindow::showSmartPlaylist(int index)
+{
+    activeSmartPlaylist = index >= 0 && index < smartPlaylists.size() ? index : -1;
+    searchLibrary();
+}
+
+void MainWindow::newSmartPlaylist()
 {
-    int row = playlistListWidget->row(item);
-    if (row >= 0 && row < currentPlaylist.size()) {
-        currentIndex = row;
-        loadSong(currentPlaylist[currentIndex]);
-        mediaPlayer->play();
-        playPauseButton->setText("Pause");
-        isPlaying = true;
+    QString name;
+    SmartQuery query;
+    if (!askSmartQuery("New Smart Playlist", &name, &query)) {
+        return;
+    }
+    
+    smartPlaylists.append(SmartPlaylist(name, query));
+    saveSmartPlaylists();
+    refreshSmartPlaylistBox();
+    if (smartPlaylistBox) {
+        smartPlaylistBox->setCurrentIndex(smartPlaylists.size());
     }
 }
 
-void MainWindow::searchLibrary()
+void MainWindow::editSmartPlaylist()
 {
-    QString searchText = searchBox->text().toLower();
-    if (searchText.isEmpty()) {
+    const int index = chooseSmartPlaylist("Edit Smart Playlist");
+    if (index < 0) {
         return;
     }
     
-    for (int row = 0; row < libraryModel->rowCount(); ++row) {
-        bool match = false;
-        
-        for (int col = 0; col < 3; ++col) { // Check title, artist, album
-            QStandardItem *item = libraryModel->item(row, col);
-            if (item && item->text().toLower().contains(searchText)) {
-                match = true;
-                break;
-            }
+    QString name = smartPlaylists[index].name();
+    SmartQuery query = smartPlaylists[index].query();
+    if (!askSmartQuery("Edit Smart Playlist", &name, &query)) {
+        return;
+    }
+    
+    smartPlaylists[index] = SmartPlaylist(name, query);
+    saveSmartPlaylists();
+    refreshSmartPlaylistBox();
+    if (index == activeSmartPlaylist) {
+        searchLibrary();
+    }
+}
+
+void MainWindow::deleteSmartPlaylist()
+{
+    const int index = chooseSmartPlaylist("Delete Smart Playlist");
+    if (index < 0) {
+        return;
+    }
+    
+    smartPlaylists.removeAt(index);
+    saveSmartPlaylists();
+    if (index == activeSmartPlaylist) {
+        activeSmartPlaylist = -1;
+        searchLibrary();
+    } else if (index < activeSmartPlaylist) {
+        --activeSmartPlaylist;
+    }
+    refreshSmartPlaylistBox();
+}
+
+void MainWindow::playSmartPlaylist()
+{
+    const int index = chooseSmartPlaylist("Play Smart Playlist");
+    if (index < 0) {
+        return;
+    }
+    
+    SmartPlaylist &playlist = smartPlaylists[index];
+    if (!playlist.isEvaluated()) {
+        playlist.evaluate(libraryIndex.tracks());
+    }
+    
+    // Replaces the queue, in the rule's order
+    const TrackStore &tracks = libraryIndex.tracks();
+    const QList<int> rows = playlist.rows(tracks);
+    if (rows.isEmpty()) {
+        statusBar()->showMessage(QString("No tracks match %1").arg(playlist.name()));
+        return;
+    }
+    QList<PlaylistEntry> entries;
+    entries.reserve(rows.size());
+    for (int row : rows) {
+        entries.append({tracks.path(row), QString(), tracks.duration(row)});
+    }
+    
+    playlistImportWatcher.cancel();
+    playlistImportWatcher.waitForFinished();
+    playlistModel->setEntries(entries);
+    session->playRow(0);
+    setWindowTitle("Qt Music Player - " + playlist.name());
+}
+
+bool MainWindow::askSmartQuery(const QString &title, QString *name, SmartQuery *query)
+{
+    bool ok;
+    *name = QInputDialog::getText(this, title, "Name:", QLineEdit::Normal, *name, &ok).trimmed();
+    if (!ok || name->isEmpty()) {
+        return false;
+    }
+    
+    // Asked again, with the text kept, until the rule parses or the dialog is cancelled
+    QString text = query->text();
+    while (true) {
+        text = QInputDialog::getText(this, title,
+                                     "Rule, e.g. artist = \"X\" and duration > 5:00 and added < 30d order by album:",
+                                     QLineEdit::Normal, text, &ok);
+        if (!ok) {
+            return false;
         }
-        
-        libraryTableView->setRowHidden(row, !match);
+        *query = SmartQuery(text);
+        if (query->isValid()) {
+            return true;
+        }
+        QMessageBox::warning(this, title, query->errorString());
+    }
+}
+
+int MainWindow::chooseSmartPlaylist(const QString &title)
+{
+    if (smartPlaylists.isEmpty()) {
+        QMessageBox::information(this, title, "There are no smart playlists yet.");
+        return -1;
+    }
+    
+    QStringList names;
+    for (const SmartPlaylist &playlist : smartPlaylists) {
+        names.append(playlist.name());
+    }
+    bool ok;
+    const QString name = QInputDialog::getItem(this, title, "Smart playlist:", names,
+                                               qMax(0, activeSmartPlaylist), false, &ok);
+    return ok ? int(names.indexOf(name)) : -1;
+}
+
+void MainWindow::refreshSmartPlaylistBox()
+{
+    if (!smartPlaylistBox) {
+        return;
+    }
+    
+    const QSignalBlocker blocker(smartPlaylistBox);
+    smartPlaylistBox->clear();
+    smartPlaylistBox->addItem("All Tracks");
+    for (const SmartPlaylist &playlist : smartPlaylists) {
+        smartPlaylistBox->addItem(playlist.name());
     }
+    smartPlaylistBox->setCurrentIndex(activeSmartPlaylist + 1);
+}
+
+void MainWindow::saveSmartPlaylists()
+{
+    settings.beginWriteArray("smartPlaylists");
+    for (int i = 0; i < smartPlaylists.size(); ++i) {
+        settings.setArrayIndex(i);
+        settings.setValue("name", smartPlaylists[i].name());
+        settings.setValue("rule", smartPlaylists[i].query().text());
+    }
+    settings.endArray();
 }
 
 void MainWindow::scanLibrary()
@@ -747,126 +1248,259 @@ void MainWindow::scanLibrary()
 
     if (musicDir.isEmpty()) return;
 
-    // Clear existing library
-    libraryModel->removeRows(0, libraryModel->rowCount());
+    updateLibrary({musicDir});
+}
+
+void MainWindow::rescanLibrary()
+{
+    if (libraryIndex.roots().isEmpty()) {
+        scanLibrary();
+        return;
+    }
+
+    updateLibrary(libraryIndex.roots());
+}
 
+void MainWindow::updateLibrary(const QStringList &roots)
+{
     // Show progress dialog (fixed declaration)
-    QProgressDialog progress("Scanning music library...", "Cancel", 0, 100, this);
+    QProgressDialog progress("Scanning music library...", "Cancel", 0, 0, this);
     progress.setWindowModality(Qt::WindowModal);
     progress.show();
 
-    // Fixed QDirIterator usage
-    QDirIterator it(musicDir,
-                    QStringList() << "*.mp3" << "*.wav" << "*.flac" << "*.ogg" << "*.m4a",
-                    QDir::Files,
-                    QDirIterator::Subdirectories);  // Fixed enum
+    TRACE_SCOPE("scan", "updateLibrary");
+    
+    // The scan saves the whole index, so a scheduled save is dropped; one
+    // already being written must land before the scan's, not after it
+    indexSaveTimer->stop();
+    indexSavePending = false;
+    indexSaveWatcher.waitForFinished();
+    
+    // The scanner stats the roots against the stored index, then reads the
+    // tags of new or changed files on the worker pool
+    int updated = 0;
+    bool saved = true;
+    QEventLoop loop;
+    connect(libraryScanner, &LibraryScanner::progressRangeChanged, &progress, &QProgressDialog::setRange);
+    connect(libraryScanner, &LibraryScanner::progressValueChanged, &progress, &QProgressDialog::setValue);
+    connect(libraryScanner, &LibraryScanner::finished, &loop, [&](int count, bool ok) {
+        updated = count;
+        saved = ok;
+        loop.quit();
+    });
+    connect(&progress, &QProgressDialog::canceled, libraryScanner, &LibraryScanner::cancel);
 
-    QStringList files;
-    while (it.hasNext()) {
-        files.append(it.next());
+    libraryScanner->scan(roots);
+    if (libraryScanner->isRunning()) {
+        TRACE_SCOPE("scan", "read tags");
+        loop.exec();
+    }
+    if (!saved) {
+        statusBar()->showMessage("Could not save the library index");
     }
 
-    int total = files.size();
-    int current = 0;
-
-    for (const QString &filePath : files) {
-        // Update progress
-        progress.setValue(current * 100 / total);
-        if (progress.wasCanceled()) break;
+    progress.setValue(progress.maximum());
 
-        // Fixed event loop implementation
-        QMediaPlayer tempPlayer;
-        tempPlayer.setSource(QUrl::fromLocalFile(filePath));
+    populateLibrary();
+    libraryWatcher->setRoots(roots);
 
-        QEventLoop loop;
-        QTimer::singleShot(100, &loop, &QEventLoop::quit);
-        loop.exec();
+    statusBar()->showMessage(QString("Library scan complete: %1 files found, %2 updated")
+                             .arg(libraryIndex.tracks().size()).arg(updated));
+}
 
+void MainWindow::populateLibrary()
+{
+    TRACE_SCOPE("library", "populateLibrary");
+    libraryModel->setTracks(libraryIndex.tracks());
+    
+    // Rows may have moved; smart playlists are evaluated again when next needed
+    for (SmartPlaylist &playlist : smartPlaylists) {
+        playlist.invalidate();
+    }
+    
+    // Rebuild the search index off the GUI thread; the active query is re-run when it lands
+    const TrackStore tracks = libraryIndex.tracks();
+    searchIndexWatcher.setFuture(QtConcurrent::run([tracks]() {
+        SearchIndex index;
+        index.build(tracks);
+        return index;
+    }));
+}
 
+void MainWindow::libraryChanged(const QStringList &changed, const QStringList &removed)
+{
+    // Removals need no I/O; the same rows come out of every view
+    const QList<int> removedRows = libraryIndex.remove(removed);
+    if (!removedRows.isEmpty()) {
+        scheduleIndexSave();
+        removeLibraryRows(removedRows);
+    }
 
+    for (const QString &path : changed) {
+        pendingLibraryChanges.insert(path);
+    }
+    readChangedTags();
+}
 
-        // Get metadata
-        QMediaMetaData metaData = tempPlayer.metaData();
-        
-        QString title = metaData.value(QMediaMetaData::Title).toString();
-        if (title.isEmpty()) {
-            QFileInfo fileInfo(filePath);
-            title = fileInfo.baseName();
-        }
-        
-        QString artist = metaData.value(QMediaMetaData::AlbumArtist).toString();
-        if (artist.isEmpty()) {
-            artist = metaData.value(QMediaMetaData::Author).toString();
-        }
-        if (artist.isEmpty()) {
-            artist = "Unknown Artist";
-        }
-        
-        QString album = metaData.value(QMediaMetaData::AlbumTitle).toString();
-        if (album.isEmpty()) {
-            album = "Unknown Album";
-        }
-        
-        qint64 duration = tempPlayer.duration();
-        QString durationStr = formatTime(duration);
-        
-        // Add to library model
-        QList<QStandardItem*> row;
-        row.append(new QStandardItem(title));
-        row.append(new QStandardItem(artist));
-        row.append(new QStandardItem(album));
-        row.append(new QStandardItem(durationStr));
-        row.append(new QStandardItem(filePath));
-        
-        libraryModel->appendRow(row);
-        
-        current++;
+void MainWindow::readChangedTags()
+{
+    // One batch at a time; events that arrive meanwhile wait for the next one
+    if (pendingLibraryChanges.isEmpty() || libraryTagWatcher.isRunning()) {
+        return;
     }
+
+    const QStringList files(pendingLibraryChanges.cbegin(), pendingLibraryChanges.cend());
+    pendingLibraryChanges.clear();
+    libraryTagWatcher.setFuture(QtConcurrent::mapped(files, &TagReader::readTrack));
+}
+
+void MainWindow::libraryTagsRead()
+{
+    const QList<TrackInfo> tracks = libraryTagWatcher.future().results();
+    applyLibraryTracks(tracks, false);
     
-    progress.setValue(100);
+    statusBar()->showMessage(QString("Library updated: %1 files").arg(tracks.size()), 5000);
+    readChangedTags();
+}
+
+void MainWindow::applyLibraryTracks(const QList<TrackInfo> &tracks, bool tagsOnly)
+{
+    const int oldCount = libraryIndex.tracks().size();
     
-    // Connect double-click on library item to play
-    connect(libraryTableView, &QTableView::doubleClicked, [this](const QModelIndex &index) {
-        int row = index.row();
-        QString filePath = libraryModel->item(row, 4)->text(); // Path is in column 4
-        
-        // Add to playlist if not already there
-        if (!currentPlaylist.contains(filePath)) {
-            currentPlaylist.append(filePath);
-            updatePlaylist();
+    QList<int> rows;
+    rows.reserve(tracks.size());
+    for (const TrackInfo &track : tracks) {
+        rows.append(libraryIndex.row(track.path));
+    }
+    libraryIndex.update(tracks, tagsOnly);
+    scheduleIndexSave();
+    
+    if (searchIndexWatcher.isRunning() || searchIndex.rowCount() != oldCount) {
+        // A rebuild is under way (or the views are out of step); start over from the index
+        populateLibrary();
+    } else {
+        // Only the touched rows go into the model and the search index
+        QList<TrackInfo> added;
+        for (int i = 0; i < tracks.size(); ++i) {
+            if (rows[i] >= 0) {
+                // From the index, which may have kept fields the fresh read doesn't have
+                libraryModel->setTrack(rows[i], libraryIndex.tracks().at(rows[i]));
+                searchIndex.updateRow(rows[i], tracks[i]);
+            } else {
+                added.append(tracks[i]);
+                searchIndex.appendRow(tracks[i]);
+            }
         }
+        libraryModel->appendTracks(added);
         
-        // Set current index and play
-        currentIndex = currentPlaylist.indexOf(filePath);
-        loadSong(filePath);
-        mediaPlayer->play();
-        playPauseButton->setText("Pause");
-        isPlaying = true;
-    });
+        // Smart playlists look at just these rows and the new ones
+        for (SmartPlaylist &playlist : smartPlaylists) {
+            if (playlist.isEvaluated()) {
+                playlist.update(libraryIndex.tracks(), rows);
+            }
+        }
+        searchLibrary();
+    }
+}
+
+void MainWindow::removeLibraryRows(const QList<int> &rows)
+{
+    const int oldCount = libraryIndex.tracks().size() + int(rows.size());
+    if (searchIndexWatcher.isRunning() || searchIndex.rowCount() != oldCount) {
+        // A rebuild is under way (or the views are out of step); start over from the index
+        populateLibrary();
+        return;
+    }
     
-    statusBar()->showMessage(QString("Library scan complete: %1 files found").arg(libraryModel->rowCount()));
+    libraryModel->removeTracks(rows, libraryIndex.tracks());
+    searchIndex.removeRows(rows);
+    for (SmartPlaylist &playlist : smartPlaylists) {
+        playlist.removeRows(rows);
+    }
+    searchLibrary();
+}
+
+void MainWindow::scheduleIndexSave()
+{
+    indexSaveTimer->start();
+}
+
+void MainWindow::saveIndexInBackground()
+{
+    // One save at a time, each of the index as it stood when it started
+    if (indexSaveWatcher.isRunning()) {
+        indexSavePending = true;
+        return;
+    }
+    const LibraryIndex index = libraryIndex;
+    indexSaveWatcher.setFuture(QtConcurrent::run([index]() {
+        return index.save();
+    }));
+}
+
+bool MainWindow::saveIndexNow()
+{
+    // Anything scheduled is covered by this save
+    indexSaveTimer->stop();
+    indexSavePending = false;
+    indexSaveWatcher.waitForFinished();
+    return libraryIndex.save();
 }
 
 void MainWindow::editMetadata()
 {
-    if (currentIndex < 0 || currentIndex >= currentPlaylist.size()) {
-        QMessageBox::information(this, "Edit Metadata", "No song is currently selected.");
+    if (tagWriteWatcher.isRunning()) {
+        QMessageBox::information(this, "Edit Metadata", "Tags are still being written.");
         return;
     }
     
-    QString filePath = currentPlaylist[currentIndex];
+    // The selected library rows when the Library tab is showing, otherwise the current song
+    QList<TrackInfo> tracks;
+    if (tabWidget->currentWidget() == libraryTab) {
+        for (const QModelIndex &index : libraryTableView->selectionModel()->selectedRows()) {
+            tracks.append(libraryModel->track(libraryFilter->mapToSource(index).row()));
+        }
+    }
+    if (tracks.isEmpty() && playlistModel->currentRow() >= 0) {
+        const QString filePath = playlistModel->path(playlistModel->currentRow());
+        const int row = libraryIndex.row(filePath);
+        tracks.append(row >= 0 ? libraryIndex.tracks().at(row) : TagReader::readTrack(filePath));
+    }
+    if (tracks.isEmpty()) {
+        QMessageBox::information(this, "Edit Metadata", "No song is currently selected.");
+        return;
+    }
     
     // Create dialog
     QDialog dialog(this);
-    dialog.setWindowTitle("Edit Metadata");
+    dialog.setWindowTitle(tracks.size() == 1 ? QString("Edit Metadata")
+                                             : QString("Edit Metadata (%1 songs)").arg(tracks.size()));
     
     QVBoxLayout *layout = new QVBoxLayout(&dialog);
     
     QFormLayout *formLayout = new QFormLayout();
     
-    QLineEdit *titleEdit = new QLineEdit(currentMetadata.value("title").toString());
-    QLineEdit *artistEdit = new QLineEdit(currentMetadata.value("artist").toString());
-    QLineEdit *albumEdit = new QLineEdit(currentMetadata.value("album").toString());
+    // A field starts out with the value the songs share, or blank if they differ
+    auto sharedValue = [&tracks](QString TrackInfo::*field) {
+        const QString first = tracks.first().*field;
+        for (const TrackInfo &track : tracks) {
+            if (track.*field != first) {
+                return QString();
+            }
+        }
+        return first;
+    };
+    auto fieldEdit = [&](QString TrackInfo::*field) {
+        QLineEdit *lineEdit = new QLineEdit(sharedValue(field));
+        if (lineEdit->text().isEmpty() && tracks.size() > 1) {
+            lineEdit->setPlaceholderText("(multiple values)");
+        }
+        return lineEdit;
+    };
+    
+    QLineEdit *titleEdit = fieldEdit(&TrackInfo::title);
+    QLineEdit *artistEdit = fieldEdit(&TrackInfo::artist);
+    QLineEdit *albumEdit = fieldEdit(&TrackInfo::album);
     
     formLayout->addRow("Title:", titleEdit);
     formLayout->addRow("Artist:", artistEdit);
@@ -880,30 +1514,74 @@ void MainWindow::editMetadata()
     
     layout->addWidget(buttonBox);
     
-    if (dialog.exec() == QDialog::Accepted) {
-        // TODO: Save metadata to file
-        // This requires a tag library like TagLib which is not part of Qt
-        // For now, just update the current metadata in memory
-        currentMetadata["title"] = titleEdit->text();
-        currentMetadata["artist"] = artistEdit->text();
-        currentMetadata["album"] = albumEdit->text();
-        
-        // Update UI
-        songTitleLabel->setText(titleEdit->text());
-        artistLabel->setText(artistEdit->text());
-        albumLabel->setText(albumEdit->text());
+    if (dialog.exec() != QDialog::Accepted) {
+        return;
+    }
+    
+    // Only fields the user changed are written, so a batch edit of the album leaves titles alone
+    int fields = 0;
+    if (titleEdit->isModified()) fields |= TagEdit::Title;
+    if (artistEdit->isModified()) fields |= TagEdit::Artist;
+    if (albumEdit->isModified()) fields |= TagEdit::Album;
+    if (fields == 0) {
+        return;
+    }
+    
+    QList<TagEdit> edits;
+    for (const TrackInfo &track : tracks) {
+        TagEdit edit;
+        edit.path = track.path;
+        edit.fields = fields;
+        edit.title = titleEdit->text().trimmed();
+        edit.artist = artistEdit->text().trimmed();
+        edit.album = albumEdit->text().trimmed();
+        edits.append(edit);
+    }
+    
+    // Files are independent, so the I/O runs on the pool; the index is updated once at the end
+    statusBar()->showMessage(QString("Writing tags to %1 files...").arg(edits.size()));
+    tagWriteWatcher.setFuture(QtConcurrent::mapped(edits, &TagWriter::write));
+}
+
+void MainWindow::tagsWritten()
+{
+    QList<TrackInfo> tracks;
+    QStringList failures;
+    int inPlace = 0;
+    for (const TagWriteResult &result : tagWriteWatcher.future().results()) {
+        if (!result.ok) {
+            failures.append(QString("%1: %2").arg(QFileInfo(result.path).fileName(), result.error));
+            continue;
+        }
+        inPlace += result.inPlace ? 1 : 0;
         
-        QMessageBox::information(this, "Edit Metadata", 
-            "Metadata editing is not fully implemented in this example.\n"
-            "To implement this feature completely, you would need to use a tag library like TagLib.");
+        // Playlist-only files are written but don't join the library
+        if (libraryIndex.row(result.path) >= 0) {
+            tracks.append(result.track);
+        }
+        if (result.path == playback->source()) {
+            updateMetadata(result.path);
+        }
+    }
+    
+    if (!tracks.isEmpty()) {
+        // The audio is untouched, so loudness results carry over to the new mtime and size
+        applyLibraryTracks(tracks, true);
+    }
+    
+    const int written = tagWriteWatcher.future().resultCount() - failures.size();
+    statusBar()->showMessage(QString("Tags written to %1 files (%2 in place)").arg(written).arg(inPlace), 5000);
+    if (!failures.isEmpty()) {
+        QMessageBox::warning(this, "Edit Metadata",
+                             QString("Tags could not be written to %1 files:\n\n%2")
+                             .arg(failures.size()).arg(failures.mid(0, 10).join("\n")));
     }
 }
 
 void MainWindow::applyEqualizer(int band, int value)
 {
-    // TODO: Implement equalizer functionality
-    // This would require audio processing which is not directly supported in Qt
-    // You would need to use a library like FFmpeg or implement DSP algorithms
+    // The engine picks the new gain up at its next audio block and ramps to it
+    playback->equalizer()->setGain(band, value);
 }
 
 void MainWindow::saveEqualizerPreset()
@@ -1017,69 +1695,227 @@ QString MainWindow::formatTime(qint64 ms)
     return QString("%1:%2").arg(minutes).arg(seconds, 2, 10, QChar('0'));
 }
 
-void MainWindow::loadSong(const QString &filePath)
+void MainWindow::showCurrentTrack(const QString &filePath)
 {
-    mediaPlayer->setSource(QUrl::fromLocalFile(filePath));
-    
     // Update UI
-    QFileInfo fileInfo(filePath);
-    songTitleLabel->setText(fileInfo.baseName());
-    artistLabel->setText("Loading...");
-    albumLabel->setText("Loading...");
+    updateMetadata(filePath);
     albumArtLabel->setText("Loading...");
+    coverArtCache->request(filePath);
+    waveformView->setSummary(nullptr);
+    waveformCache->request(filePath);
     
-    // Update playlist selection
-    for (int i = 0; i < playlistListWidget->count(); ++i) {
-        playlistListWidget->item(i)->setSelected(i == currentIndex);
+    // Scroll to current item; the model highlights it
+    if (playlistView && playlistModel->currentRow() >= 0) {
+        playlistView->scrollTo(playlistModel->index(playlistModel->currentRow()));
     }
-    
-    // Scroll to current item
-    if (currentIndex >= 0 && currentIndex < playlistListWidget->count()) {
-        playlistListWidget->scrollToItem(playlistListWidget->item(currentIndex));
+}
+
+void MainWindow::setLoudnessMode(Loudness::Mode mode)
+{
+    for (QAction *action : loudnessModeGroup->actions()) {
+        action->setChecked(action->data().toInt() == int(mode));
     }
+    
+    // Takes effect immediately for the current track and the queued one
+    session->setLoudnessMode(mode);
 }
 
-void MainWindow::updatePlaylist()
+void MainWindow::setCrossfade(int seconds, Crossfade::Curve curve)
 {
-    playlistListWidget->clear();
+    crossfadeSeconds = qBound(0, seconds, Crossfade::MaxSeconds);
+    crossfadeCurve = curve == Crossfade::Linear ? Crossfade::Linear : Crossfade::EqualPower;
+    for (QAction *action : crossfadeLengthGroup->actions()) {
+        action->setChecked(action->data().toInt() == crossfadeSeconds);
+    }
+    for (QAction *action : crossfadeCurveGroup->actions()) {
+        action->setChecked(action->data().toInt() == int(crossfadeCurve));
+    }
     
-    for (const QString &filePath : currentPlaylist) {
-        QFileInfo fileInfo(filePath);
-        playlistListWidget->addItem(fileInfo.baseName());
+    // The engine schedules each fade against the outgoing track's decoded end,
+    // so this applies from the next transition, whatever the queue order
+    playback->setCrossfade(crossfadeSeconds * 1000, crossfadeCurve);
+}
+
+void MainWindow::analyzeLoudness()
+{
+    if (loudnessWatcher.isRunning()) {
+        loudnessWatcher.cancel();
+        return;
     }
     
-    // Update selection
-    if (currentIndex >= 0 && currentIndex < playlistListWidget->count()) {
-        playlistListWidget->item(currentIndex)->setSelected(true);
+    // Only tracks without a result, so an interrupted run resumes where it stopped
+    const TrackStore &library = libraryIndex.tracks();
+    QList<TrackInfo> tracks;
+    for (int row = 0; row < library.size(); ++row) {
+        if (library.gatedBlocks(row) < 0) {
+            tracks.append(library.at(row));
+        }
+    }
+    if (tracks.isEmpty()) {
+        statusBar()->showMessage("Loudness analysis is up to date");
+        return;
     }
+    
+    // One decode per pool thread; each track is independent, so this scales with cores
+    loudnessTaken = QBitArray(tracks.size());
+    pendingLoudness.clear();
+    loudnessSaveTimer.start();
+    loudnessWatcher.setFuture(QtConcurrent::mapped(tracks, &Loudness::analyzeFile));
+    analyzeLoudnessAction->setText("Stop Loudness Analysis");
 }
 
-void MainWindow::shufflePlaylist()
+void MainWindow::loudnessResultsReady(int begin, int end)
 {
-    if (currentPlaylist.size() <= 1) return;
-    
-    // Remember current song
-    QString currentSong = currentIndex >= 0 && currentIndex < currentPlaylist.size() 
-                        ? currentPlaylist[currentIndex] : QString();
+    const QFuture<LoudnessResult> future = loudnessWatcher.future();
+    for (int i = begin; i < end && i < loudnessTaken.size(); ++i) {
+        if (!loudnessTaken.testBit(i) && future.isResultReadyAt(i)) {
+            loudnessTaken.setBit(i);
+            pendingLoudness.append(future.resultAt(i));
+        }
+    }
     
-    // Shuffle playlist
-    QStringList shuffled = currentPlaylist;
+    // Saving rewrites the whole index, so do it every so often rather than per result
+    if (loudnessSaveTimer.elapsed() > 30000) {
+        applyLoudnessResults();
+        loudnessSaveTimer.restart();
+    }
+}
+
+void MainWindow::loudnessAnalysisFinished()
+{
+    applyLoudnessResults();
+    analyzeLoudnessAction->setText("Analyze Loudness");
+    statusBar()->showMessage(loudnessWatcher.isCanceled() ? "Loudness analysis stopped"
+                                                          : "Loudness analysis complete");
     
-    // Fisher-Yates shuffle algorithm
-    QRandomGenerator *rng = QRandomGenerator::global();
-    for (int i = shuffled.size() - 1; i > 0; --i) {
-        int j = rng->bounded(i + 1);
-        if (i != j) {
-            shuffled.swapItemsAt(i, j);
+    // Gains may have changed for what is playing and what is queued
+    session->refreshGains();
+}
+
+void MainWindow::applyLoudnessResults()
+{
+    if (pendingLoudness.isEmpty()) {
+        return;
+    }
+    libraryIndex.setLoudness(pendingLoudness);
+    pendingLoudness.clear();
+    // Written on a worker; a failure is reported when it lands
+    scheduleIndexSave();
+    
+    for (SmartPlaylist &playlist : smartPlaylists) {
+        if (playlist.query().usesField(SmartQuery::Loudness)) {
+            playlist.invalidate();
         }
     }
+    if (activeSmartPlaylist >= 0 && !smartPlaylists[activeSmartPlaylist].isEvaluated()) {
+        searchLibrary();
+    }
+}
+
+void MainWindow::findDuplicates()
+{
+    if (fingerprintWatcher.isRunning()) {
+        fingerprintWatcher.cancel();
+        return;
+    }
+    if (duplicateWatcher.isRunning()) {
+        return;
+    }
     
-    // Update playlist
-    currentPlaylist = shuffled;
-    updatePlaylist();
+    // Only tracks without a fingerprint, so an interrupted run resumes where it stopped
+    const TrackStore &library = libraryIndex.tracks();
+    QList<TrackInfo> tracks;
+    for (int row = 0; row < library.size(); ++row) {
+        if (library.fingerprintSize(row) == 0) {
+            tracks.append(library.at(row));
+        }
+    }
+    if (tracks.isEmpty()) {
+        groupDuplicates();
+        return;
+    }
     
-    // Find new index of current song
-    if (!currentSong.isEmpty()) {
-        currentIndex = currentPlaylist.indexOf(currentSong);
+    // Decoding dominates, and each track is independent, so this scales with cores
+    fingerprintWatcher.setFuture(QtConcurrent::mapped(tracks, &Fingerprint::analyzeFile));
+    findDuplicatesAction->setText("Stop Finding Duplicates");
+}
+
+void MainWindow::fingerprintsFinished()
+{
+    applyFingerprintResults();
+    findDuplicatesAction->setText("Find Duplicates");
+    if (fingerprintWatcher.isCanceled()) {
+        statusBar()->showMessage("Fingerprinting stopped");
+        return;
     }
+    groupDuplicates();
+}
+
+void MainWindow::applyFingerprintResults()
+{
+    // A stopped run keeps what it finished
+    const QList<FingerprintResult> results = fingerprintWatcher.future().results();
+    if (libraryIndex.setFingerprints(results) > 0) {
+        scheduleIndexSave();
+    }
+}
+
+void MainWindow::groupDuplicates()
+{
+    statusBar()->showMessage("Looking for duplicates...");
+    const TrackStore tracks = libraryIndex.tracks();
+    duplicateWatcher.setFuture(QtConcurrent::run([tracks]() {
+        return Fingerprint::findDuplicates(tracks);
+    }));
+}
+
+void MainWindow::showDuplicates()
+{
+    buildLibraryTab();
+    duplicatesTree->clear();
+    
+    // One parent per recording, with a child per copy
+    QList<QTreeWidgetItem *> groups;
+    int copies = 0;
+    for (const QStringList &paths : duplicateWatcher.result()) {
+        QTreeWidgetItem *group = new QTreeWidgetItem();
+        for (const QString &path : paths) {
+            const int row = libraryIndex.row(path);
+            if (row < 0) {
+                continue; // Removed while the search ran
+            }
+            const TrackInfo track = libraryIndex.tracks().at(row);
+            new QTreeWidgetItem(group, {track.title, track.artist, track.album, formatTime(track.duration), track.path});
+        }
+        if (group->childCount() < 2) {
+            delete group;
+            continue;
+        }
+        group->setText(0, group->child(0)->text(0));
+        group->setText(1, group->child(0)->text(1));
+        group->setText(4, QString("%1 copies").arg(group->childCount()));
+        copies += group->childCount();
+        groups.append(group);
+    }
+    duplicatesTree->addTopLevelItems(groups);
+    duplicatesTree->expandAll();
+    
+    duplicatesLabel->setText(groups.isEmpty() ? QString("No duplicates found")
+                                              : QString("%1 recordings with more than one copy (%2 files)")
+                                                .arg(groups.size()).arg(copies));
+    duplicatesPanel->show();
+    tabWidget->setCurrentWidget(libraryTab);
+    statusBar()->clearMessage();
+}
+
+void MainWindow::playFile(const QString &filePath)
+{
+    // Add to playlist if not already there
+    int row = playlistModel->indexOf(filePath);
+    if (row < 0) {
+        row = playlistModel->count();
+        playlistModel->append(QStringList{filePath});
+    }
+    
+    session->playRow(row);
 }
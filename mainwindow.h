@@ -2,9 +2,9 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QAction>
 #include <QMediaPlayer>
-#include <QAudioOutput>
-#include <QListWidget>
+#include <QListView>
 #include <QSlider>
 #include <QPushButton>
 #include <QLabel>
@@ -15,12 +15,33 @@
 #include <QLineEdit>
 #include <QStandardItemModel>
 #include <QTableView>
-#include <QMediaMetaData>
+#include <QTreeWidget>
 #include <QSettings>
 #include <QProgressDialog>
 #include <QDirIterator>
 #include <QEventLoop>
+#include <QSet>
+#include <QActionGroup>
+#include <QBitArray>
+#include <QElapsedTimer>
 #include <QTimer>
+#include "playbackcontroller.h"
+#include "controlserver.h"
+#include "coverartcache.h"
+#include "libraryindex.h"
+#include "librarymodel.h"
+#include "libraryscanner.h"
+#include "librarywatcher.h"
+#include "playbackqueue.h"
+#include "playersession.h"
+#include "playlistmodel.h"
+#include "searchindex.h"
+#include "sessionstore.h"
+#include "smartplaylist.h"
+#include "tagwriter.h"
+#include "waveformcache.h"
+#include "waveformview.h"
+#include <QFutureWatcher>
 
 class MainWindow : public QMainWindow
 {
@@ -37,42 +58,89 @@ private slots:
     void next();
     void previous();
     void seekChanged(int position);
-    void updatePosition(qint64 position);
-    void updateDuration(qint64 duration);
-    void updateMetadata();
+    void updatePlaybackInfo(const PlaybackSnapshot &snapshot);
+    void showCoverArt(const QString &filePath, const QPixmap &pixmap);
+    void showWaveform(const QString &filePath, QSharedPointer<const WaveformSummary> summary);
     void setVolume(int volume);
     void toggleMute();
     void toggleRepeat();
     void toggleShuffle();
+    void showPlayOrder();
     void createPlaylist();
     void loadPlaylist();
     void savePlaylist();
     void addToPlaylist();
     void removeFromPlaylist();
-    void playlistItemDoubleClicked(QListWidgetItem *item);
+    void playlistItemDoubleClicked(const QModelIndex &index);
     void searchLibrary();
+    void showSmartPlaylist(int index);
+    void newSmartPlaylist();
+    void editSmartPlaylist();
+    void deleteSmartPlaylist();
+    void playSmartPlaylist();
     void scanLibrary();
+    void rescanLibrary();
+    void libraryChanged(const QStringList &changed, const QStringList &removed);
+    void libraryTagsRead();
+    void analyzeLoudness();
+    void loudnessResultsReady(int begin, int end);
+    void loudnessAnalysisFinished();
+    void findDuplicates();
+    void fingerprintsFinished();
+    void showDuplicates();
+    void setLoudnessMode(Loudness::Mode mode);
+    void setCrossfade(int seconds, Crossfade::Curve curve);
     void editMetadata();
+    void tagsWritten();
     void applyEqualizer(int band, int value);
     void saveEqualizerPreset();
     void loadEqualizerPreset();
     void setSleepTimer();
+    void playingChanged(bool playing);
+    void ensureTab(int index);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
 
 private:
     void setupUi();
+    void buildLibraryTab();
+    void buildPlaylistsTab();
+    void buildEqualizerTab();
+    void buildFileBrowserTab();
+    void startupFinished();
     void setupConnections();
     void setupMenus();
     void loadSettings();
     void saveSettings();
-    void updatePlaybackInfo();
+    void updateMetadata(const QString &filePath);
     QString formatTime(qint64 ms);
-    void loadSong(const QString &filePath);
-    void updatePlaylist();
-    void shufflePlaylist();
+    void showCurrentTrack(const QString &filePath);
+    PlaybackQueue::ShuffleMode shuffleMode() const;
+    void updateLibrary(const QStringList &roots);
+    void populateLibrary();
+    void readChangedTags();
+    void applyLoudnessResults();
+    void applyFingerprintResults();
+    void groupDuplicates();
+    void playFile(const QString &filePath);
+    void applyLibraryTracks(const QList<TrackInfo> &tracks, bool tagsOnly);
+    void removeLibraryRows(const QList<int> &rows);
+    void scheduleIndexSave();
+    void saveIndexInBackground();
+    bool saveIndexNow();
+    bool askSmartQuery(const QString &title, QString *name, SmartQuery *query);
+    int chooseSmartPlaylist(const QString &title);
+    void refreshSmartPlaylistBox();
+    void saveSmartPlaylists();
     
-    // Core media components
-    QMediaPlayer *mediaPlayer;
-    QAudioOutput *audioOutput;
+    // Core media components; the session owns the engine and the playlist
+    PlayerSession *session;
+    SessionStore *sessionStore;
+    PlaybackController *playback;
+    ControlServer *controlServer;
+    CoverArtCache *coverArtCache;
+    WaveformCache *waveformCache;
     
     // UI components
     QTabWidget *tabWidget;
@@ -84,6 +152,7 @@ private:
     QLabel *artistLabel;
     QLabel *albumLabel;
     QSlider *seekSlider;
+    WaveformView *waveformView;
     QLabel *currentTimeLabel;
     QLabel *totalTimeLabel;
     QPushButton *playPauseButton;
@@ -94,43 +163,77 @@ private:
     QPushButton *repeatButton;
     QSlider *volumeSlider;
     QPushButton *muteButton;
+    QAction *spreadArtistsAction;
+    QAction *analyzeLoudnessAction;
+    QAction *findDuplicatesAction;
+    QActionGroup *loudnessModeGroup;
+    QActionGroup *crossfadeLengthGroup;
+    QActionGroup *crossfadeCurveGroup;
     
-    // Library tab
+    // Library tab; the widgets are null until the tab is first shown, the models aren't
     QWidget *libraryTab;
-    QLineEdit *searchBox;
-    QPushButton *searchButton;
-    QTableView *libraryTableView;
-    QStandardItemModel *libraryModel;
+    QLineEdit *searchBox = nullptr;
+    QPushButton *searchButton = nullptr;
+    QTableView *libraryTableView = nullptr;
+    LibraryModel *libraryModel;
+    LibraryFilterModel *libraryFilter;
+    QTimer *searchTimer;
+    QComboBox *smartPlaylistBox = nullptr;
+    QWidget *duplicatesPanel = nullptr;
+    QLabel *duplicatesLabel = nullptr;
+    QPushButton *hideDuplicatesButton = nullptr;
+    QTreeWidget *duplicatesTree = nullptr;
     
-    // Playlists tab
+    // Playlists tab (widgets built on first show)
     QWidget *playlistsTab;
-    QListWidget *playlistListWidget;
-    QPushButton *addToPlaylistButton;
-    QPushButton *removeFromPlaylistButton;
-    QPushButton *createPlaylistButton;
-    QPushButton *loadPlaylistButton;
-    QPushButton *savePlaylistButton;
+    QListView *playlistView = nullptr;
+    PlaylistModel *playlistModel;
+    QPushButton *addToPlaylistButton = nullptr;
+    QPushButton *removeFromPlaylistButton = nullptr;
+    QPushButton *createPlaylistButton = nullptr;
+    QPushButton *loadPlaylistButton = nullptr;
+    QPushButton *savePlaylistButton = nullptr;
     
-    // Equalizer tab
+    // Equalizer tab (built on first show; the gains live in the engine)
     QWidget *equalizerTab;
     QVector<QSlider*> equalizerSliders;
-    QComboBox *equalizerPresets;
-    QPushButton *saveEqualizerButton;
+    QComboBox *equalizerPresets = nullptr;
+    QPushButton *saveEqualizerButton = nullptr;
     
-    // File browser tab
+    // File browser tab (built, and the model started, on first show)
     QWidget *fileBrowserTab;
-    QFileSystemModel *fileSystemModel;
-    QTreeView *fileSystemView;
+    QFileSystemModel *fileSystemModel = nullptr;
+    QTreeView *fileSystemView = nullptr;
+    QString fileBrowserRoot;
     
     // State variables
-    bool isPlaying;
     bool isMuted;
-    bool isShuffled;
-    int repeatMode; // 0: no repeat, 1: repeat all, 2: repeat one
-    QStringList currentPlaylist;
-    int currentIndex;
+    PlaybackSnapshot shownPlayback;
+    int crossfadeSeconds;
+    Crossfade::Curve crossfadeCurve;
     QMap<QString, QVariant> currentMetadata;
     QSettings settings;
+    bool firstFrameShown;
+    LibraryIndex libraryIndex;
+    SearchIndex searchIndex;
+    QList<SmartPlaylist> smartPlaylists; // Evaluated when first needed, then kept up to date
+    int activeSmartPlaylist;             // The one filtering the Library view, or -1
+    QFutureWatcher<SearchIndex> searchIndexWatcher;
+    LibraryScanner *libraryScanner;
+    LibraryWatcher *libraryWatcher;
+    QFutureWatcher<TrackInfo> libraryTagWatcher;
+    QSet<QString> pendingLibraryChanges;
+    QTimer *indexSaveTimer;               // Coalesces the watcher's saves
+    QFutureWatcher<bool> indexSaveWatcher;
+    bool indexSavePending;                // Changed again while a save was running
+    QFutureWatcher<QList<PlaylistEntry>> playlistImportWatcher;
+    QFutureWatcher<LoudnessResult> loudnessWatcher;
+    QFutureWatcher<TagWriteResult> tagWriteWatcher;
+    QFutureWatcher<FingerprintResult> fingerprintWatcher;
+    QFutureWatcher<QList<QStringList>> duplicateWatcher;
+    QBitArray loudnessTaken;              // Results already moved to pendingLoudness
+    QList<LoudnessResult> pendingLoudness;
+    QElapsedTimer loudnessSaveTimer;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,131 @@
+#include "playbackcontroller.h"
+#include <QDebug>
+
+namespace {
+
+// Frames to keep sampling once nothing is playing, so the outcome of a
+// command the engine hasn't processed yet (a seek while paused) still shows
+const int IdleFrames = PlaybackController::FrameRate / 2;
+
+} // namespace
+
+PlaybackController::PlaybackController(QObject *parent)
+    : QObject(parent),
+      engine(new AudioEngine),
+      idleFrames(0)
+{
+    engine->moveToThread(&thread);
+    connect(&thread, &QThread::started, engine, &AudioEngine::initialize);
+    connect(&thread, &QThread::finished, engine, &QObject::deleteLater);
+
+    // Cross-thread, so these are queued onto the GUI thread
+    connect(engine, &AudioEngine::currentSourceChanged, this, [this](const QString &filePath) {
+        sourcePath = filePath;
+        wake();
+        emit currentSourceChanged(filePath);
+    });
+    connect(engine, &AudioEngine::mediaStatusChanged, this, [this](QMediaPlayer::MediaStatus status) {
+        wake();
+        emit mediaStatusChanged(status);
+    });
+    connect(engine, &AudioEngine::errorOccurred, this, &PlaybackController::errorOccurred);
+
+    frameTimer = new QTimer(this);
+    frameTimer->setInterval(1000 / FrameRate);
+    connect(frameTimer, &QTimer::timeout, this, &PlaybackController::sample);
+
+    // Above the GUI so a burst of UI work doesn't starve decoding or the sink
+    thread.setObjectName("AudioEngine");
+    thread.start(QThread::HighPriority);
+}
+
+PlaybackController::~PlaybackController()
+{
+    thread.quit();
+    thread.wait();
+}
+
+void PlaybackController::setSource(const QString &filePath, float gain)
+{
+    sourcePath = filePath;
+    send({EngineCommand::SetSource, filePath, 0, gain});
+}
+
+void PlaybackController::setNextSource(const QString &filePath, float gain)
+{
+    send({EngineCommand::SetNextSource, filePath, 0, gain});
+}
+
+void PlaybackController::setGain(float gain)
+{
+    send({EngineCommand::SetGain, QString(), 0, gain});
+}
+
+void PlaybackController::play()
+{
+    send({EngineCommand::Play});
+}
+
+void PlaybackController::pause()
+{
+    send({EngineCommand::Pause});
+}
+
+void PlaybackController::stop()
+{
+    send({EngineCommand::Stop});
+}
+
+void PlaybackController::setPosition(qint64 position)
+{
+    send({EngineCommand::SetPosition, QString(), position});
+}
+
+void PlaybackController::setVolume(float volume)
+{
+    send({EngineCommand::SetVolume, QString(), 0, volume});
+}
+
+void PlaybackController::setMuted(bool muted)
+{
+    send({EngineCommand::SetMuted, QString(), muted ? 1 : 0});
+}
+
+void PlaybackController::setCrossfade(qint64 duration, Crossfade::Curve curve)
+{
+    send({EngineCommand::SetCrossfadeCurve, QString(), qint64(curve)});
+    send({EngineCommand::SetCrossfade, QString(), duration});
+}
+
+void PlaybackController::send(const EngineCommand &command)
+{
+    // 256 slots; the engine drains them far faster than anyone can click
+    if (!engine->post(command)) {
+        qWarning() << "Playback command queue full; dropped command" << command.type;
+    }
+    wake();
+}
+
+void PlaybackController::wake()
+{
+    idleFrames = 0;
+    if (!frameTimer->isActive()) {
+        frameTimer->start();
+    }
+}
+
+void PlaybackController::sample()
+{
+    const PlaybackSnapshot current = engine->snapshot();
+    if (current != shown) {
+        shown = current;
+        idleFrames = 0;
+        emit snapshotChanged(current);
+        return;
+    }
+
+    // Nothing moves while stopped or paused; sleep until the next command or event
+    if (current.state != QMediaPlayer::PlayingState && ++idleFrames >= IdleFrames) {
+        frameTimer->stop();
+    }
+}
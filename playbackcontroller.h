@@ -0,0 +1,66 @@
+#ifndef PLAYBACKCONTROLLER_H
+#define PLAYBACKCONTROLLER_H
+
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include "audioengine.h"
+
+// GUI-side handle for the AudioEngine, which runs on its own thread.
+// Transport calls return immediately: each becomes an EngineCommand on
+// the engine's lock-free queue. Position, duration and state are sampled
+// from the engine's snapshot at most FrameRate times a second and
+// reported through snapshotChanged() only when they differ, so the UI
+// does bounded work however often the engine publishes.
+class PlaybackController : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int FrameRate = 30;
+
+    explicit PlaybackController(QObject *parent = nullptr);
+    ~PlaybackController();
+
+    // gain is the track's loudness normalization (linear), applied sample-exactly
+    void setSource(const QString &filePath, float gain = 1.0f);
+    // Track the engine has been told comes first; updated by currentSourceChanged()
+    QString source() const { return sourcePath; }
+    void setNextSource(const QString &filePath, float gain = 1.0f);
+    // Changes the gain of the track that is playing now
+    void setGain(float gain);
+
+    void play();
+    void pause();
+    void stop();
+    void setPosition(qint64 position);
+    void setVolume(float volume);
+    void setMuted(bool muted);
+    // duration (ms) of 0 joins tracks gaplessly; at most Crossfade::MaxSeconds
+    void setCrossfade(qint64 duration, Crossfade::Curve curve);
+
+    PlaybackSnapshot snapshot() const { return engine->snapshot(); }
+    Equalizer *equalizer() { return engine->equalizer(); }
+
+signals:
+    void snapshotChanged(const PlaybackSnapshot &snapshot);
+    void currentSourceChanged(const QString &filePath);
+    void mediaStatusChanged(QMediaPlayer::MediaStatus status);
+    void errorOccurred(const QString &message);
+
+private slots:
+    void sample();
+
+private:
+    void send(const EngineCommand &command);
+    void wake();
+
+    QThread thread;
+    AudioEngine *engine;
+    QTimer *frameTimer;
+    PlaybackSnapshot shown;
+    int idleFrames;
+    QString sourcePath;
+};
+
+#endif // PLAYBACKCONTROLLER_H
@@ -0,0 +1,399 @@
+#include "playbackqueue.h"
+#include <QHash>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+PlaybackQueue::PlaybackQueue()
+    : mode(NoRepeat),
+      shuffle(NoShuffle),
+      reshuffleEachPass(false),
+      count(0),
+      anchor(-1),
+      wrapRow(-1),
+      rng(QRandomGenerator::securelySeeded())
+{
+}
+
+void PlaybackQueue::setRepeatMode(RepeatMode repeatMode)
+{
+    mode = repeatMode;
+}
+
+void PlaybackQueue::setShuffleMode(ShuffleMode shuffleMode, int currentRow)
+{
+    applyRemovals();
+    shuffle = shuffleMode;
+    anchor = currentRow;
+    wrapRow = -1;
+
+    if (shuffle == NoShuffle) {
+        // Rows were never moved, so the playlist order is simply back
+        order.clear();
+        position.clear();
+        return;
+    }
+    buildOrder(currentRow);
+}
+
+QList<int> PlaybackQueue::playOrder()
+{
+    applyRemovals();
+    return order;
+}
+
+bool PlaybackQueue::restoreOrder(ShuffleMode shuffleMode, const QList<int> &savedOrder, int currentRow)
+{
+    applyRemovals();
+    if (shuffleMode == NoShuffle || savedOrder.size() != count) {
+        return false;
+    }
+    QList<bool> seen(count, false);
+    for (int row : savedOrder) {
+        if (row < 0 || row >= count || seen.at(row)) {
+            return false;
+        }
+        seen[row] = true;
+    }
+
+    shuffle = shuffleMode;
+    order = savedOrder;
+    anchor = currentRow;
+    wrapRow = -1;
+    rebuildPositions();
+    return true;
+}
+
+void PlaybackQueue::setReshuffleOnWrap(bool enabled)
+{
+    reshuffleEachPass = enabled;
+}
+
+void PlaybackQueue::setGroupFunction(const std::function<QString(int)> &function)
+{
+    groupOf = function;
+}
+
+void PlaybackQueue::reset(int rowCount)
+{
+    pendingRemovals.clear();
+    count = rowCount;
+    anchor = -1;
+    wrapRow = -1;
+
+    if (shuffle != NoShuffle) {
+        buildOrder(-1);
+    }
+}
+
+void PlaybackQueue::insertRows(int first, int added)
+{
+    applyRemovals();
+    if (added <= 0) {
+        return;
+    }
+
+    count += added;
+    if (anchor >= first) {
+        anchor += added;
+    }
+    if (wrapRow >= first) {
+        wrapRow += added;
+    }
+    if (shuffle == NoShuffle) {
+        return;
+    }
+
+    for (int &row : order) {
+        if (row >= first) {
+            row += added;
+        }
+    }
+
+    // New rows go to random places in the part of the order that hasn't played yet
+    const int oldAnchor = anchor >= first + added ? anchor - added : anchor;
+    const int start = oldAnchor >= 0 && oldAnchor < position.size() ? position.at(oldAnchor) + 1 : 0;
+    for (int row = first; row < first + added; ++row) {
+        order.append(row);
+        const int last = order.size() - 1;
+        const int target = start + int(rng.bounded(quint32(last - start + 1)));
+        std::swap(order[last], order[target]);
+    }
+    rebuildPositions();
+}
+
+void PlaybackQueue::removeRows(int first, int removed)
+{
+    if (removed <= 0) {
+        return;
+    }
+
+    // Ranges that come highest first share the original numbering and can be batched
+    if (!pendingRemovals.isEmpty() && first + removed > pendingRemovals.last().first) {
+        applyRemovals();
+    }
+    pendingRemovals.append({first, removed});
+}
+
+void PlaybackQueue::moveRows(int first, int count, int destination)
+{
+    applyRemovals();
+    if (count <= 0) {
+        return;
+    }
+
+    // The order keeps its play positions; only the row numbers change
+    anchor = anchor >= 0 ? movedRow(anchor, first, count, destination) : -1;
+    wrapRow = wrapRow >= 0 ? movedRow(wrapRow, first, count, destination) : -1;
+    if (shuffle == NoShuffle) {
+        return;
+    }
+
+    for (int &row : order) {
+        row = movedRow(row, first, count, destination);
+    }
+    rebuildPositions();
+}
+
+int PlaybackQueue::movedRow(int row, int first, int count, int destination)
+{
+    if (destination > first + count) {
+        // Down: the block lands just above destination, the rows in between move up
+        if (row >= first && row < first + count) {
+            return row + destination - first - count;
+        }
+        if (row >= first + count && row < destination) {
+            return row - count;
+        }
+    } else if (destination < first) {
+        // Up: the rows in between move down below the block
+        if (row >= first && row < first + count) {
+            return row - (first - destination);
+        }
+        if (row >= destination && row < first) {
+            return row + count;
+        }
+    }
+    return row;
+}
+
+void PlaybackQueue::applyRemovals()
+{
+    if (pendingRemovals.isEmpty()) {
+        return;
+    }
+
+    int total = 0;
+    for (const QPair<int, int> &range : std::as_const(pendingRemovals)) {
+        total += range.second;
+    }
+
+    auto mapRow = [this](int row) {
+        // Ranges are descending, so each one is in the original numbering
+        for (const QPair<int, int> &range : std::as_const(pendingRemovals)) {
+            if (row >= range.first + range.second) {
+                row -= range.second;
+            } else if (row >= range.first) {
+                return -1;
+            }
+        }
+        return row;
+    };
+    anchor = anchor >= 0 ? mapRow(anchor) : -1;
+    wrapRow = -1;
+
+    if (shuffle != NoShuffle) {
+        // New row number for every old row in one pass, -1 for removed rows
+        QList<int> renumber(count, 0);
+        for (const QPair<int, int> &range : std::as_const(pendingRemovals)) {
+            std::fill(renumber.begin() + range.first, renumber.begin() + range.first + range.second, -1);
+        }
+        int next = 0;
+        for (int &row : renumber) {
+            row = row < 0 ? -1 : next++;
+        }
+
+        int kept = 0;
+        for (int i = 0; i < order.size(); ++i) {
+            const int row = renumber.at(order.at(i));
+            if (row >= 0) {
+                order[kept++] = row;
+            }
+        }
+        order.resize(kept);
+    }
+
+    count -= total;
+    pendingRemovals.clear();
+
+    if (shuffle != NoShuffle) {
+        rebuildPositions();
+    }
+}
+
+int PlaybackQueue::following(int row)
+{
+    applyRemovals();
+    if (row < 0 || row >= count) {
+        return -1;
+    }
+    if (mode == RepeatOne) {
+        return row;
+    }
+    return next(row);
+}
+
+int PlaybackQueue::next(int row)
+{
+    applyRemovals();
+    if (row != wrapRow || row < 0) {
+        wrapRow = -1;
+    }
+    anchor = row;
+    if (count <= 0) {
+        return -1;
+    }
+
+    if (shuffle == NoShuffle) {
+        if (row + 1 < count) {
+            return row + 1;
+        }
+        return mode == NoRepeat ? -1 : 0;
+    }
+
+    if (row == wrapRow) {
+        // This wrap already drew its order; row no longer sits at the end of it
+        return order.first();
+    }
+    const int pos = row >= 0 && row < count ? position.at(row) : -1;
+    if (pos + 1 < count) {
+        return order.at(pos + 1);
+    }
+    return mode == NoRepeat ? -1 : firstAfterWrap(row);
+}
+
+int PlaybackQueue::previous(int row)
+{
+    applyRemovals();
+    anchor = row;
+    if (count <= 0) {
+        return -1;
+    }
+
+    const int pos = row < 0 || row >= count ? -1 : (shuffle == NoShuffle ? row : position.at(row));
+    if (pos > 0) {
+        return shuffle == NoShuffle ? pos - 1 : order.at(pos - 1);
+    }
+    if (mode == NoRepeat) {
+        return -1;
+    }
+    return shuffle == NoShuffle ? count - 1 : order.at(count - 1);
+}
+
+int PlaybackQueue::firstAfterWrap(int row)
+{
+    if (reshuffleEachPass && wrapRow != row) {
+        // Asked once per wrap: the gapless queue and the Next button agree on the result
+        buildOrder(-1);
+        if (count > 1 && order.first() == row) {
+            std::swap(order[0], order[1]);
+            rebuildPositions();
+        }
+        wrapRow = row;
+    }
+    return order.first();
+}
+
+void PlaybackQueue::buildOrder(int firstRow)
+{
+    order.resize(count);
+    std::iota(order.begin(), order.end(), 0);
+
+    if (shuffle == ArtistSpread && groupOf) {
+        spreadByGroup();
+    } else {
+        // Fisher-Yates
+        for (int i = count - 1; i > 0; --i) {
+            std::swap(order[i], order[int(rng.bounded(quint32(i + 1)))]);
+        }
+    }
+
+    // Rotate rather than swap, so the spacing of an artist spread survives
+    if (firstRow >= 0 && firstRow < count) {
+        const auto it = std::find(order.begin(), order.end(), firstRow);
+        std::rotate(order.begin(), it, order.end());
+    }
+    rebuildPositions();
+}
+
+void PlaybackQueue::spreadByGroup()
+{
+    // Every group's tracks are placed at evenly spaced points in [0, 1) with a
+    // random phase and a little jitter; the points are then bucket-sorted.
+    // This keeps the whole thing O(n) where sorting by key would be O(n log n).
+    QHash<QString, int> groupIds;
+    QList<int> groupOfRow(count);
+    for (int row = 0; row < count; ++row) {
+        const QString key = groupOf(row);
+        auto it = groupIds.constFind(key);
+        if (it == groupIds.constEnd()) {
+            it = groupIds.insert(key, int(groupIds.size()));
+        }
+        groupOfRow[row] = it.value();
+    }
+
+    // Rows bucketed by group (counting sort)
+    const int groups = int(groupIds.size());
+    QList<int> groupStart(groups + 1, 0);
+    for (int group : std::as_const(groupOfRow)) {
+        ++groupStart[group + 1];
+    }
+    std::partial_sum(groupStart.begin(), groupStart.end(), groupStart.begin());
+    QList<int> members(count);
+    QList<int> fill(groupStart.begin(), groupStart.end() - 1);
+    for (int row = 0; row < count; ++row) {
+        members[fill[groupOfRow.at(row)]++] = row;
+    }
+
+    // Spread each group's members, in random order, over the unit interval
+    QList<int> bucketOf(count);
+    for (int group = 0; group < groups; ++group) {
+        const int begin = groupStart.at(group);
+        const int size = groupStart.at(group + 1) - begin;
+        for (int i = size - 1; i > 0; --i) {
+            std::swap(members[begin + i], members[begin + int(rng.bounded(quint32(i + 1)))]);
+        }
+
+        const double phase = rng.generateDouble();
+        for (int i = 0; i < size; ++i) {
+            const double jitter = (rng.generateDouble() - 0.5) * 0.2;
+            const double point = std::clamp((i + phase + jitter) / size, 0.0, 0.999999);
+            bucketOf[begin + i] = int(point * count);
+        }
+    }
+
+    // Counting sort by bucket; ties within a bucket are shuffled
+    QList<int> bucketStart(count + 1, 0);
+    for (int bucket : std::as_const(bucketOf)) {
+        ++bucketStart[bucket + 1];
+    }
+    std::partial_sum(bucketStart.begin(), bucketStart.end(), bucketStart.begin());
+    QList<int> cursor(bucketStart.begin(), bucketStart.end() - 1);
+    for (int i = 0; i < count; ++i) {
+        order[cursor[bucketOf.at(i)]++] = members.at(i);
+    }
+    for (int bucket = 0; bucket < count; ++bucket) {
+        const int begin = bucketStart.at(bucket);
+        for (int i = bucketStart.at(bucket + 1) - begin - 1; i > 0; --i) {
+            std::swap(order[begin + i], order[begin + int(rng.bounded(quint32(i + 1)))]);
+        }
+    }
+}
+
+void PlaybackQueue::rebuildPositions()
+{
+    position.resize(order.size());
+    for (int pos = 0; pos < order.size(); ++pos) {
+        position[order.at(pos)] = pos;
+    }
+}
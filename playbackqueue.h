@@ -0,0 +1,98 @@
+#ifndef PLAYBACKQUEUE_H
+#define PLAYBACKQUEUE_H
+
+#include <QList>
+#include <QPair>
+#include <QRandomGenerator>
+#include <QString>
+#include <functional>
+
+// Decides which playlist entry plays next. Kept separate from the window so
+// the engine can be told about the following track ahead of time.
+//
+// Shuffle is a permutation over playlist rows: the playlist itself is never
+// reordered, so turning shuffle off is instant and duplicates are never
+// confused. order maps play position to row and position maps row back to
+// play position, which makes next/previous O(1). Building an order, and
+// keeping it in step with inserts and removals, is O(n).
+class PlaybackQueue
+{
+public:
+    enum RepeatMode {
+        NoRepeat,
+        RepeatAll,
+        RepeatOne
+    };
+
+    enum ShuffleMode {
+        NoShuffle,
+        Shuffle,
+        ArtistSpread // Shuffle, but keep tracks by the same artist apart
+    };
+
+    PlaybackQueue();
+
+    RepeatMode repeatMode() const { return mode; }
+    void setRepeatMode(RepeatMode repeatMode);
+
+    ShuffleMode shuffleMode() const { return shuffle; }
+    // Starts a fresh order beginning at currentRow (if >= 0)
+    void setShuffleMode(ShuffleMode shuffleMode, int currentRow);
+
+    // The shuffled order (play position -> row), empty when not shuffled;
+    // shares its data with the queue until either changes
+    QList<int> playOrder();
+    // Puts back a saved order instead of drawing a new one; false, with
+    // nothing changed, unless it is a permutation of the current rows
+    bool restoreOrder(ShuffleMode shuffleMode, const QList<int> &savedOrder, int currentRow);
+
+    // With Repeat All, draw a new order each time the end is reached
+    bool reshuffleOnWrap() const { return reshuffleEachPass; }
+    void setReshuffleOnWrap(bool enabled);
+
+    // Artist (or any grouping key) of a row, used by ArtistSpread
+    void setGroupFunction(const std::function<QString(int row)> &function);
+
+    // Keep in step with the playlist model
+    void reset(int rowCount);
+    void insertRows(int first, int count);
+    void removeRows(int first, int count);
+    // Rows first..first+count-1 moved to before destination (numbered as
+    // before the move), as in QAbstractItemModel::beginMoveRows()
+    void moveRows(int first, int count, int destination);
+
+    // Where row ends up after such a move
+    static int movedRow(int row, int first, int count, int destination);
+
+    // Entry that plays when the one at row ends on its own, or -1 to stop
+    int following(int row);
+
+    // Entries for the Next/Previous buttons; Repeat One doesn't pin these
+    int next(int row);
+    int previous(int row);
+
+private:
+    void applyRemovals();
+    void buildOrder(int firstRow);
+    void spreadByGroup();
+    void rebuildPositions();
+    int firstAfterWrap(int row);
+
+    RepeatMode mode;
+    ShuffleMode shuffle;
+    bool reshuffleEachPass;
+    std::function<QString(int)> groupOf;
+
+    int count;
+    QList<int> order;     // Play position -> row (empty when not shuffled)
+    QList<int> position;  // Row -> play position
+    int anchor;           // Last row asked about; new rows are shuffled in after it
+    int wrapRow;          // Row whose wrap already drew a new order, or -1
+
+    // Removals arrive range by range (highest first) and are applied in one pass
+    QList<QPair<int, int>> pendingRemovals;
+
+    QRandomGenerator rng;
+};
+
+#endif // PLAYBACKQUEUE_H
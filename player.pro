@@ -0,0 +1,25 @@
+QT += core gui multimedia widgets concurrent
+
+greaterThan(QT_MAJOR_VERSION, 5): QT += widgets
+
+CONFIG += c++17
+
+TARGET = project
+
+include(core.pri)
+
+SOURCES += \
+    main.cpp \
+    mainwindow.cpp \
+    startupprofile.cpp \
+    waveformview.cpp
+
+HEADERS += \
+    mainwindow.h \
+    startupprofile.h \
+    waveformview.h
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,208 @@
+#include "playersession.h"
+#include "trace.h"
+
+PlayerSession::PlayerSession(const LibraryIndex *library, QObject *parent)
+    : QObject(parent),
+      library(library),
+      queuedIndex(-1),
+      playing(false),
+      gainMode(Loudness::Track)
+{
+    // The audio engine runs on its own thread
+    controller = new PlaybackController(this);
+    model = new PlaylistModel(this);
+
+    connect(controller, &PlaybackController::currentSourceChanged, this, &PlayerSession::trackAdvanced);
+    connect(controller, &PlaybackController::mediaStatusChanged, this, &PlayerSession::mediaStatusChanged);
+
+    // The queue's shuffle order follows rows as they come and go
+    connect(model, &QAbstractItemModel::rowsInserted, this, [this](const QModelIndex &, int first, int last) {
+        order.insertRows(first, last - first + 1);
+    });
+    connect(model, &QAbstractItemModel::rowsRemoved, this, [this](const QModelIndex &, int first, int last) {
+        order.removeRows(first, last - first + 1);
+    });
+    connect(model, &QAbstractItemModel::rowsMoved, this, [this](const QModelIndex &, int first, int last,
+                                                                const QModelIndex &, int destination) {
+        order.moveRows(first, last - first + 1, destination);
+        // Dragged in the view, with no caller to requeue; what follows may have changed
+        queueNextTrack();
+    });
+    connect(model, &QAbstractItemModel::modelReset, this, [this]() {
+        order.reset(model->count());
+    });
+    order.setGroupFunction([this](int row) {
+        // Artist from the library when the track is in it, else the artist folder
+        const QString path = model->path(row);
+        const int libraryRow = this->library ? this->library->row(path) : -1;
+        if (libraryRow >= 0 && !this->library->tracks().artist(libraryRow).isEmpty()) {
+            return this->library->tracks().artist(libraryRow);
+        }
+        return path.section('/', -3, -3);
+    });
+}
+
+bool PlayerSession::play()
+{
+    if (model->currentRow() < 0) {
+        if (model->isEmpty()) {
+            return false;
+        }
+        model->setCurrentRow(0);
+        load(model->path(0));
+    }
+    controller->play();
+    setPlaying(true);
+    return true;
+}
+
+void PlayerSession::pause()
+{
+    controller->pause();
+    setPlaying(false);
+}
+
+void PlayerSession::stop()
+{
+    controller->stop();
+    setPlaying(false);
+}
+
+void PlayerSession::next()
+{
+    if (model->isEmpty()) {
+        return;
+    }
+
+    const int index = order.next(model->currentRow());
+    if (index < 0) {
+        model->setCurrentRow(model->count() - 1);
+        stop();
+        return;
+    }
+
+    model->setCurrentRow(index);
+    load(model->path(index));
+    if (playing) {
+        controller->play();
+    }
+}
+
+void PlayerSession::previous()
+{
+    if (model->isEmpty()) {
+        return;
+    }
+
+    if (controller->snapshot().position > 3000) {
+        controller->setPosition(0);
+        return;
+    }
+
+    const int index = order.previous(model->currentRow());
+    if (index < 0) {
+        model->setCurrentRow(0);
+        stop();
+        return;
+    }
+
+    model->setCurrentRow(index);
+    load(model->path(index));
+    if (playing) {
+        controller->play();
+    }
+}
+
+void PlayerSession::playRow(int row)
+{
+    if (row < 0 || row >= model->count()) {
+        return;
+    }
+
+    model->setCurrentRow(row);
+    load(model->path(row));
+    controller->play();
+    setPlaying(true);
+}
+
+void PlayerSession::cue(int row, qint64 position)
+{
+    if (row < 0 || row >= model->count()) {
+        return;
+    }
+
+    model->setCurrentRow(row);
+    load(model->path(row));
+    if (position > 0) {
+        // Commands reach the engine in order, so this lands on the new source
+        controller->setPosition(position);
+    }
+}
+
+void PlayerSession::load(const QString &filePath)
+{
+    TRACE_SCOPE_ARG("player", "PlayerSession::load", filePath);
+    const int current = model->currentRow();
+    if (current < 0 || model->path(current) != filePath) {
+        model->setCurrentRow(model->indexOf(filePath));
+    }
+    controller->setSource(filePath, trackGain(filePath));
+    emit currentTrackChanged(filePath);
+    queueNextTrack();
+}
+
+void PlayerSession::setLoudnessMode(Loudness::Mode mode)
+{
+    // Takes effect immediately for the current track and the queued one
+    gainMode = mode;
+    refreshGains();
+}
+
+void PlayerSession::refreshGains()
+{
+    controller->setGain(trackGain(controller->source()));
+    queueNextTrack();
+}
+
+void PlayerSession::queueNextTrack()
+{
+    queuedIndex = order.following(model->currentRow());
+    const QString nextPath = queuedIndex >= 0 ? model->path(queuedIndex) : QString();
+    controller->setNextSource(nextPath, trackGain(nextPath));
+}
+
+void PlayerSession::trackAdvanced(const QString &filePath)
+{
+    // The engine moved on to the queued entry without a gap
+    if (queuedIndex >= 0 && queuedIndex < model->count() && model->path(queuedIndex) == filePath) {
+        model->setCurrentRow(queuedIndex);
+    } else {
+        model->setCurrentRow(model->indexOf(filePath));
+    }
+
+    emit currentTrackChanged(filePath);
+    queueNextTrack();
+}
+
+void PlayerSession::mediaStatusChanged(QMediaPlayer::MediaStatus status)
+{
+    // Only reached when nothing was queued, i.e. the end of the playlist
+    if (status == QMediaPlayer::EndOfMedia) {
+        setPlaying(false);
+    }
+}
+
+float PlayerSession::trackGain(const QString &filePath) const
+{
+    // Only library tracks have been analyzed; anything else plays as is
+    const int row = library ? library->row(filePath) : -1;
+    return row >= 0 ? Loudness::playbackGain(library->tracks().at(row), gainMode) : 1.0f;
+}
+
+void PlayerSession::setPlaying(bool value)
+{
+    if (playing != value) {
+        playing = value;
+        emit playingChanged(playing);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef PLAYERSESSION_H
+#define PLAYERSESSION_H
+
+#include <QObject>
+#include "libraryindex.h"
+#include "loudness.h"
+#include "playbackcontroller.h"
+#include "playbackqueue.h"
+#include "playlistmodel.h"
+
+// The playing side of the player, without any widgets: the playlist, the
+// play order over it and the audio engine, and the rules that tie them
+// together (the following entry is handed to the engine ahead of time for
+// gapless playback, the playlist follows the engine when it advances, and
+// library tracks get their loudness gain). The main window and the
+// headless daemon each drive one.
+class PlayerSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    // library supplies loudness gains and the artists for the artist
+    // spread; it must outlive the session and may be null
+    explicit PlayerSession(const LibraryIndex *library, QObject *parent = nullptr);
+
+    PlaybackController *playback() const { return controller; }
+    PlaylistModel *playlist() const { return model; }
+    PlaybackQueue &queue() { return order; }
+
+    // Our own flag: the engine's state may not reflect a command it hasn't processed yet
+    bool isPlaying() const { return playing; }
+
+    // Starts the current entry, or the first one; false if the playlist is empty
+    bool play();
+    void pause();
+    void stop();
+    void next();
+    // Restarts the track when more than three seconds in, else goes back one
+    void previous();
+    void playRow(int row);
+    // Loads row without playing it and seeks to position, e.g. to resume a saved session
+    void cue(int row, qint64 position);
+    // Loads a file without changing the transport state; it becomes the
+    // current entry if it is in the playlist
+    void load(const QString &filePath);
+
+    Loudness::Mode loudnessMode() const { return gainMode; }
+    void setLoudnessMode(Loudness::Mode mode);
+    // Re-reads the gains of the current and the queued track, e.g. after loudness analysis
+    void refreshGains();
+
+    // Hands the engine the entry after the current one so it is decoded
+    // before it is needed; call after changing the playlist or the play order
+    void queueNextTrack();
+
+signals:
+    // A track was loaded, or the engine moved on to the queued one
+    void currentTrackChanged(const QString &filePath);
+    void playingChanged(bool playing);
+
+private slots:
+    void trackAdvanced(const QString &filePath);
+    void mediaStatusChanged(QMediaPlayer::MediaStatus status);
+
+private:
+    float trackGain(const QString &filePath) const;
+    void setPlaying(bool value);
+
+    const LibraryIndex *library;
+    PlaybackController *controller;
+    PlaylistModel *model;
+    PlaybackQueue order;
+    int queuedIndex; // Entry handed to the engine for gapless playback, or -1
+    bool playing;
+    Loudness::Mode gainMode;
+};
+
+#endif // PLAYERSESSION_H
@@ -0,0 +1,253 @@
+#include "playlistmodel.h"
+#include "playbackqueue.h"
+#include "trace.h"
+#include <QFont>
+#include <algorithm>
+#include <functional>
+
+PlaylistModel::PlaylistModel(QObject *parent)
+    : QAbstractListModel(parent),
+      current(-1),
+      rowsByPathValid(false)
+{
+}
+
+int PlaylistModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : entries.size();
+}
+
+QVariant PlaylistModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= entries.size()) {
+        return QVariant();
+    }
+
+    const Entry &entry = entries.at(index.row());
+
+    switch (role) {
+    case Qt::DisplayRole:
+        return entry.name;
+    case Qt::ToolTipRole:
+        return entry.path;
+    case Qt::FontRole:
+        if (index.row() == current) {
+            QFont font;
+            font.setBold(true);
+            return font;
+        }
+        break;
+    }
+
+    return QVariant();
+}
+
+Qt::ItemFlags PlaylistModel::flags(const QModelIndex &index) const
+{
+    // Rows are dragged; drops land between them, never on one
+    const Qt::ItemFlags flags = QAbstractListModel::flags(index);
+    return index.isValid() ? flags | Qt::ItemIsDragEnabled : flags | Qt::ItemIsDropEnabled;
+}
+
+bool PlaylistModel::moveRows(const QModelIndex &sourceParent, int sourceRow, int count,
+                             const QModelIndex &destinationParent, int destinationChild)
+{
+    if (sourceParent.isValid() || destinationParent.isValid() || count <= 0 || sourceRow < 0
+        || sourceRow + count > entries.size() || destinationChild < 0 || destinationChild > entries.size()) {
+        return false;
+    }
+    // Also refuses a destination inside the block, or right after it
+    if (!beginMoveRows(QModelIndex(), sourceRow, sourceRow + count - 1, QModelIndex(), destinationChild)) {
+        return false;
+    }
+
+    const auto first = entries.begin() + sourceRow;
+    if (destinationChild > sourceRow) {
+        std::rotate(first, first + count, entries.begin() + destinationChild);
+    } else {
+        std::rotate(entries.begin() + destinationChild, first, first + count);
+    }
+    if (current >= 0) {
+        current = PlaybackQueue::movedRow(current, sourceRow, count, destinationChild);
+    }
+    rowsByPathValid = false;
+    endMoveRows();
+    return true;
+}
+
+QStringList PlaylistModel::paths() const
+{
+    QStringList result;
+    result.reserve(entries.size());
+    for (const Entry &entry : entries) {
+        result.append(entry.path);
+    }
+    return result;
+}
+
+QList<PlaylistEntry> PlaylistModel::toEntries() const
+{
+    QList<PlaylistEntry> result;
+    result.reserve(entries.size());
+    for (const Entry &entry : entries) {
+        result.append({entry.path, entry.name, entry.duration});
+    }
+    return result;
+}
+
+int PlaylistModel::indexOf(const QString &path) const
+{
+    if (!rowsByPathValid) {
+        // From the end, so a path listed twice keeps its first row
+        rowsByPath.clear();
+        rowsByPath.reserve(entries.size());
+        for (int row = int(entries.size()) - 1; row >= 0; --row) {
+            rowsByPath.insert(entries.at(row).path, row);
+        }
+        rowsByPathValid = true;
+    }
+    return rowsByPath.value(path, -1);
+}
+
+void PlaylistModel::append(const QStringList &paths)
+{
+    insert(entries.size(), paths);
+}
+
+void PlaylistModel::insert(int row, const QStringList &paths)
+{
+    QList<Entry> added;
+    added.reserve(paths.size());
+    for (const QString &path : paths) {
+        added.append({path, displayNameFor(path), -1});
+    }
+    insertEntries(row, std::move(added));
+}
+
+void PlaylistModel::append(const QList<PlaylistEntry> &imported)
+{
+    QList<Entry> added;
+    added.reserve(imported.size());
+    for (const PlaylistEntry &entry : imported) {
+        added.append({entry.path, entry.title.isEmpty() ? displayNameFor(entry.path) : entry.title, entry.duration});
+    }
+    insertEntries(entries.size(), std::move(added));
+}
+
+void PlaylistModel::insertEntries(int row, QList<Entry> added)
+{
+    if (added.isEmpty()) {
+        return;
+    }
+    row = qBound(0, row, int(entries.size()));
+    TRACE_SCOPE("playlist", "PlaylistModel::insertEntries");
+
+    beginInsertRows(QModelIndex(), row, row + added.size() - 1);
+    if (rowsByPathValid && row == entries.size()) {
+        for (int i = 0; i < added.size(); ++i) {
+            if (!rowsByPath.contains(added.at(i).path)) {
+                rowsByPath.insert(added.at(i).path, row + i);
+            }
+        }
+    } else {
+        rowsByPathValid = false;
+    }
+    entries.insert(row, added.size(), Entry{QString(), QString(), -1});
+    std::move(added.begin(), added.end(), entries.begin() + row);
+    if (current >= row) {
+        current += added.size();
+    }
+    endInsertRows();
+}
+
+void PlaylistModel::setPaths(const QStringList &paths)
+{
+    TRACE_SCOPE("playlist", "PlaylistModel::setPaths");
+    beginResetModel();
+    entries.clear();
+    entries.reserve(paths.size());
+    for (const QString &path : paths) {
+        entries.append({path, displayNameFor(path), -1});
+    }
+    current = -1;
+    rowsByPathValid = false;
+    endResetModel();
+}
+
+void PlaylistModel::setEntries(const QList<PlaylistEntry> &replacement)
+{
+    TRACE_SCOPE("playlist", "PlaylistModel::setEntries");
+    beginResetModel();
+    entries.clear();
+    entries.reserve(replacement.size());
+    for (const PlaylistEntry &entry : replacement) {
+        entries.append({entry.path, entry.title.isEmpty() ? displayNameFor(entry.path) : entry.title, entry.duration});
+    }
+    current = -1;
+    rowsByPathValid = false;
+    endResetModel();
+}
+
+void PlaylistModel::clear()
+{
+    setPaths(QStringList());
+}
+
+void PlaylistModel::removeRowList(QList<int> rows)
+{
+    TRACE_SCOPE("playlist", "PlaylistModel::removeRowList");
+
+    // Highest rows first, so the remaining row numbers stay valid
+    std::sort(rows.begin(), rows.end(), std::greater<int>());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+    int i = 0;
+    while (i < rows.size()) {
+        const int last = rows.at(i);
+        int first = last;
+        while (i + 1 < rows.size() && rows.at(i + 1) == first - 1) {
+            first = rows.at(++i);
+        }
+        ++i;
+
+        if (first < 0 || last >= entries.size()) {
+            continue;
+        }
+
+        beginRemoveRows(QModelIndex(), first, last);
+        entries.remove(first, last - first + 1);
+        rowsByPathValid = false;
+        if (current > last) {
+            current -= last - first + 1;
+        } else if (current >= first) {
+            current = -1;
+        }
+        endRemoveRows();
+    }
+}
+
+void PlaylistModel::setCurrentRow(int row)
+{
+    if (row == current) {
+        return;
+    }
+
+    const int previous = current;
+    current = row >= 0 && row < entries.size() ? row : -1;
+
+    if (previous >= 0) {
+        emit dataChanged(index(previous), index(previous), {Qt::FontRole});
+    }
+    if (current >= 0) {
+        emit dataChanged(index(current), index(current), {Qt::FontRole});
+    }
+}
+
+QString PlaylistModel::displayNameFor(const QString &path)
+{
+    // Like QFileInfo::baseName(), without constructing a QFileInfo per entry
+    const int slash = std::max(path.lastIndexOf(QLatin1Char('/')), path.lastIndexOf(QLatin1Char('\\')));
+    const QString fileName = path.mid(slash + 1);
+    const int dot = fileName.indexOf(QLatin1Char('.'));
+    return dot < 0 ? fileName : fileName.left(dot);
+}
@@ -0,0 +1,79 @@
+#ifndef PLAYLISTMODEL_H
+#define PLAYLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include "playlistparser.h"
+
+// List model behind the Playlists tab. Edits are reported to the view as
+// row ranges (one beginInsertRows()/beginRemoveRows() per contiguous
+// range), so adding or removing entries never rebuilds the whole list.
+// Display names are derived once when an entry is added, or taken from
+// the playlist file when it has titles. The model also
+// tracks which row is playing and keeps it pointing at the same entry
+// across inserts, removals and moves. Rows can be dragged within the
+// list; the view moves them with moveRows(), so they stay selected.
+// Shuffle never reorders rows; see PlaybackQueue.
+class PlaylistModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit PlaylistModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+    Qt::DropActions supportedDropActions() const override { return Qt::MoveAction; }
+    bool moveRows(const QModelIndex &sourceParent, int sourceRow, int count,
+                  const QModelIndex &destinationParent, int destinationChild) override;
+
+    int count() const { return entries.size(); }
+    bool isEmpty() const { return entries.isEmpty(); }
+    QString path(int row) const { return entries.at(row).path; }
+    QString displayName(int row) const { return entries.at(row).name; }
+    qint64 duration(int row) const { return entries.at(row).duration; }
+    QStringList paths() const;
+    QList<PlaylistEntry> toEntries() const;
+    // First row with this path, or -1; a hash lookup
+    int indexOf(const QString &path) const;
+
+    void append(const QStringList &paths);
+    void insert(int row, const QStringList &paths);
+    // Imported entries keep the playlist's own titles and durations
+    void append(const QList<PlaylistEntry> &imported);
+    void setPaths(const QStringList &paths);
+    // Replaces everything in one reset, keeping titles and durations (see append())
+    void setEntries(const QList<PlaylistEntry> &replacement);
+    void clear();
+
+    // Rows may be unsorted and non-contiguous; they are removed range by range
+    void removeRowList(QList<int> rows);
+
+    // -1 when nothing from this playlist is playing
+    int currentRow() const { return current; }
+    void setCurrentRow(int row);
+
+    static QString displayNameFor(const QString &path);
+
+private:
+    struct Entry
+    {
+        QString path;
+        QString name;
+        qint64 duration; // ms, -1 if unknown
+    };
+
+    void insertEntries(int row, QList<Entry> added);
+
+    QList<Entry> entries;
+    int current;
+
+    // Path -> first row. Appends extend it; other edits drop it until the next lookup.
+    mutable QHash<QString, int> rowsByPath;
+    mutable bool rowsByPathValid;
+};
+
+#endif // PLAYLISTMODEL_H
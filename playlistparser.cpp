@@ -0,0 +1,417 @@
+#include "playlistparser.h"
+#include "trace.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QSaveFile>
+#include <QStringDecoder>
+#include <QUrl>
+#include <QXmlStreamReader>
+#include <QtConcurrent>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+const int FirstChunkSize = 256;
+const int ChunkSize = 8192;
+
+// Collects entries and hands them to the promise in chunks
+class ChunkWriter
+{
+public:
+    explicit ChunkWriter(QPromise<QList<PlaylistEntry>> &promise)
+        : promise(promise),
+          limit(FirstChunkSize)
+    {
+        chunk.reserve(limit);
+    }
+
+    void add(PlaylistEntry entry)
+    {
+        if (entry.path.isEmpty()) {
+            return;
+        }
+        chunk.append(std::move(entry));
+        if (chunk.size() >= limit) {
+            flush();
+            limit = ChunkSize;
+            chunk.reserve(limit);
+        }
+    }
+
+    void flush()
+    {
+        if (!chunk.isEmpty()) {
+            promise.addResult(std::move(chunk));
+            chunk = QList<PlaylistEntry>();
+        }
+    }
+
+    bool isCanceled() const { return promise.isCanceled(); }
+
+private:
+    QPromise<QList<PlaylistEntry>> &promise;
+    QList<PlaylistEntry> chunk;
+    int limit;
+};
+
+// Resolves playlist locations: absolute paths, paths relative to the
+// playlist, and file:// URLs. Other URLs are kept as they are.
+class PathResolver
+{
+public:
+    explicit PathResolver(const QString &fileName)
+        : baseDir(QFileInfo(fileName).absoluteDir())
+    {
+    }
+
+    QString resolve(QString location) const
+    {
+        if (location.startsWith(QLatin1String("file:"), Qt::CaseInsensitive)) {
+            location = QUrl(location).toLocalFile();
+        } else if (location.contains(QLatin1String("://"))) {
+            return location;
+        }
+        if (location.isEmpty()) {
+            return location;
+        }
+
+        // Playlists written on Windows use backslashes
+        location.replace(QLatin1Char('\\'), QLatin1Char('/'));
+        if (QDir::isRelativePath(location)) {
+            location = baseDir.absoluteFilePath(location);
+        }
+        return QDir::cleanPath(location);
+    }
+
+    // XSPF locations are URIs; relative ones are relative to the playlist
+    QString resolveUri(const QString &location) const
+    {
+        const QUrl url(location);
+        if (url.isRelative()) {
+            return resolve(QUrl::fromPercentEncoding(location.toUtf8()));
+        }
+        if (url.isLocalFile()) {
+            return QDir::cleanPath(url.toLocalFile());
+        }
+        return location;
+    }
+
+private:
+    QDir baseDir;
+};
+
+// Iterates over the lines of a buffer without copying it. Lines are
+// decoded as UTF-8, falling back to Latin-1 (classic .m3u) when invalid.
+class LineReader
+{
+public:
+    LineReader(const char *data, qint64 size)
+        : pos(data),
+          end(data + size)
+    {
+        if (size >= 3 && std::memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+            pos += 3;
+        }
+    }
+
+    bool next(QString &line)
+    {
+        if (pos >= end) {
+            return false;
+        }
+
+        const char *newline = static_cast<const char *>(std::memchr(pos, '\n', end - pos));
+        const char *lineEnd = newline ? newline : end;
+        const char *start = pos;
+        pos = newline ? newline + 1 : end;
+
+        while (lineEnd > start && (lineEnd[-1] == '\r' || lineEnd[-1] == ' ' || lineEnd[-1] == '\t')) {
+            --lineEnd;
+        }
+        while (start < lineEnd && (*start == ' ' || *start == '\t')) {
+            ++start;
+        }
+
+        const QByteArrayView bytes(start, lineEnd - start);
+        line = decoder.decode(bytes);
+        if (decoder.hasError()) {
+            decoder.resetState();
+            line = QString::fromLatin1(bytes);
+        }
+        return true;
+    }
+
+private:
+    const char *pos;
+    const char *end;
+    QStringDecoder decoder{QStringDecoder::Utf8};
+};
+
+void parseM3u(const char *data, qint64 size, const PathResolver &resolver, ChunkWriter &writer)
+{
+    LineReader reader(data, size);
+    QString line;
+    PlaylistEntry pending;
+
+    while (reader.next(line) && !writer.isCanceled()) {
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        if (line.startsWith(QLatin1Char('#'))) {
+            // #EXTINF:<seconds>[ attributes],<title>
+            if (line.startsWith(QLatin1String("#EXTINF:"), Qt::CaseInsensitive)) {
+                const int comma = line.indexOf(QLatin1Char(','));
+                const QString info = line.mid(8, comma < 0 ? -1 : comma - 8);
+                bool ok = false;
+                const double seconds = info.section(QLatin1Char(' '), 0, 0).toDouble(&ok);
+                pending.duration = ok && seconds >= 0 ? qint64(seconds * 1000.0) : -1;
+                pending.title = comma < 0 ? QString() : line.mid(comma + 1).trimmed();
+            }
+            continue;
+        }
+
+        pending.path = resolver.resolve(line);
+        writer.add(std::move(pending));
+        pending = PlaylistEntry();
+    }
+}
+
+void parsePls(const char *data, qint64 size, const PathResolver &resolver, ChunkWriter &writer)
+{
+    // Keys are FileN/TitleN/LengthN and usually come grouped by N. An entry
+    // is passed on once a key for a later N shows up, so the file streams.
+    LineReader reader(data, size);
+    QString line;
+    QMap<int, PlaylistEntry> pending;
+
+    auto flushBefore = [&](int number) {
+        while (!pending.isEmpty() && pending.firstKey() < number) {
+            writer.add(pending.take(pending.firstKey()));
+        }
+    };
+
+    while (reader.next(line) && !writer.isCanceled()) {
+        const int equals = line.indexOf(QLatin1Char('='));
+        if (equals <= 0) {
+            continue;
+        }
+
+        const QStringView key = QStringView(line).left(equals);
+        const QString value = line.mid(equals + 1).trimmed();
+
+        int prefix = 0;
+        if (key.startsWith(QLatin1String("File"), Qt::CaseInsensitive)) {
+            prefix = 4;
+        } else if (key.startsWith(QLatin1String("Title"), Qt::CaseInsensitive)) {
+            prefix = 5;
+        } else if (key.startsWith(QLatin1String("Length"), Qt::CaseInsensitive)) {
+            prefix = 6;
+        } else {
+            continue;
+        }
+
+        bool ok = false;
+        const int number = key.mid(prefix).toInt(&ok);
+        if (!ok) {
+            continue;
+        }
+
+        flushBefore(number);
+        PlaylistEntry &entry = pending[number];
+        if (prefix == 4) {
+            entry.path = resolver.resolve(value);
+        } else if (prefix == 5) {
+            entry.title = value;
+        } else {
+            const qint64 seconds = value.toLongLong(&ok);
+            entry.duration = ok && seconds >= 0 ? seconds * 1000 : -1;
+        }
+    }
+
+    flushBefore(std::numeric_limits<int>::max());
+}
+
+void parseXspf(const char *data, qint64 size, const PathResolver &resolver, ChunkWriter &writer)
+{
+    QXmlStreamReader xml(QByteArray::fromRawData(data, size));
+    PlaylistEntry entry;
+    bool inTrack = false;
+
+    while (!xml.atEnd() && !writer.isCanceled()) {
+        xml.readNext();
+
+        if (xml.isStartElement()) {
+            const QStringView name = xml.name();
+            if (name == QLatin1String("track")) {
+                inTrack = true;
+                entry = PlaylistEntry();
+            } else if (inTrack && name == QLatin1String("location") && entry.path.isEmpty()) {
+                entry.path = resolver.resolveUri(xml.readElementText().trimmed());
+            } else if (inTrack && name == QLatin1String("title")) {
+                entry.title = xml.readElementText().trimmed();
+            } else if (inTrack && name == QLatin1String("duration")) {
+                bool ok = false;
+                const qint64 ms = xml.readElementText().trimmed().toLongLong(&ok);
+                entry.duration = ok && ms >= 0 ? ms : -1;
+            }
+        } else if (xml.isEndElement() && xml.name() == QLatin1String("track")) {
+            inTrack = false;
+            writer.add(std::move(entry));
+            entry = PlaylistEntry();
+        }
+    }
+}
+
+} // namespace
+
+namespace PlaylistParser {
+
+Format detectFormat(const QString &fileName, const QByteArray &head)
+{
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    if (suffix == QLatin1String("pls")) {
+        return Pls;
+    }
+    if (suffix == QLatin1String("xspf")) {
+        return Xspf;
+    }
+    if (suffix == QLatin1String("m3u") || suffix == QLatin1String("m3u8")) {
+        return M3u;
+    }
+
+    const QByteArray start = head.left(256).trimmed().toLower();
+    if (start.startsWith("[playlist]")) {
+        return Pls;
+    }
+    if (start.startsWith("<?xml") || start.startsWith("<playlist")) {
+        return Xspf;
+    }
+    return M3u;
+}
+
+void parse(QPromise<QList<PlaylistEntry>> &promise, const QString &fileName)
+{
+    TRACE_SCOPE_ARG("playlist", "PlaylistParser::parse", fileName);
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    // Map the whole file; fall back to reading it if mapping isn't possible
+    QByteArray contents;
+    const char *data = nullptr;
+    const qint64 size = file.size();
+    if (size > 0) {
+        data = reinterpret_cast<const char *>(file.map(0, size));
+    }
+    if (!data) {
+        contents = file.readAll();
+        data = contents.constData();
+    }
+    const qint64 length = contents.isEmpty() ? size : contents.size();
+    if (length <= 0) {
+        return;
+    }
+
+    const PathResolver resolver(fileName);
+    ChunkWriter writer(promise);
+
+    switch (detectFormat(fileName, QByteArray::fromRawData(data, qMin<qint64>(length, 256)))) {
+    case Pls:
+        parsePls(data, length, resolver, writer);
+        break;
+    case Xspf:
+        parseXspf(data, length, resolver, writer);
+        break;
+    case M3u:
+        parseM3u(data, length, resolver, writer);
+        break;
+    }
+
+    writer.flush();
+}
+
+QFuture<QList<PlaylistEntry>> parseAsync(const QString &fileName)
+{
+    return QtConcurrent::run(&PlaylistParser::parse, fileName);
+}
+
+bool write(const QString &fileName, const QList<PlaylistEntry> &entries)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    // Built in memory and written in large blocks; QTextStream per line is far slower
+    QByteArray out;
+    out.reserve(qsizetype(entries.size()) * 128);
+    const auto flush = [&]() {
+        const bool ok = file.write(out) == out.size();
+        out.clear();
+        return ok;
+    };
+    auto seconds = [](qint64 ms) {
+        return QByteArray::number(ms >= 0 ? ms / 1000 : -1);
+    };
+
+    const Format format = detectFormat(fileName, QByteArray());
+    if (format == Pls) {
+        out += "[playlist]\nNumberOfEntries=" + QByteArray::number(entries.size()) + "\n";
+    } else if (format == Xspf) {
+        out += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+               "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n  <trackList>\n";
+    } else {
+        out += "#EXTM3U\n";
+    }
+
+    for (int i = 0; i < entries.size(); ++i) {
+        const PlaylistEntry &entry = entries.at(i);
+        const QByteArray number = QByteArray::number(i + 1);
+
+        switch (format) {
+        case Pls:
+            out += "File" + number + "=" + entry.path.toUtf8() + "\n";
+            if (!entry.title.isEmpty()) {
+                out += "Title" + number + "=" + entry.title.toUtf8() + "\n";
+            }
+            out += "Length" + number + "=" + seconds(entry.duration) + "\n";
+            break;
+        case Xspf: {
+            // toEncoded() leaves & as it is, which XML doesn't allow bare
+            const QUrl url = entry.path.contains(QLatin1String("://")) ? QUrl(entry.path) : QUrl::fromLocalFile(entry.path);
+            out += "    <track><location>" + QString::fromUtf8(url.toEncoded()).toHtmlEscaped().toUtf8() + "</location>";
+            if (!entry.title.isEmpty()) {
+                out += "<title>" + entry.title.toHtmlEscaped().toUtf8() + "</title>";
+            }
+            if (entry.duration >= 0) {
+                out += "<duration>" + QByteArray::number(entry.duration) + "</duration>";
+            }
+            out += "</track>\n";
+            break;
+        }
+        case M3u:
+            out += "#EXTINF:" + seconds(entry.duration) + "," + entry.title.toUtf8() + "\n"
+                 + entry.path.toUtf8() + "\n";
+            break;
+        }
+
+        if (out.size() > (1 << 20) && !flush()) {
+            return false;
+        }
+    }
+
+    if (format == Pls) {
+        out += "Version=2\n";
+    } else if (format == Xspf) {
+        out += "  </trackList>\n</playlist>\n";
+    }
+
+    return flush() && file.commit();
+}
+
+} // namespace PlaylistParser
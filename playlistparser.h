@@ -0,0 +1,44 @@
+#ifndef PLAYLISTPARSER_H
+#define PLAYLISTPARSER_H
+
+#include <QFuture>
+#include <QList>
+#include <QPromise>
+#include <QString>
+
+// One playlist line as read from an M3U/PLS/XSPF file
+struct PlaylistEntry
+{
+    QString path;
+    QString title;       // Empty when the playlist doesn't name the entry
+    qint64 duration = -1; // milliseconds, -1 if unknown
+};
+
+// Streaming playlist import. The file is memory-mapped and parsed in one
+// forward pass on a worker thread; entries are reported through the
+// future in chunks, the first one small so playback can start while the
+// rest is still being read. Relative paths and file:// URLs are resolved
+// against the playlist's directory.
+namespace PlaylistParser {
+
+enum Format {
+    M3u,
+    Pls,
+    Xspf
+};
+
+// Guesses from the extension, falling back to the first bytes of the file
+Format detectFormat(const QString &fileName, const QByteArray &head);
+
+// Runs on a worker; each result is one chunk of entries. Stops early if canceled.
+void parse(QPromise<QList<PlaylistEntry>> &promise, const QString &fileName);
+
+QFuture<QList<PlaylistEntry>> parseAsync(const QString &fileName);
+
+// Writes extended M3U, PLS or XSPF depending on the extension (M3U when
+// unknown). The file is replaced atomically; returns false on I/O errors.
+bool write(const QString &fileName, const QList<PlaylistEntry> &entries);
+
+} // namespace PlaylistParser
+
+#endif // PLAYLISTPARSER_H
@@ -1,17 +1,14 @@
-QT += core gui multimedia widgets
-
-greaterThan(QT_MAJOR_VERSION, 5): QT += widgets
-
-CONFIG += c++17
-
-SOURCES += \
-    main.cpp \
-    mainwindow.cpp
-
-HEADERS += \
-    mainwindow.h
-
-# Default rules for deployment.
-qnx: target.path = /tmp/$${TARGET}/bin
-else: unix:!android: target.path = /opt/$${TARGET}/bin
-!isEmpty(target.path): INSTALLS += target
+TEMPLATE = subdirs
+
+# The GUI player, the headless CLI/daemon, the benchmark suite and the
+# tests (run with make check) share core.pri
+SUBDIRS += \
+    player \
+    cli \
+    bench \
+    tests
+
+player.file = player.pro
+cli.file = cli/cli.pro
+bench.file = bench/bench.pro
+tests.file = tests/tests.pro
@@ -0,0 +1,248 @@
+#include "searchindex.h"
+#include "trace.h"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+inline quint64 trigramKey(const QChar *p)
+{
+    return (quint64(p[0].unicode()) << 32) | (quint64(p[1].unicode()) << 16) | quint64(p[2].unicode());
+}
+
+// Bigrams fill the low 32 bits; a character alone sits above them
+inline quint64 unigramKey(QChar c)
+{
+    return (quint64(1) << 32) | c.unicode();
+}
+
+inline quint64 bigramKey(const QChar *p)
+{
+    return (quint64(p[0].unicode()) << 16) | quint64(p[1].unicode());
+}
+
+template <typename Key>
+void sortUnique(QList<Key> &keys)
+{
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+} // namespace
+
+void SearchIndex::build(const TrackStore &tracks)
+{
+    TRACE_SCOPE("search", "SearchIndex::build");
+    strings.clear();
+    stringIds.clear();
+    rowsByString.clear();
+    postings.clear();
+    shortPostings.clear();
+    rowFields.clear();
+    rowFields.reserve(tracks.size());
+
+    // The store has already interned artists and albums, so each distinct
+    // one is case-folded and looked up once rather than once per row
+    QList<int> artistStrings(tracks.artistDictionary().size(), -1);
+    QList<int> albumStrings(tracks.albumDictionary().size(), -1);
+    for (int row = 0; row < tracks.size(); ++row) {
+        int &artist = artistStrings[tracks.artistColumn().at(row)];
+        if (artist < 0) {
+            artist = internString(tracks.artist(row));
+        }
+        int &album = albumStrings[tracks.albumColumn().at(row)];
+        if (album < 0) {
+            album = internString(tracks.album(row));
+        }
+        rowFields.append({-1, -1, -1});
+        linkRow(row, internString(tracks.title(row).toString()), artist, album);
+    }
+}
+
+void SearchIndex::appendRow(const TrackInfo &track)
+{
+    rowFields.append({-1, -1, -1});
+    linkRow(int(rowFields.size()) - 1, internString(track.title), internString(track.artist),
+            internString(track.album));
+}
+
+void SearchIndex::updateRow(int row, const TrackInfo &track)
+{
+    if (row < 0 || row >= rowFields.size()) {
+        return;
+    }
+
+    for (int id : rowFields.at(row)) {
+        if (id < 0) {
+            continue;
+        }
+        // A field equal to an earlier one was listed once and is already gone
+        QList<int> &rows = rowsByString[id];
+        const auto it = std::lower_bound(rows.begin(), rows.end(), row);
+        if (it != rows.end() && *it == row) {
+            rows.erase(it);
+        }
+    }
+    linkRow(row, internString(track.title), internString(track.artist), internString(track.album));
+}
+
+void SearchIndex::removeRows(const QList<int> &rows)
+{
+    if (rows.isEmpty()) {
+        return;
+    }
+
+    // Old row -> new row, or -1 for a removed one
+    QList<int> renumbered(rowFields.size());
+    int removed = 0;
+    for (int row = 0; row < rowFields.size(); ++row) {
+        if (removed < rows.size() && rows.at(removed) == row) {
+            renumbered[row] = -1;
+            ++removed;
+        } else {
+            renumbered[row] = row - removed;
+            rowFields[row - removed] = rowFields.at(row);
+        }
+    }
+    rowFields.resize(rowFields.size() - removed);
+
+    // The mapping is increasing, so each list stays in order. Strings no
+    // row uses any more keep their trigrams; they just expand to nothing.
+    for (QList<int> &list : rowsByString) {
+        int kept = 0;
+        for (int row : std::as_const(list)) {
+            const int newRow = renumbered.at(row);
+            if (newRow >= 0) {
+                list[kept++] = newRow;
+            }
+        }
+        list.resize(kept);
+    }
+}
+
+void SearchIndex::linkRow(int row, int title, int artist, int album)
+{
+    std::array<int, 3> &fields = rowFields[row];
+    fields = {title, artist, album};
+
+    for (int i = 0; i < 3; ++i) {
+        // A row whose artist equals its album only needs listing once
+        if (i > 0 && (fields[i] == fields[0] || (i == 2 && fields[2] == fields[1]))) {
+            continue;
+        }
+        // Rows arrive in order while building and appending; an updated row goes back in its place
+        QList<int> &rows = rowsByString[fields[i]];
+        if (rows.isEmpty() || rows.last() < row) {
+            rows.append(row);
+        } else {
+            const auto it = std::lower_bound(rows.begin(), rows.end(), row);
+            if (*it != row) {
+                rows.insert(it, row);
+            }
+        }
+    }
+}
+
+int SearchIndex::internString(const QString &value)
+{
+    const QString folded = value.toCaseFolded();
+
+    auto it = stringIds.constFind(folded);
+    if (it != stringIds.constEnd()) {
+        return it.value();
+    }
+
+    const int id = int(strings.size());
+    strings.append(folded);
+    stringIds.insert(folded, id);
+    rowsByString.append(QList<int>());
+
+    // Ids grow monotonically, so appending keeps every posting list sorted
+    QList<quint64> keys;
+    for (int i = 0; i + 3 <= folded.size(); ++i) {
+        keys.append(trigramKey(folded.constData() + i));
+    }
+    sortUnique(keys);
+    for (quint64 key : keys) {
+        postings[key].append(id);
+    }
+
+    QList<quint64> shortKeys;
+    for (int i = 0; i < folded.size(); ++i) {
+        shortKeys.append(unigramKey(folded.at(i)));
+        if (i + 2 <= folded.size()) {
+            shortKeys.append(bigramKey(folded.constData() + i));
+        }
+    }
+    sortUnique(shortKeys);
+    for (quint64 key : shortKeys) {
+        shortPostings[key].append(id);
+    }
+
+    return id;
+}
+
+QBitArray SearchIndex::match(const QString &query) const
+{
+    TRACE_SCOPE_ARG("search", "SearchIndex::match", query);
+    const QString folded = query.toCaseFolded();
+    QBitArray result(rowFields.size());
+
+    auto addRows = [&](int id) {
+        for (int row : rowsByString.at(id)) {
+            result.setBit(row);
+        }
+    };
+
+    if (folded.isEmpty()) {
+        result.fill(true);
+        return result;
+    }
+    if (folded.size() < 3) {
+        // Too short for trigrams, but the unigram or bigram list is exact
+        const quint64 key = folded.size() == 1 ? unigramKey(folded.at(0)) : bigramKey(folded.constData());
+        auto it = shortPostings.constFind(key);
+        if (it != shortPostings.constEnd()) {
+            for (int id : it.value()) {
+                addRows(id);
+            }
+        }
+        return result;
+    }
+
+    QList<const QList<int> *> lists;
+    for (int i = 0; i + 3 <= folded.size(); ++i) {
+        auto it = postings.constFind(trigramKey(folded.constData() + i));
+        if (it == postings.constEnd()) {
+            return result;
+        }
+        lists.append(&it.value());
+    }
+
+    // Intersect from the shortest list up
+    std::sort(lists.begin(), lists.end(), [](const QList<int> *a, const QList<int> *b) {
+        return a->size() < b->size();
+    });
+
+    QList<int> candidates = *lists.first();
+    QList<int> next;
+    for (int i = 1; i < lists.size() && !candidates.isEmpty(); ++i) {
+        if (lists.at(i) == lists.at(i - 1)) {
+            continue; // Repeated trigram in the query
+        }
+        next.clear();
+        std::set_intersection(candidates.cbegin(), candidates.cend(),
+                              lists.at(i)->cbegin(), lists.at(i)->cend(),
+                              std::back_inserter(next));
+        candidates.swap(next);
+    }
+
+    // Trigrams only narrow the set; confirm the full substring
+    for (int id : std::as_const(candidates)) {
+        if (strings.at(id).contains(folded)) {
+            addRows(id);
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,49 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QBitArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <array>
+#include "tagreader.h"
+#include "trackstore.h"
+
+// Case-folded trigram index over the title, artist and album of every
+// library row. Each distinct field value is indexed once (artists and
+// albums repeat across thousands of rows), so a query intersects a few
+// short posting lists, verifies the surviving strings with a substring
+// test and expands them to rows. One- and two-character queries, too
+// short for a trigram, are answered straight from unigram and bigram
+// lists. Matching keeps the old searchLibrary() semantics: a row matches
+// when any of the three fields contains the query.
+//
+// Every list is kept sorted, so a row is unlinked from a string by binary
+// search when its tags change.
+class SearchIndex
+{
+public:
+    void build(const TrackStore &tracks);
+    void appendRow(const TrackInfo &track);
+    void updateRow(int row, const TrackInfo &track);
+    // Drops rows (ascending) and renumbers the ones after them
+    void removeRows(const QList<int> &rows);
+
+    int rowCount() const { return int(rowFields.size()); }
+
+    // Returns one bit per row, set for rows matching the query
+    QBitArray match(const QString &query) const;
+
+private:
+    int internString(const QString &value);
+    void linkRow(int row, int title, int artist, int album);
+
+    QList<QString> strings;                 // Distinct case-folded field values
+    QHash<QString, int> stringIds;
+    QList<QList<int>> rowsByString;         // String id -> ascending rows
+    QHash<quint64, QList<int>> postings;    // Trigram -> ascending string ids
+    QHash<quint64, QList<int>> shortPostings; // Character or bigram -> ascending string ids
+    QList<std::array<int, 3>> rowFields;    // Row -> title/artist/album string ids
+};
+
+#endif // SEARCHINDEX_H
@@ -0,0 +1,67 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+// Publishes a small value from one writer thread to any number of readers
+// without locks. The writer never waits; a reader retries if it raced
+// with a write, so it always sees one complete value. The value is
+// copied through atomic words, which keeps the retry loop free of data
+// races.
+template <typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SeqLock values are copied bytewise");
+
+public:
+    SeqLock()
+        : sequence(0)
+    {
+        store(T());
+    }
+
+    // Single writer only
+    void store(const T &value)
+    {
+        quint64 words[WordCount] = {};
+        std::memcpy(words, &value, sizeof(T));
+
+        const unsigned int s = sequence.load(std::memory_order_relaxed);
+        sequence.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int i = 0; i < WordCount; ++i) {
+            data[i].store(words[i], std::memory_order_relaxed);
+        }
+        sequence.store(s + 2, std::memory_order_release);
+    }
+
+    T load() const
+    {
+        quint64 words[WordCount];
+        unsigned int before;
+        unsigned int after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            for (int i = 0; i < WordCount; ++i) {
+                words[i] = data[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while (before != after || (before & 1));
+
+        T value;
+        std::memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+private:
+    static constexpr int WordCount = int((sizeof(T) + sizeof(quint64) - 1) / sizeof(quint64));
+
+    std::atomic<unsigned int> sequence; // Odd while a write is in progress
+    std::atomic<quint64> data[WordCount];
+};
+
+#endif // SEQLOCK_H
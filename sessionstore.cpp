@@ -0,0 +1,535 @@
+#include "sessionstore.h"
+#include "trace.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Snapshot layout (all little-endian):
+//   header       magic "MPSS", version, generation (u64), entry count, directory count,
+//                current row (i32), position (i64 ms), shuffle, repeat, playing, 0 (u8 each),
+//                order count
+//   directories  directory count x string, each with its trailing slash
+//   entries      entry count x {directory: u32 index; file name, title: string; duration: i64}
+//   order        order count x u32 row (the shuffled play order; none when not shuffled)
+// Strings are a u32 byte length plus UTF-8; an empty title means the
+// entry is named after its file.
+//
+// Log layout: magic "MPSL", version, generation (u64), then records of
+// {type: u8; body length: u32; body; CRC-16 of all that: u16}. A log
+// whose generation isn't the snapshot's predates it and is ignored.
+const char Magic[4] = {'M', 'P', 'S', 'S'};
+const quint32 Version = 1;
+const int HeaderSize = 44;
+const char LogMagic[4] = {'M', 'P', 'S', 'L'};
+const quint32 LogVersion = 1;
+const int LogHeaderSize = 16;
+
+enum RecordType : quint8 {
+    StateRecord = 1,  // i32 current row, i64 position, u8 shuffle, u8 repeat, u8 playing
+    InsertRecord = 2, // i32 row, u32 count, count x {path, title: string; duration: i64}
+    RemoveRecord = 3, // i32 first row, i32 count
+    MoveRecord = 4    // i32 first row, i32 count, i32 destination row (before the move)
+};
+
+template <typename T>
+void append(QByteArray &out, T value)
+{
+    char buffer[sizeof(T)];
+    qToLittleEndian(value, buffer);
+    out.append(buffer, sizeof(T));
+}
+
+void appendString(QByteArray &out, QStringView value)
+{
+    const QByteArray utf8 = value.toUtf8();
+    append<quint32>(out, quint32(utf8.size()));
+    out.append(utf8);
+}
+
+// Bounds-checked reads over a mapped file
+class Cursor
+{
+public:
+    Cursor(const uchar *data, qint64 size) : data(data), size(size), pos(0) {}
+
+    template <typename T>
+    bool read(T &value)
+    {
+        if (pos + qint64(sizeof(T)) > size) {
+            return false;
+        }
+        value = qFromLittleEndian<T>(data + pos);
+        pos += sizeof(T);
+        return true;
+    }
+
+    bool read(QString &value)
+    {
+        quint32 length;
+        if (!read(length) || pos + qint64(length) > size) {
+            return false;
+        }
+        value = QString::fromUtf8(reinterpret_cast<const char *>(data + pos), length);
+        pos += length;
+        return true;
+    }
+
+    bool skip(qint64 bytes)
+    {
+        if (pos + bytes > size) {
+            return false;
+        }
+        pos += bytes;
+        return true;
+    }
+
+    bool atEnd() const { return pos >= size; }
+    qint64 offset() const { return pos; }
+    qint64 remaining() const { return size - pos; }
+    const uchar *current() const { return data + pos; }
+
+private:
+    const uchar *data;
+    qint64 size;
+    qint64 pos;
+};
+
+bool readEntry(Cursor &in, PlaylistEntry &entry)
+{
+    return in.read(entry.path) && in.read(entry.title) && in.read(entry.duration);
+}
+
+} // namespace
+
+SessionStore::SessionStore(PlayerSession *session, const QString &fileName, QObject *parent)
+    : QObject(parent),
+      session(session),
+      fileName(fileName),
+      generation(0),
+      validLogSize(-1),
+      restoredPlaying(false),
+      recording(false)
+{
+    stateTimer.setInterval(1000);
+    connect(&stateTimer, &QTimer::timeout, this, [this]() {
+        saveState();
+
+        // A redrawn shuffle order goes into a snapshot rather than the log
+        const QList<int> order = this->session->queue().playOrder();
+        if (order == writtenOrder) {
+            writtenOrder = order; // Shared again, so the next comparison is O(1)
+        } else if (!compactTimer.isActive()) {
+            compactTimer.start();
+        }
+    });
+
+    compactTimer.setSingleShot(true);
+    compactTimer.setInterval(1000);
+    connect(&compactTimer, &QTimer::timeout, this, &SessionStore::compact);
+}
+
+QString SessionStore::defaultFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/session.snap";
+}
+
+bool SessionStore::restore()
+{
+    TRACE_SCOPE("session", "SessionStore::restore");
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < HeaderSize) {
+        return false;
+    }
+    const uchar *data = file.map(0, file.size());
+    if (!data || memcmp(data, Magic, 4) != 0) {
+        return false;
+    }
+
+    Cursor in(data, file.size());
+    quint32 version, entryCount, directoryCount, orderCount;
+    quint64 snapshotGeneration;
+    quint8 playing, reserved;
+    State state;
+    if (!in.skip(4) || !in.read(version) || version != Version || !in.read(snapshotGeneration)
+        || !in.read(entryCount) || !in.read(directoryCount) || !in.read(state.row) || !in.read(state.position)
+        || !in.read(state.shuffle) || !in.read(state.repeat) || !in.read(playing) || !in.read(reserved)
+        || !in.read(orderCount)) {
+        return false;
+    }
+    state.playing = playing != 0;
+
+    // Counts that can't fit in the file are corrupt; don't reserve for them
+    if (quint64(directoryCount) * 4 + quint64(entryCount) * 20 + quint64(orderCount) * 4 > quint64(in.remaining())) {
+        return false;
+    }
+
+    QStringList directories;
+    directories.reserve(directoryCount);
+    for (quint32 i = 0; i < directoryCount; ++i) {
+        QString directory;
+        if (!in.read(directory)) {
+            return false;
+        }
+        directories.append(directory);
+    }
+
+    QList<PlaylistEntry> entries;
+    entries.reserve(entryCount);
+    for (quint32 i = 0; i < entryCount; ++i) {
+        quint32 directory;
+        PlaylistEntry entry;
+        if (!in.read(directory) || directory >= quint32(directories.size()) || !in.read(entry.path)
+            || !in.read(entry.title) || !in.read(entry.duration)) {
+            return false;
+        }
+        entry.path.prepend(directories.at(directory));
+        entries.append(entry);
+    }
+
+    QList<int> order;
+    order.reserve(orderCount);
+    for (quint32 i = 0; i < orderCount; ++i) {
+        quint32 row;
+        if (!in.read(row)) {
+            return false;
+        }
+        order.append(int(row));
+    }
+
+    // Replay the log up to its first damaged record. Rows in the saved
+    // order are renumbered around edits; inserted rows go to its end.
+    validLogSize = -1;
+    QFile logFile(logFileName());
+    const uchar *logData = logFile.open(QIODevice::ReadOnly) && logFile.size() >= LogHeaderSize
+                           ? logFile.map(0, logFile.size()) : nullptr;
+    if (logData && memcmp(logData, LogMagic, 4) == 0 && qFromLittleEndian<quint32>(logData + 4) == LogVersion
+        && qFromLittleEndian<quint64>(logData + 8) == snapshotGeneration) {
+        TRACE_SCOPE("session", "replay log");
+        Cursor records(logData + LogHeaderSize, logFile.size() - LogHeaderSize);
+        validLogSize = LogHeaderSize;
+        while (!records.atEnd()) {
+            const uchar *start = records.current();
+            quint8 type;
+            quint32 length;
+            quint16 checksum;
+            if (!records.read(type) || !records.read(length) || !records.skip(length) || !records.read(checksum)
+                || qChecksum(QByteArrayView(start, 5 + qsizetype(length))) != checksum) {
+                break;
+            }
+
+            Cursor record(start + 5, length);
+            if (type == StateRecord) {
+                State logged;
+                if (!record.read(logged.row) || !record.read(logged.position) || !record.read(logged.shuffle)
+                    || !record.read(logged.repeat) || !record.read(playing)) {
+                    break;
+                }
+                logged.playing = playing != 0;
+                state = logged;
+            } else if (type == InsertRecord) {
+                qint32 row;
+                quint32 count;
+                if (!record.read(row) || !record.read(count) || quint64(count) * 16 > quint64(record.remaining())) {
+                    break;
+                }
+                QList<PlaylistEntry> added(count);
+                bool ok = true;
+                for (PlaylistEntry &entry : added) {
+                    ok = ok && readEntry(record, entry);
+                }
+                if (!ok) {
+                    break;
+                }
+                row = qBound(0, row, int(entries.size()));
+                entries.insert(row, added.size(), PlaylistEntry());
+                std::move(added.begin(), added.end(), entries.begin() + row);
+                if (!order.isEmpty()) {
+                    for (int &orderRow : order) {
+                        orderRow += orderRow >= row ? int(count) : 0;
+                    }
+                    for (int i = 0; i < int(count); ++i) {
+                        order.append(row + i);
+                    }
+                }
+                state.row += state.row >= row ? int(count) : 0;
+            } else if (type == RemoveRecord) {
+                qint32 first, count;
+                if (!record.read(first) || !record.read(count) || first < 0 || count < 0
+                    || qint64(first) + count > entries.size()) {
+                    break;
+                }
+                entries.remove(first, count);
+                qsizetype kept = 0;
+                for (int orderRow : std::as_const(order)) {
+                    if (orderRow < first || orderRow >= first + count) {
+                        order[kept++] = orderRow >= first + count ? orderRow - count : orderRow;
+                    }
+                }
+                order.resize(kept);
+                state.row = state.row >= first + count ? state.row - count : (state.row >= first ? -1 : state.row);
+            } else if (type == MoveRecord) {
+                qint32 first, count, destination;
+                if (!record.read(first) || !record.read(count) || !record.read(destination) || first < 0
+                    || count <= 0 || qint64(first) + count > entries.size() || destination < 0
+                    || destination > entries.size() || (destination >= first && destination <= first + count)) {
+                    break;
+                }
+                const auto block = entries.begin() + first;
+                if (destination > first) {
+                    std::rotate(block, block + count, entries.begin() + destination);
+                } else {
+                    std::rotate(entries.begin() + destination, block, block + count);
+                }
+                for (int &orderRow : order) {
+                    orderRow = PlaybackQueue::movedRow(orderRow, first, count, destination);
+                }
+                if (state.row >= 0) {
+                    state.row = PlaybackQueue::movedRow(state.row, first, count, destination);
+                }
+            }
+            validLogSize = LogHeaderSize + records.offset();
+        }
+    }
+
+    PlaylistModel *model = session->playlist();
+    PlaybackQueue &queue = session->queue();
+    model->setEntries(entries);
+    queue.setRepeatMode(PlaybackQueue::RepeatMode(qMin<int>(state.repeat, PlaybackQueue::RepeatOne)));
+    const auto shuffle = PlaybackQueue::ShuffleMode(qMin<int>(state.shuffle, PlaybackQueue::ArtistSpread));
+    if (shuffle == PlaybackQueue::NoShuffle || !queue.restoreOrder(shuffle, order, state.row)) {
+        queue.setShuffleMode(shuffle, state.row);
+    }
+    session->cue(state.row, state.position);
+
+    generation = snapshotGeneration;
+    restoredPlaying = state.playing;
+    written = state;
+    written.playing = false; // Cued, not playing
+    writtenOrder = queue.playOrder();
+    return true;
+}
+
+void SessionStore::start()
+{
+    if (recording) {
+        return;
+    }
+    recording = true;
+
+    // Carry on with the log restore() read, unless there was none to match the snapshot
+    if (validLogSize < 0 || !openLog(validLogSize)) {
+        compact();
+    }
+
+    PlaylistModel *model = session->playlist();
+    connect(model, &QAbstractItemModel::rowsInserted, this, &SessionStore::rowsInserted);
+    connect(model, &QAbstractItemModel::rowsRemoved, this, &SessionStore::rowsRemoved);
+    connect(model, &QAbstractItemModel::rowsMoved, this, &SessionStore::rowsMoved);
+    connect(model, &QAbstractItemModel::modelReset, this, &SessionStore::compact);
+    connect(session, &PlayerSession::currentTrackChanged, this, &SessionStore::saveState);
+    connect(session, &PlayerSession::playingChanged, this, &SessionStore::saveState);
+    connect(session->playback(), &PlaybackController::snapshotChanged, this, &SessionStore::saveState);
+    stateTimer.start();
+}
+
+SessionStore::State SessionStore::currentState()
+{
+    State state;
+    state.row = session->playlist()->currentRow();
+    state.position = session->playback()->snapshot().position;
+    state.shuffle = quint8(session->queue().shuffleMode());
+    state.repeat = quint8(session->queue().repeatMode());
+    state.playing = session->isPlaying();
+    return state;
+}
+
+void SessionStore::saveState()
+{
+    // While playing the position moves all the time; a second's worth is enough.
+    // Paused, any change is a seek.
+    const State state = currentState();
+    const bool moved = state.playing ? qAbs(state.position - written.position) >= 1000
+                                     : state.position != written.position;
+    if (!moved && state.row == written.row && state.shuffle == written.shuffle && state.repeat == written.repeat
+        && state.playing == written.playing) {
+        return;
+    }
+
+    QByteArray body;
+    append<qint32>(body, state.row);
+    append<qint64>(body, state.position);
+    append<quint8>(body, state.shuffle);
+    append<quint8>(body, state.repeat);
+    append<quint8>(body, state.playing);
+    if (appendRecord(StateRecord, body)) {
+        written = state;
+    }
+}
+
+void SessionStore::rowsInserted(const QModelIndex &, int first, int last)
+{
+    TRACE_SCOPE("session", "log insert");
+    const PlaylistModel *model = session->playlist();
+    QByteArray body;
+    append<qint32>(body, first);
+    append<quint32>(body, quint32(last - first + 1));
+    for (int row = first; row <= last; ++row) {
+        const QString path = model->path(row);
+        const QString title = model->displayName(row);
+        appendString(body, path);
+        appendString(body, title == PlaylistModel::displayNameFor(path) ? QString() : title);
+        append<qint64>(body, model->duration(row));
+    }
+    appendRecord(InsertRecord, body);
+
+    // The current row may have moved down
+    saveState();
+}
+
+void SessionStore::rowsRemoved(const QModelIndex &, int first, int last)
+{
+    QByteArray body;
+    append<qint32>(body, first);
+    append<qint32>(body, last - first + 1);
+    appendRecord(RemoveRecord, body);
+    saveState();
+}
+
+void SessionStore::rowsMoved(const QModelIndex &, int first, int last, const QModelIndex &, int destination)
+{
+    QByteArray body;
+    append<qint32>(body, first);
+    append<qint32>(body, last - first + 1);
+    append<qint32>(body, destination);
+    appendRecord(MoveRecord, body);
+    saveState();
+}
+
+bool SessionStore::appendRecord(quint8 type, const QByteArray &body)
+{
+    if (!log.isOpen()) {
+        return false;
+    }
+
+    QByteArray record;
+    record.reserve(body.size() + 7);
+    append<quint8>(record, type);
+    append<quint32>(record, quint32(body.size()));
+    record.append(body);
+    append<quint16>(record, qChecksum(record));
+
+    // Flushed to the OS at once, so it survives the process crashing right after
+    if (log.write(record) != record.size() || !log.flush()) {
+        // A partial record would hide everything after it; start over from a snapshot
+        log.close();
+        compactTimer.start();
+        return false;
+    }
+    if (log.size() > CompactThreshold && !compactTimer.isActive()) {
+        compactTimer.start();
+    }
+    return true;
+}
+
+bool SessionStore::openLog(qint64 validSize)
+{
+    log.close();
+    log.setFileName(logFileName());
+    if (!log.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+
+    // Cut a torn record off the end, so new records follow the last intact one
+    if (!log.resize(validSize) || !log.seek(validSize)) {
+        log.close();
+        return false;
+    }
+    return true;
+}
+
+bool SessionStore::compact()
+{
+    TRACE_SCOPE("session", "SessionStore::compact");
+    compactTimer.stop();
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    const PlaylistModel *model = session->playlist();
+    const State state = currentState();
+    const QList<int> order = session->queue().playOrder();
+
+    // Each directory is stored once, in order of first use
+    QHash<QString, quint32> directoryIds;
+    QByteArray directories;
+    QByteArray entries;
+    entries.reserve(model->count() * 48);
+    for (int row = 0; row < model->count(); ++row) {
+        const QString path = model->path(row);
+        const qsizetype slash = path.lastIndexOf(QLatin1Char('/'));
+        const QString directory = path.left(slash + 1);
+        auto it = directoryIds.constFind(directory);
+        if (it == directoryIds.constEnd()) {
+            it = directoryIds.insert(directory, quint32(directoryIds.size()));
+            appendString(directories, directory);
+        }
+        const QString title = model->displayName(row);
+
+        append<quint32>(entries, it.value());
+        appendString(entries, QStringView(path).mid(slash + 1));
+        appendString(entries, title == PlaylistModel::displayNameFor(path) ? QString() : title);
+        append<qint64>(entries, model->duration(row));
+    }
+
+    QByteArray orderRows;
+    orderRows.reserve(order.size() * 4);
+    for (int row : order) {
+        append<quint32>(orderRows, quint32(row));
+    }
+
+    QByteArray header(Magic, 4);
+    append<quint32>(header, Version);
+    append<quint64>(header, generation + 1);
+    append<quint32>(header, quint32(model->count()));
+    append<quint32>(header, quint32(directoryIds.size()));
+    append<qint32>(header, state.row);
+    append<qint64>(header, state.position);
+    append<quint8>(header, state.shuffle);
+    append<quint8>(header, state.repeat);
+    append<quint8>(header, state.playing);
+    append<quint8>(header, 0);
+    append<quint32>(header, quint32(order.size()));
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(header);
+    file.write(directories);
+    file.write(entries);
+    file.write(orderRows);
+    if (!file.commit()) {
+        return false;
+    }
+
+    // The snapshot holds everything now. Until the new log header is down,
+    // the old log's generation no longer matches and it is ignored.
+    ++generation;
+    written = state;
+    writtenOrder = order;
+
+    log.close();
+    log.setFileName(logFileName());
+    if (!log.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    QByteArray logHeader(LogMagic, 4);
+    append<quint32>(logHeader, LogVersion);
+    append<quint64>(logHeader, generation);
+    return log.write(logHeader) == logHeader.size() && log.flush();
+}
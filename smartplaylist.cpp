@@ -0,0 +1,817 @@
+#include "smartplaylist.h"
+#include "trace.h"
+#include <QDate>
+#include <QDateTime>
+#include <QRegularExpression>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+// Rows per mask on the evaluation stack, so a program's masks stay in L1
+const int BlockRows = 1024;
+// Rows per worker pool task
+const int ChunkRows = 1 << 16;
+
+const double Second = 1000;
+const double Hour = 3600 * Second;
+const double Day = 24 * Hour;
+
+struct FieldName
+{
+    const char *name;
+    SmartQuery::Field field;
+};
+
+const FieldName FieldNames[] = {
+    {"title", SmartQuery::Title},       {"artist", SmartQuery::Artist},     {"album", SmartQuery::Album},
+    {"genre", SmartQuery::Genre},       {"folder", SmartQuery::Folder},     {"directory", SmartQuery::Folder},
+    {"file", SmartQuery::File},         {"filename", SmartQuery::File},     {"duration", SmartQuery::Duration},
+    {"length", SmartQuery::Duration},   {"added", SmartQuery::Added},       {"modified", SmartQuery::Added},
+    {"size", SmartQuery::Size},         {"loudness", SmartQuery::Loudness},
+};
+
+bool isTextField(SmartQuery::Field field)
+{
+    return field <= SmartQuery::File;
+}
+
+struct Token
+{
+    enum Kind { End, Word, String, Literal, Operator, Open, Close, Comma };
+    Kind kind = End;
+    QString text;
+    int position = 0;
+};
+
+bool isLiteralChar(QChar c)
+{
+    return c.isLetterOrNumber() || c == QLatin1Char(':') || c == QLatin1Char('.') || c == QLatin1Char('-');
+}
+
+// Words, quoted text, literals (anything starting with a digit, such as 5:00,
+// 30d, 2024-05-01 or -14.5), comparison operators, parentheses and commas
+QList<Token> tokenize(const QString &text, QString *error)
+{
+    QList<Token> tokens;
+    int i = 0;
+    while (true) {
+        while (i < text.size() && text.at(i).isSpace()) {
+            ++i;
+        }
+        Token token;
+        token.position = i;
+        if (i == text.size()) {
+            tokens.append(token);
+            return tokens;
+        }
+
+        const QChar c = text.at(i);
+        const QChar next = i + 1 < text.size() ? text.at(i + 1) : QChar();
+        if (c == QLatin1Char('"') || c == QLatin1Char('\'')) {
+            // A backslash escapes the next character
+            token.kind = Token::String;
+            for (++i; i < text.size() && text.at(i) != c; ++i) {
+                if (text.at(i) == QLatin1Char('\\') && i + 1 < text.size()) {
+                    ++i;
+                }
+                token.text.append(text.at(i));
+            }
+            if (i == text.size()) {
+                *error = QString("Unterminated text at column %1").arg(token.position + 1);
+                return {};
+            }
+            ++i;
+        } else if (c.isDigit() || ((c == QLatin1Char('-') || c == QLatin1Char('.')) && next.isDigit())) {
+            token.kind = Token::Literal;
+            for (token.text.append(c), ++i; i < text.size() && isLiteralChar(text.at(i)); ++i) {
+                token.text.append(text.at(i));
+            }
+        } else if (c.isLetter() || c == QLatin1Char('_')) {
+            token.kind = Token::Word;
+            for (; i < text.size() && (text.at(i).isLetterOrNumber() || text.at(i) == QLatin1Char('_')); ++i) {
+                token.text.append(text.at(i));
+            }
+        } else if (c == QLatin1Char('(') || c == QLatin1Char(')') || c == QLatin1Char(',')) {
+            token.kind = c == QLatin1Char('(') ? Token::Open : c == QLatin1Char(')') ? Token::Close : Token::Comma;
+            token.text = c;
+            ++i;
+        } else if (c == QLatin1Char('=') || c == QLatin1Char('<') || c == QLatin1Char('>') || c == QLatin1Char('~')
+                   || (c == QLatin1Char('!') && (next == QLatin1Char('=') || next == QLatin1Char('~')))) {
+            token.kind = Token::Operator;
+            token.text = c;
+            ++i;
+            if (c != QLatin1Char('~') && (next == QLatin1Char('=') || (c == QLatin1Char('!') && next == QLatin1Char('~')))) {
+                token.text.append(next);
+                ++i;
+            }
+        } else {
+            *error = QString("Unexpected '%1' at column %2").arg(c).arg(i + 1);
+            return {};
+        }
+        tokens.append(token);
+    }
+}
+
+// A number with an optional unit, such as 90s, 1.5GB or -14; step is one in
+// its last written digit
+bool splitNumber(const QString &text, double *value, double *step, QString *unit)
+{
+    static const QRegularExpression pattern(QStringLiteral("^(-?\\d*(?:\\.(\\d+))?)([a-zA-Z]*)$"));
+    const QRegularExpressionMatch match = pattern.match(text);
+    if (!match.hasMatch()) {
+        return false;
+    }
+    bool ok = false;
+    *value = match.captured(1).toDouble(&ok);
+    *step = std::pow(10.0, -double(match.capturedLength(2)));
+    *unit = match.captured(3).toLower();
+    return ok;
+}
+
+// The value of a numeric literal in the field's units (ms, ms since the
+// epoch, bytes or LUFS) and the step it was written to
+bool parseNumber(SmartQuery::Field field, const QString &text, double *value, double *step, bool *age)
+{
+    *age = false;
+    QString unit;
+    switch (field) {
+    case SmartQuery::Duration: {
+        if (text.contains(QLatin1Char(':'))) {
+            // m:ss or h:mm:ss
+            double seconds = 0;
+            for (const QString &part : text.split(QLatin1Char(':'))) {
+                bool ok = false;
+                const int number = part.toInt(&ok);
+                if (!ok || number < 0) {
+                    return false;
+                }
+                seconds = seconds * 60 + number;
+            }
+            *value = seconds * Second;
+            *step = Second;
+            return text.count(QLatin1Char(':')) <= 2;
+        }
+        if (!splitNumber(text, value, step, &unit)) {
+            return false;
+        }
+        const double scale = unit.isEmpty() || unit == QLatin1String("s") ? Second
+                             : unit == QLatin1String("m")                 ? 60 * Second
+                             : unit == QLatin1String("h")                 ? Hour
+                                                                          : 0;
+        *value *= scale;
+        *step *= scale;
+        return scale > 0;
+    }
+    case SmartQuery::Added: {
+        const QDate date = QDate::fromString(text, Qt::ISODate);
+        if (date.isValid()) {
+            *value = double(date.startOfDay().toMSecsSinceEpoch());
+            *step = double(date.addDays(1).startOfDay().toMSecsSinceEpoch()) - *value;
+            return true;
+        }
+        if (!splitNumber(text, value, step, &unit)) {
+            return false;
+        }
+        const double scale = unit == QLatin1String("h")   ? Hour
+                             : unit == QLatin1String("d") ? Day
+                             : unit == QLatin1String("w") ? 7 * Day
+                             : unit == QLatin1String("y") ? 365 * Day
+                                                          : 0;
+        *value *= scale;
+        *step *= scale;
+        *age = true;
+        return scale > 0;
+    }
+    case SmartQuery::Size: {
+        if (!splitNumber(text, value, step, &unit)) {
+            return false;
+        }
+        const double scale = unit.isEmpty() || unit == QLatin1String("b")       ? 1
+                             : unit == QLatin1String("k") || unit == QLatin1String("kb") ? 1024
+                             : unit == QLatin1String("m") || unit == QLatin1String("mb") ? 1024 * 1024
+                             : unit == QLatin1String("g") || unit == QLatin1String("gb") ? 1024 * 1024 * 1024
+                                                                                           : 0;
+        *value *= scale;
+        *step = std::max(1.0, *step * scale);
+        return scale > 0;
+    }
+    case SmartQuery::Loudness:
+        return splitNumber(text, value, step, &unit)
+            && (unit.isEmpty() || unit == QLatin1String("lufs") || unit == QLatin1String("lu"));
+    default:
+        return false;
+    }
+}
+
+// Whole units of an integer column that fall in [bound, ...), clamped to qint64
+qint64 integerBound(double bound)
+{
+    if (bound <= double(std::numeric_limits<qint64>::min())) {
+        return std::numeric_limits<qint64>::min();
+    }
+    if (bound >= double(std::numeric_limits<qint64>::max())) {
+        return std::numeric_limits<qint64>::max();
+    }
+    return qint64(std::ceil(bound));
+}
+
+const StringDictionary *dictionaryOf(const TrackStore &tracks, SmartQuery::Field field)
+{
+    switch (field) {
+    case SmartQuery::Artist:
+        return &tracks.artistDictionary();
+    case SmartQuery::Album:
+        return &tracks.albumDictionary();
+    case SmartQuery::Genre:
+        return &tracks.genreDictionary();
+    case SmartQuery::Folder:
+        return &tracks.directoryDictionary();
+    default:
+        return nullptr;
+    }
+}
+
+const QList<quint32> &idColumnOf(const TrackStore &tracks, SmartQuery::Field field)
+{
+    switch (field) {
+    case SmartQuery::Artist:
+        return tracks.artistColumn();
+    case SmartQuery::Album:
+        return tracks.albumColumn();
+    case SmartQuery::Genre:
+        return tracks.genreColumn();
+    default:
+        return tracks.directoryColumn();
+    }
+}
+
+// Folders are compared without their trailing slash
+QStringView folderName(QStringView directory)
+{
+    return directory.size() > 1 && directory.endsWith(QLatin1Char('/')) ? directory.chopped(1) : directory;
+}
+
+// The kernels: straight loops over one column that the compiler vectorizes
+template <typename T>
+void inRange(const T *values, int count, qint64 low, qint64 high, bool negate, uchar *out)
+{
+    const uchar flip = negate ? 1 : 0;
+    for (int i = 0; i < count; ++i) {
+        const qint64 value = qint64(values[i]);
+        out[i] = uchar(((value >= low) & (value < high)) ^ flip);
+    }
+}
+
+void lookup(const quint32 *ids, int count, const uchar *verdicts, uchar *out)
+{
+    for (int i = 0; i < count; ++i) {
+        out[i] = verdicts[ids[i]];
+    }
+}
+
+template <typename T>
+int compareValues(T a, T b)
+{
+    return (a > b) - (a < b);
+}
+
+// Every id's place in the dictionary's case-insensitive order
+std::vector<quint32> ranksOf(const StringDictionary &dictionary)
+{
+    std::vector<quint32> ids(size_t(dictionary.size()));
+    std::iota(ids.begin(), ids.end(), 0u);
+    std::sort(ids.begin(), ids.end(), [&](quint32 a, quint32 b) {
+        return dictionary.value(a).compare(dictionary.value(b), Qt::CaseInsensitive) < 0;
+    });
+    std::vector<quint32> ranks(ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ranks[ids[i]] = quint32(i);
+    }
+    return ranks;
+}
+
+} // namespace
+
+class SmartQuery::Parser
+{
+public:
+    Parser(SmartQuery &query, const QList<Token> &tokens) : query(query), tokens(tokens) {}
+
+    // query := [or] ["order" "by" key ("," key)*] ["limit" n]
+    bool parse()
+    {
+        if (peek().kind != Token::End && !atKeyword("order") && !atKeyword("limit") && !parseOr()) {
+            return false;
+        }
+        if (atKeyword("order")) {
+            take();
+            if (!atKeyword("by")) {
+                return fail("Expected 'by' after 'order'");
+            }
+            take();
+            while (true) {
+                SortKey key;
+                if (!parseField(&key.field)) {
+                    return false;
+                }
+                key.descending = atKeyword("desc");
+                if (key.descending || atKeyword("asc")) {
+                    take();
+                }
+                query.order.append(key);
+                if (peek().kind != Token::Comma) {
+                    break;
+                }
+                take();
+            }
+        }
+        if (atKeyword("limit")) {
+            take();
+            bool ok = false;
+            const int limit = peek().text.toInt(&ok);
+            if (peek().kind != Token::Literal || !ok || limit < 0) {
+                return fail("Expected a number after 'limit'");
+            }
+            take();
+            query.limit = limit;
+        }
+        if (peek().kind != Token::End) {
+            return fail(QString("Unexpected '%1'").arg(peek().text));
+        }
+        return true;
+    }
+
+private:
+    // or := and ("or" and)*
+    bool parseOr()
+    {
+        if (!parseAnd()) {
+            return false;
+        }
+        while (atKeyword("or")) {
+            take();
+            if (!parseAnd()) {
+                return false;
+            }
+            append(Or);
+        }
+        return true;
+    }
+
+    // and := unary ("and" unary)*
+    bool parseAnd()
+    {
+        if (!parseUnary()) {
+            return false;
+        }
+        while (atKeyword("and")) {
+            take();
+            if (!parseUnary()) {
+                return false;
+            }
+            append(And);
+        }
+        return true;
+    }
+
+    // unary := "not" unary | "(" or ")" | test
+    bool parseUnary()
+    {
+        if (atKeyword("not")) {
+            take();
+            if (!parseUnary()) {
+                return false;
+            }
+            append(Not);
+            return true;
+        }
+        if (peek().kind == Token::Open) {
+            take();
+            if (!parseOr()) {
+                return false;
+            }
+            if (peek().kind != Token::Close) {
+                return fail("Expected ')'");
+            }
+            take();
+            return true;
+        }
+        return parseTest();
+    }
+
+    // test := field (operator | "contains" | "is") value
+    bool parseTest()
+    {
+        Test test;
+        const QString fieldName = peek().text;
+        if (!parseField(&test.field)) {
+            return false;
+        }
+
+        QString comparison = peek().text;
+        if (atKeyword("contains")) {
+            comparison = QStringLiteral("~");
+        } else if (atKeyword("is")) {
+            comparison = QStringLiteral("=");
+        } else if (peek().kind != Token::Operator) {
+            return fail(QString("Expected a comparison after '%1'").arg(fieldName));
+        }
+        take();
+
+        const Token value = peek();
+        if (value.kind != Token::String && value.kind != Token::Literal && value.kind != Token::Word) {
+            return fail(QString("Expected a value after '%1 %2'").arg(fieldName, comparison));
+        }
+
+        if (isTextField(test.field)) {
+            if (comparison == QLatin1String("=") || comparison == QLatin1String("==")) {
+                test.comparison = Equal;
+            } else if (comparison == QLatin1String("!=")) {
+                test.comparison = NotEqual;
+            } else if (comparison == QLatin1String("~")) {
+                test.comparison = Contains;
+            } else if (comparison == QLatin1String("!~")) {
+                test.comparison = NotContains;
+            } else {
+                return fail(QString("'%1' compares with =, !=, ~ or !~").arg(fieldName));
+            }
+            test.text = test.field == Folder ? folderName(value.text).toString() : value.text;
+        } else {
+            double number = 0;
+            double step = 0;
+            if (!parseNumber(test.field, value.text, &number, &step, &test.age)) {
+                return fail(QString("'%1' is not a valid %2").arg(value.text, fieldName));
+            }
+
+            // The literal stands for [number, number + step)
+            const double infinity = std::numeric_limits<double>::infinity();
+            test.comparison = InRange;
+            if (comparison == QLatin1String("<")) {
+                test.low = -infinity;
+                test.high = number;
+            } else if (comparison == QLatin1String("<=")) {
+                test.low = -infinity;
+                test.high = number + step;
+            } else if (comparison == QLatin1String(">")) {
+                test.low = number + step;
+                test.high = infinity;
+            } else if (comparison == QLatin1String(">=")) {
+                test.low = number;
+                test.high = infinity;
+            } else if (comparison == QLatin1String("=") || comparison == QLatin1String("==")
+                       || comparison == QLatin1String("!=")) {
+                test.low = number;
+                test.high = number + step;
+                test.negate = comparison == QLatin1String("!=");
+            } else {
+                return fail(QString("'%1' compares with =, !=, <, <=, > or >=").arg(fieldName));
+            }
+        }
+        take();
+
+        query.tests.append(test);
+        append(Push, int(query.tests.size()) - 1);
+        return true;
+    }
+
+    bool parseField(Field *field)
+    {
+        if (peek().kind == Token::Word) {
+            for (const FieldName &name : FieldNames) {
+                if (peek().text.compare(QLatin1String(name.name), Qt::CaseInsensitive) == 0) {
+                    *field = name.field;
+                    take();
+                    return true;
+                }
+            }
+        }
+        return fail(peek().kind == Token::End ? QString("Expected a field name")
+                                              : QString("Unknown field '%1'").arg(peek().text));
+    }
+
+    void append(Op op, int test = -1)
+    {
+        query.program.append({op, test});
+        if (op == Push) {
+            query.depth = std::max(query.depth, ++stackSize);
+        } else if (op != Not) {
+            --stackSize;
+        }
+    }
+
+    bool fail(const QString &message)
+    {
+        query.error = peek().kind == Token::End ? message + " at the end"
+                                                : message + QString(" at column %1").arg(peek().position + 1);
+        return false;
+    }
+
+    const Token &peek() const { return tokens.at(next); }
+    void take() { next = std::min(next + 1, int(tokens.size()) - 1); }
+    bool atKeyword(const char *keyword) const
+    {
+        return peek().kind == Token::Word && peek().text.compare(QLatin1String(keyword), Qt::CaseInsensitive) == 0;
+    }
+
+    SmartQuery &query;
+    const QList<Token> &tokens;
+    int next = 0;
+    int stackSize = 0;
+};
+
+SmartQuery::SmartQuery(const QString &text)
+    : source(text.trimmed())
+{
+    const QList<Token> tokens = tokenize(source, &error);
+    if (error.isEmpty() && !Parser(*this, tokens).parse()) {
+        tests.clear();
+        program.clear();
+        order.clear();
+    }
+}
+
+bool SmartQuery::usesField(Field field) const
+{
+    return std::any_of(tests.cbegin(), tests.cend(), [field](const Test &test) { return test.field == field; })
+        || std::any_of(order.cbegin(), order.cend(), [field](const SortKey &key) { return key.field == field; });
+}
+
+SmartPlaylist::SmartPlaylist(const QString &name, const SmartQuery &query)
+    : title(name), rule(query)
+{
+}
+
+void SmartPlaylist::evaluate(const TrackStore &tracks)
+{
+    TRACE_SCOPE("library", "SmartPlaylist::evaluate");
+
+    // A fresh store may have numbered its dictionaries differently
+    bindings.clear();
+    bind(tracks);
+    matched.assign(size_t(tracks.size()), 0);
+
+    // Chunks are independent and each writes only its own bytes
+    const int chunks = (tracks.size() + ChunkRows - 1) / ChunkRows;
+    if (chunks <= 1) {
+        run(tracks, 0, tracks.size(), matched.data());
+    } else {
+        QList<int> starts(chunks);
+        for (int chunk = 0; chunk < chunks; ++chunk) {
+            starts[chunk] = chunk * ChunkRows;
+        }
+        QtConcurrent::blockingMap(starts, [&](const int &begin) {
+            run(tracks, begin, std::min(begin + ChunkRows, tracks.size()), matched.data() + begin);
+        });
+    }
+    evaluated = true;
+}
+
+void SmartPlaylist::update(const TrackStore &tracks, const QList<int> &rows)
+{
+    const int oldCount = int(matched.size());
+    if (!evaluated || tracks.size() < oldCount) {
+        evaluate(tracks);
+        return;
+    }
+
+    bind(tracks);
+    matched.resize(size_t(tracks.size()), 0);
+    for (int row : rows) {
+        if (row >= 0 && row < oldCount) {
+            run(tracks, row, row + 1, matched.data() + row);
+        }
+    }
+    if (tracks.size() > oldCount) {
+        run(tracks, oldCount, tracks.size(), matched.data() + oldCount);
+    }
+}
+
+void SmartPlaylist::removeRows(const QList<int> &rows)
+{
+    if (!evaluated) {
+        return;
+    }
+
+    // The dictionaries keep their ids, so the bindings stay valid
+    size_t kept = 0;
+    int next = 0;
+    for (size_t row = 0; row < matched.size(); ++row) {
+        if (next < rows.size() && size_t(rows.at(next)) == row) {
+            ++next;
+        } else {
+            matched[kept++] = matched[row];
+        }
+    }
+    matched.resize(kept);
+}
+
+void SmartPlaylist::invalidate()
+{
+    bindings.clear();
+    std::vector<uchar>().swap(matched);
+    evaluated = false;
+}
+
+QBitArray SmartPlaylist::matches() const
+{
+    QBitArray bits(int(matched.size()));
+    for (int row = 0; row < bits.size(); ++row) {
+        if (matched[size_t(row)]) {
+            bits.setBit(row);
+        }
+    }
+    return bits;
+}
+
+QList<int> SmartPlaylist::rows(const TrackStore &tracks) const
+{
+    QList<int> result;
+    const int count = std::min(int(matched.size()), tracks.size());
+    for (int row = 0; row < count; ++row) {
+        if (matched[size_t(row)]) {
+            result.append(row);
+        }
+    }
+
+    if (!rule.order.isEmpty()) {
+        // Interned columns sort by rank, so rows compare as integers
+        std::vector<std::vector<quint32>> ranks;
+        for (const SmartQuery::SortKey &key : rule.order) {
+            const StringDictionary *dictionary = dictionaryOf(tracks, key.field);
+            ranks.push_back(dictionary ? ranksOf(*dictionary) : std::vector<quint32>());
+        }
+
+        auto compare = [&](int k, int a, int b) {
+            switch (rule.order.at(k).field) {
+            case SmartQuery::Title:
+                return tracks.title(a).compare(tracks.title(b), Qt::CaseInsensitive);
+            case SmartQuery::File:
+                return tracks.fileName(a).compare(tracks.fileName(b), Qt::CaseInsensitive);
+            case SmartQuery::Duration:
+                return compareValues(tracks.duration(a), tracks.duration(b));
+            case SmartQuery::Added:
+                return compareValues(tracks.modified(a), tracks.modified(b));
+            case SmartQuery::Size:
+                return compareValues(tracks.fileSize(a), tracks.fileSize(b));
+            case SmartQuery::Loudness:
+                return compareValues(tracks.trackLoudness(a), tracks.trackLoudness(b));
+            default: {
+                const QList<quint32> &ids = idColumnOf(tracks, rule.order.at(k).field);
+                return compareValues(ranks[size_t(k)][ids.at(a)], ranks[size_t(k)][ids.at(b)]);
+            }
+            }
+        };
+        std::stable_sort(result.begin(), result.end(), [&](int a, int b) {
+            for (int k = 0; k < rule.order.size(); ++k) {
+                const int order = compare(k, a, b);
+                if (order != 0) {
+                    return rule.order.at(k).descending ? order > 0 : order < 0;
+                }
+            }
+            return false;
+        });
+    }
+
+    if (rule.limit >= 0 && result.size() > rule.limit) {
+        result.resize(rule.limit);
+    }
+    return result;
+}
+
+void SmartPlaylist::bind(const TrackStore &tracks)
+{
+    const double now = double(QDateTime::currentMSecsSinceEpoch());
+    bindings.resize(size_t(rule.tests.size()));
+    for (int i = 0; i < rule.tests.size(); ++i) {
+        const SmartQuery::Test &test = rule.tests.at(i);
+        Binding &binding = bindings[size_t(i)];
+
+        if (const StringDictionary *dictionary = dictionaryOf(tracks, test.field)) {
+            // Dictionaries only grow, so ids judged on an earlier pass keep their verdicts
+            for (int id = int(binding.verdicts.size()); id < dictionary->size(); ++id) {
+                QStringView value = dictionary->value(quint32(id));
+                if (test.field == SmartQuery::Folder) {
+                    value = folderName(value);
+                }
+                binding.verdicts.push_back(uchar(matchesText(test, value)));
+            }
+        } else if (test.field == SmartQuery::Loudness) {
+            binding.lowLoudness = float(test.low);
+            binding.highLoudness = float(test.high);
+        } else if (test.age) {
+            // An age in [low, high) is a modification time in (now - high, now - low]
+            binding.low = integerBound(now - test.high + 1);
+            binding.high = integerBound(now - test.low + 1);
+        } else {
+            binding.low = integerBound(test.low);
+            binding.high = integerBound(test.high);
+        }
+    }
+}
+
+void SmartPlaylist::run(const TrackStore &tracks, int begin, int end, uchar *out) const
+{
+    if (!rule.isValid() || rule.program.isEmpty()) {
+        std::fill(out, out + (end - begin), uchar(rule.isValid()));
+        return;
+    }
+
+    // The program runs over a block of rows at a time, on a stack of byte masks
+    const int blockRows = std::min(BlockRows, end - begin);
+    std::vector<uchar> stack(size_t(rule.depth) * size_t(blockRows));
+    for (int first = begin; first < end; first += blockRows) {
+        const int count = std::min(blockRows, end - first);
+        uchar *top = stack.data(); // The next free mask
+        for (const SmartQuery::Instruction &instruction : rule.program) {
+            switch (instruction.op) {
+            case SmartQuery::Push:
+                runTest(tracks, instruction.test, first, count, top);
+                top += blockRows;
+                break;
+            case SmartQuery::And: {
+                top -= blockRows;
+                uchar *left = top - blockRows;
+                for (int i = 0; i < count; ++i) {
+                    left[i] &= top[i];
+                }
+                break;
+            }
+            case SmartQuery::Or: {
+                top -= blockRows;
+                uchar *left = top - blockRows;
+                for (int i = 0; i < count; ++i) {
+                    left[i] |= top[i];
+                }
+                break;
+            }
+            case SmartQuery::Not: {
+                uchar *operand = top - blockRows;
+                for (int i = 0; i < count; ++i) {
+                    operand[i] ^= 1;
+                }
+                break;
+            }
+            }
+        }
+        std::copy_n(stack.data(), count, out + (first - begin));
+    }
+}
+
+void SmartPlaylist::runTest(const TrackStore &tracks, int index, int first, int count, uchar *out) const
+{
+    const SmartQuery::Test &test = rule.tests.at(index);
+    const Binding &binding = bindings[size_t(index)];
+    switch (test.field) {
+    case SmartQuery::Title:
+    case SmartQuery::File:
+        for (int i = 0; i < count; ++i) {
+            const int row = first + i;
+            out[i] = uchar(matchesText(test, test.field == SmartQuery::Title ? tracks.title(row) : tracks.fileName(row)));
+        }
+        break;
+    case SmartQuery::Artist:
+    case SmartQuery::Album:
+    case SmartQuery::Genre:
+    case SmartQuery::Folder:
+        lookup(idColumnOf(tracks, test.field).constData() + first, count, binding.verdicts.data(), out);
+        break;
+    case SmartQuery::Duration:
+        inRange(tracks.durationColumn().constData() + first, count, binding.low, binding.high, test.negate, out);
+        break;
+    case SmartQuery::Added:
+        inRange(tracks.modifiedColumn().constData() + first, count, binding.low, binding.high, test.negate, out);
+        break;
+    case SmartQuery::Size:
+        inRange(tracks.fileSizeColumn().constData() + first, count, binding.low, binding.high, test.negate, out);
+        break;
+    case SmartQuery::Loudness:
+        // Tracks that haven't been analyzed match no loudness test
+        for (int i = 0; i < count; ++i) {
+            const int row = first + i;
+            const float value = tracks.trackLoudness(row);
+            const bool inside = value >= binding.lowLoudness && value < binding.highLoudness;
+            out[i] = uchar(tracks.gatedBlocks(row) > 0 && inside != test.negate);
+        }
+        break;
+    }
+}
+
+bool SmartPlaylist::matchesText(const SmartQuery::Test &test, QStringView value)
+{
+    switch (test.comparison) {
+    case SmartQuery::Equal:
+        return value.compare(test.text, Qt::CaseInsensitive) == 0;
+    case SmartQuery::NotEqual:
+        return value.compare(test.text, Qt::CaseInsensitive) != 0;
+    case SmartQuery::Contains:
+        return value.contains(test.text, Qt::CaseInsensitive);
+    case SmartQuery::NotContains:
+        return !value.contains(test.text, Qt::CaseInsensitive);
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef SMARTPLAYLIST_H
+#define SMARTPLAYLIST_H
+
+#include <QBitArray>
+#include <QList>
+#include <QString>
+#include <vector>
+#include "trackstore.h"
+
+// A smart playlist rule, such as
+//
+//     artist = "Nina Simone" and duration > 5:00 and added < 30d order by album
+//
+// Fields: title, artist, album, genre, folder, file (text, compared with
+// =, !=, ~ for "contains" and !~, ignoring case) and duration, added, size,
+// loudness (numbers, compared with = != < <= > >=). Durations are m:ss,
+// h:mm:ss or a number with s, m or h; added takes a date (2024-05-01) or
+// an age in h, d, w or y, so "added < 30d" is the last 30 days; sizes take
+// KB, MB or GB; loudness is in LUFS. A literal stands for everything that
+// rounds down to it: "duration = 3:30" is that whole second. Tests combine
+// with and, or, not and parentheses, and may be followed by
+// "order by field [asc|desc], ..." and "limit n". An empty rule matches
+// every track.
+//
+// The text is parsed once into a postfix program of tests, so evaluation
+// never looks at it again. "added" is the file's modification time, the
+// closest thing the library stores to a date added.
+class SmartQuery
+{
+public:
+    enum Field { Title, Artist, Album, Genre, Folder, File, Duration, Added, Size, Loudness };
+
+    SmartQuery() = default;
+    explicit SmartQuery(const QString &text);
+
+    bool isValid() const { return error.isEmpty(); }
+    // What is wrong with the text and where, for showing to the user
+    const QString &errorString() const { return error; }
+    const QString &text() const { return source; }
+    // Whether the rule tests or sorts by field
+    bool usesField(Field field) const;
+
+private:
+    friend class SmartPlaylist;
+    class Parser;
+
+    enum Comparison { Equal, NotEqual, Contains, NotContains, InRange };
+    struct Test
+    {
+        Field field = Title;
+        Comparison comparison = Equal;
+        QString text;        // Text fields
+        double low = 0;      // Numeric fields match in [low, high), or outside it when negate is set
+        double high = 0;
+        bool negate = false;
+        bool age = false;    // Added, as milliseconds before the evaluation
+    };
+    enum Op { Push, And, Or, Not };
+    struct Instruction
+    {
+        Op op;
+        int test;
+    };
+    struct SortKey
+    {
+        Field field;
+        bool descending;
+    };
+
+    QString source;
+    QString error;
+    QList<Test> tests;
+    QList<Instruction> program; // Postfix; empty matches everything
+    int depth = 0;              // Masks the program's stack needs
+    QList<SortKey> order;
+    int limit = -1;
+};
+
+// A named rule and its verdict for every library row. A pass binds the
+// rule to the store (each text test on an interned column becomes one
+// verdict per distinct value, computed once, so a row costs a table
+// lookup) and runs the program over blocks of rows, each test filling a
+// byte mask with a straight loop over one column and and/or/not folding
+// the masks; the compiler vectorizes those loops. Large libraries are cut
+// into chunks evaluated on the worker pool.
+//
+// After tag changes or new files only the touched rows are re-evaluated;
+// ages are measured from the latest pass, so untouched rows keep their
+// verdicts until the next full evaluate().
+class SmartPlaylist
+{
+public:
+    SmartPlaylist() = default;
+    SmartPlaylist(const QString &name, const SmartQuery &query);
+
+    const QString &name() const { return title; }
+    const SmartQuery &query() const { return rule; }
+
+    void evaluate(const TrackStore &tracks);
+    // Re-evaluates rows and any rows appended since the last pass. Falls
+    // back to evaluate() before the first pass.
+    void update(const TrackStore &tracks, const QList<int> &rows);
+    // Drops the verdicts of removed rows (ascending), keeping the rest
+    void removeRows(const QList<int> &rows);
+    // Drops the verdicts until the next evaluate()
+    void invalidate();
+    bool isEvaluated() const { return evaluated; }
+
+    // One bit per row of the last pass
+    QBitArray matches() const;
+    // The matching rows in the rule's order, cut to its limit
+    QList<int> rows(const TrackStore &tracks) const;
+
+private:
+    struct Binding
+    {
+        std::vector<uchar> verdicts; // Interned text fields, by dictionary id
+        qint64 low = 0;              // Integer columns, in their own units
+        qint64 high = 0;
+        float lowLoudness = 0;
+        float highLoudness = 0;
+    };
+
+    void bind(const TrackStore &tracks);
+    void run(const TrackStore &tracks, int begin, int end, uchar *out) const;
+    void runTest(const TrackStore &tracks, int test, int first, int count, uchar *out) const;
+    static bool matchesText(const SmartQuery::Test &test, QStringView value);
+
+    QString title;
+    SmartQuery rule;
+    std::vector<Binding> bindings;
+    std::vector<uchar> matched; // A byte per row, so parallel chunks never share a word
+    bool evaluated = false;
+};
+
+#endif // SMARTPLAYLIST_H
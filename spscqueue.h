@@ -0,0 +1,57 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded single-producer, single-consumer ring. push() is called from one
+// thread and pop() from one other; neither blocks, takes a lock or
+// allocates (beyond what T's own assignment does). Capacity must be a
+// power of two.
+template <typename T, std::size_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    SpscQueue()
+        : head(0),
+          tail(0)
+    {
+    }
+
+    // Producer side; returns false and drops the value when the ring is full
+    bool push(T value)
+    {
+        const std::size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        slots[t & (Capacity - 1)] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; returns false when the ring is empty
+    bool pop(T &value)
+    {
+        const std::size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(slots[h & (Capacity - 1)]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, Capacity> slots;
+
+    // Separate cache lines so the two threads don't bounce one line between them
+    alignas(64) std::atomic<std::size_t> head; // Next slot to read, written by the consumer
+    alignas(64) std::atomic<std::size_t> tail; // Next slot to write, written by the producer
+};
+
+#endif // SPSCQUEUE_H
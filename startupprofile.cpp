@@ -0,0 +1,82 @@
+#include "startupprofile.h"
+#include "trace.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QList>
+
+namespace {
+
+struct Phase
+{
+    const char *name;
+    qint64 nsecs;
+};
+
+QElapsedTimer clock;
+QList<Phase> phases;
+qint64 lastMark = 0;
+bool finished = false;
+
+} // namespace
+
+namespace StartupProfile {
+
+void start()
+{
+    clock.start();
+    phases.clear();
+    lastMark = 0;
+    finished = false;
+}
+
+void mark(const char *phase)
+{
+    if (finished || !clock.isValid()) {
+        return;
+    }
+    const qint64 now = clock.nsecsElapsed();
+    phases.append({phase, now - lastMark});
+    lastMark = now;
+    TRACE_INSTANT("startup", phase);
+}
+
+void finish()
+{
+    if (finished || !clock.isValid()) {
+        return;
+    }
+    mark("first frame");
+    finished = true;
+
+    if (totalMs() > BudgetMs) {
+        qWarning().noquote() << report();
+    } else if (qEnvironmentVariableIntValue("PLAYER_STARTUP_REPORT") != 0) {
+        qInfo().noquote() << report();
+    }
+}
+
+bool isFinished()
+{
+    return finished;
+}
+
+qint64 totalMs()
+{
+    return lastMark / 1000000;
+}
+
+QString report()
+{
+    QString text;
+    for (const Phase &phase : std::as_const(phases)) {
+        text += QString("%1 %2 ms\n").arg(QString::fromLatin1(phase.name), -24)
+                                     .arg(phase.nsecs / 1e6, 7, 'f', 1);
+    }
+    text += QString("Startup: %1 ms to first frame (budget %2 ms)%3")
+                .arg(lastMark / 1e6, 0, 'f', 1)
+                .arg(BudgetMs)
+                .arg(QLatin1String(finished ? "" : ", still starting"));
+    return text;
+}
+
+} // namespace StartupProfile
@@ -0,0 +1,34 @@
+#ifndef STARTUPPROFILE_H
+#define STARTUPPROFILE_H
+
+#include <QString>
+#include <QtGlobal>
+
+// Time from the start of main() to the main window's first frame, broken
+// down by phase. main() calls start() first thing, each phase ends with
+// mark(), and the window calls finish() once its first frame is on screen.
+// The report is logged when it goes over BudgetMs, or always when
+// PLAYER_STARTUP_REPORT=1; with tracing on, each mark is also an instant
+// event in the "startup" category. Main thread only.
+namespace StartupProfile {
+
+const qint64 BudgetMs = 150;
+
+void start();
+
+// Ends the phase begun by the previous mark (or start()). The name must be
+// a string literal; nothing is recorded after finish().
+void mark(const char *phase);
+
+// Ends the last phase and logs the report if asked to
+void finish();
+
+bool isFinished();
+qint64 totalMs();
+
+// One line per phase, then the total against the budget
+QString report();
+
+} // namespace StartupProfile
+
+#endif // STARTUPPROFILE_H
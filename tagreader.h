@@ -0,0 +1,1072 @@
+#ifndef TAGREADER_H
+#define TAGREADER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QStringDecoder>
+#include <QtEndian>
+#include "trace.h"
+
+// Basic tag information for one audio file, as shown in the library table
+struct TrackInfo
+{
+    QString path;
+    QString title;
+    QString artist;
+    QString album;
+    QString genre;
+    qint64 duration = 0; // milliseconds
+    qint64 modified = 0; // file mtime, ms since epoch
+    qint64 size = 0;     // file size in bytes
+
+    // Filled in by loudness analysis (see loudness.h), not by the tag reader
+    qint32 gatedBlocks = -1;   // 400 ms blocks that passed the R128 gates; -1 = not analyzed
+    float loudness = 0;        // integrated loudness, LUFS
+    float peak = 0;            // true peak, linear full scale
+    float albumLoudness = 0;   // integrated loudness of the whole album, LUFS
+
+    // Filled in by fingerprinting (see fingerprint.h); empty = not fingerprinted
+    QList<quint32> fingerprint;
+};
+
+// Small native tag/duration reader for the formats the player supports.
+// Only the container headers are read (plus the last few KB for ID3v1 and
+// Ogg granule positions); large frames such as embedded pictures and the
+// audio payload itself are skipped with seeks, so the cost per file is a
+// handful of small reads. All functions are reentrant and may be called
+// from worker threads.
+namespace TagReader {
+
+namespace detail {
+
+inline quint32 be16(const char *p) { return qFromBigEndian<quint16>(p); }
+inline quint32 be24(const char *p)
+{
+    const uchar *u = reinterpret_cast<const uchar *>(p);
+    return (quint32(u[0]) << 16) | (quint32(u[1]) << 8) | quint32(u[2]);
+}
+inline quint32 be32(const char *p) { return qFromBigEndian<quint32>(p); }
+inline quint64 be64(const char *p) { return qFromBigEndian<quint64>(p); }
+inline quint32 le16(const char *p) { return qFromLittleEndian<quint16>(p); }
+inline quint32 le32(const char *p) { return qFromLittleEndian<quint32>(p); }
+inline quint64 le64(const char *p) { return qFromLittleEndian<quint64>(p); }
+
+inline quint32 syncsafe(const char *p)
+{
+    const uchar *u = reinterpret_cast<const uchar *>(p);
+    return (quint32(u[0] & 0x7f) << 21) | (quint32(u[1] & 0x7f) << 14)
+         | (quint32(u[2] & 0x7f) << 7) | quint32(u[3] & 0x7f);
+}
+
+// Reads up to len bytes at pos; returns fewer at end of file
+inline QByteArray readAt(QFile &file, qint64 pos, qint64 len)
+{
+    if (pos < 0 || !file.seek(pos)) {
+        return QByteArray();
+    }
+    return file.read(len);
+}
+
+inline void setIfEmpty(QString &field, const QString &value)
+{
+    if (field.isEmpty()) {
+        field = value.trimmed();
+    }
+}
+
+// Decodes an ID3v2 text frame payload (encoding byte + text), keeping the first value only
+inline QString decodeId3Text(const QByteArray &payload)
+{
+    if (payload.size() < 2) {
+        return QString();
+    }
+
+    const char encoding = payload.at(0);
+    QByteArray text = payload.mid(1);
+
+    if (encoding == 1 || encoding == 2) {
+        // UTF-16, terminated by an aligned double zero
+        for (int i = 0; i + 1 < text.size(); i += 2) {
+            if (text.at(i) == 0 && text.at(i + 1) == 0) {
+                text.truncate(i);
+                break;
+            }
+        }
+
+        QStringConverter::Encoding utf16 = QStringConverter::Utf16BE;
+        if (encoding == 1) {
+            utf16 = QStringConverter::Utf16LE;
+            if (text.startsWith("\xfe\xff")) {
+                utf16 = QStringConverter::Utf16BE;
+                text.remove(0, 2);
+            } else if (text.startsWith("\xff\xfe")) {
+                text.remove(0, 2);
+            }
+        }
+
+        QStringDecoder decoder(utf16);
+        return decoder(text);
+    }
+
+    const int end = text.indexOf('\0');
+    if (end >= 0) {
+        text.truncate(end);
+    }
+    return encoding == 3 ? QString::fromUtf8(text) : QString::fromLatin1(text);
+}
+
+// The 80 genres of the original ID3v1 list, which ID3v1, ID3v2 TCON and
+// MP4 'gnre' refer to by number
+inline QString id3v1Genre(int index)
+{
+    static const char *const names[] = {
+        "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop", "Jazz", "Metal",
+        "New Age", "Oldies", "Other", "Pop", "R&B", "Rap", "Reggae", "Rock", "Techno", "Industrial",
+        "Alternative", "Ska", "Death Metal", "Pranks", "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop",
+        "Vocal", "Jazz+Funk", "Fusion", "Trance", "Classical", "Instrumental", "Acid", "House", "Game",
+        "Sound Clip", "Gospel", "Noise", "AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative",
+        "Instrumental Pop", "Instrumental Rock", "Ethnic", "Gothic", "Darkwave", "Techno-Industrial",
+        "Electronic", "Pop-Folk", "Eurodance", "Dream", "Southern Rock", "Comedy", "Cult", "Gangsta",
+        "Top 40", "Christian Rap", "Pop/Funk", "Jungle", "Native American", "Cabaret", "New Wave",
+        "Psychedelic", "Rave", "Showtunes", "Trailer", "Lo-Fi", "Tribal", "Acid Punk", "Acid Jazz", "Polka",
+        "Retro", "Musical", "Rock & Roll", "Hard Rock"
+    };
+    const int count = int(sizeof(names) / sizeof(names[0]));
+    return index >= 0 && index < count ? QString::fromLatin1(names[index]) : QString();
+}
+
+// TCON may hold "(17)", "(17)Rock", "17" or plain text
+inline QString genreName(const QString &value)
+{
+    const QString text = value.trimmed();
+    bool numeric = false;
+    if (text.startsWith(QLatin1Char('('))) {
+        const int close = text.indexOf(QLatin1Char(')'));
+        const int index = close > 1 ? text.mid(1, close - 1).toInt(&numeric) : 0;
+        if (numeric) {
+            const QString refinement = text.mid(close + 1).trimmed();
+            return refinement.isEmpty() ? id3v1Genre(index) : refinement;
+        }
+    }
+    const int index = text.toInt(&numeric);
+    return numeric ? id3v1Genre(index) : text;
+}
+
+// Parses a Vorbis comment structure (used by FLAC and Ogg). Tolerates
+// truncated input so callers may pass only the head of a large packet.
+inline void parseVorbisComment(const QByteArray &data, TrackInfo &info)
+{
+    const char *p = data.constData();
+    const qint64 size = data.size();
+
+    if (size < 8) {
+        return;
+    }
+
+    qint64 pos = 4 + qint64(le32(p));
+    if (pos + 4 > size) {
+        return;
+    }
+
+    quint32 count = le32(p + pos);
+    pos += 4;
+
+    QString albumArtist;
+    for (quint32 i = 0; i < count && pos + 4 <= size; ++i) {
+        const qint64 len = le32(p + pos);
+        pos += 4;
+        if (pos + len > size) {
+            break;
+        }
+
+        const QByteArray entry = QByteArray::fromRawData(p + pos, int(len));
+        pos += len;
+
+        const int eq = entry.indexOf('=');
+        if (eq <= 0) {
+            continue;
+        }
+
+        const QByteArray key = entry.left(eq).toUpper();
+        const QString value = QString::fromUtf8(entry.constData() + eq + 1, entry.size() - eq - 1);
+
+        if (key == "TITLE") {
+            setIfEmpty(info.title, value);
+        } else if (key == "ARTIST") {
+            setIfEmpty(info.artist, value);
+        } else if (key == "ALBUMARTIST" || key == "ALBUM ARTIST") {
+            setIfEmpty(albumArtist, value);
+        } else if (key == "ALBUM") {
+            setIfEmpty(info.album, value);
+        } else if (key == "GENRE") {
+            setIfEmpty(info.genre, value);
+        }
+    }
+
+    setIfEmpty(info.artist, albumArtist);
+}
+
+// Reads an ID3v2 tag starting at pos. Returns the offset just past the tag,
+// or pos itself if there is no tag there.
+inline qint64 readId3v2(QFile &file, qint64 pos, TrackInfo &info)
+{
+    const QByteArray header = readAt(file, pos, 10);
+    if (header.size() < 10 || !header.startsWith("ID3")) {
+        return pos;
+    }
+
+    const int major = uchar(header.at(3));
+    const int flags = uchar(header.at(5));
+    const qint64 tagEnd = pos + 10 + syncsafe(header.constData() + 6) + ((flags & 0x10) ? 10 : 0);
+
+    if (major < 2 || major > 4) {
+        return tagEnd;
+    }
+
+    qint64 framePos = pos + 10;
+    if ((flags & 0x40) && major >= 3) {
+        // Extended header: v2.3 stores its size without the size field, v2.4 includes it
+        const QByteArray ext = readAt(file, framePos, 4);
+        if (ext.size() < 4) {
+            return tagEnd;
+        }
+        framePos += major == 3 ? 4 + be32(ext.constData()) : syncsafe(ext.constData());
+    }
+
+    const int frameHeaderSize = major == 2 ? 6 : 10;
+    QString albumArtist;
+    QString genre;
+    QString length;
+
+    while (framePos + frameHeaderSize <= tagEnd) {
+        const QByteArray frameHeader = readAt(file, framePos, frameHeaderSize);
+        if (frameHeader.size() < frameHeaderSize || frameHeader.at(0) == 0) {
+            break; // Padding
+        }
+
+        QByteArray id;
+        qint64 frameSize;
+        bool compressed = false;
+        if (major == 2) {
+            id = frameHeader.left(3);
+            frameSize = be24(frameHeader.constData() + 3);
+        } else {
+            id = frameHeader.left(4);
+            frameSize = major == 4 ? syncsafe(frameHeader.constData() + 4)
+                                   : be32(frameHeader.constData() + 4);
+            const int formatFlags = uchar(frameHeader.at(9));
+            compressed = major == 4 ? (formatFlags & 0x0c) : (formatFlags & 0xc0);
+        }
+
+        const qint64 payloadPos = framePos + frameHeaderSize;
+        framePos = payloadPos + frameSize;
+        if (frameSize <= 0 || framePos > tagEnd) {
+            break;
+        }
+
+        QString *target = nullptr;
+        if (id == "TIT2" || id == "TT2") {
+            target = &info.title;
+        } else if (id == "TPE1" || id == "TP1") {
+            target = &info.artist;
+        } else if (id == "TPE2" || id == "TP2") {
+            target = &albumArtist;
+        } else if (id == "TALB" || id == "TAL") {
+            target = &info.album;
+        } else if (id == "TCON" || id == "TCO") {
+            target = &genre;
+        } else if (id == "TLEN" || id == "TLE") {
+            target = &length;
+        }
+
+        // Text frames are tiny; anything larger (or compressed) is not worth reading
+        if (target && !compressed && frameSize < 4096) {
+            setIfEmpty(*target, decodeId3Text(readAt(file, payloadPos, frameSize)));
+        }
+    }
+
+    setIfEmpty(info.artist, albumArtist);
+    setIfEmpty(info.genre, genreName(genre));
+    if (info.duration <= 0) {
+        info.duration = length.toLongLong();
+    }
+
+    return tagEnd;
+}
+
+inline void readId3v1(QFile &file, TrackInfo &info)
+{
+    if (file.size() < 128) {
+        return;
+    }
+
+    const QByteArray tag = readAt(file, file.size() - 128, 128);
+    if (tag.size() < 128 || !tag.startsWith("TAG")) {
+        return;
+    }
+
+    auto field = [&tag](int offset) {
+        QByteArray value = tag.mid(offset, 30);
+        const int end = value.indexOf('\0');
+        if (end >= 0) {
+            value.truncate(end);
+        }
+        return QString::fromLatin1(value);
+    };
+
+    setIfEmpty(info.title, field(3));
+    setIfEmpty(info.artist, field(33));
+    setIfEmpty(info.album, field(63));
+    setIfEmpty(info.genre, id3v1Genre(uchar(tag.at(127))));
+}
+
+// Estimates MPEG audio duration from the first frame header, using the
+// Xing/Info or VBRI frame count when present and a CBR estimate otherwise
+inline qint64 mpegDuration(QFile &file, qint64 audioStart)
+{
+    static const int bitrates[5][16] = {
+        {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0}, // V1 L1
+        {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0},    // V1 L2
+        {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0},     // V1 L3
+        {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},    // V2 L1
+        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},         // V2 L2/L3
+    };
+    static const int sampleRates[3] = {44100, 48000, 32000};
+
+    const QByteArray head = readAt(file, audioStart, 8192);
+    const char *p = head.constData();
+
+    for (int i = 0; i + 4 <= head.size(); ++i) {
+        const uchar b1 = uchar(p[i + 1]);
+        const uchar b2 = uchar(p[i + 2]);
+        if (uchar(p[i]) != 0xff || (b1 & 0xe0) != 0xe0) {
+            continue;
+        }
+
+        const int version = (b1 >> 3) & 3; // 3: MPEG1, 2: MPEG2, 0: MPEG2.5
+        const int layer = (b1 >> 1) & 3;   // 3: I, 2: II, 1: III
+        const int bitrateIndex = b2 >> 4;
+        const int rateIndex = (b2 >> 2) & 3;
+        if (version == 1 || layer == 0 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3) {
+            continue;
+        }
+
+        const bool mpeg1 = version == 3;
+        const bool mono = (uchar(p[i + 3]) >> 6) == 3;
+        const int table = mpeg1 ? 3 - layer : (layer == 3 ? 3 : 4);
+        const int bitrate = bitrates[table][bitrateIndex];
+        const int sampleRate = sampleRates[rateIndex] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+        const int samplesPerFrame = layer == 3 ? 384 : (layer == 1 && !mpeg1 ? 576 : 1152);
+
+        // Xing/Info header sits after the side information of the first frame
+        const int xingOffset = i + 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+        if (xingOffset + 12 <= head.size()) {
+            const QByteArray magic = head.mid(xingOffset, 4);
+            if (magic == "Xing" || magic == "Info") {
+                if (be32(p + xingOffset + 4) & 1) {
+                    const qint64 frames = be32(p + xingOffset + 8);
+                    return frames * samplesPerFrame * 1000 / sampleRate;
+                }
+            }
+        }
+
+        const int vbriOffset = i + 4 + 32;
+        if (vbriOffset + 18 <= head.size() && head.mid(vbriOffset, 4) == "VBRI") {
+            const qint64 frames = be32(p + vbriOffset + 14);
+            return frames * samplesPerFrame * 1000 / sampleRate;
+        }
+
+        qint64 audioBytes = file.size() - (audioStart + i);
+        const QByteArray tail = readAt(file, file.size() - 128, 3);
+        if (tail == "TAG") {
+            audioBytes -= 128;
+        }
+        return audioBytes * 8 / bitrate; // kbit/s gives milliseconds directly
+    }
+
+    return 0;
+}
+
+inline void readMpeg(QFile &file, qint64 audioStart, TrackInfo &info)
+{
+    if (info.duration <= 0) {
+        info.duration = mpegDuration(file, audioStart);
+    }
+    readId3v1(file, info);
+}
+
+inline void readFlac(QFile &file, qint64 pos, TrackInfo &info)
+{
+    pos += 4; // "fLaC"
+
+    bool last = false;
+    while (!last) {
+        const QByteArray header = readAt(file, pos, 4);
+        if (header.size() < 4) {
+            break;
+        }
+
+        last = uchar(header.at(0)) & 0x80;
+        const int type = uchar(header.at(0)) & 0x7f;
+        const qint64 length = be24(header.constData() + 1);
+        pos += 4;
+
+        if (type == 0 && length >= 18) {
+            const QByteArray streamInfo = readAt(file, pos, 18);
+            if (streamInfo.size() == 18) {
+                const uchar *u = reinterpret_cast<const uchar *>(streamInfo.constData());
+                const quint32 sampleRate = (quint32(u[10]) << 12) | (quint32(u[11]) << 4) | (u[12] >> 4);
+                const quint64 totalSamples = (quint64(u[13] & 0x0f) << 32) | be32(streamInfo.constData() + 14);
+                if (sampleRate > 0) {
+                    info.duration = qint64(totalSamples * 1000 / sampleRate);
+                }
+            }
+        } else if (type == 4) {
+            parseVorbisComment(readAt(file, pos, qMin<qint64>(length, 65536)), info);
+        }
+
+        pos += length;
+    }
+}
+
+// Walks Ogg pages from the start of the file and returns the first
+// maxPackets packets of the first logical stream (each capped at
+// maxPacketSize, 64 KB unless the caller wants embedded pictures)
+inline QList<QByteArray> oggHeaderPackets(QFile &file, int maxPackets, quint32 *serial,
+                                          qint64 maxPacketSize = 65536)
+{
+    QList<QByteArray> packets;
+    QByteArray packet;
+    qint64 pos = 0;
+
+    while (packets.size() < maxPackets) {
+        const QByteArray header = readAt(file, pos, 27);
+        if (header.size() < 27 || !header.startsWith("OggS")) {
+            break;
+        }
+
+        const int segments = uchar(header.at(26));
+        const QByteArray table = readAt(file, pos + 27, segments);
+        if (table.size() < segments) {
+            break;
+        }
+
+        if (serial && pos == 0) {
+            *serial = le32(header.constData() + 14);
+        }
+
+        qint64 dataPos = pos + 27 + segments;
+        for (int i = 0; i < segments && packets.size() < maxPackets; ++i) {
+            const int lacing = uchar(table.at(i));
+            if (packet.size() < maxPacketSize) {
+                packet.append(readAt(file, dataPos, lacing));
+            }
+            dataPos += lacing;
+            if (lacing < 255) {
+                packets.append(packet);
+                packet.clear();
+            }
+        }
+
+        pos = dataPos;
+    }
+
+    return packets;
+}
+
+inline qint64 oggLastGranule(QFile &file, quint32 serial)
+{
+    const qint64 tailSize = qMin<qint64>(file.size(), 65536);
+    const QByteArray tail = readAt(file, file.size() - tailSize, tailSize);
+
+    for (int i = tail.lastIndexOf("OggS"); i >= 0; i = tail.lastIndexOf("OggS", i - 1)) {
+        if (i + 27 <= tail.size() && le32(tail.constData() + i + 14) == serial) {
+            const qint64 granule = qint64(le64(tail.constData() + i + 6));
+            if (granule >= 0) {
+                return granule;
+            }
+        }
+        if (i == 0) {
+            break;
+        }
+    }
+
+    return -1;
+}
+
+inline void readOgg(QFile &file, TrackInfo &info)
+{
+    quint32 serial = 0;
+    const QList<QByteArray> packets = oggHeaderPackets(file, 2, &serial);
+    if (packets.isEmpty()) {
+        return;
+    }
+
+    const QByteArray &ident = packets.first();
+    qint64 sampleRate = 0;
+    qint64 preSkip = 0;
+    int commentOffset = -1;
+
+    if (ident.size() >= 16 && ident.startsWith("\x01vorbis")) {
+        sampleRate = le32(ident.constData() + 12);
+        commentOffset = 7;
+    } else if (ident.size() >= 19 && ident.startsWith("OpusHead")) {
+        sampleRate = 48000; // Opus granule positions are always 48 kHz
+        preSkip = le16(ident.constData() + 10);
+        commentOffset = 8;
+    } else if (ident.size() >= 31 && ident.startsWith("\x7f" "FLAC")) {
+        const uchar *u = reinterpret_cast<const uchar *>(ident.constData()) + 17;
+        sampleRate = (quint32(u[10]) << 12) | (quint32(u[11]) << 4) | (u[12] >> 4);
+        commentOffset = 4;
+    }
+
+    if (packets.size() > 1 && commentOffset >= 0) {
+        parseVorbisComment(packets.at(1).mid(commentOffset), info);
+    }
+
+    const qint64 granule = oggLastGranule(file, serial);
+    if (sampleRate > 0 && granule > preSkip) {
+        info.duration = (granule - preSkip) * 1000 / sampleRate;
+    }
+}
+
+inline void readMp4Items(QFile &file, qint64 pos, qint64 end, TrackInfo &info)
+{
+    QString albumArtist;
+
+    while (pos + 8 <= end) {
+        const QByteArray header = readAt(file, pos, 8);
+        if (header.size() < 8) {
+            break;
+        }
+
+        const qint64 size = be32(header.constData());
+        if (size < 8 || pos + size > end) {
+            break;
+        }
+
+        const QByteArray type = header.mid(4, 4);
+        QString *target = nullptr;
+        if (type == "\xa9nam") {
+            target = &info.title;
+        } else if (type == "\xa9" "ART") {
+            target = &info.artist;
+        } else if (type == "aART") {
+            target = &albumArtist;
+        } else if (type == "\xa9" "alb") {
+            target = &info.album;
+        } else if (type == "\xa9gen") {
+            target = &info.genre;
+        } else if (type == "gnre" && size < 4096) {
+            // A 16-bit ID3v1 genre number plus one
+            const QByteArray item = readAt(file, pos + 8, size - 8);
+            if (item.size() >= 18 && item.mid(4, 4) == "data") {
+                setIfEmpty(info.genre, id3v1Genre(int(be16(item.constData() + 16)) - 1));
+            }
+        }
+
+        if (target && size < 4096) {
+            // Item atom contains a 'data' atom: size, 'data', type, locale, value
+            const QByteArray item = readAt(file, pos + 8, size - 8);
+            if (item.size() >= 16 && item.mid(4, 4) == "data") {
+                const qint64 dataSize = qMin<qint64>(be32(item.constData()), item.size());
+                if (dataSize > 16) {
+                    setIfEmpty(*target, QString::fromUtf8(item.constData() + 16, int(dataSize - 16)));
+                }
+            }
+        }
+
+        pos += size;
+    }
+
+    setIfEmpty(info.artist, albumArtist);
+}
+
+inline void readMp4Atoms(QFile &file, qint64 pos, qint64 end, TrackInfo &info)
+{
+    while (pos + 8 <= end) {
+        const QByteArray header = readAt(file, pos, 16);
+        if (header.size() < 8) {
+            break;
+        }
+
+        qint64 size = be32(header.constData());
+        qint64 headerSize = 8;
+        if (size == 1 && header.size() >= 16) {
+            size = qint64(be64(header.constData() + 8));
+            headerSize = 16;
+        } else if (size == 0) {
+            size = end - pos;
+        }
+        if (size < headerSize || pos + size > end) {
+            break;
+        }
+
+        const QByteArray type = header.mid(4, 4);
+        const qint64 bodyPos = pos + headerSize;
+        const qint64 bodyEnd = pos + size;
+
+        if (type == "moov" || type == "udta") {
+            readMp4Atoms(file, bodyPos, bodyEnd, info);
+        } else if (type == "meta") {
+            // ISO 'meta' is a full box with 4 bytes of version/flags; QuickTime's is not
+            const QByteArray peek = readAt(file, bodyPos, 8);
+            const bool fullBox = peek.size() == 8 && peek.mid(4, 4) != "hdlr";
+            readMp4Atoms(file, bodyPos + (fullBox ? 4 : 0), bodyEnd, info);
+        } else if (type == "ilst") {
+            readMp4Items(file, bodyPos, bodyEnd, info);
+        } else if (type == "mvhd") {
+            const QByteArray mvhd = readAt(file, bodyPos, 32);
+            if (mvhd.size() >= 20) {
+                const bool v1 = mvhd.at(0) == 1;
+                const qint64 timescale = be32(mvhd.constData() + (v1 ? 20 : 12));
+                const qint64 duration = v1 && mvhd.size() >= 32 ? qint64(be64(mvhd.constData() + 24))
+                                                                 : be32(mvhd.constData() + 16);
+                if (timescale > 0) {
+                    info.duration = duration * 1000 / timescale;
+                }
+            }
+        }
+
+        pos = bodyEnd;
+    }
+}
+
+inline void readWav(QFile &file, TrackInfo &info)
+{
+    qint64 pos = 12;
+    qint64 byteRate = 0;
+    qint64 dataSize = 0;
+
+    while (pos + 8 <= file.size()) {
+        const QByteArray header = readAt(file, pos, 8);
+        if (header.size() < 8) {
+            break;
+        }
+
+        const QByteArray id = header.left(4);
+        const qint64 size = le32(header.constData() + 4);
+        const qint64 bodyPos = pos + 8;
+
+        if (id == "fmt " && size >= 12) {
+            const QByteArray fmt = readAt(file, bodyPos, 12);
+            if (fmt.size() == 12) {
+                byteRate = le32(fmt.constData() + 8);
+            }
+        } else if (id == "data") {
+            dataSize = qMin(size, file.size() - bodyPos);
+        } else if (id == "LIST" && size >= 4 && size < 65536) {
+            const QByteArray list = readAt(file, bodyPos, size);
+            if (list.startsWith("INFO")) {
+                for (qint64 sub = 4; sub + 8 <= list.size();) {
+                    const QByteArray subId = list.mid(int(sub), 4);
+                    const qint64 subSize = le32(list.constData() + sub + 4);
+                    QByteArray value = list.mid(int(sub + 8), int(subSize));
+                    const int end = value.indexOf('\0');
+                    if (end >= 0) {
+                        value.truncate(end);
+                    }
+
+                    if (subId == "INAM") {
+                        setIfEmpty(info.title, QString::fromUtf8(value));
+                    } else if (subId == "IART") {
+                        setIfEmpty(info.artist, QString::fromUtf8(value));
+                    } else if (subId == "IPRD") {
+                        setIfEmpty(info.album, QString::fromUtf8(value));
+                    } else if (subId == "IGNR") {
+                        setIfEmpty(info.genre, QString::fromUtf8(value));
+                    }
+
+                    sub += 8 + subSize + (subSize & 1);
+                }
+            }
+        } else if (id == "id3 " || id == "ID3 ") {
+            readId3v2(file, bodyPos, info);
+        }
+
+        pos = bodyPos + size + (size & 1);
+    }
+
+    if (byteRate > 0 && info.duration <= 0) {
+        info.duration = dataSize * 1000 / byteRate;
+    }
+}
+
+// Embedded pictures larger than this are ignored
+const qint64 MaxPictureSize = 16 * 1024 * 1024;
+
+// Picks the front cover (picture type 3) over any other embedded picture
+inline void offerPicture(QByteArray &best, bool &bestIsFront, const QByteArray &data, int pictureType)
+{
+    if (data.isEmpty() || (!best.isEmpty() && (bestIsFront || pictureType != 3))) {
+        return;
+    }
+    best = data;
+    bestIsFront = pictureType == 3;
+}
+
+// Parses a FLAC PICTURE block body (also the payload of METADATA_BLOCK_PICTURE)
+inline void parseFlacPicture(const QByteArray &block, QByteArray &best, bool &bestIsFront)
+{
+    const char *p = block.constData();
+    const qint64 size = block.size();
+    if (size < 32) {
+        return;
+    }
+
+    const int type = int(be32(p));
+    qint64 pos = 4;
+    pos += 4 + qint64(be32(p + pos)); // MIME type
+    if (pos + 4 > size) {
+        return;
+    }
+    pos += 4 + qint64(be32(p + pos)); // Description
+    pos += 16;                        // Width, height, depth, colors
+    if (pos + 4 > size) {
+        return;
+    }
+    const qint64 length = be32(p + pos);
+    pos += 4;
+    if (pos + length <= size) {
+        offerPicture(best, bestIsFront, block.mid(int(pos), int(length)), type);
+    }
+}
+
+// Undoes ID3v2 unsynchronisation (FF 00 -> FF)
+inline QByteArray id3Resync(const QByteArray &data)
+{
+    QByteArray out;
+    out.reserve(data.size());
+    for (int i = 0; i < data.size(); ++i) {
+        out.append(data.at(i));
+        if (uchar(data.at(i)) == 0xff && i + 1 < data.size() && data.at(i + 1) == 0) {
+            ++i;
+        }
+    }
+    return out;
+}
+
+inline void readId3v2Picture(QFile &file, qint64 pos, QByteArray &best, bool &bestIsFront)
+{
+    const QByteArray header = readAt(file, pos, 10);
+    if (header.size() < 10 || !header.startsWith("ID3")) {
+        return;
+    }
+
+    const int major = uchar(header.at(3));
+    const int flags = uchar(header.at(5));
+    const qint64 tagEnd = pos + 10 + syncsafe(header.constData() + 6);
+    if (major < 2 || major > 4) {
+        return;
+    }
+
+    qint64 framePos = pos + 10;
+    if ((flags & 0x40) && major >= 3) {
+        const QByteArray ext = readAt(file, framePos, 4);
+        if (ext.size() < 4) {
+            return;
+        }
+        framePos += major == 3 ? 4 + be32(ext.constData()) : syncsafe(ext.constData());
+    }
+
+    const int frameHeaderSize = major == 2 ? 6 : 10;
+    while (framePos + frameHeaderSize <= tagEnd) {
+        const QByteArray frameHeader = readAt(file, framePos, frameHeaderSize);
+        if (frameHeader.size() < frameHeaderSize || frameHeader.at(0) == 0) {
+            break;
+        }
+
+        QByteArray id;
+        qint64 frameSize;
+        int formatFlags = 0;
+        if (major == 2) {
+            id = frameHeader.left(3);
+            frameSize = be24(frameHeader.constData() + 3);
+        } else {
+            id = frameHeader.left(4);
+            frameSize = major == 4 ? syncsafe(frameHeader.constData() + 4)
+                                   : be32(frameHeader.constData() + 4);
+            formatFlags = uchar(frameHeader.at(9));
+        }
+
+        const qint64 payloadPos = framePos + frameHeaderSize;
+        framePos = payloadPos + frameSize;
+        if (frameSize <= 0 || framePos > tagEnd) {
+            break;
+        }
+
+        const bool compressed = major == 4 ? (formatFlags & 0x0c) : (formatFlags & 0xc0);
+        if ((id != "APIC" && id != "PIC") || compressed || frameSize > MaxPictureSize) {
+            continue;
+        }
+
+        QByteArray payload = readAt(file, payloadPos, frameSize);
+        if ((major == 4 && (formatFlags & 0x02)) || (major < 4 && (flags & 0x80))) {
+            payload = id3Resync(payload);
+        }
+        if (payload.size() < 4) {
+            continue;
+        }
+
+        // APIC: encoding, MIME\0, type, description\0, data. PIC has a 3-byte format instead of MIME.
+        const char encoding = payload.at(0);
+        int p = 1;
+        if (id == "PIC") {
+            p += 3;
+        } else {
+            p = payload.indexOf('\0', p);
+            if (p < 0) {
+                continue;
+            }
+            ++p;
+        }
+        if (p >= payload.size()) {
+            continue;
+        }
+        const int type = uchar(payload.at(p++));
+
+        if (encoding == 1 || encoding == 2) {
+            while (p + 1 < payload.size() && (payload.at(p) != 0 || payload.at(p + 1) != 0)) {
+                p += 2;
+            }
+            p += 2;
+        } else {
+            p = payload.indexOf('\0', p);
+            if (p < 0) {
+                continue;
+            }
+            ++p;
+        }
+        if (p < payload.size()) {
+            offerPicture(best, bestIsFront, payload.mid(p), type);
+        }
+    }
+}
+
+inline void readFlacPicture(QFile &file, qint64 pos, QByteArray &best, bool &bestIsFront)
+{
+    pos += 4; // "fLaC"
+
+    bool last = false;
+    while (!last) {
+        const QByteArray header = readAt(file, pos, 4);
+        if (header.size() < 4) {
+            break;
+        }
+
+        last = uchar(header.at(0)) & 0x80;
+        const int type = uchar(header.at(0)) & 0x7f;
+        const qint64 length = be24(header.constData() + 1);
+        pos += 4;
+
+        if (type == 6) {
+            parseFlacPicture(readAt(file, pos, length), best, bestIsFront);
+        }
+
+        pos += length;
+    }
+}
+
+inline void readOggPicture(QFile &file, QByteArray &best, bool &bestIsFront)
+{
+    const QList<QByteArray> packets = oggHeaderPackets(file, 2, nullptr, MaxPictureSize);
+    if (packets.size() < 2) {
+        return;
+    }
+
+    const QByteArray &ident = packets.first();
+    int commentOffset = -1;
+    if (ident.startsWith("\x01vorbis")) {
+        commentOffset = 7;
+    } else if (ident.startsWith("OpusHead")) {
+        commentOffset = 8;
+    } else if (ident.startsWith("\x7f" "FLAC")) {
+        commentOffset = 4;
+    }
+    if (commentOffset < 0) {
+        return;
+    }
+
+    const QByteArray comment = packets.at(1).mid(commentOffset);
+    const char *p = comment.constData();
+    const qint64 size = comment.size();
+    if (size < 8) {
+        return;
+    }
+
+    qint64 pos = 4 + qint64(le32(p));
+    if (pos + 4 > size) {
+        return;
+    }
+    const quint32 count = le32(p + pos);
+    pos += 4;
+
+    static const QByteArray key("METADATA_BLOCK_PICTURE=");
+    for (quint32 i = 0; i < count && pos + 4 <= size; ++i) {
+        const qint64 len = le32(p + pos);
+        pos += 4;
+        if (pos + len > size) {
+            break;
+        }
+
+        const QByteArray entry = QByteArray::fromRawData(p + pos, int(len));
+        pos += len;
+        if (entry.size() > key.size() && entry.left(key.size()).toUpper() == key) {
+            parseFlacPicture(QByteArray::fromBase64(entry.mid(key.size())), best, bestIsFront);
+        }
+    }
+}
+
+inline void readMp4Picture(QFile &file, qint64 pos, qint64 end, QByteArray &best, bool &bestIsFront)
+{
+    while (pos + 8 <= end) {
+        const QByteArray header = readAt(file, pos, 16);
+        if (header.size() < 8) {
+            break;
+        }
+
+        qint64 size = be32(header.constData());
+        qint64 headerSize = 8;
+        if (size == 1 && header.size() >= 16) {
+            size = qint64(be64(header.constData() + 8));
+            headerSize = 16;
+        } else if (size == 0) {
+            size = end - pos;
+        }
+        if (size < headerSize || pos + size > end) {
+            break;
+        }
+
+        const QByteArray type = header.mid(4, 4);
+        const qint64 bodyPos = pos + headerSize;
+        const qint64 bodyEnd = pos + size;
+
+        if (type == "moov" || type == "udta" || type == "ilst") {
+            readMp4Picture(file, bodyPos, bodyEnd, best, bestIsFront);
+        } else if (type == "meta") {
+            const QByteArray peek = readAt(file, bodyPos, 8);
+            const bool fullBox = peek.size() == 8 && peek.mid(4, 4) != "hdlr";
+            readMp4Picture(file, bodyPos + (fullBox ? 4 : 0), bodyEnd, best, bestIsFront);
+        } else if (type == "covr" && size - headerSize <= MaxPictureSize) {
+            // One or more 'data' atoms: size, 'data', type, locale, image
+            const QByteArray covr = readAt(file, bodyPos, size - headerSize);
+            for (qint64 sub = 0; sub + 16 <= covr.size();) {
+                const qint64 dataSize = be32(covr.constData() + sub);
+                if (dataSize < 16 || sub + dataSize > covr.size()) {
+                    break;
+                }
+                if (covr.mid(int(sub + 4), 4) == "data") {
+                    offerPicture(best, bestIsFront, covr.mid(int(sub + 16), int(dataSize - 16)), 3);
+                }
+                sub += dataSize;
+            }
+        }
+
+        pos = bodyEnd;
+    }
+}
+
+} // namespace detail
+
+// Reads tags and duration from an audio file without decoding it.
+// Missing fields fall back to the same placeholders the library shows.
+inline TrackInfo readTrack(const QString &filePath)
+{
+    TRACE_SCOPE_ARG("tags", "readTrack", filePath);
+    using namespace detail;
+
+    TrackInfo info;
+    info.path = filePath;
+
+    QFile file(filePath);
+    if (file.open(QIODevice::ReadOnly)) {
+        info.size = file.size();
+        info.modified = file.fileTime(QFileDevice::FileModificationTime).toMSecsSinceEpoch();
+
+        const QByteArray magic = readAt(file, 0, 12);
+
+        if (magic.startsWith("OggS")) {
+            readOgg(file, info);
+        } else if (magic.startsWith("RIFF") && magic.mid(8, 4) == "WAVE") {
+            readWav(file, info);
+        } else if (magic.mid(4, 4) == "ftyp") {
+            readMp4Atoms(file, 0, file.size(), info);
+        } else {
+            // MP3 and FLAC may both start with an ID3v2 tag
+            const qint64 audioStart = readId3v2(file, 0, info);
+            if (readAt(file, audioStart, 4) == "fLaC") {
+                readFlac(file, audioStart, info);
+            } else {
+                readMpeg(file, audioStart, info);
+            }
+        }
+    }
+
+    if (info.title.isEmpty()) {
+        info.title = QFileInfo(filePath).baseName();
+    }
+    if (info.artist.isEmpty()) {
+        info.artist = "Unknown Artist";
+    }
+    if (info.album.isEmpty()) {
+        info.album = "Unknown Album";
+    }
+
+    return info;
+}
+
+// Returns the raw bytes (usually JPEG or PNG) of the embedded cover art,
+// preferring the front cover, or an empty array if there is none. Unlike
+// readTrack() this reads the picture payload, so it is meant for the
+// cover-art cache rather than library scans.
+inline QByteArray readCoverArt(const QString &filePath)
+{
+    using namespace detail;
+
+    QByteArray best;
+    bool bestIsFront = false;
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return best;
+    }
+
+    const QByteArray magic = readAt(file, 0, 12);
+    if (magic.startsWith("OggS")) {
+        readOggPicture(file, best, bestIsFront);
+    } else if (magic.startsWith("RIFF") && magic.mid(8, 4) == "WAVE") {
+        for (qint64 pos = 12; pos + 8 <= file.size();) {
+            const QByteArray header = readAt(file, pos, 8);
+            if (header.size() < 8) {
+                break;
+            }
+            const qint64 size = le32(header.constData() + 4);
+            if (header.startsWith("id3 ") || header.startsWith("ID3 ")) {
+                readId3v2Picture(file, pos + 8, best, bestIsFront);
+            }
+            pos += 8 + size + (size & 1);
+        }
+    } else if (magic.mid(4, 4) == "ftyp") {
+        readMp4Picture(file, 0, file.size(), best, bestIsFront);
+    } else {
+        readId3v2Picture(file, 0, best, bestIsFront);
+        const QByteArray id3 = readAt(file, 0, 10);
+        qint64 audioStart = 0;
+        if (id3.size() == 10 && id3.startsWith("ID3")) {
+            audioStart = 10 + syncsafe(id3.constData() + 6) + ((uchar(id3.at(5)) & 0x10) ? 10 : 0);
+        }
+        if (readAt(file, audioStart, 4) == "fLaC") {
+            readFlacPicture(file, audioStart, best, bestIsFront);
+        }
+    }
+
+    return best;
+}
+
+} // namespace TagReader
+
+#endif // TAGREADER_H
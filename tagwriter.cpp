@@ -0,0 +1,947 @@
+#include "tagwriter.h"
+#include "trace.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUuid>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+using namespace TagReader::detail;
+
+// Room left for later edits when a tag has to grow
+const int Id3Padding = 4096;
+const int FlacPadding = 8192;
+const int Mp4Padding = 4096;
+
+const qint64 CopyChunk = 1024 * 1024;
+const qint64 MaxTagRegion = 64 * 1024 * 1024;
+
+const char JournalMagic[4] = {'M', 'P', 'T', 'J'};
+const quint32 JournalVersion = 1;
+
+// Replaces [offset, offset + length) of the file with data
+struct Patch
+{
+    qint64 offset = 0;
+    qint64 length = 0;
+    QByteArray data;
+};
+
+struct Plan
+{
+    QList<Patch> patches;
+    QString error;
+};
+
+void appendBe32(QByteArray &out, quint32 value)
+{
+    char bytes[4];
+    qToBigEndian(value, bytes);
+    out.append(bytes, 4);
+}
+
+void appendLe32(QByteArray &out, quint32 value)
+{
+    char bytes[4];
+    qToLittleEndian(value, bytes);
+    out.append(bytes, 4);
+}
+
+void appendLe64(QByteArray &out, quint64 value)
+{
+    char bytes[8];
+    qToLittleEndian(value, bytes);
+    out.append(bytes, 8);
+}
+
+void appendSyncsafe(QByteArray &out, quint32 value)
+{
+    out.append(char((value >> 21) & 0x7f));
+    out.append(char((value >> 14) & 0x7f));
+    out.append(char((value >> 7) & 0x7f));
+    out.append(char(value & 0x7f));
+}
+
+bool syncToDisk(QFile &file)
+{
+    if (!file.flush()) {
+        return false;
+    }
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+}
+
+QString journalDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/tag-journal";
+}
+
+// --- ID3v2 ---
+
+QByteArray id3TextFrame(const char *id, const QString &value, int major)
+{
+    QByteArray payload;
+    if (major == 4) {
+        payload.append(char(3)); // UTF-8
+        payload.append(value.toUtf8());
+    } else {
+        // v2.3 has no UTF-8; UTF-16 with a BOM
+        payload.append(char(1));
+        payload.append("\xff\xfe", 2);
+        for (const QChar c : value) {
+            const ushort u = c.unicode();
+            payload.append(char(u & 0xff));
+            payload.append(char(u >> 8));
+        }
+    }
+
+    QByteArray frame(id, 4);
+    if (major == 4) {
+        appendSyncsafe(frame, quint32(payload.size()));
+    } else {
+        appendBe32(frame, quint32(payload.size()));
+    }
+    frame.append(2, '\0'); // Flags
+    frame.append(payload);
+    return frame;
+}
+
+// Rewrites (or creates, at pos) the ID3v2 tag. Frames other than the
+// edited ones are copied as they are.
+bool planId3v2(QFile &file, qint64 pos, const TagEdit &edit, Plan &plan)
+{
+    const QByteArray header = readAt(file, pos, 10);
+    const bool exists = header.size() == 10 && header.startsWith("ID3");
+
+    int major = 4;
+    qint64 region = 0;
+    QByteArray frames;
+
+    if (exists) {
+        major = uchar(header.at(3));
+        const int flags = uchar(header.at(5));
+        const qint64 bodySize = syncsafe(header.constData() + 6);
+        region = 10 + bodySize + ((flags & 0x10) ? 10 : 0);
+        if (major != 3 && major != 4) {
+            plan.error = QString("ID3v2.%1 tags can't be written").arg(major);
+            return false;
+        }
+
+        QByteArray body = readAt(file, pos + 10, bodySize);
+        if (body.size() < bodySize) {
+            plan.error = "Truncated ID3v2 tag";
+            return false;
+        }
+        // v2.3 unsynchronises the whole tag; the rewritten tag is stored plain
+        if (major == 3 && (flags & 0x80)) {
+            body = id3Resync(body);
+        }
+
+        // The extended header (and any CRC in it) is dropped
+        qint64 framePos = 0;
+        if ((flags & 0x40) && body.size() >= 4) {
+            framePos = major == 3 ? 4 + be32(body.constData()) : syncsafe(body.constData());
+        }
+
+        while (framePos + 10 <= body.size() && body.at(int(framePos)) != 0) {
+            const char *frameHeader = body.constData() + framePos;
+            const qint64 frameSize = major == 4 ? syncsafe(frameHeader + 4) : be32(frameHeader + 4);
+            if (frameSize <= 0 || framePos + 10 + frameSize > body.size()) {
+                break;
+            }
+
+            const QByteArray id(frameHeader, 4);
+            const bool replaced = ((edit.fields & TagEdit::Title) && id == "TIT2")
+                               || ((edit.fields & TagEdit::Artist) && id == "TPE1")
+                               || ((edit.fields & TagEdit::Album) && id == "TALB");
+            if (!replaced) {
+                frames.append(frameHeader, int(10 + frameSize));
+            }
+            framePos += 10 + frameSize;
+        }
+    }
+
+    if ((edit.fields & TagEdit::Title) && !edit.title.isEmpty()) {
+        frames.append(id3TextFrame("TIT2", edit.title, major));
+    }
+    if ((edit.fields & TagEdit::Artist) && !edit.artist.isEmpty()) {
+        frames.append(id3TextFrame("TPE1", edit.artist, major));
+    }
+    if ((edit.fields & TagEdit::Album) && !edit.album.isEmpty()) {
+        frames.append(id3TextFrame("TALB", edit.album, major));
+    }
+
+    // Same size if the padding allows it, otherwise grow with fresh padding
+    const qint64 bodySize = frames.size() <= region - 10 ? region - 10 : frames.size() + Id3Padding;
+
+    Patch patch;
+    patch.offset = pos;
+    patch.length = region;
+    patch.data = QByteArray("ID3", 3);
+    patch.data.append(char(major));
+    patch.data.append('\0');
+    patch.data.append('\0'); // No unsynchronisation, extended header or footer
+    appendSyncsafe(patch.data, quint32(bodySize));
+    patch.data.append(frames);
+    patch.data.append(int(bodySize - frames.size()), '\0');
+    plan.patches.append(patch);
+    return true;
+}
+
+// Keeps a trailing ID3v1 tag in step, since it is read for missing fields
+void planId3v1(QFile &file, const TagEdit &edit, Plan &plan)
+{
+    if (file.size() < 128 || readAt(file, file.size() - 128, 3) != "TAG") {
+        return;
+    }
+
+    auto field = [&](int offset, const QString &value) {
+        Patch patch;
+        patch.offset = file.size() - 128 + offset;
+        patch.length = 30;
+        patch.data = value.toLatin1().left(30);
+        patch.data.append(30 - patch.data.size(), '\0');
+        plan.patches.append(patch);
+    };
+
+    if (edit.fields & TagEdit::Title) {
+        field(3, edit.title);
+    }
+    if (edit.fields & TagEdit::Artist) {
+        field(33, edit.artist);
+    }
+    if (edit.fields & TagEdit::Album) {
+        field(63, edit.album);
+    }
+}
+
+// --- FLAC ---
+
+QByteArray vorbisComment(const QByteArray &old, const TagEdit &edit)
+{
+    QByteArray vendor("Music Player");
+    QList<QByteArray> entries;
+
+    const char *p = old.constData();
+    const qint64 size = old.size();
+    if (size >= 8) {
+        const qint64 vendorSize = le32(p);
+        if (4 + vendorSize + 4 <= size) {
+            vendor = old.mid(4, int(vendorSize));
+            qint64 pos = 4 + vendorSize;
+            const quint32 count = le32(p + pos);
+            pos += 4;
+            for (quint32 i = 0; i < count && pos + 4 <= size; ++i) {
+                const qint64 len = le32(p + pos);
+                pos += 4;
+                if (pos + len > size) {
+                    break;
+                }
+                entries.append(old.mid(int(pos), int(len)));
+                pos += len;
+            }
+        }
+    }
+
+    auto replace = [&](int field, const char *key, const QString &value) {
+        if (!(edit.fields & field)) {
+            return;
+        }
+        const QByteArray prefix = QByteArray(key) + '=';
+        entries.removeIf([&](const QByteArray &entry) {
+            return entry.left(prefix.size()).toUpper() == prefix;
+        });
+        if (!value.isEmpty()) {
+            entries.append(prefix + value.toUtf8());
+        }
+    };
+    replace(TagEdit::Title, "TITLE", edit.title);
+    replace(TagEdit::Artist, "ARTIST", edit.artist);
+    replace(TagEdit::Album, "ALBUM", edit.album);
+
+    QByteArray out;
+    appendLe32(out, quint32(vendor.size()));
+    out.append(vendor);
+    appendLe32(out, quint32(entries.size()));
+    for (const QByteArray &entry : entries) {
+        appendLe32(out, quint32(entry.size()));
+        out.append(entry);
+    }
+    return out;
+}
+
+void appendFlacBlock(QByteArray &out, int type, const QByteArray &data)
+{
+    out.append(char(type));
+    out.append(char((data.size() >> 16) & 0xff));
+    out.append(char((data.size() >> 8) & 0xff));
+    out.append(char(data.size() & 0xff));
+    out.append(data);
+}
+
+// Padding of exactly total bytes (headers included) as one or more PADDING blocks
+bool appendFlacPadding(QByteArray &out, qint64 total)
+{
+    const qint64 maxBlock = 0xffffff;
+    while (total > 0) {
+        if (total < 4) {
+            return false;
+        }
+        const qint64 length = std::min(total - 4, maxBlock);
+        appendFlacBlock(out, 1, QByteArray(int(length), '\0'));
+        total -= 4 + length;
+    }
+    return true;
+}
+
+// Rebuilds the metadata blocks after "fLaC" at pos with a new comment block
+bool planFlac(QFile &file, qint64 pos, const TagEdit &edit, Plan &plan)
+{
+    struct Block
+    {
+        int type;
+        QByteArray data;
+    };
+
+    QList<Block> blocks;
+    int commentIndex = -1;
+    qint64 blockPos = pos + 4;
+    bool last = false;
+    while (!last) {
+        const QByteArray header = readAt(file, blockPos, 4);
+        if (header.size() < 4) {
+            plan.error = "Truncated FLAC metadata";
+            return false;
+        }
+        last = uchar(header.at(0)) & 0x80;
+        const int type = uchar(header.at(0)) & 0x7f;
+        const qint64 length = be24(header.constData() + 1);
+        if (blockPos - pos > MaxTagRegion) {
+            plan.error = "FLAC metadata is too large";
+            return false;
+        }
+
+        if (type != 1) {
+            const QByteArray data = readAt(file, blockPos + 4, length);
+            if (data.size() < length) {
+                plan.error = "Truncated FLAC metadata";
+                return false;
+            }
+            if (type == 4 && commentIndex < 0) {
+                commentIndex = blocks.size();
+            }
+            blocks.append({type, data});
+        }
+        blockPos += 4 + length;
+    }
+
+    if (blocks.isEmpty() || blocks.first().type != 0) {
+        plan.error = "FLAC file without STREAMINFO";
+        return false;
+    }
+
+    const QByteArray comment = vorbisComment(commentIndex >= 0 ? blocks.at(commentIndex).data : QByteArray(), edit);
+    if (comment.size() > 0xffffff) {
+        plan.error = "Vorbis comment is too large";
+        return false;
+    }
+    if (commentIndex >= 0) {
+        blocks[commentIndex].data = comment;
+    } else {
+        blocks.insert(1, {4, comment});
+    }
+
+    QByteArray metadata;
+    for (const Block &block : blocks) {
+        appendFlacBlock(metadata, block.type, block.data);
+    }
+
+    // Fill the old region exactly if the padding allows it
+    const qint64 region = blockPos - (pos + 4);
+    const qint64 spare = region - metadata.size();
+    QByteArray padded = metadata;
+    if (spare < 0 || !appendFlacPadding(padded, spare)) {
+        padded = metadata;
+        appendFlacPadding(padded, FlacPadding);
+    }
+
+    // Flag the final block (padding, when there is any) as the last one
+    qint64 lastHeader = 0;
+    for (qint64 at = 0; at < padded.size(); at += 4 + be24(padded.constData() + at + 1)) {
+        lastHeader = at;
+    }
+    padded[int(lastHeader)] = char(uchar(padded.at(int(lastHeader))) | 0x80);
+
+    Patch patch;
+    patch.offset = pos + 4;
+    patch.length = region;
+    patch.data = padded;
+    plan.patches.append(patch);
+    return true;
+}
+
+// --- MP4 ---
+
+struct Mp4Atom
+{
+    qint64 offset = -1; // Of the header, within the buffer searched
+    qint64 size = 0;
+    int headerSize = 8;
+};
+
+// Finds the first child of the given type in data[begin, end)
+Mp4Atom findAtom(const QByteArray &data, qint64 begin, qint64 end, const char *type)
+{
+    for (qint64 pos = begin; pos + 8 <= end;) {
+        qint64 size = be32(data.constData() + pos);
+        int headerSize = 8;
+        if (size == 1 && pos + 16 <= end) {
+            size = qint64(be64(data.constData() + pos + 8));
+            headerSize = 16;
+        } else if (size == 0) {
+            size = end - pos;
+        }
+        if (size < headerSize || pos + size > end) {
+            break;
+        }
+        if (std::memcmp(data.constData() + pos + 4, type, 4) == 0) {
+            return {pos, size, headerSize};
+        }
+        pos += size;
+    }
+    return Mp4Atom();
+}
+
+QByteArray mp4Atom(const char *type, const QByteArray &body)
+{
+    QByteArray atom;
+    appendBe32(atom, quint32(8 + body.size()));
+    atom.append(type, 4);
+    atom.append(body);
+    return atom;
+}
+
+QByteArray mp4FreeAtom(qint64 size)
+{
+    return mp4Atom("free", QByteArray(int(size - 8), '\0'));
+}
+
+QByteArray mp4TextItem(const char *type, const QString &value)
+{
+    QByteArray data;
+    appendBe32(data, 1); // Well-known type: UTF-8
+    appendBe32(data, 0); // Locale
+    data.append(value.toUtf8());
+    return mp4Atom(type, mp4Atom("data", data));
+}
+
+QByteArray mp4Ilst(const QByteArray &old, const TagEdit &edit)
+{
+    QByteArray items;
+    for (qint64 pos = 0; pos + 8 <= old.size();) {
+        const qint64 size = be32(old.constData() + pos);
+        if (size < 8 || pos + size > old.size()) {
+            break;
+        }
+        const QByteArray type = old.mid(int(pos + 4), 4);
+        const bool replaced = ((edit.fields & TagEdit::Title) && type == "\xa9nam")
+                           || ((edit.fields & TagEdit::Artist) && type == "\xa9" "ART")
+                           || ((edit.fields & TagEdit::Album) && type == "\xa9" "alb");
+        if (!replaced) {
+            items.append(old.mid(int(pos), int(size)));
+        }
+        pos += size;
+    }
+
+    if ((edit.fields & TagEdit::Title) && !edit.title.isEmpty()) {
+        items.append(mp4TextItem("\xa9nam", edit.title));
+    }
+    if ((edit.fields & TagEdit::Artist) && !edit.artist.isEmpty()) {
+        items.append(mp4TextItem("\xa9" "ART", edit.artist));
+    }
+    if ((edit.fields & TagEdit::Album) && !edit.album.isEmpty()) {
+        items.append(mp4TextItem("\xa9" "alb", edit.album));
+    }
+    return items;
+}
+
+// Body of a container with one child replaced (or appended when absent)
+QByteArray replaceChild(const QByteArray &body, const Mp4Atom &child, const QByteArray &atom)
+{
+    if (child.offset < 0) {
+        return body + atom;
+    }
+    return body.left(int(child.offset)) + atom + body.mid(int(child.offset + child.size));
+}
+
+// New meta body with the edited ilst. A 'free' atom inside meta takes up
+// (or gives back) the size difference when it can, so meta keeps its size.
+QByteArray mp4Meta(const QByteArray &body, const TagEdit &edit)
+{
+    // ISO 'meta' is a full box with 4 bytes of version/flags; QuickTime's is not.
+    // A new one is created as a full box.
+    const bool fullBox = body.isEmpty() || (body.size() >= 8 && body.mid(4, 4) != "hdlr");
+    const qint64 begin = fullBox ? 4 : 0;
+    QByteArray result = body.isEmpty() ? QByteArray(4, '\0') : body;
+
+    const Mp4Atom hdlr = findAtom(result, begin, result.size(), "hdlr");
+    if (hdlr.offset < 0) {
+        QByteArray handler(8, '\0'); // Version/flags, pre-defined
+        handler.append("mdirappl", 8);
+        handler.append(9, '\0');
+        result.insert(int(begin), mp4Atom("hdlr", handler));
+    }
+
+    const Mp4Atom ilst = findAtom(result, begin, result.size(), "ilst");
+    const QByteArray oldItems = ilst.offset >= 0 ? result.mid(int(ilst.offset + ilst.headerSize),
+                                                              int(ilst.size - ilst.headerSize))
+                                                 : QByteArray();
+    const QByteArray newIlst = mp4Atom("ilst", mp4Ilst(oldItems, edit));
+    const qint64 delta = newIlst.size() - (ilst.offset >= 0 ? ilst.size : 0);
+    result = replaceChild(result, ilst, newIlst);
+
+    const Mp4Atom free = findAtom(result, begin, result.size(), "free");
+    if (free.offset >= 0 && delta != 0 && (free.size - delta == 0 || free.size - delta >= 8)) {
+        const QByteArray resized = free.size - delta == 0 ? QByteArray() : mp4FreeAtom(free.size - delta);
+        result = result.left(int(free.offset)) + resized + result.mid(int(free.offset + free.size));
+    }
+    return result;
+}
+
+// Adds shift to every chunk offset at or past from in the stco/co64 tables of moov
+bool shiftChunkOffsets(QByteArray &moov, qint64 begin, qint64 end, qint64 from, qint64 shift)
+{
+    for (qint64 pos = begin; pos + 8 <= end;) {
+        qint64 size = be32(moov.constData() + pos);
+        int headerSize = 8;
+        if (size == 1 && pos + 16 <= end) {
+            size = qint64(be64(moov.constData() + pos + 8));
+            headerSize = 16;
+        }
+        if (size < headerSize || pos + size > end) {
+            break;
+        }
+
+        const QByteArray type = moov.mid(int(pos + 4), 4);
+        const qint64 body = pos + headerSize;
+        if (type == "trak" || type == "mdia" || type == "minf" || type == "stbl") {
+            if (!shiftChunkOffsets(moov, body, pos + size, from, shift)) {
+                return false;
+            }
+        } else if ((type == "stco" || type == "co64") && body + 8 <= pos + size) {
+            const bool wide = type == "co64";
+            const qint64 count = be32(moov.constData() + body + 4);
+            const int entrySize = wide ? 8 : 4;
+            if (body + 8 + count * entrySize > pos + size) {
+                return false;
+            }
+            char *entry = moov.data() + body + 8;
+            for (qint64 i = 0; i < count; ++i, entry += entrySize) {
+                const qint64 offset = wide ? qint64(be64(entry)) : qint64(be32(entry));
+                if (offset < from) {
+                    continue;
+                }
+                if (wide) {
+                    qToBigEndian(quint64(offset + shift), entry);
+                } else if (offset + shift > 0xffffffffLL) {
+                    return false;
+                } else {
+                    qToBigEndian(quint32(offset + shift), entry);
+                }
+            }
+        }
+        pos += size;
+    }
+    return true;
+}
+
+bool planMp4(QFile &file, const TagEdit &edit, Plan &plan)
+{
+    // Top level: where moov is, the free space right after it, and whether any media data follows
+    qint64 moovPos = -1;
+    qint64 moovSize = 0;
+    int moovHeader = 8;
+    qint64 freeAfter = 0;
+    bool mdatAfter = false;
+    bool freeRun = false;
+
+    for (qint64 pos = 0; pos + 8 <= file.size();) {
+        const QByteArray header = readAt(file, pos, 16);
+        qint64 size = be32(header.constData());
+        int headerSize = 8;
+        if (size == 1 && header.size() >= 16) {
+            size = qint64(be64(header.constData() + 8));
+            headerSize = 16;
+        } else if (size == 0) {
+            size = file.size() - pos;
+        }
+        if (size < headerSize || pos + size > file.size()) {
+            break;
+        }
+
+        const QByteArray type = header.mid(4, 4);
+        if (type == "moov") {
+            moovPos = pos;
+            moovSize = size;
+            moovHeader = headerSize;
+            freeRun = true;
+        } else if (moovPos >= 0) {
+            if (freeRun && (type == "free" || type == "skip")) {
+                freeAfter += size;
+            } else {
+                freeRun = false;
+            }
+            if (type == "mdat") {
+                mdatAfter = true;
+            }
+        }
+        pos += size;
+    }
+
+    if (moovPos < 0) {
+        plan.error = "MP4 file without a moov atom";
+        return false;
+    }
+    if (moovSize > MaxTagRegion) {
+        plan.error = "MP4 moov atom is too large";
+        return false;
+    }
+
+    const QByteArray moovBody = readAt(file, moovPos + moovHeader, moovSize - moovHeader);
+    if (moovBody.size() < moovSize - moovHeader) {
+        plan.error = "Truncated MP4 moov atom";
+        return false;
+    }
+
+    // moov > udta > meta > ilst, created where missing
+    const Mp4Atom udta = findAtom(moovBody, 0, moovBody.size(), "udta");
+    const QByteArray udtaBody = udta.offset >= 0 ? moovBody.mid(int(udta.offset + udta.headerSize),
+                                                                int(udta.size - udta.headerSize))
+                                                 : QByteArray();
+    const Mp4Atom meta = findAtom(udtaBody, 0, udtaBody.size(), "meta");
+    const QByteArray metaBody = meta.offset >= 0 ? udtaBody.mid(int(meta.offset + meta.headerSize),
+                                                                int(meta.size - meta.headerSize))
+                                                 : QByteArray();
+
+    const QByteArray newUdta = mp4Atom("udta", replaceChild(udtaBody, meta, mp4Atom("meta", mp4Meta(metaBody, edit))));
+    QByteArray moov = mp4Atom("moov", replaceChild(moovBody, udta, newUdta));
+    const qint64 moovEnd = moov.size();
+
+    Patch patch;
+    patch.offset = moovPos;
+    const qint64 delta = moov.size() - moovSize;
+    const bool atEnd = !mdatAfter && moovPos + moovSize + freeAfter == file.size();
+
+    if (delta == 0) {
+        patch.length = moovSize;
+    } else if (atEnd) {
+        // Nothing after moov to move; the file just ends at a different place
+        patch.length = file.size() - moovPos;
+    } else if (delta <= freeAfter && (freeAfter - delta == 0 || freeAfter - delta >= 8)) {
+        patch.length = moovSize + freeAfter;
+        if (freeAfter - delta > 0) {
+            moov.append(mp4FreeAtom(freeAfter - delta));
+        }
+    } else {
+        // Everything after moov moves, so the media data offsets move with it
+        patch.length = moovSize + freeAfter;
+        moov.append(mp4FreeAtom(Mp4Padding));
+        const qint64 shift = moov.size() - patch.length;
+        if (mdatAfter && !shiftChunkOffsets(moov, 8, moovEnd, moovPos + moovSize, shift)) {
+            plan.error = "MP4 chunk offsets can't be moved";
+            return false;
+        }
+    }
+
+    patch.data = moov;
+    plan.patches.append(patch);
+    return true;
+}
+
+// --- Committing ---
+
+QByteArray journalRecord(const QString &path, qint64 oldSize, qint64 newSize, const QList<Patch> &patches)
+{
+    QByteArray record(JournalMagic, 4);
+    appendLe32(record, JournalVersion);
+    const QByteArray path8 = path.toUtf8();
+    appendLe32(record, quint32(path8.size()));
+    record.append(path8);
+    appendLe64(record, quint64(oldSize));
+    appendLe64(record, quint64(newSize));
+    appendLe32(record, quint32(patches.size()));
+    for (const Patch &patch : patches) {
+        appendLe64(record, quint64(patch.offset));
+        appendLe32(record, quint32(patch.data.size()));
+        record.append(patch.data);
+    }
+    record.append(QCryptographicHash::hash(record, QCryptographicHash::Sha1));
+    return record;
+}
+
+bool parseJournal(const QByteArray &record, QString &path, qint64 &oldSize, qint64 &newSize, QList<Patch> &patches)
+{
+    const int hashSize = 20;
+    if (record.size() < 4 + 4 + 4 + 8 + 8 + 4 + hashSize || std::memcmp(record.constData(), JournalMagic, 4) != 0) {
+        return false;
+    }
+    const QByteArray body = record.left(record.size() - hashSize);
+    if (QCryptographicHash::hash(body, QCryptographicHash::Sha1) != record.right(hashSize)) {
+        return false;
+    }
+    if (le32(body.constData() + 4) != JournalVersion) {
+        return false;
+    }
+
+    const char *p = body.constData();
+    qint64 pos = 8;
+    const qint64 pathSize = le32(p + pos);
+    pos += 4;
+    if (pos + pathSize + 20 > body.size()) {
+        return false;
+    }
+    path = QString::fromUtf8(p + pos, int(pathSize));
+    pos += pathSize;
+    oldSize = qint64(le64(p + pos));
+    newSize = qint64(le64(p + pos + 8));
+    const quint32 count = le32(p + pos + 16);
+    pos += 20;
+
+    for (quint32 i = 0; i < count; ++i) {
+        if (pos + 12 > body.size()) {
+            return false;
+        }
+        Patch patch;
+        patch.offset = qint64(le64(p + pos));
+        const qint64 size = le32(p + pos + 8);
+        pos += 12;
+        if (pos + size > body.size()) {
+            return false;
+        }
+        patch.data = body.mid(int(pos), int(size));
+        patch.length = size;
+        pos += size;
+        patches.append(patch);
+    }
+    return true;
+}
+
+bool applyInPlace(const QString &path, qint64 newSize, const QList<Patch> &patches)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+    for (const Patch &patch : patches) {
+        if (!file.seek(patch.offset) || file.write(patch.data) != patch.data.size()) {
+            return false;
+        }
+    }
+    if (file.size() != newSize && !file.resize(newSize)) {
+        return false;
+    }
+    return syncToDisk(file);
+}
+
+// Same-size patches (plus one running to the end of the file) only touch
+// those bytes: the new bytes are journaled, written and synced, then the
+// journal is removed
+bool writeInPlace(QFile &source, const QList<Patch> &patches, qint64 newSize, QString &error)
+{
+    const QString path = source.fileName();
+    const qint64 oldSize = source.size();
+    source.close();
+
+    const QString directory = journalDirectory();
+    QDir().mkpath(directory);
+    const QString journalPath = directory + "/" + QUuid::createUuid().toString(QUuid::WithoutBraces) + ".journal";
+
+    QSaveFile journal(journalPath);
+    if (!journal.open(QIODevice::WriteOnly) || journal.write(journalRecord(path, oldSize, newSize, patches)) < 0
+        || !journal.commit()) {
+        error = "Could not write the tag journal";
+        return false;
+    }
+
+    const bool ok = applyInPlace(path, newSize, patches);
+    if (ok) {
+        QFile::remove(journalPath);
+    } else {
+        // The journal still holds the edit; the next start replays it
+        error = "Could not write the file";
+    }
+    return ok;
+}
+
+// Anything else copies the file with the patches applied and swaps it in atomically
+bool rewrite(QFile &source, const QList<Patch> &patches, QString &error)
+{
+    QSaveFile target(source.fileName());
+    if (!target.open(QIODevice::WriteOnly)) {
+        error = "Could not create the rewritten file";
+        return false;
+    }
+
+    std::vector<char> buffer(size_t(CopyChunk));
+    auto copy = [&](qint64 from, qint64 to) {
+        if (!source.seek(from)) {
+            return false;
+        }
+        while (from < to) {
+            const qint64 got = source.read(buffer.data(), std::min(CopyChunk, to - from));
+            if (got <= 0 || target.write(buffer.data(), got) != got) {
+                return false;
+            }
+            from += got;
+        }
+        return true;
+    };
+
+    qint64 pos = 0;
+    for (const Patch &patch : patches) {
+        if (!copy(pos, patch.offset) || target.write(patch.data) != patch.data.size()) {
+            error = "Could not write the file";
+            target.cancelWriting();
+            return false;
+        }
+        pos = patch.offset + patch.length;
+    }
+    if (!copy(pos, source.size())) {
+        error = "Could not write the file";
+        target.cancelWriting();
+        return false;
+    }
+
+    source.close();
+    if (!target.commit()) {
+        error = "Could not replace the file";
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+namespace TagWriter {
+
+TagWriteResult write(const TagEdit &edit)
+{
+    TRACE_SCOPE_ARG("tags", "TagWriter::write", edit.path);
+
+    TagWriteResult result;
+    result.path = edit.path;
+
+    QFile file(edit.path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        result.error = file.errorString();
+        return result;
+    }
+
+    Plan plan;
+    bool planned = false;
+    const QByteArray magic = readAt(file, 0, 12);
+
+    if (magic.startsWith("OggS")) {
+        plan.error = "Writing Ogg comments isn't supported";
+    } else if (magic.startsWith("RIFF")) {
+        plan.error = "Writing WAV tags isn't supported";
+    } else if (magic.mid(4, 4) == "ftyp") {
+        planned = planMp4(file, edit, plan);
+    } else {
+        // Like the reader: an optional ID3v2 tag, then FLAC or MPEG audio
+        const bool hasId3 = magic.startsWith("ID3");
+        qint64 audioStart = 0;
+        if (hasId3 && magic.size() >= 10) {
+            audioStart = 10 + syncsafe(magic.constData() + 6) + ((uchar(magic.at(5)) & 0x10) ? 10 : 0);
+        }
+
+        if (readAt(file, audioStart, 4) == "fLaC") {
+            planned = planFlac(file, audioStart, edit, plan) && (!hasId3 || planId3v2(file, 0, edit, plan));
+        } else if (hasId3 || QFileInfo(edit.path).suffix().compare("mp3", Qt::CaseInsensitive) == 0) {
+            planned = planId3v2(file, 0, edit, plan);
+            if (planned) {
+                planId3v1(file, edit, plan);
+            }
+        } else {
+            plan.error = "Unsupported file type";
+        }
+    }
+
+    if (!planned) {
+        result.error = plan.error;
+        return result;
+    }
+
+    std::sort(plan.patches.begin(), plan.patches.end(), [](const Patch &a, const Patch &b) {
+        return a.offset < b.offset;
+    });
+
+    // In place if nothing moves: every patch keeps its size, except one that runs to the end
+    qint64 newSize = file.size();
+    bool inPlace = true;
+    for (const Patch &patch : plan.patches) {
+        if (patch.data.size() == patch.length) {
+            continue;
+        }
+        if (patch.offset + patch.length == file.size()) {
+            newSize = patch.offset + patch.data.size();
+        } else {
+            inPlace = false;
+        }
+    }
+
+    result.ok = inPlace ? writeInPlace(file, plan.patches, newSize, result.error)
+                        : rewrite(file, plan.patches, result.error);
+    result.inPlace = inPlace;
+    if (result.ok) {
+        result.track = TagReader::readTrack(edit.path);
+    }
+    return result;
+}
+
+int recoverJournal()
+{
+    const QDir directory(journalDirectory());
+    int recovered = 0;
+
+    for (const QFileInfo &entry : directory.entryInfoList({"*.journal"}, QDir::Files)) {
+        QFile journal(entry.filePath());
+        QString path;
+        qint64 oldSize = 0;
+        qint64 newSize = 0;
+        QList<Patch> patches;
+
+        // A journal that doesn't verify was never committed, so its edit never started
+        if (journal.open(QIODevice::ReadOnly) && parseJournal(journal.readAll(), path, oldSize, newSize, patches)) {
+            journal.close();
+
+            // Replaying is idempotent; skip files someone else has changed since
+            const qint64 size = QFileInfo(path).size();
+            if ((size == oldSize || size == newSize) && applyInPlace(path, newSize, patches)) {
+                ++recovered;
+            } else if (size == oldSize || size == newSize) {
+                continue; // Keep it for the next start
+            }
+        }
+        journal.close();
+        QFile::remove(entry.filePath());
+    }
+    return recovered;
+}
+
+} // namespace TagWriter
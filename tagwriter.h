@@ -0,0 +1,55 @@
+#ifndef TAGWRITER_H
+#define TAGWRITER_H
+
+#include <QString>
+#include "tagreader.h"
+
+// Tag changes for one file; only the fields flagged in fields are written,
+// and an empty value removes the field
+struct TagEdit
+{
+    enum Field {
+        Title = 0x1,
+        Artist = 0x2,
+        Album = 0x4
+    };
+
+    QString path;
+    int fields = 0;
+    QString title;
+    QString artist;
+    QString album;
+};
+
+struct TagWriteResult
+{
+    QString path;
+    bool ok = false;
+    bool inPlace = false; // Only the tag region was rewritten
+    QString error;
+    TrackInfo track;      // Read back after writing
+};
+
+// Writes title, artist and album into the tags TagReader reads: ID3v2
+// (MP3, and in front of FLAC), FLAC Vorbis comments and MP4 ilst items.
+// All other frames, blocks and atoms are kept byte for byte.
+//
+// When the new tag fits in the space the old one had (using its padding,
+// FLAC PADDING blocks or MP4 'free' atoms), only that region is
+// overwritten, so editing a large file costs a few KB of I/O. Those writes
+// go through a redo journal: the new bytes are committed to a journal
+// file first and replayed by recoverJournal() if the write is
+// interrupted. Otherwise the file is rewritten with fresh padding through
+// QSaveFile, which replaces it atomically; MP4 chunk offsets are shifted
+// when the audio moves. Reentrant; meant to be mapped over many files on
+// worker threads.
+namespace TagWriter {
+
+TagWriteResult write(const TagEdit &edit);
+
+// Finishes in-place writes left behind by a crash; returns the number replayed
+int recoverJournal();
+
+} // namespace TagWriter
+
+#endif // TAGWRITER_H
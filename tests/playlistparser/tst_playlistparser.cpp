@@ -0,0 +1,60 @@
+#include <QTemporaryDir>
+#include <QtTest>
+#include "playlistparser.h"
+
+// Writes each format and reads it back; the paths and titles must come
+// back unchanged, including characters that are special in XML or URLs
+class PlaylistParserTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void roundTrip_data();
+    void roundTrip();
+};
+
+void PlaylistParserTest::roundTrip_data()
+{
+    QTest::addColumn<QString>("format");
+
+    QTest::newRow("m3u") << QStringLiteral("m3u");
+    QTest::newRow("pls") << QStringLiteral("pls");
+    QTest::newRow("xspf") << QStringLiteral("xspf");
+}
+
+void PlaylistParserTest::roundTrip()
+{
+    QFETCH(QString, format);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QList<PlaylistEntry> entries;
+    entries.append({dir.filePath("Simon & Garfunkel/01 The Boxer.mp3"), "Simon & Garfunkel - The Boxer", 308000});
+    entries.append({dir.filePath("<Various>/It's \"Quoted\" #1 100%.flac"), "It's <Quoted>", -1});
+    entries.append({dir.filePath("Sigur Rós/Hoppípolla.ogg"), QString(), 268000});
+
+    const QString fileName = dir.filePath("playlist." + format);
+    QVERIFY(PlaylistParser::write(fileName, entries));
+
+    QFuture<QList<PlaylistEntry>> future = PlaylistParser::parseAsync(fileName);
+    future.waitForFinished();
+    QList<PlaylistEntry> parsed;
+    for (const QList<PlaylistEntry> &chunk : future.results()) {
+        parsed.append(chunk);
+    }
+
+    QCOMPARE(parsed.size(), entries.size());
+    for (int i = 0; i < entries.size(); ++i) {
+        QCOMPARE(parsed.at(i).path, entries.at(i).path);
+        QCOMPARE(parsed.at(i).title, entries.at(i).title);
+        // M3U and PLS store whole seconds
+        const qint64 duration = format == QLatin1String("xspf") || entries.at(i).duration < 0
+                ? entries.at(i).duration : entries.at(i).duration / 1000 * 1000;
+        QCOMPARE(parsed.at(i).duration, duration);
+    }
+}
+
+QTEST_GUILESS_MAIN(PlaylistParserTest)
+
+#include "tst_playlistparser.moc"
@@ -0,0 +1,11 @@
+QT += core gui multimedia concurrent testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_tagwriter
+
+include(../../core.pri)
+
+SOURCES += \
+    tst_tagwriter.cpp
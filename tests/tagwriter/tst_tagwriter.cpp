@@ -0,0 +1,400 @@
+#include <QCryptographicHash>
+#include <QDir>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QtTest>
+#include <cstring>
+#include "tagreader.h"
+#include "tagwriter.h"
+
+using namespace TagReader::detail;
+
+namespace {
+
+QByteArray putBe32(quint32 value)
+{
+    char bytes[4];
+    qToBigEndian(value, bytes);
+    return QByteArray(bytes, 4);
+}
+
+QByteArray putBe64(quint64 value)
+{
+    char bytes[8];
+    qToBigEndian(value, bytes);
+    return QByteArray(bytes, 8);
+}
+
+QByteArray putLe32(quint32 value)
+{
+    char bytes[4];
+    qToLittleEndian(value, bytes);
+    return QByteArray(bytes, 4);
+}
+
+QByteArray putLe64(quint64 value)
+{
+    char bytes[8];
+    qToLittleEndian(value, bytes);
+    return QByteArray(bytes, 8);
+}
+
+QByteArray putSyncsafe(quint32 value)
+{
+    QByteArray out;
+    for (int shift = 21; shift >= 0; shift -= 7) {
+        out.append(char((value >> shift) & 0x7f));
+    }
+    return out;
+}
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+QByteArray readFile(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+QString journalDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/tag-journal";
+}
+
+// Twenty 128 kbit/s MPEG-1 Layer III frames, so every file has audio the
+// tags must not touch and MP3 files have a duration
+QByteArray audio()
+{
+    QByteArray data;
+    for (int frame = 0; frame < 20; ++frame) {
+        data.append("\xff\xfb\x90\x00", 4);
+        for (int i = 4; i < 417; ++i) {
+            data.append(char((frame * 31 + i * 7) & 0x7f));
+        }
+    }
+    return data;
+}
+
+// --- Generated files: title, artist, album and genre, with room to spare ---
+
+QByteArray id3Frame(const char *id, const QString &value)
+{
+    const QByteArray payload = char(3) + value.toUtf8(); // UTF-8
+    return QByteArray(id, 4) + putSyncsafe(quint32(payload.size())) + QByteArray(2, '\0') + payload;
+}
+
+QByteArray mp3File()
+{
+    const int padding = 256;
+    const QByteArray frames = id3Frame("TIT2", "Old Title") + id3Frame("TPE1", "Old Artist")
+                            + id3Frame("TALB", "Old Album") + id3Frame("TCON", "Jazz");
+    return QByteArray("ID3\x04\x00\x00", 6) + putSyncsafe(quint32(frames.size() + padding)) + frames
+         + QByteArray(padding, '\0') + audio();
+}
+
+QByteArray flacBlock(int type, const QByteArray &data, bool last = false)
+{
+    return char(type | (last ? 0x80 : 0)) + putBe32(quint32(data.size())).mid(1) + data;
+}
+
+QByteArray flacFile()
+{
+    // 44.1 kHz, stereo, 16 bits, 132300 samples: three seconds
+    QByteArray streamInfo(34, '\0');
+    streamInfo[10] = char(0x0a);
+    streamInfo[11] = char(0xc4);
+    streamInfo[12] = char(0x42);
+    streamInfo[13] = char(0xf0);
+    streamInfo.replace(14, 4, putBe32(132300));
+
+    const QList<QByteArray> entries = {"TITLE=Old Title", "ARTIST=Old Artist", "ALBUM=Old Album", "GENRE=Jazz"};
+    QByteArray comment = putLe32(4) + "test" + putLe32(quint32(entries.size()));
+    for (const QByteArray &entry : entries) {
+        comment += putLe32(quint32(entry.size())) + entry;
+    }
+
+    return "fLaC" + flacBlock(0, streamInfo) + flacBlock(4, comment) + flacBlock(1, QByteArray(512, '\0'), true)
+         + audio();
+}
+
+QByteArray atom(const char *type, const QByteArray &body)
+{
+    return putBe32(quint32(8 + body.size())) + QByteArray(type, 4) + body;
+}
+
+QByteArray mp4Item(const char *type, const QString &value)
+{
+    return atom(type, atom("data", putBe32(1) + putBe32(0) + value.toUtf8()));
+}
+
+QByteArray mp4Moov(const QList<quint64> &offsets, bool wide)
+{
+    QByteArray mvhd(100, '\0');
+    mvhd.replace(12, 4, putBe32(1000)); // Timescale
+    mvhd.replace(16, 4, putBe32(3000)); // Three seconds
+
+    QByteArray table = putBe32(0) + putBe32(quint32(offsets.size()));
+    for (const quint64 offset : offsets) {
+        table += wide ? putBe64(offset) : putBe32(quint32(offset));
+    }
+    const QByteArray trak = atom("trak", atom("mdia", atom("minf", atom("stbl", atom(wide ? "co64" : "stco", table)))));
+
+    const QByteArray handler = QByteArray(8, '\0') + "mdirappl" + QByteArray(9, '\0');
+    const QByteArray ilst = atom("ilst", mp4Item("\xa9nam", "Old Title") + mp4Item("\xa9" "ART", "Old Artist")
+                                         + mp4Item("\xa9" "alb", "Old Album") + mp4Item("\xa9gen", "Jazz"));
+    const QByteArray meta = atom("meta", QByteArray(4, '\0') + atom("hdlr", handler) + ilst
+                                         + atom("free", QByteArray(248, '\0')));
+
+    return atom("moov", atom("mvhd", mvhd) + trak + atom("udta", meta));
+}
+
+// moov before mdat, which holds the audio as four chunks
+QByteArray mp4File(bool wide)
+{
+    const QByteArray ftyp = atom("ftyp", QByteArray("M4A ") + putBe32(0) + "M4A isom");
+    const QByteArray data = audio();
+    const int chunk = data.size() / 4;
+
+    // The offsets don't change the size of moov, so a first layout finds mdat
+    const qint64 mdatBody = ftyp.size() + mp4Moov(QList<quint64>(4, 0), wide).size() + 8;
+    QList<quint64> offsets;
+    for (int i = 0; i < 4; ++i) {
+        offsets.append(quint64(mdatBody + i * chunk));
+    }
+    return ftyp + mp4Moov(offsets, wide) + atom("mdat", data);
+}
+
+// --- Reading the results back ---
+
+struct Range
+{
+    qint64 begin = 0;
+    qint64 end = 0;
+};
+
+// Body of the first child atom of the given type, or an empty range
+Range findChild(const QByteArray &data, Range parent, const char *type)
+{
+    for (qint64 pos = parent.begin; pos + 8 <= parent.end;) {
+        const qint64 size = be32(data.constData() + pos);
+        if (size < 8 || pos + size > parent.end) {
+            break;
+        }
+        if (std::memcmp(data.constData() + pos + 4, type, 4) == 0) {
+            return {pos + 8, pos + size};
+        }
+        pos += size;
+    }
+    return Range();
+}
+
+QList<quint64> chunkOffsets(const QByteArray &data)
+{
+    Range range{0, data.size()};
+    for (const char *type : {"moov", "trak", "mdia", "minf", "stbl"}) {
+        range = findChild(data, range, type);
+    }
+    bool wide = false;
+    Range table = findChild(data, range, "stco");
+    if (table.end == 0) {
+        table = findChild(data, range, "co64");
+        wide = true;
+    }
+
+    QList<quint64> offsets;
+    if (table.end - table.begin < 8) {
+        return offsets;
+    }
+    const char *entry = data.constData() + table.begin + 8;
+    const quint32 count = be32(data.constData() + table.begin + 4);
+    for (quint32 i = 0; i < count; ++i, entry += wide ? 8 : 4) {
+        offsets.append(wide ? be64(entry) : be32(entry));
+    }
+    return offsets;
+}
+
+// Where the audio starts: after the ID3v2 tag, after the last FLAC
+// metadata block, or at the body of mdat
+qint64 audioStart(const QByteArray &data)
+{
+    if (data.mid(4, 4) == "ftyp") {
+        return findChild(data, {0, data.size()}, "mdat").begin;
+    }
+
+    qint64 pos = data.startsWith("ID3") ? 10 + syncsafe(data.constData() + 6) : 0;
+    if (data.mid(pos, 4) == "fLaC") {
+        pos += 4;
+        bool last = false;
+        while (!last && pos + 4 <= data.size()) {
+            last = uchar(data.at(pos)) & 0x80;
+            pos += 4 + be24(data.constData() + pos + 1);
+        }
+    }
+    return pos;
+}
+
+// A journal record as TagWriter commits it before an in-place write
+QByteArray journalRecord(const QString &path, qint64 size, qint64 offset, const QByteArray &data)
+{
+    const QByteArray path8 = path.toUtf8();
+    const QByteArray record = "MPTJ" + putLe32(1) + putLe32(quint32(path8.size())) + path8 + putLe64(quint64(size))
+                            + putLe64(quint64(size)) + putLe32(1) + putLe64(quint64(offset))
+                            + putLe32(quint32(data.size())) + data;
+    return record + QCryptographicHash::hash(record, QCryptographicHash::Sha1);
+}
+
+} // namespace
+
+// Writes tags into generated MP3, FLAC and MP4 files, both into the
+// existing padding and past it, and reads them back with TagReader; the
+// audio and what the MP4 chunk offsets point at must not change. Also
+// replays the journal an interrupted in-place write leaves behind.
+class TagWriterTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void write_data();
+    void write();
+    void recoverJournal();
+    void discardCorruptJournal();
+};
+
+void TagWriterTest::initTestCase()
+{
+    // Keeps the journal out of the user's own application data
+    QStandardPaths::setTestModeEnabled(true);
+    QDir(journalDirectory()).removeRecursively();
+    QVERIFY(QDir().mkpath(journalDirectory()));
+}
+
+void TagWriterTest::write_data()
+{
+    QTest::addColumn<QString>("format");
+    QTest::addColumn<bool>("wide");
+    QTest::addColumn<bool>("grow");
+
+    QTest::newRow("mp3 in place") << QStringLiteral("mp3") << false << false;
+    QTest::newRow("mp3 grown") << QStringLiteral("mp3") << false << true;
+    QTest::newRow("flac in place") << QStringLiteral("flac") << false << false;
+    QTest::newRow("flac grown") << QStringLiteral("flac") << false << true;
+    QTest::newRow("mp4 in place") << QStringLiteral("m4a") << false << false;
+    QTest::newRow("mp4 grown") << QStringLiteral("m4a") << false << true;
+    QTest::newRow("mp4 co64 grown") << QStringLiteral("m4a") << true << true;
+}
+
+void TagWriterTest::write()
+{
+    QFETCH(QString, format);
+    QFETCH(bool, wide);
+    QFETCH(bool, grow);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const QString path = dir.filePath("track." + format);
+    const QByteArray original = format == QLatin1String("mp3") ? mp3File()
+                              : format == QLatin1String("flac") ? flacFile()
+                                                                : mp4File(wide);
+    QVERIFY(writeFile(path, original));
+
+    const TrackInfo before = TagReader::readTrack(path);
+    QCOMPARE(before.title, QStringLiteral("Old Title"));
+    QVERIFY(before.duration > 0);
+
+    TagEdit edit;
+    edit.path = path;
+    edit.fields = TagEdit::Title | TagEdit::Artist;
+    edit.title = grow ? QStringLiteral("A Title Longer Than The Padding ").repeated(20) : QStringLiteral("Hoppípolla");
+    edit.artist = QStringLiteral("Sigur Rós");
+
+    const TagWriteResult result = TagWriter::write(edit);
+    QVERIFY2(result.ok, qPrintable(result.error));
+    QCOMPARE(result.inPlace, !grow);
+
+    const TrackInfo track = TagReader::readTrack(path);
+    QCOMPARE(track.title, edit.title);
+    QCOMPARE(track.artist, edit.artist);
+    QCOMPARE(track.album, QStringLiteral("Old Album"));
+    QCOMPARE(track.genre, QStringLiteral("Jazz"));
+    QCOMPARE(track.duration, before.duration);
+
+    const QByteArray written = readFile(path);
+    if (!grow) {
+        QCOMPARE(written.size(), original.size());
+    }
+    QCOMPARE(written.mid(audioStart(written)), audio());
+
+    const QList<quint64> oldOffsets = chunkOffsets(original);
+    const QList<quint64> newOffsets = chunkOffsets(written);
+    QCOMPARE(newOffsets.size(), oldOffsets.size());
+    if (!grow) {
+        QCOMPARE(newOffsets, oldOffsets);
+    }
+    // Moved or not, every chunk offset still points at the same audio
+    for (int i = 0; i < newOffsets.size(); ++i) {
+        QCOMPARE(written.mid(qsizetype(newOffsets.at(i)), 64), original.mid(qsizetype(oldOffsets.at(i)), 64));
+    }
+}
+
+void TagWriterTest::recoverJournal()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const QByteArray original = mp3File();
+    const QString edited = dir.filePath("edited.mp3");
+    const QString interrupted = dir.filePath("interrupted.mp3");
+    QVERIFY(writeFile(edited, original));
+
+    // The bytes a finished in-place write leaves
+    TagEdit edit;
+    edit.path = edited;
+    edit.fields = TagEdit::Title;
+    edit.title = QStringLiteral("Hoppípolla");
+    const TagWriteResult result = TagWriter::write(edit);
+    QVERIFY2(result.ok, qPrintable(result.error));
+    QVERIFY(result.inPlace);
+    const QByteArray expected = readFile(edited);
+    const qint64 tagSize = audioStart(expected);
+
+    // Interrupted after the journal was committed and half the tag was written
+    QByteArray torn = original;
+    torn.replace(0, tagSize / 2, expected.left(tagSize / 2));
+    QVERIFY(writeFile(interrupted, torn));
+    QVERIFY(writeFile(journalDirectory() + "/interrupted.journal",
+                      journalRecord(interrupted, original.size(), 0, expected.left(tagSize))));
+
+    QCOMPARE(TagWriter::recoverJournal(), 1);
+    QCOMPARE(readFile(interrupted), expected);
+    QCOMPARE(TagReader::readTrack(interrupted).title, edit.title);
+    QVERIFY(QDir(journalDirectory()).isEmpty());
+}
+
+void TagWriterTest::discardCorruptJournal()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const QByteArray original = mp3File();
+    const QString path = dir.filePath("track.mp3");
+    QVERIFY(writeFile(path, original));
+
+    // A record whose checksum fails was never committed, so it is dropped unapplied
+    QByteArray record = journalRecord(path, original.size(), 0, QByteArray(64, 'x'));
+    record[record.size() - 30] = char(record.at(record.size() - 30) ^ 1);
+    QVERIFY(writeFile(journalDirectory() + "/corrupt.journal", record));
+
+    QCOMPARE(TagWriter::recoverJournal(), 0);
+    QCOMPARE(readFile(path), original);
+    QVERIFY(QDir(journalDirectory()).isEmpty());
+}
+
+QTEST_GUILESS_MAIN(TagWriterTest)
+
+#include "tst_tagwriter.moc"
@@ -0,0 +1,6 @@
+TEMPLATE = subdirs
+
+# One executable per test; make check runs them all
+SUBDIRS += \
+    playlistparser \
+    tagwriter
@@ -0,0 +1,225 @@
+#include "trace.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QThread>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// Per thread; about 1 MB once a thread records its first event
+const int RingCapacity = 1 << 14;
+
+struct Event
+{
+    const char *category = nullptr;
+    const char *name = nullptr;
+    qint64 start = 0;    // ns since the trace clock started
+    qint64 duration = 0; // ns
+    QString arg;
+    char phase = 'X';
+};
+
+struct Ring
+{
+    // Only ever contended while a dump copies the ring
+    QMutex mutex;
+    std::vector<Event> events;
+    qint64 written = 0;
+    int threadId = 0;
+    QString threadName;
+};
+
+struct Registry
+{
+    Registry() { clock.start(); }
+
+    QMutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings; // Kept after their thread ends
+    QElapsedTimer clock;
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+thread_local Ring *localRing = nullptr;
+
+Ring *ringForThisThread()
+{
+    if (localRing) {
+        return localRing;
+    }
+
+    auto ring = std::make_unique<Ring>();
+    ring->events.resize(RingCapacity);
+
+    QThread *thread = QThread::currentThread();
+    QCoreApplication *app = QCoreApplication::instance();
+    if (app && app->thread() == thread) {
+        ring->threadName = QStringLiteral("GUI");
+    } else {
+        ring->threadName = thread->objectName();
+    }
+
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+    ring->threadId = int(r.rings.size()) + 1;
+    if (ring->threadName.isEmpty()) {
+        ring->threadName = QStringLiteral("Thread %1").arg(ring->threadId);
+    }
+    localRing = ring.get();
+    r.rings.push_back(std::move(ring));
+    return localRing;
+}
+
+void appendEscaped(QByteArray &out, const QByteArray &value)
+{
+    for (const char c : value) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        default:
+            if (uchar(c) < 0x20) {
+                out += "\\u00";
+                out += "0123456789abcdef"[(c >> 4) & 0xf];
+                out += "0123456789abcdef"[c & 0xf];
+            } else {
+                out += c;
+            }
+            break;
+        }
+    }
+}
+
+void appendMicroseconds(QByteArray &out, qint64 nanoseconds)
+{
+    out += QByteArray::number(nanoseconds / 1000);
+    out += '.';
+    out += QByteArray::number(nanoseconds % 1000).rightJustified(3, '0');
+}
+
+} // namespace
+
+namespace Trace {
+
+namespace detail {
+
+std::atomic<bool> enabled(false);
+
+qint64 now()
+{
+    return registry().clock.nsecsElapsed();
+}
+
+void record(const char *category, const char *name, char phase, qint64 start, qint64 duration, const QString &arg)
+{
+    Ring *ring = ringForThisThread();
+    QMutexLocker locker(&ring->mutex);
+
+    Event &event = ring->events[size_t(ring->written % RingCapacity)];
+    event.category = category;
+    event.name = name;
+    event.start = start;
+    event.duration = duration;
+    event.arg = arg;
+    event.phase = phase;
+    ++ring->written;
+}
+
+} // namespace detail
+
+void setEnabled(bool enabled)
+{
+    detail::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void clear()
+{
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+    for (const std::unique_ptr<Ring> &ring : r.rings) {
+        QMutexLocker ringLocker(&ring->mutex);
+        ring->written = 0;
+    }
+}
+
+bool writeChromeJson(const QString &fileName)
+{
+    QByteArray out;
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+
+    auto beginEvent = [&]() {
+        out += first ? "\n{" : ",\n{";
+        first = false;
+    };
+
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+    for (const std::unique_ptr<Ring> &ring : r.rings) {
+        // Copy under the ring's lock so its thread is held up for as short a time as possible
+        std::vector<Event> events;
+        {
+            QMutexLocker ringLocker(&ring->mutex);
+            const qint64 count = std::min<qint64>(ring->written, RingCapacity);
+            events.reserve(size_t(count));
+            for (qint64 i = ring->written - count; i < ring->written; ++i) {
+                events.push_back(ring->events[size_t(i % RingCapacity)]);
+            }
+        }
+
+        const QByteArray tid = QByteArray::number(ring->threadId);
+        beginEvent();
+        out += "\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid + ",\"args\":{\"name\":\"";
+        appendEscaped(out, ring->threadName.toUtf8());
+        out += "\"}}";
+
+        for (const Event &event : events) {
+            beginEvent();
+            out += "\"name\":\"";
+            appendEscaped(out, event.name);
+            out += "\",\"cat\":\"";
+            appendEscaped(out, event.category);
+            out += "\",\"ph\":\"";
+            out += event.phase;
+            out += "\",\"ts\":";
+            appendMicroseconds(out, event.start);
+            if (event.phase == 'X') {
+                out += ",\"dur\":";
+                appendMicroseconds(out, event.duration);
+            } else {
+                out += ",\"s\":\"t\"";
+            }
+            out += ",\"pid\":1,\"tid\":" + tid;
+            if (!event.arg.isEmpty()) {
+                out += ",\"args\":{\"detail\":\"";
+                appendEscaped(out, event.arg.toUtf8());
+                out += "\"}";
+            }
+            out += '}';
+        }
+    }
+    locker.unlock();
+
+    out += "\n]}\n";
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(out);
+    return file.commit();
+}
+
+} // namespace Trace
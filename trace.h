@@ -0,0 +1,105 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+
+// Scoped trace points for finding where time goes, e.g. from a double-click
+// to the first audible sample, or which files dominate a library scan.
+//
+//     TRACE_SCOPE("engine", "setSource");
+//     TRACE_SCOPE_ARG("scan", "readTrack", path);
+//     TRACE_INSTANT("audio", "first buffer");
+//
+// Events go to a fixed-size ring per thread (the oldest are overwritten)
+// and are only collected when writeChromeJson() is called; the output
+// loads in chrome://tracing and ui.perfetto.dev. Names and categories
+// must be string literals, since only the pointers are stored.
+//
+// Tracing is compiled in when PLAYER_TRACING is defined (core.pri does so
+// unless CONFIG += notrace) and starts disabled. A disabled trace point
+// costs one relaxed atomic load; argument strings aren't even built.
+namespace Trace {
+
+namespace detail {
+extern std::atomic<bool> enabled;
+qint64 now();
+void record(const char *category, const char *name, char phase, qint64 start, qint64 duration, const QString &arg);
+} // namespace detail
+
+inline bool isEnabled()
+{
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+void setEnabled(bool enabled);
+
+// Drops everything recorded so far
+void clear();
+
+// Writes every thread's events as Chrome trace-event JSON
+bool writeChromeJson(const QString &fileName);
+
+// Records a complete ("X") event covering its own lifetime
+class Scope
+{
+public:
+    Scope(const char *category, const char *name)
+        : category(category),
+          name(name),
+          start(isEnabled() ? detail::now() : -1)
+    {
+    }
+
+    ~Scope()
+    {
+        if (start >= 0) {
+            detail::record(category, name, 'X', start, detail::now() - start, arg);
+        }
+    }
+
+    bool isActive() const { return start >= 0; }
+    void setArg(const QString &value) { arg = value; }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    const char *category;
+    const char *name;
+    const qint64 start;
+    QString arg;
+};
+
+inline void instant(const char *category, const char *name, const QString &arg = QString())
+{
+    if (isEnabled()) {
+        detail::record(category, name, 'i', detail::now(), 0, arg);
+    }
+}
+
+} // namespace Trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef PLAYER_TRACING
+#define TRACE_SCOPE(category, name) \
+    Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(category, name)
+#define TRACE_SCOPE_ARG(category, name, value) \
+    Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(category, name); \
+    if (TRACE_CONCAT(traceScope, __LINE__).isActive()) \
+        TRACE_CONCAT(traceScope, __LINE__).setArg(value)
+#define TRACE_INSTANT(category, name) \
+    do { if (Trace::isEnabled()) Trace::instant(category, name); } while (false)
+#define TRACE_INSTANT_ARG(category, name, value) \
+    do { if (Trace::isEnabled()) Trace::instant(category, name, value); } while (false)
+#else
+#define TRACE_SCOPE(category, name) do { } while (false)
+#define TRACE_SCOPE_ARG(category, name, value) do { } while (false)
+#define TRACE_INSTANT(category, name) do { } while (false)
+#define TRACE_INSTANT_ARG(category, name, value) do { } while (false)
+#endif
+
+#endif // TRACE_H
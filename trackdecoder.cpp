@@ -0,0 +1,356 @@
+#include "trackdecoder.h"
+#include "trace.h"
+#include <QAudioFormat>
+#include <QEventLoop>
+#include <QUrl>
+#include <algorithm>
+#include <cmath>
+
+PcmBuffer::PcmBuffer(int sampleRate, int channelCount)
+    : rate(sampleRate),
+      channels(channelCount),
+      capacity(qint64(LookAheadSeconds + HistorySeconds) * sampleRate),
+      ring(size_t(capacity * channelCount)),
+      frames(0),
+      readFrame(0),
+      finished(false)
+{
+}
+
+qint64 PcmBuffer::append(const qint16 *data, qint64 frameCount)
+{
+    // Frames more than HistorySeconds behind the reader are free; the
+    // reader's older positions only make this more conservative
+    const qint64 written = frames.load(std::memory_order_relaxed);
+    const qint64 limit = readFrame.load(std::memory_order_acquire) + capacity - qint64(HistorySeconds) * rate;
+    const qint64 count = std::clamp<qint64>(limit - written, 0, frameCount);
+
+    // In two pieces where the ring wraps
+    for (qint64 done = 0; done < count;) {
+        const qint64 slot = (written + done) % capacity;
+        const qint64 piece = std::min(count - done, capacity - slot);
+        std::copy_n(data + done * channels, piece * channels, ring.data() + slot * channels);
+        done += piece;
+    }
+    frames.store(written + count, std::memory_order_release);
+    return count;
+}
+
+void PcmBuffer::finish()
+{
+    finished.store(true, std::memory_order_release);
+}
+
+qint64 PcmBuffer::read(qint64 frame, qint16 *out, qint64 frameCount)
+{
+    // Published before the copy, so the writer keeps off these frames
+    readFrame.store(frame, std::memory_order_release);
+
+    const qint64 written = frames.load(std::memory_order_acquire);
+    if (frame < written - capacity) {
+        return 0;
+    }
+    const qint64 count = qBound<qint64>(0, frameCount, written - frame);
+    for (qint64 done = 0; done < count;) {
+        const qint64 slot = (frame + done) % capacity;
+        const qint64 piece = std::min(count - done, capacity - slot);
+        std::copy_n(ring.data() + slot * channels, piece * channels, out + done * channels);
+        done += piece;
+    }
+    return count;
+}
+
+void PcmBuffer::setReadFrame(qint64 frame)
+{
+    readFrame.store(std::max<qint64>(0, frame), std::memory_order_release);
+}
+
+bool PcmBuffer::isRetained(qint64 frame) const
+{
+    return frame >= frames.load(std::memory_order_acquire) - capacity;
+}
+
+TrackDecoder::TrackDecoder(const QString &filePath, int sampleRate, int channelCount, QObject *parent)
+    : QObject(parent),
+      decoder(new QAudioDecoder(this)),
+      path(filePath),
+      pcm(new PcmBuffer(sampleRate, channelCount)),
+      started(false),
+      decodingDone(false),
+      resamplePosition(0.0)
+{
+    // Ask the backend for the output format; convert() handles backends that ignore it
+    QAudioFormat format;
+    format.setSampleRate(sampleRate);
+    format.setChannelCount(channelCount);
+    format.setSampleFormat(QAudioFormat::Int16);
+    decoder->setAudioFormat(format);
+    decoder->setSource(QUrl::fromLocalFile(filePath));
+
+    connect(decoder, &QAudioDecoder::bufferReady, this, &TrackDecoder::readBuffer);
+    connect(decoder, &QAudioDecoder::finished, this, &TrackDecoder::decodingFinished);
+    connect(decoder, qOverload<QAudioDecoder::Error>(&QAudioDecoder::error), this, &TrackDecoder::decodingError);
+
+    retryTimer.setSingleShot(true);
+    retryTimer.setInterval(50);
+    connect(&retryTimer, &QTimer::timeout, this, &TrackDecoder::readBuffer);
+}
+
+TrackDecoder::~TrackDecoder()
+{
+    decoder->stop();
+}
+
+void TrackDecoder::start()
+{
+    if (started) {
+        return;
+    }
+    started = true;
+    TRACE_INSTANT_ARG("decode", "decode start", path);
+    decoder->start();
+}
+
+void TrackDecoder::readBuffer()
+{
+    if (pcm->isFinished()) {
+        return;
+    }
+
+    TRACE_SCOPE("decode", "TrackDecoder::readBuffer");
+    while (flushBacklog() && decoder->bufferAvailable()) {
+        const QAudioBuffer buffer = decoder->read();
+        if (!buffer.isValid()) {
+            break;
+        }
+        convert(buffer);
+    }
+
+    // Unread blocks hold the decoder back until the reader makes room
+    if (!backlog.empty() || decoder->bufferAvailable()) {
+        retryTimer.start();
+        return;
+    }
+    if (decodingDone) {
+        pcm->finish();
+        TRACE_INSTANT_ARG("decode", "decode finished", path);
+        emit finished();
+    }
+}
+
+void TrackDecoder::decodingFinished()
+{
+    decodingDone = true;
+    readBuffer();
+}
+
+void TrackDecoder::decodingError(QAudioDecoder::Error error)
+{
+    Q_UNUSED(error);
+
+    retryTimer.stop();
+    pcm->finish();
+    emit errorOccurred(decoder->errorString());
+}
+
+void TrackDecoder::convert(const QAudioBuffer &buffer)
+{
+    const QAudioFormat format = buffer.format();
+    const qint64 frames = buffer.frameCount();
+    const int inputChannels = format.channelCount();
+    const int outputChannels = pcm->channelCount();
+
+    if (frames <= 0 || inputChannels <= 0) {
+        return;
+    }
+
+    if (format.sampleFormat() == QAudioFormat::Int16 && inputChannels == outputChannels
+        && format.sampleRate() == pcm->sampleRate()) {
+        push(buffer.constData<qint16>(), frames);
+        return;
+    }
+
+    // Generic path: normalize to float and map channels (mono is duplicated,
+    // extra channels are dropped, or the first two are mixed for mono output)
+    scratch.resize(size_t(frames * outputChannels));
+    const char *data = buffer.constData<char>();
+    const int bytesPerFrame = format.bytesPerFrame();
+    const int bytesPerSample = format.bytesPerSample();
+
+    for (qint64 f = 0; f < frames; ++f) {
+        const char *frame = data + f * bytesPerFrame;
+        float *out = scratch.data() + f * outputChannels;
+
+        if (outputChannels == 1 && inputChannels > 1) {
+            out[0] = 0.5f * (format.normalizedSampleValue(frame)
+                             + format.normalizedSampleValue(frame + bytesPerSample));
+            continue;
+        }
+        for (int ch = 0; ch < outputChannels; ++ch) {
+            out[ch] = format.normalizedSampleValue(frame + std::min(ch, inputChannels - 1) * bytesPerSample);
+        }
+    }
+
+    if (format.sampleRate() != pcm->sampleRate()) {
+        resample(scratch.data(), frames, format.sampleRate());
+    } else {
+        appendFloat(scratch.data(), frames);
+    }
+}
+
+void TrackDecoder::resample(const float *input, qint64 frames, int inputRate)
+{
+    const int channels = pcm->channelCount();
+
+    // Index 0 is the last frame of the previous buffer, index k the k-th frame of this one
+    if (previousFrame.empty()) {
+        if (frames == 0) {
+            return;
+        }
+        previousFrame.assign(input, input + channels);
+        input += channels;
+        --frames;
+        resamplePosition = 0.0;
+    }
+
+    auto sampleAt = [&](qint64 index, int ch) {
+        return index == 0 ? previousFrame[ch] : input[(index - 1) * channels + ch];
+    };
+
+    const double step = double(inputRate) / pcm->sampleRate();
+    resampled.clear();
+
+    while (resamplePosition < frames) {
+        const qint64 i = qint64(resamplePosition);
+        const float fraction = float(resamplePosition - i);
+        for (int ch = 0; ch < channels; ++ch) {
+            const float a = sampleAt(i, ch);
+            const float b = sampleAt(i + 1, ch);
+            resampled.push_back(a + (b - a) * fraction);
+        }
+        resamplePosition += step;
+    }
+
+    resamplePosition -= frames;
+    if (frames > 0) {
+        previousFrame.assign(input + (frames - 1) * channels, input + frames * channels);
+    }
+
+    appendFloat(resampled.data(), qint64(resampled.size()) / channels);
+}
+
+void TrackDecoder::appendFloat(const float *input, qint64 frames)
+{
+    const qint64 count = frames * pcm->channelCount();
+    converted.resize(size_t(count));
+
+    for (qint64 i = 0; i < count; ++i) {
+        converted[i] = qint16(std::lrint(std::clamp(input[i], -1.0f, 1.0f) * 32767.0f));
+    }
+
+    push(converted.data(), frames);
+}
+
+void TrackDecoder::push(const qint16 *data, qint64 frames)
+{
+    const int channels = pcm->channelCount();
+    const qint64 taken = backlog.empty() ? pcm->append(data, frames) : 0;
+    backlog.insert(backlog.end(), data + taken * channels, data + frames * channels);
+}
+
+bool TrackDecoder::flushBacklog()
+{
+    if (!backlog.empty()) {
+        const int channels = pcm->channelCount();
+        const qint64 taken = pcm->append(backlog.data(), qint64(backlog.size()) / channels);
+        backlog.erase(backlog.begin(), backlog.begin() + taken * channels);
+    }
+    return backlog.empty();
+}
+
+bool TrackDecoder::decodeFile(const QString &filePath, const BlockHandler &handler)
+{
+    // Ask for float; buffers in other formats are converted below
+    QAudioFormat wanted;
+    wanted.setSampleFormat(QAudioFormat::Float);
+
+    QAudioDecoder decoder;
+    decoder.setAudioFormat(wanted);
+    decoder.setSource(QUrl::fromLocalFile(filePath));
+
+    std::vector<float> scratch;
+    int rate = 0;
+    int channels = 0;
+    bool done = false;
+    bool ok = true;
+    QEventLoop loop;
+
+    auto finish = [&](bool success) {
+        done = true;
+        ok = ok && success;
+        decoder.stop();
+        loop.quit();
+    };
+
+    QObject::connect(&decoder, &QAudioDecoder::bufferReady, &loop, [&]() {
+        while (!done && decoder.bufferAvailable()) {
+            const QAudioBuffer buffer = decoder.read();
+            if (!buffer.isValid()) {
+                break;
+            }
+            const QAudioFormat format = buffer.format();
+            const qint64 frames = buffer.frameCount();
+            if (frames <= 0) {
+                continue;
+            }
+            if (rate == 0) {
+                rate = format.sampleRate();
+                channels = format.channelCount();
+            } else if (format.sampleRate() != rate || format.channelCount() != channels) {
+                finish(false);
+                return;
+            }
+
+            const float *samples;
+            if (format.sampleFormat() == QAudioFormat::Float) {
+                samples = buffer.constData<float>();
+            } else {
+                // The scratch buffer only grows, so steady-state decoding doesn't allocate
+                const size_t count = size_t(frames * channels);
+                if (scratch.size() < count) {
+                    scratch.resize(count);
+                }
+                const char *data = buffer.constData<char>();
+                if (format.sampleFormat() == QAudioFormat::Int16) {
+                    const qint16 *in = reinterpret_cast<const qint16 *>(data);
+                    for (size_t i = 0; i < count; ++i) {
+                        scratch[i] = in[i] * (1.0f / 32768.0f);
+                    }
+                } else {
+                    const int bytesPerSample = format.bytesPerSample();
+                    for (size_t i = 0; i < count; ++i) {
+                        scratch[i] = format.normalizedSampleValue(data + i * bytesPerSample);
+                    }
+                }
+                samples = scratch.data();
+            }
+
+            if (!handler(samples, frames, rate, channels)) {
+                finish(true);
+                return;
+            }
+        }
+    });
+    QObject::connect(&decoder, &QAudioDecoder::finished, &loop, [&]() {
+        finish(true);
+    });
+    QObject::connect(&decoder, qOverload<QAudioDecoder::Error>(&QAudioDecoder::error), &loop, [&]() {
+        finish(false);
+    });
+
+    decoder.start();
+    if (!done) {
+        loop.exec();
+    }
+    return ok && rate > 0;
+}
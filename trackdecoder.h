@@ -0,0 +1,122 @@
+#ifndef TRACKDECODER_H
+#define TRACKDECODER_H
+
+#include <QObject>
+#include <QAudioBuffer>
+#include <QAudioDecoder>
+#include <QSharedPointer>
+#include <QTimer>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+// Decoded 16-bit interleaved PCM for one track at the output rate and
+// channel count, in a ring that holds a window around the read position:
+// up to LookAheadSeconds ahead of it and HistorySeconds behind. A
+// TrackDecoder appends while the audio thread reads, so playback starts
+// before decoding has finished. One writer and one reader at a time, and
+// no lock: appends copy into free space only and never move frames
+// already there, and the read position tells the writer what it may
+// overwrite. The ring is allocated once, about 7 MB for 48 kHz stereo,
+// however long the track.
+class PcmBuffer
+{
+public:
+    PcmBuffer(int sampleRate, int channelCount);
+
+    int sampleRate() const { return rate; }
+    int channelCount() const { return channels; }
+    // Frames appended so far; the track's length once finished
+    qint64 frameCount() const { return frames.load(std::memory_order_acquire); }
+    bool isFinished() const { return finished.load(std::memory_order_acquire); }
+
+    // Copies as many frames as the window has room for; returns the number copied
+    qint64 append(const qint16 *data, qint64 frameCount);
+    void finish();
+
+    // Copies up to frameCount frames starting at frame; returns the number
+    // copied. Frames before it may be overwritten from then on.
+    qint64 read(qint64 frame, qint16 *out, qint64 frameCount);
+    // Moves the read position ahead of a seek, so the writer leaves the
+    // frames there alone (or stops waiting for the reader)
+    void setReadFrame(qint64 frame);
+    // False once frame has been overwritten; a seek there has to decode the track again
+    bool isRetained(qint64 frame) const;
+
+    static const int LookAheadSeconds = 30; // More than the longest crossfade
+    static const int HistorySeconds = 5;
+
+private:
+    const int rate;
+    const int channels;
+    const qint64 capacity; // Frames
+    std::vector<qint16> ring;
+    std::atomic<qint64> frames;
+    std::atomic<qint64> readFrame;
+    std::atomic<bool> finished;
+};
+
+// Decodes one file with QAudioDecoder into a PcmBuffer, converting sample
+// format, channel layout and sample rate when the backend cannot deliver
+// the requested format itself. Once the buffer's window is full it stops
+// reading the decoder, which then stops decoding, and checks back on a
+// timer; a block that only partly fit waits in a small backlog.
+class TrackDecoder : public QObject
+{
+    Q_OBJECT
+
+public:
+    TrackDecoder(const QString &filePath, int sampleRate, int channelCount, QObject *parent = nullptr);
+    ~TrackDecoder();
+
+    QString filePath() const { return path; }
+    QSharedPointer<PcmBuffer> buffer() const { return pcm; }
+
+    // Does nothing after the first call
+    void start();
+    bool isStarted() const { return started; }
+
+    // Called with each decoded block as interleaved float samples; the
+    // pointer is only valid during the call. Return false to stop early.
+    using BlockHandler = std::function<bool(const float *samples, qint64 frames, int sampleRate, int channelCount)>;
+
+    // Decodes a whole file at its own rate and channel count on the calling
+    // thread, in a local event loop, without keeping the PCM. For analysis
+    // passes on pool threads. Returns false if decoding failed or the format
+    // changed mid-stream.
+    static bool decodeFile(const QString &filePath, const BlockHandler &handler);
+
+signals:
+    void finished();
+    void errorOccurred(const QString &message);
+
+private slots:
+    void readBuffer();
+    void decodingFinished();
+    void decodingError(QAudioDecoder::Error error);
+
+private:
+    void convert(const QAudioBuffer &buffer);
+    void resample(const float *input, qint64 frames, int inputRate);
+    void appendFloat(const float *input, qint64 frames);
+    void push(const qint16 *data, qint64 frames);
+    bool flushBacklog();
+
+    QAudioDecoder *decoder;
+    QString path;
+    QSharedPointer<PcmBuffer> pcm;
+    QTimer retryTimer;           // Polls for room while the buffer is full
+    std::vector<qint16> backlog; // Samples of the last block that didn't fit
+    bool started;
+    bool decodingDone;           // The decoder finished; the backlog may still hold samples
+
+    // Streaming linear resampler state
+    double resamplePosition;
+    std::vector<float> previousFrame;
+
+    std::vector<float> scratch;
+    std::vector<float> resampled;
+    std::vector<qint16> converted;
+};
+
+#endif // TRACKDECODER_H
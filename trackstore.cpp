@@ -0,0 +1,305 @@
+#include "trackstore.h"
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+namespace {
+
+// A replaced title or fingerprint leaves its old space behind until this
+// much (and more than half the pool) is unused
+const qint64 CompactThreshold = 1 << 16;
+
+// Directory (with its trailing slash) and file name; the directory is
+// empty only for a bare file name
+QStringView directoryOf(const QString &path)
+{
+    return QStringView(path).left(path.lastIndexOf(QLatin1Char('/')) + 1);
+}
+
+QStringView fileNameOf(const QString &path)
+{
+    return QStringView(path).mid(path.lastIndexOf(QLatin1Char('/')) + 1);
+}
+
+quint32 packDuration(qint64 ms)
+{
+    return quint32(qBound<qint64>(0, ms, std::numeric_limits<quint32>::max()));
+}
+
+} // namespace
+
+quint32 StringDictionary::intern(const QString &value)
+{
+    auto it = ids.constFind(value);
+    if (it != ids.constEnd()) {
+        return it.value();
+    }
+    const quint32 id = quint32(values.size());
+    values.append(value);
+    ids.insert(value, id);
+    return id;
+}
+
+qint64 StringDictionary::find(const QString &value) const
+{
+    auto it = ids.constFind(value);
+    return it != ids.constEnd() ? qint64(it.value()) : -1;
+}
+
+void TextColumn::append(QStringView text)
+{
+    starts.append(quint32(chars.size()));
+    lengths.append(quint32(text.size()));
+    chars.append(text);
+}
+
+void TextColumn::set(int row, QStringView text)
+{
+    const quint32 oldLength = lengths.at(row);
+    if (quint32(text.size()) <= oldLength) {
+        std::copy(text.begin(), text.end(), chars.begin() + starts.at(row));
+        garbage += oldLength - quint32(text.size());
+    } else {
+        starts[row] = quint32(chars.size());
+        chars.append(text);
+        garbage += oldLength;
+    }
+    lengths[row] = quint32(text.size());
+
+    if (garbage > CompactThreshold && garbage > chars.size() / 2) {
+        compact();
+    }
+}
+
+void TextColumn::compact()
+{
+    QString packed;
+    packed.reserve(chars.size() - garbage);
+    for (int row = 0; row < starts.size(); ++row) {
+        const quint32 start = quint32(packed.size());
+        packed.append(at(row));
+        starts[row] = start;
+    }
+    chars = packed;
+    garbage = 0;
+}
+
+qint64 TextColumn::bytesUsed() const
+{
+    return chars.capacity() * qint64(sizeof(QChar)) + (starts.capacity() + lengths.capacity()) * qint64(sizeof(quint32));
+}
+
+void TrackStore::clear()
+{
+    *this = TrackStore();
+}
+
+void TrackStore::reserve(int count)
+{
+    directoryIds.reserve(count);
+    artistIds.reserve(count);
+    albumIds.reserve(count);
+    genreIds.reserve(count);
+    durations.reserve(count);
+    modifiedTimes.reserve(count);
+    fileSizes.reserve(count);
+    loudness.reserve(count);
+    fingerprintStarts.reserve(count);
+    fingerprintLengths.reserve(count);
+    rowsByPath.reserve(count);
+}
+
+void TrackStore::append(const TrackInfo &track)
+{
+    const int row = size();
+    const QStringView directory = directoryOf(track.path);
+    const QStringView name = fileNameOf(track.path);
+
+    directoryIds.append(directories.intern(directory.toString()));
+    fileNames.append(name);
+    titles.append(track.title);
+    artistIds.append(artists.intern(track.artist));
+    albumIds.append(albums.intern(track.album));
+    genreIds.append(genres.intern(track.genre));
+    durations.append(packDuration(track.duration));
+    modifiedTimes.append(track.modified);
+    fileSizes.append(track.size);
+    loudness.append(LoudnessFields{track.gatedBlocks, track.loudness, track.peak, track.albumLoudness});
+
+    const int words = std::min<int>(track.fingerprint.size(), std::numeric_limits<quint8>::max());
+    fingerprintStarts.append(quint32(fingerprintWords.size()));
+    fingerprintLengths.append(quint8(words));
+    fingerprintWords.append(track.fingerprint.mid(0, words));
+
+    rowsByPath.insert(pathHash(directory, name), row);
+}
+
+void TrackStore::set(int row, const TrackInfo &track)
+{
+    const QStringView directory = directoryOf(track.path);
+    const QStringView name = fileNameOf(track.path);
+    if (directory != directories.value(directoryIds.at(row)) || name != fileNames.at(row)) {
+        rowsByPath.remove(pathHash(directories.value(directoryIds.at(row)), fileNames.at(row)), row);
+        directoryIds[row] = directories.intern(directory.toString());
+        fileNames.set(row, name);
+        rowsByPath.insert(pathHash(directory, name), row);
+    }
+
+    titles.set(row, track.title);
+    artistIds[row] = artists.intern(track.artist);
+    albumIds[row] = albums.intern(track.album);
+    genreIds[row] = genres.intern(track.genre);
+    durations[row] = packDuration(track.duration);
+    modifiedTimes[row] = track.modified;
+    fileSizes[row] = track.size;
+    loudness[row] = {track.gatedBlocks, track.loudness, track.peak, track.albumLoudness};
+    setFingerprint(row, track.fingerprint);
+}
+
+void TrackStore::retain(const QList<bool> &keep)
+{
+    // Copied column by column; the dictionaries carry over as they are
+    TrackStore kept;
+    kept.directories = directories;
+    kept.artists = artists;
+    kept.albums = albums;
+    kept.genres = genres;
+    kept.reserve(int(std::count(keep.cbegin(), keep.cend(), true)));
+
+    for (int row = 0; row < size(); ++row) {
+        if (!keep.value(row)) {
+            continue;
+        }
+        const int newRow = kept.size();
+        kept.directoryIds.append(directoryIds.at(row));
+        kept.fileNames.append(fileNames.at(row));
+        kept.titles.append(titles.at(row));
+        kept.artistIds.append(artistIds.at(row));
+        kept.albumIds.append(albumIds.at(row));
+        kept.genreIds.append(genreIds.at(row));
+        kept.durations.append(durations.at(row));
+        kept.modifiedTimes.append(modifiedTimes.at(row));
+        kept.fileSizes.append(fileSizes.at(row));
+        kept.loudness.append(loudness.at(row));
+        kept.fingerprintStarts.append(quint32(kept.fingerprintWords.size()));
+        kept.fingerprintLengths.append(fingerprintLengths.at(row));
+        std::copy_n(fingerprintData(row), fingerprintSize(row), std::back_inserter(kept.fingerprintWords));
+        kept.rowsByPath.insert(pathHash(directory(row), fileNames.at(row)), newRow);
+    }
+
+    *this = kept;
+}
+
+TrackInfo TrackStore::at(int row) const
+{
+    TrackInfo track;
+    track.path = path(row);
+    track.title = titles.at(row).toString();
+    track.artist = artist(row);
+    track.album = album(row);
+    track.genre = genre(row);
+    track.duration = durations.at(row);
+    track.modified = modifiedTimes.at(row);
+    track.size = fileSizes.at(row);
+    track.gatedBlocks = loudness.at(row).gatedBlocks;
+    track.loudness = loudness.at(row).loudness;
+    track.peak = loudness.at(row).peak;
+    track.albumLoudness = loudness.at(row).albumLoudness;
+    track.fingerprint = fingerprint(row);
+    return track;
+}
+
+int TrackStore::find(const QString &path) const
+{
+    const QStringView directory = directoryOf(path);
+    const QStringView name = fileNameOf(path);
+    const auto range = rowsByPath.equal_range(pathHash(directory, name));
+    for (auto it = range.first; it != range.second; ++it) {
+        const int row = it.value();
+        if (fileNames.at(row) == name && directories.value(directoryIds.at(row)) == directory) {
+            return row;
+        }
+    }
+    return -1;
+}
+
+QString TrackStore::path(int row) const
+{
+    const QString &directory = directories.value(directoryIds.at(row));
+    const QStringView name = fileNames.at(row);
+    QString path;
+    path.reserve(directory.size() + name.size());
+    path.append(directory).append(name);
+    return path;
+}
+
+void TrackStore::setLoudness(int row, qint32 gatedBlocks, float trackLoudness, float peak)
+{
+    LoudnessFields &value = loudness[row];
+    value.gatedBlocks = gatedBlocks;
+    value.loudness = trackLoudness;
+    value.peak = peak;
+}
+
+void TrackStore::setAlbumLoudness(int row, float albumLoudness)
+{
+    loudness[row].albumLoudness = albumLoudness;
+}
+
+QList<quint32> TrackStore::fingerprint(int row) const
+{
+    return QList<quint32>(fingerprintData(row), fingerprintData(row) + fingerprintSize(row));
+}
+
+void TrackStore::setFingerprint(int row, const QList<quint32> &words)
+{
+    const int count = std::min<int>(words.size(), std::numeric_limits<quint8>::max());
+    const int oldCount = fingerprintLengths.at(row);
+    if (count <= oldCount) {
+        std::copy(words.cbegin(), words.cbegin() + count, fingerprintWords.begin() + fingerprintStarts.at(row));
+        fingerprintGarbage += oldCount - count;
+    } else {
+        fingerprintStarts[row] = quint32(fingerprintWords.size());
+        std::copy_n(words.constData(), count, std::back_inserter(fingerprintWords));
+        fingerprintGarbage += oldCount;
+    }
+    fingerprintLengths[row] = quint8(count);
+
+    if (fingerprintGarbage > CompactThreshold && fingerprintGarbage > fingerprintWords.size() / 2) {
+        QList<quint32> packed;
+        packed.reserve(fingerprintWords.size() - fingerprintGarbage);
+        for (int i = 0; i < size(); ++i) {
+            const quint32 start = quint32(packed.size());
+            std::copy_n(fingerprintData(i), fingerprintSize(i), std::back_inserter(packed));
+            fingerprintStarts[i] = start;
+        }
+        fingerprintWords = packed;
+        fingerprintGarbage = 0;
+    }
+}
+
+qint64 TrackStore::bytesUsed() const
+{
+    // Dictionary entries cost their characters plus a list slot and a hash node
+    auto dictionaryBytes = [](const StringDictionary &dictionary) {
+        qint64 bytes = 0;
+        for (int id = 0; id < dictionary.size(); ++id) {
+            bytes += dictionary.value(quint32(id)).capacity() * qint64(sizeof(QChar)) + 64;
+        }
+        return bytes;
+    };
+
+    const qint64 ids = (directoryIds.capacity() + artistIds.capacity() + albumIds.capacity()
+                        + genreIds.capacity() + durations.capacity() + fingerprintStarts.capacity()) * 4;
+    const qint64 numbers = (modifiedTimes.capacity() + fileSizes.capacity()) * 8
+                           + loudness.capacity() * qint64(sizeof(LoudnessFields)) + fingerprintLengths.capacity();
+    const qint64 pathIndex = rowsByPath.size() * 32;
+    return dictionaryBytes(directories) + dictionaryBytes(artists) + dictionaryBytes(albums)
+         + dictionaryBytes(genres) + fileNames.bytesUsed() + titles.bytesUsed() + ids + numbers
+         + fingerprintWords.capacity() * 4 + pathIndex;
+}
+
+size_t TrackStore::pathHash(QStringView directory, QStringView fileName)
+{
+    return qHashMulti(0, directory, fileName);
+}
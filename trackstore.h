@@ -0,0 +1,153 @@
+#ifndef TRACKSTORE_H
+#define TRACKSTORE_H
+
+#include <QHash>
+#include <QList>
+#include <QMultiHash>
+#include <QString>
+#include <QStringView>
+#include "tagreader.h"
+
+// Distinct values of one text column, with stable 32-bit ids
+class StringDictionary
+{
+public:
+    quint32 intern(const QString &value);
+    // The id of value, or -1 if it has never been interned
+    qint64 find(const QString &value) const;
+
+    const QString &value(quint32 id) const { return values.at(id); }
+    int size() const { return int(values.size()); }
+
+private:
+    QList<QString> values;
+    QHash<QString, quint32> ids;
+};
+
+// Mostly-distinct text of one column in a single character pool, so a row
+// costs eight bytes plus its characters instead of a QString allocation.
+// Longer replacements are appended, and the pool is compacted once more
+// than half of it is garbage.
+class TextColumn
+{
+public:
+    void append(QStringView text);
+    void set(int row, QStringView text);
+    QStringView at(int row) const { return QStringView(chars).mid(starts.at(row), lengths.at(row)); }
+    qint64 bytesUsed() const;
+
+private:
+    void compact();
+
+    QString chars;
+    QList<quint32> starts;
+    QList<quint32> lengths;
+    qint64 garbage = 0;
+};
+
+// The library's in-memory metadata, stored by column rather than as a list
+// of TrackInfo. Artist, album, genre and directory repeat across thousands
+// of rows, so they are interned and each row keeps a 32-bit id; paths are
+// split into an interned directory and a pooled file name; titles and
+// fingerprints live in flat pools; numbers sit in packed arrays. A row
+// takes a few hundred bytes less than a TrackInfo with its strings, and a
+// pass over one column (filtering, sorting, grouping by id) reads
+// contiguous memory.
+//
+// The columns are implicitly shared, so copying a store to a worker
+// thread or a model is cheap, as it was for QList<TrackInfo>. TrackInfo
+// remains the type for single tracks and batches coming from the tag reader.
+class TrackStore
+{
+public:
+    int size() const { return int(durations.size()); }
+    bool isEmpty() const { return durations.isEmpty(); }
+    void clear();
+    void reserve(int count);
+
+    void append(const TrackInfo &track);
+    void set(int row, const TrackInfo &track);
+    // Drops the rows whose flag is false, keeping the order of the rest
+    void retain(const QList<bool> &keep);
+
+    TrackInfo at(int row) const;
+    // The row with this path, or -1
+    int find(const QString &path) const;
+
+    QString path(int row) const;
+    QStringView fileName(int row) const { return fileNames.at(row); }
+    QStringView title(int row) const { return titles.at(row); }
+    // With its trailing slash
+    const QString &directory(int row) const { return directories.value(directoryIds.at(row)); }
+    const QString &artist(int row) const { return artists.value(artistIds.at(row)); }
+    const QString &album(int row) const { return albums.value(albumIds.at(row)); }
+    const QString &genre(int row) const { return genres.value(genreIds.at(row)); }
+    qint64 duration(int row) const { return durations.at(row); }
+    qint64 modified(int row) const { return modifiedTimes.at(row); }
+    qint64 fileSize(int row) const { return fileSizes.at(row); }
+
+    qint32 gatedBlocks(int row) const { return loudness.at(row).gatedBlocks; }
+    float trackLoudness(int row) const { return loudness.at(row).loudness; }
+    float peak(int row) const { return loudness.at(row).peak; }
+    float albumLoudness(int row) const { return loudness.at(row).albumLoudness; }
+    void setLoudness(int row, qint32 gatedBlocks, float loudness, float peak);
+    void setAlbumLoudness(int row, float loudness);
+
+    const quint32 *fingerprintData(int row) const { return fingerprintWords.constData() + fingerprintStarts.at(row); }
+    int fingerprintSize(int row) const { return fingerprintLengths.at(row); }
+    QList<quint32> fingerprint(int row) const;
+    void setFingerprint(int row, const QList<quint32> &words);
+
+    // Whole columns, for scans that filter or group by id
+    const StringDictionary &directoryDictionary() const { return directories; }
+    const StringDictionary &artistDictionary() const { return artists; }
+    const StringDictionary &albumDictionary() const { return albums; }
+    const StringDictionary &genreDictionary() const { return genres; }
+    const QList<quint32> &directoryColumn() const { return directoryIds; }
+    const QList<quint32> &artistColumn() const { return artistIds; }
+    const QList<quint32> &albumColumn() const { return albumIds; }
+    const QList<quint32> &genreColumn() const { return genreIds; }
+    const QList<quint32> &durationColumn() const { return durations; }   // ms
+    const QList<qint64> &modifiedColumn() const { return modifiedTimes; }
+    const QList<qint64> &fileSizeColumn() const { return fileSizes; }
+
+    // Approximate heap use of the columns and dictionaries, for benchmarks
+    qint64 bytesUsed() const;
+
+private:
+    struct LoudnessFields
+    {
+        qint32 gatedBlocks;
+        float loudness;
+        float peak;
+        float albumLoudness;
+    };
+
+    static size_t pathHash(QStringView directory, QStringView fileName);
+
+    StringDictionary directories;
+    StringDictionary artists;
+    StringDictionary albums;
+    StringDictionary genres;
+
+    QList<quint32> directoryIds;
+    TextColumn fileNames;
+    TextColumn titles;
+    QList<quint32> artistIds;
+    QList<quint32> albumIds;
+    QList<quint32> genreIds;
+    QList<quint32> durations;
+    QList<qint64> modifiedTimes;
+    QList<qint64> fileSizes;
+    QList<LoudnessFields> loudness;
+
+    QList<quint32> fingerprintWords;
+    QList<quint32> fingerprintStarts;
+    QList<quint8> fingerprintLengths;
+    qint64 fingerprintGarbage = 0;
+
+    // Path hash -> row; the paths themselves are not stored a second time
+    QMultiHash<size_t, int> rowsByPath;
+};
+
+#endif // TRACKSTORE_H
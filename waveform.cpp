@@ -0,0 +1,222 @@
+#include "waveform.h"
+#include <QtEndian>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const char Magic[4] = {'M', 'P', 'W', 'F'};
+const quint32 FormatVersion = 1;
+const int HeaderSize = 4 + 4 + 4 + 8 + 4; // magic, version, rate, frames, bins
+const int BinSize = 3;
+
+// Coarser levels stop once a level fits in this many bins
+const size_t TopLevelBins = 64;
+
+qint8 quantizeSample(float value)
+{
+    return qint8(std::lrint(std::clamp(value, -1.0f, 1.0f) * 127.0f));
+}
+
+quint8 quantizeRms(double value)
+{
+    return quint8(std::lrint(std::clamp(value, 0.0, 1.0) * 255.0));
+}
+
+} // namespace
+
+WaveformSummary::WaveformSummary()
+    : rate(0),
+      frames(0)
+{
+}
+
+void WaveformSummary::buildLevels()
+{
+    levels.resize(1);
+    while (levels.back().size() > TopLevelBins) {
+        const std::vector<Bin> &below = levels.back();
+        std::vector<Bin> merged((below.size() + 1) / 2);
+
+        for (size_t i = 0; i < merged.size(); ++i) {
+            const Bin &a = below[2 * i];
+            if (2 * i + 1 == below.size()) {
+                merged[i] = a;
+                continue;
+            }
+            const Bin &b = below[2 * i + 1];
+            merged[i].min = std::min(a.min, b.min);
+            merged[i].max = std::max(a.max, b.max);
+            // RMS of the pair is the root of the mean of the squares
+            const double squares = (double(a.rms) * a.rms + double(b.rms) * b.rms) / 2.0;
+            merged[i].rms = quint8(std::lrint(std::sqrt(squares)));
+        }
+        levels.push_back(std::move(merged));
+    }
+}
+
+WaveformSummary::Bin WaveformSummary::range(qint64 firstFrame, qint64 lastFrame) const
+{
+    Bin result;
+    firstFrame = std::max<qint64>(firstFrame, 0);
+    lastFrame = std::min(lastFrame, frames);
+    if (isEmpty() || firstFrame >= lastFrame) {
+        return result;
+    }
+
+    // The finest level at which the range spans at most about four bins
+    int index = 0;
+    const qint64 span = lastFrame - firstFrame;
+    while (index + 1 < levelCount() && (qint64(BaseBinFrames) << (index + 1)) * 2 <= span) {
+        ++index;
+    }
+
+    const std::vector<Bin> &bins = levels[size_t(index)];
+    const qint64 binFrames = qint64(BaseBinFrames) << index;
+    const qint64 first = firstFrame / binFrames;
+    const qint64 last = std::min<qint64>((lastFrame - 1) / binFrames, qint64(bins.size()) - 1);
+    if (last < first) {
+        return result;
+    }
+
+    result.min = 127;
+    result.max = -127;
+    double squares = 0.0;
+    for (qint64 i = first; i <= last; ++i) {
+        const Bin &bin = bins[size_t(i)];
+        result.min = std::min(result.min, bin.min);
+        result.max = std::max(result.max, bin.max);
+        squares += double(bin.rms) * bin.rms;
+    }
+    result.rms = quint8(std::lrint(std::sqrt(squares / double(last - first + 1))));
+    return result;
+}
+
+QByteArray WaveformSummary::serialize() const
+{
+    const std::vector<Bin> empty;
+    const std::vector<Bin> &bins = levels.empty() ? empty : levels.front();
+
+    QByteArray data(HeaderSize + int(bins.size()) * BinSize, Qt::Uninitialized);
+    char *out = data.data();
+    std::memcpy(out, Magic, 4);
+    qToLittleEndian<quint32>(FormatVersion, out + 4);
+    qToLittleEndian<quint32>(quint32(rate), out + 8);
+    qToLittleEndian<qint64>(frames, out + 12);
+    qToLittleEndian<quint32>(quint32(bins.size()), out + 20);
+
+    out += HeaderSize;
+    for (const Bin &bin : bins) {
+        out[0] = char(bin.min);
+        out[1] = char(bin.max);
+        out[2] = char(bin.rms);
+        out += BinSize;
+    }
+    return data;
+}
+
+bool WaveformSummary::deserialize(const QByteArray &data)
+{
+    if (data.size() < HeaderSize || std::memcmp(data.constData(), Magic, 4) != 0) {
+        return false;
+    }
+    const char *in = data.constData();
+    if (qFromLittleEndian<quint32>(in + 4) != FormatVersion) {
+        return false;
+    }
+    const quint32 sampleRate = qFromLittleEndian<quint32>(in + 8);
+    const qint64 frameCount = qFromLittleEndian<qint64>(in + 12);
+    const quint32 binCount = qFromLittleEndian<quint32>(in + 20);
+    if (sampleRate == 0 || frameCount < 0 || qint64(binCount) * BinSize != data.size() - HeaderSize) {
+        return false;
+    }
+
+    rate = int(sampleRate);
+    frames = frameCount;
+    levels.assign(1, std::vector<Bin>(binCount));
+
+    in += HeaderSize;
+    for (Bin &bin : levels.front()) {
+        bin.min = qint8(in[0]);
+        bin.max = qint8(in[1]);
+        bin.rms = quint8(in[2]);
+        in += BinSize;
+    }
+    buildLevels();
+    return true;
+}
+
+WaveformBuilder::WaveformBuilder(int sampleRate, int channelCount, qint64 expectedFrames)
+    : channels(std::max(channelCount, 1)),
+      binFill(0),
+      binMin(0.0f),
+      binMax(0.0f),
+      binSquares(0.0)
+{
+    summary.rate = sampleRate;
+    summary.levels.resize(1);
+    if (expectedFrames > 0) {
+        // A little slack for tag durations that are slightly short
+        summary.levels.front().reserve(size_t(expectedFrames / WaveformSummary::BaseBinFrames) + 64);
+    }
+}
+
+void WaveformBuilder::addFrames(const float *samples, qint64 frameCount)
+{
+    while (frameCount > 0) {
+        const int count = int(std::min<qint64>(frameCount, WaveformSummary::BaseBinFrames - binFill));
+        const float *end = samples + qint64(count) * channels;
+
+        if (binFill == 0) {
+            binMin = binMax = samples[0];
+        }
+
+        // Locals keep the accumulators in registers across the bin
+        float low = binMin;
+        float high = binMax;
+        double squares = 0.0;
+        for (const float *s = samples; s != end; ++s) {
+            const float value = *s;
+            low = std::min(low, value);
+            high = std::max(high, value);
+            squares += double(value) * value;
+        }
+        binMin = low;
+        binMax = high;
+        binSquares += squares;
+
+        binFill += count;
+        summary.frames += count;
+        samples = end;
+        frameCount -= count;
+
+        if (binFill == WaveformSummary::BaseBinFrames) {
+            closeBin(binFill);
+        }
+    }
+}
+
+void WaveformBuilder::closeBin(int binFrames)
+{
+    WaveformSummary::Bin bin;
+    bin.min = quantizeSample(binMin);
+    bin.max = quantizeSample(binMax);
+    bin.rms = quantizeRms(std::sqrt(binSquares / (double(binFrames) * channels)));
+    summary.levels.front().push_back(bin);
+
+    binFill = 0;
+    binSquares = 0.0;
+}
+
+WaveformSummary WaveformBuilder::finish()
+{
+    if (binFill > 0) {
+        closeBin(binFill);
+    }
+    summary.buildLevels();
+
+    WaveformSummary result = std::move(summary);
+    summary = WaveformSummary();
+    return result;
+}
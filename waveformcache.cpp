@@ -0,0 +1,156 @@
+#include "waveformcache.h"
+#include "diskcache.h"
+#include "tagreader.h"
+#include "trace.h"
+#include "trackdecoder.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <memory>
+
+namespace {
+
+// Roughly the last dozen long tracks
+const int MemoryBudget = 8 * 1024 * 1024;
+
+// Some thousands of tracks; the least recently shown go first
+const qint64 DiskBudget = 64 * 1024 * 1024;
+
+int summaryCost(const WaveformSummary &summary)
+{
+    return int(2 * summary.level(0).size() * sizeof(WaveformSummary::Bin));
+}
+
+} // namespace
+
+WaveformCache::WaveformCache(QObject *parent)
+    : QObject(parent),
+      directory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/waveforms"),
+      summaries(MemoryBudget),
+      generation(0)
+{
+    QDir().mkpath(directory);
+    connect(&watcher, &QFutureWatcher<Result>::finished, this, &WaveformCache::finished);
+}
+
+WaveformCache::~WaveformCache()
+{
+    // The worker reads generation; let it see the change and bail out
+    generation.fetch_add(1, std::memory_order_relaxed);
+    watcher.waitForFinished();
+}
+
+void WaveformCache::request(const QString &filePath)
+{
+    if (const auto *summary = summaries.object(filePath)) {
+        emit waveformReady(filePath, *summary);
+        return;
+    }
+
+    // One decode at a time; a newer request abandons the running one
+    if (watcher.isRunning()) {
+        pendingPath = filePath;
+        generation.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    start(filePath);
+}
+
+void WaveformCache::start(const QString &filePath)
+{
+    pendingPath.clear();
+    watcher.setFuture(QtConcurrent::run(&WaveformCache::load, filePath, directory, &generation,
+                                        generation.load(std::memory_order_relaxed)));
+}
+
+void WaveformCache::finished()
+{
+    const Result result = watcher.result();
+    if (result.complete && result.summary) {
+        summaries.insert(result.filePath, new QSharedPointer<const WaveformSummary>(result.summary),
+                         summaryCost(*result.summary));
+    }
+
+    if (pendingPath.isEmpty()) {
+        if (result.complete) {
+            emit waveformReady(result.filePath, result.summary);
+        }
+    } else {
+        const QString next = pendingPath;
+        if (const auto *summary = summaries.object(next)) {
+            pendingPath.clear();
+            emit waveformReady(next, *summary);
+        } else {
+            start(next);
+        }
+    }
+}
+
+WaveformCache::Result WaveformCache::load(const QString &filePath, const QString &directory,
+                                          const std::atomic<int> *generation, int requested)
+{
+    TRACE_SCOPE_ARG("waveform", "WaveformCache::load", filePath);
+    Result result;
+    result.filePath = filePath;
+
+    // A changed file gets a new key; stale entries are just never read again
+    const QFileInfo info(filePath);
+    const QByteArray identity = filePath.toUtf8() + '\0' + QByteArray::number(info.size()) + '\0'
+                                + QByteArray::number(info.lastModified().toMSecsSinceEpoch());
+    const QString cachePath = directory + "/"
+                              + QString::fromLatin1(QCryptographicHash::hash(identity, QCryptographicHash::Sha1).toHex())
+                              + ".wf";
+
+    // An empty entry records that this version of the file could not be decoded
+    QFile cached(cachePath);
+    if (cached.open(QIODevice::ReadOnly)) {
+        const QByteArray data = cached.readAll();
+        auto summary = QSharedPointer<WaveformSummary>::create();
+        if (data.isEmpty() || summary->deserialize(data)) {
+            DiskCache::touch(cached);
+            if (!data.isEmpty()) {
+                result.summary = summary;
+            }
+            result.complete = true;
+            return result;
+        }
+    }
+
+    // The tag duration only sizes the bins up front
+    const qint64 expectedDuration = TagReader::readTrack(filePath).duration;
+    std::unique_ptr<WaveformBuilder> builder;
+    bool abandoned = false;
+
+    const bool ok = TrackDecoder::decodeFile(filePath, [&](const float *samples, qint64 frames, int rate, int channels) {
+        if (generation->load(std::memory_order_relaxed) != requested) {
+            abandoned = true;
+            return false;
+        }
+        if (!builder) {
+            builder = std::make_unique<WaveformBuilder>(rate, channels, expectedDuration * rate / 1000);
+        }
+        builder->addFrames(samples, frames);
+        return true;
+    });
+    if (abandoned) {
+        return result;
+    }
+
+    result.complete = true;
+    QSharedPointer<WaveformSummary> summary;
+    if (ok && builder) {
+        summary = QSharedPointer<WaveformSummary>::create(builder->finish());
+    }
+
+    QSaveFile file(cachePath);
+    if (file.open(QIODevice::WriteOnly) && (!summary || file.write(summary->serialize()) >= 0)) {
+        file.commit();
+    }
+    DiskCache::prune(directory, DiskBudget);
+    result.summary = summary;
+    return result;
+}
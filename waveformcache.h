@@ -0,0 +1,55 @@
+#ifndef WAVEFORMCACHE_H
+#define WAVEFORMCACHE_H
+
+#include <QObject>
+#include <QCache>
+#include <QFutureWatcher>
+#include <QSharedPointer>
+#include <atomic>
+#include "waveform.h"
+
+// Waveform overviews for the Now Playing view. A track is decoded once on
+// a worker into a WaveformSummary, which is kept in a small LRU and
+// written under the cache location keyed by path, size and modification
+// time, so replaying or restarting never decodes it again. A track that
+// fails to decode gets an empty entry under the same key, so it isn't
+// retried until the file changes. The directory is held to a size budget
+// by DiskCache.
+class WaveformCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit WaveformCache(QObject *parent = nullptr);
+    ~WaveformCache();
+
+    // Answers through waveformReady(), synchronously if the summary is in memory.
+    // Only the most recent request is guaranteed an answer; a superseded
+    // decode is abandoned.
+    void request(const QString &filePath);
+
+signals:
+    // summary is null when the track could not be decoded
+    void waveformReady(const QString &filePath, QSharedPointer<const WaveformSummary> summary);
+
+private:
+    struct Result
+    {
+        QString filePath;
+        QSharedPointer<const WaveformSummary> summary;
+        bool complete = false; // False if abandoned for a newer request
+    };
+
+    static Result load(const QString &filePath, const QString &directory,
+                       const std::atomic<int> *generation, int requested);
+    void start(const QString &filePath);
+    void finished();
+
+    const QString directory;
+    QCache<QString, QSharedPointer<const WaveformSummary>> summaries;
+    QFutureWatcher<Result> watcher;
+    std::atomic<int> generation;
+    QString pendingPath;
+};
+
+#endif // WAVEFORMCACHE_H
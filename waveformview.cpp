@@ -0,0 +1,192 @@
+#include "waveformview.h"
+#include <QMouseEvent>
+#include <QPainter>
+#include <QWheelEvent>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Deepest zoom shows about two seconds across the widget
+const qint64 MinimumSpan = 2000; // ms
+const double ZoomStep = 1.25;    // Per wheel notch
+
+} // namespace
+
+WaveformView::WaveformView(QWidget *parent)
+    : QWidget(parent),
+      duration(0),
+      position(0),
+      viewStart(0),
+      zoom(1.0)
+{
+    setMinimumHeight(40);
+    setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Fixed);
+    setCursor(Qt::PointingHandCursor);
+}
+
+QSize WaveformView::sizeHint() const
+{
+    return QSize(400, 64);
+}
+
+void WaveformView::setSummary(QSharedPointer<const WaveformSummary> newSummary)
+{
+    summary = newSummary;
+    zoom = 1.0;
+    viewStart = 0;
+    update();
+}
+
+void WaveformView::setDuration(qint64 newDuration)
+{
+    if (newDuration == duration) {
+        return;
+    }
+    duration = newDuration;
+    clampView();
+    update();
+}
+
+void WaveformView::setPosition(qint64 newPosition)
+{
+    const int oldX = playheadX(position);
+    position = newPosition;
+
+    // When zoomed in, page along with the playhead
+    const qint64 span = visibleSpan();
+    if (zoom > 1.0 && (position < viewStart || position >= viewStart + span)) {
+        viewStart = position - span / 10;
+        clampView();
+        update();
+        return;
+    }
+
+    // Most position updates don't move the playhead by a whole pixel
+    const int newX = playheadX(position);
+    if (newX != oldX) {
+        update(QRect(QPoint(std::min(oldX, newX) - 1, 0), QPoint(std::max(oldX, newX) + 1, height())));
+    }
+}
+
+qint64 WaveformView::visibleSpan() const
+{
+    return std::max<qint64>(1, qint64(duration / zoom));
+}
+
+qint64 WaveformView::positionAt(double x) const
+{
+    const double fraction = std::clamp(x / std::max(1, width()), 0.0, 1.0);
+    return viewStart + qint64(fraction * visibleSpan());
+}
+
+int WaveformView::playheadX(qint64 at) const
+{
+    return int(std::floor(double(at - viewStart) * width() / visibleSpan()));
+}
+
+void WaveformView::clampView()
+{
+    if (duration <= 0) {
+        zoom = 1.0;
+        viewStart = 0;
+        return;
+    }
+    zoom = std::clamp(zoom, 1.0, std::max(1.0, double(duration) / MinimumSpan));
+    viewStart = std::clamp<qint64>(viewStart, 0, duration - visibleSpan());
+}
+
+void WaveformView::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(this);
+    const QRect area = event->rect();
+    painter.fillRect(area, palette().base());
+
+    const int h = height();
+    const double middle = h / 2.0;
+    const double scale = (h / 2.0 - 1.0) / 127.0;
+
+    if (summary && !summary->isEmpty() && duration > 0) {
+        const QColor envelope = palette().color(QPalette::Mid);
+        const QColor body = palette().color(QPalette::Dark);
+        const QColor playedEnvelope = palette().color(QPalette::Highlight).lighter(150);
+        const QColor playedBody = palette().color(QPalette::Highlight);
+
+        // Columns map to frames through the view, not the summary, so the two
+        // stay aligned even if the tag duration and decoded length differ a little
+        const double framesPerMs = summary->sampleRate() / 1000.0;
+        const double msPerPixel = double(visibleSpan()) / std::max(1, width());
+        const int playhead = playheadX(position);
+
+        for (int x = area.left(); x <= area.right(); ++x) {
+            const double from = viewStart + x * msPerPixel;
+            const qint64 first = qint64(from * framesPerMs);
+            const qint64 last = std::max(first + 1, qint64((from + msPerPixel) * framesPerMs));
+            const WaveformSummary::Bin bin = summary->range(first, last);
+            if (bin.min == 0 && bin.max == 0) {
+                continue;
+            }
+
+            const bool played = x < playhead;
+            painter.setPen(played ? playedEnvelope : envelope);
+            painter.drawLine(QPointF(x + 0.5, middle - bin.max * scale), QPointF(x + 0.5, middle - bin.min * scale));
+
+            // The RMS body, clipped to the envelope
+            const double rms = std::min<double>(bin.rms / 2.0, std::max<int>(bin.max, -bin.min));
+            painter.setPen(played ? playedBody : body);
+            painter.drawLine(QPointF(x + 0.5, middle - rms * scale), QPointF(x + 0.5, middle + rms * scale));
+        }
+    } else {
+        painter.setPen(palette().color(QPalette::Mid));
+        painter.drawLine(QPointF(area.left(), middle), QPointF(area.right() + 1, middle));
+    }
+
+    if (duration > 0) {
+        const int x = playheadX(position);
+        if (x >= area.left() - 1 && x <= area.right() + 1) {
+            painter.setPen(palette().color(QPalette::Text));
+            painter.drawLine(x, 0, x, h);
+        }
+    }
+}
+
+void WaveformView::wheelEvent(QWheelEvent *event)
+{
+    if (duration <= 0) {
+        return;
+    }
+
+    // Keep the time under the cursor where it is
+    const double x = event->position().x();
+    const qint64 anchor = positionAt(x);
+    const double notches = event->angleDelta().y() / 120.0;
+    zoom *= std::pow(ZoomStep, notches);
+    clampView();
+    viewStart = anchor - qint64(x / std::max(1, width()) * visibleSpan());
+    clampView();
+    update();
+    event->accept();
+}
+
+void WaveformView::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton && duration > 0) {
+        emit seekRequested(positionAt(event->position().x()));
+    }
+}
+
+void WaveformView::mouseMoveEvent(QMouseEvent *event)
+{
+    if ((event->buttons() & Qt::LeftButton) && duration > 0) {
+        emit seekRequested(positionAt(event->position().x()));
+    }
+}
+
+void WaveformView::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    Q_UNUSED(event);
+
+    zoom = 1.0;
+    viewStart = 0;
+    update();
+}
@@ -0,0 +1,50 @@
+#ifndef WAVEFORMVIEW_H
+#define WAVEFORMVIEW_H
+
+#include <QWidget>
+#include <QSharedPointer>
+#include "waveform.h"
+
+// Draws a WaveformSummary under the playback position: the min/max
+// envelope with the RMS body inside it, the played part highlighted.
+// The wheel zooms around the cursor (the view then follows the playhead),
+// a double-click shows the whole track again, and clicking or dragging
+// asks for a seek. Every column is one WaveformSummary::range() lookup,
+// so zooming never decodes anything.
+class WaveformView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit WaveformView(QWidget *parent = nullptr);
+
+    void setSummary(QSharedPointer<const WaveformSummary> summary);
+    void setDuration(qint64 duration); // ms
+    void setPosition(qint64 position); // ms
+
+    QSize sizeHint() const override;
+
+signals:
+    void seekRequested(qint64 position); // ms
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+
+private:
+    qint64 visibleSpan() const;
+    qint64 positionAt(double x) const;
+    int playheadX(qint64 position) const;
+    void clampView();
+
+    QSharedPointer<const WaveformSummary> summary;
+    qint64 duration;
+    qint64 position;
+    qint64 viewStart; // ms at the left edge
+    double zoom;      // 1 shows the whole track
+};
+
+#endif // WAVEFORMVIEW_H